@@ -42,6 +42,7 @@
 
 #include "bricklet_stack.h"
 
+#include "event_timing.h"
 #include "hardware.h"
 #include "network.h"
 
@@ -81,6 +82,11 @@ static int bricklet_stack_dispatch_to_spi(Stack *stack, Packet *request, Recipie
 		return 0;
 	}
 
+	// the request points into the receive buffer of the client and is only
+	// valid during this call. the SPI thread sends it later, so this copy is
+	// the transport boundary. sharing a PacketBuffer with the SPI thread would
+	// not save it, the pool is not thread-safe and the SPITFP framing in
+	// bricklet_stack_send_ack_and_message needs its own contiguous buffer
 	mutex_lock(&bricklet_stack->request_queue_mutex);
 	queued_request = queue_push(&bricklet_stack->request_queue);
 	memcpy(queued_request, request, request->header.length);
@@ -147,6 +153,7 @@ static void bricklet_stack_dispatch_from_spi(void *opaque) {
 		}
 
 		// Send message into brickd dispatcher
+		stack_count_response(&bricklet_stack->base, packet);
 		network_dispatch_response(packet);
 		bricklet_stack->data_seen = true;
 
@@ -797,6 +804,28 @@ static void bricklet_stack_spi_thread(void *opaque) {
 	}
 }
 
+static const MetricFamily _bricklet_stack_errors = {
+	"brickd_bricklet_stack_errors_total", METRIC_TYPE_COUNTER,
+	"Number of SPITFP protocol errors on the Bricklet port."
+};
+
+// the error counters are incremented by the SPI thread. they are read here
+// without locking, a slightly outdated value is good enough for metrics
+static void bricklet_stack_collect_metrics(Stack *stack, Metrics *metrics) {
+	BrickletStack *bricklet_stack = (BrickletStack *)stack;
+
+	metrics_add(metrics, &_bricklet_stack_errors, bricklet_stack->error_count_ack_checksum,
+	            "stack", stack->name, "type", "ack-checksum", NULL);
+	metrics_add(metrics, &_bricklet_stack_errors, bricklet_stack->error_count_message_checksum,
+	            "stack", stack->name, "type", "message-checksum", NULL);
+	metrics_add(metrics, &_bricklet_stack_errors, bricklet_stack->error_count_message_packet,
+	            "stack", stack->name, "type", "message-packet", NULL);
+	metrics_add(metrics, &_bricklet_stack_errors, bricklet_stack->error_count_frame,
+	            "stack", stack->name, "type", "frame", NULL);
+	metrics_add(metrics, &_bricklet_stack_errors, bricklet_stack->error_count_overflow,
+	            "stack", stack->name, "type", "overflow", NULL);
+}
+
 int bricklet_stack_create(BrickletStack *bricklet_stack, BrickletStackConfig *config) {
 	int phase = 0;
 	int rc;
@@ -827,6 +856,8 @@ int bricklet_stack_create(BrickletStack *bricklet_stack, BrickletStackConfig *co
 		goto cleanup;
 	}
 
+	bricklet_stack->base.collect_metrics = bricklet_stack_collect_metrics;
+
 	phase = 1;
 
 	// add to stacks array
@@ -862,9 +893,9 @@ int bricklet_stack_create(BrickletStack *bricklet_stack, BrickletStackConfig *co
 
 	// Add notification pipe as event source.
 	// Event is used to dispatch packets.
-	if (event_add_source(bricklet_stack->notification_event, EVENT_SOURCE_TYPE_GENERIC,
-	                     "bricklet-stack-notification", EVENT_READ,
-	                     bricklet_stack_dispatch_from_spi, bricklet_stack) < 0) {
+	if (event_timing_add_source(bricklet_stack->notification_event, EVENT_SOURCE_TYPE_GENERIC,
+	                            "bricklet-stack-notification", EVENT_READ,
+	                            bricklet_stack_dispatch_from_spi, bricklet_stack) < 0) {
 		log_error("Could not add Bricklet notification pipe as event source");
 
 		goto cleanup;
@@ -916,7 +947,7 @@ cleanup:
 		// fall through
 
 	case 4:
-		event_remove_source(bricklet_stack->notification_event, EVENT_SOURCE_TYPE_GENERIC);
+		event_timing_remove_source(bricklet_stack->notification_event, EVENT_SOURCE_TYPE_GENERIC);
 		// fall through
 
 	case 3:
@@ -944,7 +975,7 @@ cleanup:
 
 void bricklet_stack_destroy(BrickletStack *bricklet_stack) {
 	// Remove event as possible poll source
-	event_remove_source(bricklet_stack->notification_event, EVENT_SOURCE_TYPE_GENERIC);
+	event_timing_remove_source(bricklet_stack->notification_event, EVENT_SOURCE_TYPE_GENERIC);
 
 	// Make sure that Thread shuts down properly
 	if (bricklet_stack->spi_thread_running) {
@@ -0,0 +1,57 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * byte_order.c: Byte order conversion for 64-bit values
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * daemonlib only provides the 16-bit and 32-bit variants. the 64-bit values
+ * in the packet trace dump and the traffic capture files are converted byte
+ * by byte here, so this works independent of the host byte order.
+ */
+
+#include <string.h>
+
+#include "byte_order.h"
+
+uint64_t uint64_to_le(uint64_t native) {
+	uint8_t bytes[8];
+	int i;
+
+	for (i = 0; i < 8; ++i) {
+		bytes[i] = (uint8_t)(native >> (i * 8));
+	}
+
+	memcpy(&native, bytes, sizeof(native));
+
+	return native;
+}
+
+uint64_t uint64_from_le(uint64_t value) {
+	uint8_t bytes[8];
+	uint64_t native = 0;
+	int i;
+
+	memcpy(bytes, &value, sizeof(bytes));
+
+	for (i = 7; i >= 0; --i) {
+		native = (native << 8) | bytes[i];
+	}
+
+	return native;
+}
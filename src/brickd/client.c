@@ -32,9 +32,14 @@
 
 #include "client.h"
 
+#include "event_timing.h"
 #include "hardware.h"
 #include "hmac.h"
+#include "metrics_server.h"
 #include "network.h"
+#include "packet_trace.h"
+#include "traffic_capture.h"
+#include "usb.h"
 #ifdef BRICKD_WITH_RED_BRICK
 	#include "red_usb_gadget.h"
 #endif
@@ -91,7 +96,7 @@ static void client_handle_get_authentication_nonce_request(Client *client,
 #endif
 
 	packet_add_trace(&u.packet);
-	client_dispatch_response(client, NULL, &u.packet, false, true);
+	client_dispatch_response(client, NULL, &u.packet, NULL, false, true);
 
 	client->authentication_state = CLIENT_AUTHENTICATION_STATE_NONCE_SEND;
 }
@@ -161,10 +166,217 @@ static void client_handle_authenticate_request(Client *client,
 #endif
 
 		packet_add_trace(&u.packet);
-		client_dispatch_response(client, NULL, &u.packet, false, false);
+		client_dispatch_response(client, NULL, &u.packet, NULL, false, false);
 	}
 }
 
+static int client_find_callback_subscription(Client *client,
+                                             CallbackSubscriptionRequest *request) {
+	int i;
+	CallbackSubscription *subscription;
+
+	for (i = 0; i < client->callback_subscriptions.count; ++i) {
+		subscription = array_get(&client->callback_subscriptions, i);
+
+		if (subscription->uid == request->uid &&
+		    subscription->function_id == request->function_id) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+static void client_handle_callback_subscription_request(Client *client, Packet *request) {
+	CallbackSubscriptionRequest *subscription_request = (CallbackSubscriptionRequest *)request;
+	PacketE error_code = PACKET_E_SUCCESS;
+	int i;
+	CallbackSubscription *subscription;
+	char base58[BASE58_MAX_LENGTH];
+	union {
+		EmptyResponse response;
+		Packet packet;
+	} u;
+
+	if (request->header.function_id == FUNCTION_SUBSCRIBE_CALLBACK) {
+		if (client_find_callback_subscription(client, subscription_request) >= 0) {
+			// already subscribed
+		} else if (client->callback_subscriptions.count >= CLIENT_MAX_CALLBACK_SUBSCRIPTIONS) {
+			log_warn("Client ("CLIENT_SIGNATURE_FORMAT") exceeded the maximum of %d callback subscriptions",
+			         client_expand_signature(client), CLIENT_MAX_CALLBACK_SUBSCRIPTIONS);
+
+			error_code = PACKET_E_INVALID_PARAMETER;
+		} else {
+			subscription = array_append(&client->callback_subscriptions);
+
+			if (subscription == NULL) {
+				log_error("Could not append to callback subscription array of client ("CLIENT_SIGNATURE_FORMAT"): %s (%d)",
+				          client_expand_signature(client), get_errno_name(errno), errno);
+
+				error_code = PACKET_E_UNKNOWN_ERROR;
+			} else {
+				subscription->uid = subscription_request->uid;
+				subscription->function_id = subscription_request->function_id;
+
+				log_debug("Client ("CLIENT_SIGNATURE_FORMAT") subscribed to callback (uid: %s, function-id: %u)",
+				          client_expand_signature(client),
+				          subscription->uid == 0 ? "*" : base58_encode(base58, uint32_from_le(subscription->uid)),
+				          subscription->function_id);
+			}
+		}
+	} else if (request->header.function_id == FUNCTION_UNSUBSCRIBE_CALLBACK) {
+		i = client_find_callback_subscription(client, subscription_request);
+
+		if (i >= 0) {
+			array_remove(&client->callback_subscriptions, i, NULL);
+		}
+	} else { // FUNCTION_CLEAR_CALLBACK_SUBSCRIPTIONS
+		// iterate backwards to avoid memmove in array_remove call
+		for (i = client->callback_subscriptions.count - 1; i >= 0; --i) {
+			array_remove(&client->callback_subscriptions, i, NULL);
+		}
+	}
+
+	if (packet_header_get_response_expected(&request->header)) {
+		u.response.header = request->header;
+		u.response.header.length = sizeof(u.response);
+
+		packet_header_set_error_code(&u.response.header, error_code);
+
+#ifdef DAEMONLIB_WITH_PACKET_TRACE
+		u.packet.trace_id = packet_get_next_response_trace_id();
+#endif
+
+		packet_add_trace(&u.packet);
+		client_dispatch_response(client, NULL, &u.packet, NULL, false, false);
+	}
+}
+
+// the metrics text is too long for a single response. it is streamed in
+// chunks, the snapshot taken at chunk offset 0 is used for all other chunks,
+// so the chunks of one stream are consistent with each other
+static void client_handle_get_metrics_low_level_request(Client *client,
+                                                        GetMetricsLowLevelRequest *request) {
+	uint32_t chunk_offset = uint32_from_le(request->chunk_offset);
+	int chunk_length = 0;
+	PacketE error_code = PACKET_E_SUCCESS;
+	union {
+		GetMetricsLowLevelResponse response;
+		Packet packet;
+	} u;
+
+	if (chunk_offset == 0) {
+		free(client->metrics);
+
+		client->metrics = NULL;
+		client->metrics_length = metrics_get_text(&client->metrics);
+
+		if (client->metrics_length < 0) {
+			log_error("Could not collect metrics for client ("CLIENT_SIGNATURE_FORMAT"): %s (%d)",
+			          client_expand_signature(client), get_errno_name(errno), errno);
+
+			client->metrics = NULL;
+			client->metrics_length = 0;
+			error_code = PACKET_E_UNKNOWN_ERROR;
+		}
+	} else if (client->metrics == NULL || chunk_offset > (uint32_t)client->metrics_length) {
+		error_code = PACKET_E_INVALID_PARAMETER;
+	}
+
+	if (!packet_header_get_response_expected(&request->header)) {
+		return;
+	}
+
+	memset(&u.response, 0, sizeof(u.response));
+
+	u.response.header = request->header;
+	u.response.header.length = sizeof(u.response);
+
+	if (error_code == PACKET_E_SUCCESS) {
+		chunk_length = client->metrics_length - (int)chunk_offset;
+
+		if (chunk_length > CLIENT_METRICS_CHUNK_LENGTH) {
+			chunk_length = CLIENT_METRICS_CHUNK_LENGTH;
+		}
+
+		u.response.length = uint32_to_le(client->metrics_length);
+		u.response.chunk_offset = uint32_to_le(chunk_offset);
+
+		memcpy(u.response.chunk_data, client->metrics + chunk_offset, chunk_length);
+	}
+
+	packet_header_set_error_code(&u.response.header, error_code);
+
+#ifdef DAEMONLIB_WITH_PACKET_TRACE
+	u.packet.trace_id = packet_get_next_response_trace_id();
+#endif
+
+	packet_add_trace(&u.packet);
+	client_dispatch_response(client, NULL, &u.packet, NULL, false, false);
+}
+
+// the dump is written to a fixed file on the host running brickd, the response
+// only reports the number of written events
+static void client_handle_dump_packet_trace_request(Client *client, Packet *request) {
+	int event_count = packet_trace_dump();
+	union {
+		DumpPacketTraceResponse response;
+		Packet packet;
+	} u;
+
+	if (!packet_header_get_response_expected(&request->header)) {
+		return;
+	}
+
+	memset(&u.response, 0, sizeof(u.response));
+
+	u.response.header = request->header;
+	u.response.header.length = sizeof(u.response);
+
+	if (event_count < 0) {
+		packet_header_set_error_code(&u.response.header, PACKET_E_UNKNOWN_ERROR);
+	} else {
+		u.response.event_count = uint32_to_le(event_count);
+
+		packet_header_set_error_code(&u.response.header, PACKET_E_SUCCESS);
+	}
+
+#ifdef DAEMONLIB_WITH_PACKET_TRACE
+	u.packet.trace_id = packet_get_next_response_trace_id();
+#endif
+
+	packet_add_trace(&u.packet);
+	client_dispatch_response(client, NULL, &u.packet, NULL, false, false);
+}
+
+// the USB device is reopened in the background, the response only reports
+// whether the USB device was found
+static void client_handle_reopen_usb_device_request(Client *client,
+                                                    ReopenUSBDeviceRequest *request) {
+	int rc = usb_reopen_device(request->uid, request->bus_number, request->device_address);
+	union {
+		EmptyResponse response;
+		Packet packet;
+	} u;
+
+	if (!packet_header_get_response_expected(&request->header)) {
+		return;
+	}
+
+	u.response.header = request->header;
+	u.response.header.length = sizeof(u.response);
+
+	packet_header_set_error_code(&u.response.header,
+	                             rc < 0 ? PACKET_E_INVALID_PARAMETER : PACKET_E_SUCCESS);
+
+#ifdef DAEMONLIB_WITH_PACKET_TRACE
+	u.packet.trace_id = packet_get_next_response_trace_id();
+#endif
+
+	packet_add_trace(&u.packet);
+	client_dispatch_response(client, NULL, &u.packet, NULL, false, false);
+}
+
 static void client_handle_request(Client *client, Packet *request) {
 	char packet_signature[PACKET_MAX_SIGNATURE_LENGTH];
 	union {
@@ -173,9 +385,17 @@ static void client_handle_request(Client *client, Packet *request) {
 	} u;
 	PendingRequest *pending_request;
 	bool dispatched;
+	Stack *stack;
 
 	packet_add_trace(request);
 
+	if (traffic_capture_is_enabled()) {
+		stack = hardware_get_route(request->header.uid);
+
+		traffic_capture_record(TRAFFIC_CAPTURE_RECORD_REQUEST, client->capture_source,
+		                       stack != NULL ? stack->capture_source : 0, request);
+	}
+
 	// handle requests meant for brickd
 	if (uint32_from_le(request->header.uid) == UID_BRICK_DAEMON) {
 		// add as pending request if response is expected
@@ -207,6 +427,93 @@ static void client_handle_request(Client *client, Packet *request) {
 			}
 
 			client_handle_authenticate_request(client, (AuthenticateRequest *)request);
+		} else if (request->header.function_id == FUNCTION_SUBSCRIBE_CALLBACK ||
+		           request->header.function_id == FUNCTION_UNSUBSCRIBE_CALLBACK ||
+		           request->header.function_id == FUNCTION_CLEAR_CALLBACK_SUBSCRIPTIONS) {
+			if (request->header.length != (request->header.function_id == FUNCTION_CLEAR_CALLBACK_SUBSCRIPTIONS
+			                               ? sizeof(EmptyRequest) : sizeof(CallbackSubscriptionRequest))) {
+				log_error("Received callback subscription request (%s) from client ("CLIENT_SIGNATURE_FORMAT") with wrong length, disconnecting client",
+				          packet_get_request_signature(packet_signature, request),
+				          client_expand_signature(client));
+
+				client->disconnected = true;
+
+				return;
+			}
+
+			if (client->authentication_state != CLIENT_AUTHENTICATION_STATE_DISABLED &&
+			    client->authentication_state != CLIENT_AUTHENTICATION_STATE_DONE) {
+				log_packet_debug("Client ("CLIENT_SIGNATURE_FORMAT") is not authenticated, dropping request (%s)",
+				                 client_expand_signature(client),
+				                 packet_get_request_signature(packet_signature, request));
+
+				return;
+			}
+
+			client_handle_callback_subscription_request(client, request);
+		} else if (request->header.function_id == FUNCTION_GET_METRICS_LOW_LEVEL) {
+			if (request->header.length != sizeof(GetMetricsLowLevelRequest)) {
+				log_error("Received get-metrics-low-level request (%s) from client ("CLIENT_SIGNATURE_FORMAT") with wrong length, disconnecting client",
+				          packet_get_request_signature(packet_signature, request),
+				          client_expand_signature(client));
+
+				client->disconnected = true;
+
+				return;
+			}
+
+			if (client->authentication_state != CLIENT_AUTHENTICATION_STATE_DISABLED &&
+			    client->authentication_state != CLIENT_AUTHENTICATION_STATE_DONE) {
+				log_packet_debug("Client ("CLIENT_SIGNATURE_FORMAT") is not authenticated, dropping request (%s)",
+				                 client_expand_signature(client),
+				                 packet_get_request_signature(packet_signature, request));
+
+				return;
+			}
+
+			client_handle_get_metrics_low_level_request(client, (GetMetricsLowLevelRequest *)request);
+		} else if (request->header.function_id == FUNCTION_DUMP_PACKET_TRACE) {
+			if (request->header.length != sizeof(EmptyRequest)) {
+				log_error("Received dump-packet-trace request (%s) from client ("CLIENT_SIGNATURE_FORMAT") with wrong length, disconnecting client",
+				          packet_get_request_signature(packet_signature, request),
+				          client_expand_signature(client));
+
+				client->disconnected = true;
+
+				return;
+			}
+
+			if (client->authentication_state != CLIENT_AUTHENTICATION_STATE_DISABLED &&
+			    client->authentication_state != CLIENT_AUTHENTICATION_STATE_DONE) {
+				log_packet_debug("Client ("CLIENT_SIGNATURE_FORMAT") is not authenticated, dropping request (%s)",
+				                 client_expand_signature(client),
+				                 packet_get_request_signature(packet_signature, request));
+
+				return;
+			}
+
+			client_handle_dump_packet_trace_request(client, request);
+		} else if (request->header.function_id == FUNCTION_REOPEN_USB_DEVICE) {
+			if (request->header.length != sizeof(ReopenUSBDeviceRequest)) {
+				log_error("Received reopen-usb-device request (%s) from client ("CLIENT_SIGNATURE_FORMAT") with wrong length, disconnecting client",
+				          packet_get_request_signature(packet_signature, request),
+				          client_expand_signature(client));
+
+				client->disconnected = true;
+
+				return;
+			}
+
+			if (client->authentication_state != CLIENT_AUTHENTICATION_STATE_DISABLED &&
+			    client->authentication_state != CLIENT_AUTHENTICATION_STATE_DONE) {
+				log_packet_debug("Client ("CLIENT_SIGNATURE_FORMAT") is not authenticated, dropping request (%s)",
+				                 client_expand_signature(client),
+				                 packet_get_request_signature(packet_signature, request));
+
+				return;
+			}
+
+			client_handle_reopen_usb_device_request(client, (ReopenUSBDeviceRequest *)request);
 		} else if (packet_header_get_response_expected(&request->header)) {
 			u.response.header = request->header;
 			u.response.header.length = sizeof(u.response);
@@ -219,7 +526,7 @@ static void client_handle_request(Client *client, Packet *request) {
 #endif
 
 			packet_add_trace(&u.packet);
-			client_dispatch_response(client, NULL, &u.packet, false, false);
+			client_dispatch_response(client, NULL, &u.packet, NULL, false, false);
 		}
 	} else if (client->authentication_state == CLIENT_AUTHENTICATION_STATE_DISABLED ||
 	           client->authentication_state == CLIENT_AUTHENTICATION_STATE_DONE) {
@@ -247,16 +554,55 @@ static void client_handle_request(Client *client, Packet *request) {
 	}
 }
 
+// the request is still in the receive buffer and is followed by the next one
+static void client_handle_received_request(Client *client, Packet *request) {
+	char packet_signature[PACKET_MAX_SIGNATURE_LENGTH];
+#ifdef DAEMONLIB_WITH_PACKET_TRACE
+	Packet traced_request;
+#endif
+
+	++client->request_count;
+	client->request_bytes += request->header.length;
+
+	if (request->header.function_id == FUNCTION_DISCONNECT_PROBE) {
+		log_packet_debug("Received disconnect probe from client ("CLIENT_SIGNATURE_FORMAT"), dropping request",
+		                 client_expand_signature(client));
+
+		return;
+	}
+
+#ifdef DAEMONLIB_WITH_PACKET_TRACE
+	// the trace ID is stored behind the packet data, setting it in place
+	// would overwrite the beginning of the next request
+	memcpy(&traced_request, request, request->header.length);
+
+	request = &traced_request;
+	request->trace_id = packet_get_next_request_trace_id();
+#endif
+
+	log_packet_debug("Received request (%s) from client ("CLIENT_SIGNATURE_FORMAT")",
+	                 packet_get_request_signature(packet_signature, request),
+	                 client_expand_signature(client));
+
+	packet_trace_record(PACKET_TRACE_HOP_CLIENT_REQUEST, packet_trace_begin_request(),
+	                    client->trace_source, request);
+
+	client_handle_request(client, request);
+
+	packet_trace_end_request();
+}
+
 static void client_handle_read(void *opaque) {
 	Client *client = opaque;
+	uint8_t *buffer;
 	int length;
+	int result;
+	Packet *request;
 	const char *message = NULL;
 	char packet_dump[PACKET_MAX_DUMP_LENGTH];
-	char packet_signature[PACKET_MAX_SIGNATURE_LENGTH];
-	Packet request;
 
-	length = io_read(client->io, client->request_buffer + client->request_buffer_used,
-	                 sizeof(client->request_buffer) - client->request_buffer_used);
+	buffer = packet_reader_get_free(&client->request_reader, &length);
+	length = io_read(client->io, buffer, length);
 
 	if (length == 0) {
 		log_info("Client ("CLIENT_SIGNATURE_FORMAT") disconnected by peer",
@@ -291,61 +637,51 @@ static void client_handle_read(void *opaque) {
 		return;
 	}
 
-	client->request_buffer_used += length;
-
-	while (!client->disconnected && client->request_buffer_used > 0) {
-		if (client->request_buffer_used < (int)sizeof(PacketHeader)) {
-			// wait for complete header
-			break;
-		}
-
-		if (!client->request_header_checked) {
-			if (!packet_header_is_valid_request(&client->request.header, &message)) {
-				log_error("Received invalid request (packet: %s) from client ("CLIENT_SIGNATURE_FORMAT"), disconnecting client: %s",
-				          packet_get_dump(packet_dump, &client->request, client->request_buffer_used),
-				          client_expand_signature(client), message);
+	packet_reader_commit(&client->request_reader, length);
 
-				client->disconnected = true;
+	++client->read_count;
 
-				return;
-			}
+	// handle all complete requests in place, without copying them out of the
+	// receive buffer
+	while (!client->disconnected) {
+		result = packet_reader_next(&client->request_reader, &request, &message);
 
-			client->request_header_checked = true;
+		if (result == 0) {
+			break;
 		}
 
-		length = client->request.header.length;
+		if (result < 0) {
+			log_error("Received invalid request (packet: %s) from client ("CLIENT_SIGNATURE_FORMAT"), disconnecting client: %s",
+			          packet_get_dump(packet_dump, request, packet_reader_get_pending(&client->request_reader)),
+			          client_expand_signature(client), message);
 
-		if (client->request_buffer_used < length) {
-			// wait for complete packet
-			break;
-		}
+			client->disconnected = true;
 
-		if (client->request.header.function_id == FUNCTION_DISCONNECT_PROBE) {
-			log_packet_debug("Received disconnect probe from client ("CLIENT_SIGNATURE_FORMAT"), dropping request",
-			                 client_expand_signature(client));
-		} else {
-			memcpy(&request, &client->request, length);
+			return;
+		}
 
-#ifdef DAEMONLIB_WITH_PACKET_TRACE
-			request.trace_id = packet_get_next_request_trace_id();
-#endif
+		client_handle_received_request(client, request);
+	}
+}
 
-			log_packet_debug("Received request (%s) from client ("CLIENT_SIGNATURE_FORMAT")",
-			                 packet_get_request_signature(packet_signature, &request),
-			                 client_expand_signature(client));
+// handles a block of complete and already validated requests that were
+// received on behalf of the client, e.g. by a network shard
+void client_handle_requests(Client *client, uint8_t *data, int length) {
+	int offset = 0;
+	Packet *request;
 
-			client_handle_request(client, &request);
-		}
+	++client->read_count;
 
-		memmove(client->request_buffer, client->request_buffer + length, client->request_buffer_used - length);
+	while (offset < length && !client->disconnected) {
+		request = (Packet *)(data + offset);
+		offset += request->header.length;
 
-		client->request_buffer_used -= length;
-		client->request_header_checked = false;
+		client_handle_received_request(client, request);
 	}
 }
 
 void pending_request_remove_and_free(PendingRequest *pending_request) {
-	node_remove(&pending_request->global_node);
+	network_remove_pending_request(pending_request);
 	node_remove(&pending_request->client_node);
 
 	if (pending_request->client != NULL) {
@@ -356,7 +692,7 @@ void pending_request_remove_and_free(PendingRequest *pending_request) {
 		--pending_request->zombie->pending_request_count;
 	}
 
-	free(pending_request);
+	network_free_pending_request(pending_request);
 }
 
 const char *client_get_authentication_state_name(ClientAuthenticationState state) {
@@ -370,20 +706,355 @@ const char *client_get_authentication_state_name(ClientAuthenticationState state
 	}
 }
 
-static char *client_get_recipient_signature(char *signature, bool upper, void *opaque) {
-	Client *client = opaque;
+#define INITIAL_RESPONSE_BACKLOG_SIZE 16 // must be a power of two
+
+// responses of coalescing clients are gathered into this buffer to send them
+// with a single write. it is shared by all clients, because it is only used
+// for the duration of one write
+static uint8_t _coalesced_responses[CLIENT_MAX_COALESCED_LENGTH];
+
+static uint32_t _total_write_count = 0;
+static uint32_t _total_response_count = 0;
+
+static PacketBuffer **client_get_backlog_slot(Client *client, int i) {
+	return &client->response_backlog[(client->response_backlog_start + i) & (client->response_backlog_allocated - 1)];
+}
+
+static void client_pop_response_from_backlog(Client *client) {
+	PacketBuffer *buffer = *client_get_backlog_slot(client, 0);
+
+	client->response_backlog_length -= buffer->packet.header.length;
+	client->response_backlog_offset = 0;
+
+	packet_buffer_unref(buffer);
+
+	client->response_backlog_start = (client->response_backlog_start + 1) & (client->response_backlog_allocated - 1);
+	--client->response_backlog_count;
+}
+
+// drops the oldest responses from the backlog. a partially sent response is
+// kept, dropping it would corrupt the byte stream to the client
+static void client_drop_responses_from_backlog(Client *client, int count) {
+	int i;
+	int offset = client->response_backlog_offset;
+	PacketBuffer *partial = NULL;
+
+	if (offset > 0) {
+		partial = packet_buffer_ref(*client_get_backlog_slot(client, 0));
+
+		client_pop_response_from_backlog(client);
+	}
+
+	for (i = 0; i < count && client->response_backlog_count > 0; ++i) {
+		client_pop_response_from_backlog(client);
+	}
+
+	if (partial != NULL) {
+		client->response_backlog_start = (client->response_backlog_start - 1) & (client->response_backlog_allocated - 1);
+		client->response_backlog_length += partial->packet.header.length;
+		client->response_backlog_offset = offset;
+
+		*client_get_backlog_slot(client, 0) = partial;
+
+		++client->response_backlog_count;
+	}
+}
+
+static void client_handle_write(void *opaque);
+
+static int client_set_write_event(Client *client, bool enable) {
+	if (client->write_event_registered == enable) {
+		return 0;
+	}
+
+	if (event_timing_modify_source(client->io->write_handle, EVENT_SOURCE_TYPE_GENERIC,
+	                               enable ? 0 : EVENT_WRITE, enable ? EVENT_WRITE : 0,
+	                               client_handle_write, client) < 0) {
+		log_error("Could not %s client ("CLIENT_SIGNATURE_FORMAT") %s write events, disconnecting client: %s (%d)",
+		          enable ? "register" : "deregister", client_expand_signature(client),
+		          enable ? "for" : "from", get_errno_name(errno), errno);
+
+		client->disconnected = true;
+
+		return -1;
+	}
+
+	client->write_event_registered = enable;
+
+	return 0;
+}
+
+// an I/O object that cannot take more data right now either would block or,
+// in case of a network shard client, reports ENOBUFS for a full queue
+static bool client_is_write_deferred(void) {
+	return errno_would_block() || errno == ENOBUFS;
+}
+
+// waits for the I/O object to become writable again. an I/O object without
+// write handle cannot be polled, it calls client_flush_responses itself once
+// it can take more data again
+static int client_wait_for_write(Client *client) {
+	if (client->io->write_handle == IO_HANDLE_INVALID) {
+		return 0;
+	}
+
+	return client_set_write_event(client, true);
+}
+
+// copies as many backlog responses as fit into the coalescing buffer,
+// starting with the unsent part of the first response
+static int client_gather_responses(Client *client) {
+	int i;
+	int length = 0;
+	int chunk_length;
+	uint8_t *chunk;
+	PacketBuffer *buffer;
+
+	for (i = 0; i < client->response_backlog_count; ++i) {
+		buffer = *client_get_backlog_slot(client, i);
+		chunk = (uint8_t *)&buffer->packet;
+		chunk_length = buffer->packet.header.length;
+
+		if (i == 0) {
+			chunk += client->response_backlog_offset;
+			chunk_length -= client->response_backlog_offset;
+		}
+
+		if (length + chunk_length > (int)sizeof(_coalesced_responses)) {
+			break;
+		}
 
-	snprintf(signature, WRITER_MAX_RECIPIENT_SIGNATURE_LENGTH,
-	         "%client ("CLIENT_SIGNATURE_FORMAT")",
-	         upper ? 'C' : 'c', client_expand_signature(client));
+		memcpy(_coalesced_responses + length, chunk, chunk_length);
 
-	return signature;
+		length += chunk_length;
+	}
+
+	return length;
 }
 
-static void client_recipient_disconnect(void *opaque) {
+// removes the given number of sent bytes from the front of the backlog
+static void client_consume_responses(Client *client, int length) {
+	int remaining;
+	PacketBuffer *buffer;
+
+	while (length > 0) {
+		buffer = *client_get_backlog_slot(client, 0);
+		remaining = buffer->packet.header.length - client->response_backlog_offset;
+
+		if (length < remaining) {
+			client->response_backlog_offset += length;
+
+			break;
+		}
+
+		length -= remaining;
+
+		client->response_bytes += buffer->packet.header.length;
+
+		client_pop_response_from_backlog(client);
+
+		++client->response_count;
+		++_total_response_count;
+	}
+}
+
+// sends as much of the backlog as possible. a coalescing client sends all
+// responses that fit into the coalescing buffer with a single write, any other
+// client sends one response per write. a lone response is always sent
+// directly from its buffer, gathering it would only add a copy. returns -1 on
+// error, 0 if the backlog is empty and 1 if the I/O object would block
+static int client_send_backlog(Client *client) {
+	PacketBuffer *buffer;
+	const void *data;
+	int length;
+	int result;
+	char packet_signature[PACKET_MAX_SIGNATURE_LENGTH];
+
+	while (client->response_backlog_count > 0) {
+		buffer = *client_get_backlog_slot(client, 0);
+
+		if (client->coalesce_responses && client->response_backlog_count > 1) {
+			data = _coalesced_responses;
+			length = client_gather_responses(client);
+		} else {
+			data = (uint8_t *)&buffer->packet + client->response_backlog_offset;
+			length = buffer->packet.header.length - client->response_backlog_offset;
+		}
+
+		result = io_write(client->io, data, length);
+
+		if (result < 0) {
+			if (client_is_write_deferred()) {
+				return 1;
+			}
+
+			log_error("Could not send queued response (%s) to client ("CLIENT_SIGNATURE_FORMAT"), disconnecting client: %s (%d)",
+			          packet_get_response_signature(packet_signature, &buffer->packet),
+			          client_expand_signature(client), get_errno_name(errno), errno);
+
+			client->disconnected = true;
+
+			return -1;
+		}
+
+		++client->write_count;
+		++_total_write_count;
+
+		if (!client->coalesce_responses) {
+			log_packet_debug("Sent queued response (%s) to client ("CLIENT_SIGNATURE_FORMAT"), %d response(s) left in backlog",
+			                 packet_get_response_signature(packet_signature, &buffer->packet),
+			                 client_expand_signature(client), client->response_backlog_count - 1);
+
+			client->response_bytes += length;
+
+			client_pop_response_from_backlog(client);
+
+			++client->response_count;
+			++_total_response_count;
+
+			continue;
+		}
+
+		client_consume_responses(client, result);
+
+		log_packet_debug("Sent %d byte(s) of queued responses to client ("CLIENT_SIGNATURE_FORMAT"), %d response(s) left in backlog",
+		                 result, client_expand_signature(client), client->response_backlog_count);
+
+		if (result < length) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static void client_handle_write(void *opaque) {
 	Client *client = opaque;
 
-	client->disconnected = true;
+	if (client_send_backlog(client) != 0) {
+		return;
+	}
+
+	// last queued response handled, deregister for write events
+	client_set_write_event(client, false);
+}
+
+// the backlog holds references to packet buffers instead of copies. if the
+// caller passes a response buffer then it is shared with all other clients
+// that have to enqueue the same response, so a broadcast is copied only once
+static int client_push_response_to_backlog(Client *client, Packet *response,
+                                           PacketBuffer **response_buffer) {
+	int i;
+	int allocated;
+	PacketBuffer **backlog;
+	PacketBuffer *buffer;
+	char packet_signature[PACKET_MAX_SIGNATURE_LENGTH];
+
+	if (client->response_backlog_count >= CLIENT_MAX_RESPONSE_BACKLOG) {
+		client_drop_responses_from_backlog(client, CLIENT_RESPONSE_BACKLOG_DROP_COUNT);
+
+		client->dropped_responses += CLIENT_RESPONSE_BACKLOG_DROP_COUNT;
+
+		log_warn("Response backlog for client ("CLIENT_SIGNATURE_FORMAT") is full, dropped %d queued response(s), %u dropped in total",
+		         client_expand_signature(client), CLIENT_RESPONSE_BACKLOG_DROP_COUNT,
+		         client->dropped_responses);
+	}
+
+	if (client->response_backlog_count == client->response_backlog_allocated) {
+		allocated = client->response_backlog_allocated > 0
+		          ? client->response_backlog_allocated * 2 : INITIAL_RESPONSE_BACKLOG_SIZE;
+		backlog = malloc(sizeof(PacketBuffer *) * allocated);
+
+		if (backlog == NULL) {
+			log_error("Could not grow response backlog of client ("CLIENT_SIGNATURE_FORMAT") to %d entries: %s (%d)",
+			          client_expand_signature(client), allocated,
+			          get_errno_name(ENOMEM), ENOMEM);
+
+			return -1;
+		}
+
+		for (i = 0; i < client->response_backlog_count; ++i) {
+			backlog[i] = *client_get_backlog_slot(client, i);
+		}
+
+		free(client->response_backlog);
+
+		client->response_backlog = backlog;
+		client->response_backlog_allocated = allocated;
+		client->response_backlog_start = 0;
+	}
+
+	if (response_buffer != NULL && *response_buffer != NULL) {
+		buffer = packet_buffer_ref(*response_buffer);
+	} else {
+		buffer = packet_buffer_create(response);
+
+		if (buffer == NULL) {
+			log_error("Could not create buffer for response (%s) to client ("CLIENT_SIGNATURE_FORMAT"): %s (%d)",
+			          packet_get_response_signature(packet_signature, response),
+			          client_expand_signature(client), get_errno_name(errno), errno);
+
+			return -1;
+		}
+
+		if (response_buffer != NULL) {
+			*response_buffer = packet_buffer_ref(buffer);
+		}
+	}
+
+	*client_get_backlog_slot(client, client->response_backlog_count) = buffer;
+
+	++client->response_backlog_count;
+	client->response_backlog_length += response->header.length;
+
+	return 0;
+}
+
+// returns -1 on error, 0 if the response was sent and 1 if it was enqueued.
+// responses to a coalescing client are always enqueued, the network subsystem
+// flushes them once per event loop iteration or after the coalescing delay
+static int client_write_response(Client *client, Packet *response,
+                                 PacketBuffer **response_buffer) {
+	char packet_signature[PACKET_MAX_SIGNATURE_LENGTH];
+
+	if (!client->coalesce_responses && client->response_backlog_count == 0) {
+		if (io_write(client->io, response, response->header.length) >= 0) {
+			++client->write_count;
+			++client->response_count;
+			client->response_bytes += response->header.length;
+			++_total_write_count;
+			++_total_response_count;
+
+			return 0;
+		}
+
+		if (!client_is_write_deferred()) {
+			log_error("Could not send response (%s) to client ("CLIENT_SIGNATURE_FORMAT"), disconnecting client: %s (%d)",
+			          packet_get_response_signature(packet_signature, response),
+			          client_expand_signature(client), get_errno_name(errno), errno);
+
+			client->disconnected = true;
+
+			return -1;
+		}
+	}
+
+	if (client_push_response_to_backlog(client, response, response_buffer) < 0) {
+		return -1;
+	}
+
+	if (!client->coalesce_responses) {
+		// first queued response, register for write events
+		if (client_wait_for_write(client) < 0) {
+			return -1;
+		}
+	} else if (!client->write_event_registered) {
+		// while registered for write events the backlog is sent as soon as
+		// the I/O object is writable again, no need to flush it
+		network_add_unflushed_client(client);
+	}
+
+	return 1;
 }
 
 int client_create(Client *client, const char *name, IO *io,
@@ -396,12 +1067,30 @@ int client_create(Client *client, const char *name, IO *io,
 
 	client->io = io;
 	client->disconnected = false;
-	client->request_buffer_used = 0;
-	client->request_header_checked = false;
+	client->read_count = 0;
+	client->request_count = 0;
+	client->request_bytes = 0;
 	client->pending_request_count = 0;
 	client->dropped_pending_requests = 0;
+	client->expired_pending_requests = 0;
+	client->unreported_expired_pending_requests = 0;
+	client->response_backlog = NULL;
+	client->response_backlog_allocated = 0;
+	client->response_backlog_start = 0;
+	client->response_backlog_count = 0;
+	client->response_backlog_length = 0;
+	client->response_backlog_offset = 0;
+	client->dropped_responses = 0;
+	client->coalesce_responses = false;
+	client->write_event_registered = false;
+	client->flush_deadline = 0;
+	client->write_count = 0;
+	client->response_count = 0;
+	client->response_bytes = 0;
 	client->authentication_state = CLIENT_AUTHENTICATION_STATE_DISABLED;
 	client->authentication_nonce = authentication_nonce;
+	client->metrics = NULL;
+	client->metrics_length = 0;
 	client->destroy_done = destroy_done;
 
 	if (config_get_option_value("authentication.secret")->string != NULL) {
@@ -409,21 +1098,42 @@ int client_create(Client *client, const char *name, IO *io,
 	}
 
 	node_reset(&client->pending_request_sentinel);
+	node_reset(&client->flush_node);
 
-	// create response writer
-	if (writer_create(&client->response_writer, client->io,
-	                  "response", packet_get_response_signature,
-	                  "client", client_get_recipient_signature,
-	                  client_recipient_disconnect, client) < 0) {
-		log_error("Could not create response writer: %s (%d)",
+	// create request reader
+	if (packet_reader_create(&client->request_reader,
+	                         config_get_option_value("client.receive_buffer_size")->integer) < 0) {
+		log_error("Could not create request reader: %s (%d)",
 		          get_errno_name(errno), errno);
 
 		return -1;
 	}
 
-	// add I/O object as event source
-	return event_add_source(client->io->read_handle, EVENT_SOURCE_TYPE_GENERIC,
-	                        "client", EVENT_READ, client_handle_read, client);
+	// create callback subscription array
+	if (array_create(&client->callback_subscriptions, 8, sizeof(CallbackSubscription), true) < 0) {
+		log_error("Could not create callback subscription array: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		packet_reader_destroy(&client->request_reader);
+
+		return -1;
+	}
+
+	// add I/O object as event source. an I/O object without handle receives
+	// its requests from elsewhere, see client_handle_requests
+	if (client->io->read_handle != IO_HANDLE_INVALID &&
+	    event_timing_add_source(client->io->read_handle, EVENT_SOURCE_TYPE_GENERIC,
+	                            "client", EVENT_READ, client_handle_read, client) < 0) {
+		array_destroy(&client->callback_subscriptions, NULL);
+		packet_reader_destroy(&client->request_reader);
+
+		return -1;
+	}
+
+	client->trace_source = packet_trace_add_source(PACKET_TRACE_SOURCE_CLIENT, client->name);
+	client->capture_source = traffic_capture_add_source(TRAFFIC_CAPTURE_RECORD_CLIENT, client->name);
+
+	return 0;
 }
 
 void client_destroy(Client *client) {
@@ -442,9 +1152,35 @@ void client_destroy(Client *client) {
 		}
 	}
 
-	writer_destroy(&client->response_writer);
+	if (client->response_backlog_count > 0) {
+		log_warn("Destroying client ("CLIENT_SIGNATURE_FORMAT") while %d response(s) have not been sent",
+		         client_expand_signature(client), client->response_backlog_count);
+
+		while (client->response_backlog_count > 0) {
+			client_pop_response_from_backlog(client);
+		}
+	}
+
+	free(client->response_backlog);
+
+	node_remove(&client->flush_node);
+
+	array_destroy(&client->callback_subscriptions, NULL);
+
+	free(client->metrics);
+
+	log_debug("Client ("CLIENT_SIGNATURE_FORMAT") sent %u request(s) in %u read(s) and received %u response(s) in %u write(s)",
+	          client_expand_signature(client), client->request_count, client->read_count,
+	          client->response_count, client->write_count);
+
+	packet_reader_destroy(&client->request_reader);
+
+	packet_trace_remove_source(client->trace_source);
+
+	if (client->io->read_handle != IO_HANDLE_INVALID) {
+		event_timing_remove_source(client->io->read_handle, EVENT_SOURCE_TYPE_GENERIC);
+	}
 
-	event_remove_source(client->io->read_handle, EVENT_SOURCE_TYPE_GENERIC);
 	io_destroy(client->io);
 	free(client->io);
 
@@ -461,9 +1197,35 @@ void client_destroy(Client *client) {
 	}
 }
 
+// a client without subscriptions receives all callbacks. enumerate callbacks
+// are always received, the IP Connection relies on them to discover devices
+bool client_is_subscribed_to_callback(Client *client, Packet *callback) {
+	int i;
+	CallbackSubscription *subscription;
+
+	if (client->callback_subscriptions.count == 0 ||
+	    callback->header.function_id == CALLBACK_ENUMERATE) {
+		return true;
+	}
+
+	for (i = 0; i < client->callback_subscriptions.count; ++i) {
+		subscription = array_get(&client->callback_subscriptions, i);
+
+		if ((subscription->uid == 0 || subscription->uid == callback->header.uid) &&
+		    (subscription->function_id == 0 || subscription->function_id == callback->header.function_id)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// if response_buffer is not NULL then it points to a packet buffer shared
+// between all clients that dispatch the same response. it is created on first
+// use and has to be unref'ed by the caller afterwards
 void client_dispatch_response(Client *client, PendingRequest *pending_request,
-                              Packet *response, bool force, bool ignore_authentication) {
-	Node *pending_request_client_node = NULL;
+                              Packet *response, PacketBuffer **response_buffer,
+                              bool force, bool ignore_authentication) {
 	int enqueued = 0;
 
 	packet_add_trace(response);
@@ -481,21 +1243,9 @@ void client_dispatch_response(Client *client, PendingRequest *pending_request,
 	// already given. do this before the disconnect check to ensure that even
 	// for a disconnected client the pending request list is updated correctly
 	if (!force && pending_request == NULL) {
-		pending_request_client_node = client->pending_request_sentinel.next;
-
-		while (pending_request_client_node != &client->pending_request_sentinel) {
-			pending_request = containerof(pending_request_client_node, PendingRequest, client_node);
-
-			if (packet_is_matching_response(response, &pending_request->header)) {
-				break;
-			}
-
-			pending_request_client_node = pending_request_client_node->next;
-		}
-
-		if (pending_request_client_node == &client->pending_request_sentinel) {
-			pending_request = NULL;
+		pending_request = network_find_pending_request(response, client);
 
+		if (pending_request == NULL) {
 			goto cleanup;
 		}
 	}
@@ -508,7 +1258,12 @@ void client_dispatch_response(Client *client, PendingRequest *pending_request,
 	}
 
 	if (force || pending_request != NULL) {
-		enqueued = writer_write(&client->response_writer, response);
+		if (pending_request != NULL) {
+			packet_trace_record(PACKET_TRACE_HOP_CLIENT_RESPONSE, pending_request->trace_id,
+			                    client->trace_source, response);
+		}
+
+		enqueued = client_write_response(client, response, response_buffer);
 
 		if (enqueued < 0) {
 			goto cleanup;
@@ -530,6 +1285,112 @@ cleanup:
 	}
 }
 
+// sends the backlog of a coalescing client. if the I/O object would block
+// then the rest of the backlog is sent as soon as it is writable again
+void client_flush_responses(Client *client) {
+	if (client->disconnected || client->write_event_registered) {
+		return;
+	}
+
+	if (client_send_backlog(client) > 0) {
+		client_wait_for_write(client);
+	}
+}
+
+void client_get_write_statistics(uint32_t *write_count, uint32_t *response_count) {
+	*write_count = _total_write_count;
+	*response_count = _total_response_count;
+}
+
+static const MetricFamily _client_requests = {
+	"brickd_client_requests_total", METRIC_TYPE_COUNTER,
+	"Number of requests received from the client."
+};
+
+static const MetricFamily _client_request_bytes = {
+	"brickd_client_request_bytes_total", METRIC_TYPE_COUNTER,
+	"Number of request bytes received from the client."
+};
+
+static const MetricFamily _client_reads = {
+	"brickd_client_reads_total", METRIC_TYPE_COUNTER,
+	"Number of reads the requests of the client were received in."
+};
+
+static const MetricFamily _client_responses = {
+	"brickd_client_responses_total", METRIC_TYPE_COUNTER,
+	"Number of responses and callbacks sent to the client."
+};
+
+static const MetricFamily _client_response_bytes = {
+	"brickd_client_response_bytes_total", METRIC_TYPE_COUNTER,
+	"Number of response and callback bytes sent to the client."
+};
+
+static const MetricFamily _client_writes = {
+	"brickd_client_writes_total", METRIC_TYPE_COUNTER,
+	"Number of writes the responses to the client were sent in."
+};
+
+static const MetricFamily _client_pending_requests = {
+	"brickd_client_pending_requests", METRIC_TYPE_GAUGE,
+	"Number of requests of the client waiting for a response."
+};
+
+static const MetricFamily _client_dropped_pending_requests = {
+	"brickd_client_dropped_pending_requests_total", METRIC_TYPE_COUNTER,
+	"Number of pending requests dropped because the client had too many."
+};
+
+static const MetricFamily _client_expired_pending_requests = {
+	"brickd_client_expired_pending_requests_total", METRIC_TYPE_COUNTER,
+	"Number of pending requests of the client that expired without a response."
+};
+
+static const MetricFamily _client_response_backlog = {
+	"brickd_client_response_backlog", METRIC_TYPE_GAUGE,
+	"Number of responses queued for the client."
+};
+
+static const MetricFamily _client_response_backlog_bytes = {
+	"brickd_client_response_backlog_bytes", METRIC_TYPE_GAUGE,
+	"Number of response bytes queued for the client."
+};
+
+static const MetricFamily _client_dropped_responses = {
+	"brickd_client_dropped_responses_total", METRIC_TYPE_COUNTER,
+	"Number of responses dropped because the response backlog of the client was full."
+};
+
+void client_collect_metrics(Client *client, Metrics *metrics) {
+	const char *type = client->io->type;
+
+	metrics_add(metrics, &_client_requests, client->request_count,
+	            "client", client->name, "type", type, NULL);
+	metrics_add(metrics, &_client_request_bytes, client->request_bytes,
+	            "client", client->name, "type", type, NULL);
+	metrics_add(metrics, &_client_reads, client->read_count,
+	            "client", client->name, "type", type, NULL);
+	metrics_add(metrics, &_client_responses, client->response_count,
+	            "client", client->name, "type", type, NULL);
+	metrics_add(metrics, &_client_response_bytes, client->response_bytes,
+	            "client", client->name, "type", type, NULL);
+	metrics_add(metrics, &_client_writes, client->write_count,
+	            "client", client->name, "type", type, NULL);
+	metrics_add(metrics, &_client_pending_requests, client->pending_request_count,
+	            "client", client->name, "type", type, NULL);
+	metrics_add(metrics, &_client_dropped_pending_requests, client->dropped_pending_requests,
+	            "client", client->name, "type", type, NULL);
+	metrics_add(metrics, &_client_expired_pending_requests, client->expired_pending_requests,
+	            "client", client->name, "type", type, NULL);
+	metrics_add(metrics, &_client_response_backlog, client->response_backlog_count,
+	            "client", client->name, "type", type, NULL);
+	metrics_add(metrics, &_client_response_backlog_bytes, client->response_backlog_length,
+	            "client", client->name, "type", type, NULL);
+	metrics_add(metrics, &_client_dropped_responses, client->dropped_responses,
+	            "client", client->name, "type", type, NULL);
+}
+
 #ifdef BRICKD_WITH_RED_BRICK
 
 void client_send_red_brick_enumerate(Client *client, EnumerationType type) {
@@ -565,7 +1426,7 @@ void client_send_red_brick_enumerate(Client *client, EnumerationType type) {
 #endif
 
 	packet_add_trace(&u.packet);
-	client_dispatch_response(client, NULL, &u.packet, true, false);
+	client_dispatch_response(client, NULL, &u.packet, NULL, true, false);
 }
 
 #endif
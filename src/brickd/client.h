@@ -34,11 +34,69 @@
 #include <daemonlib/io.h>
 #include <daemonlib/node.h>
 #include <daemonlib/packet.h>
-#include <daemonlib/writer.h>
+
+#include "metrics.h"
+#include "packet_buffer.h"
+#include "packet_reader.h"
 
 #define CLIENT_MAX_NAME_LENGTH 128
 #define CLIENT_MAX_PENDING_REQUESTS 32768
 #define CLIENT_PENDING_REQUESTS_DROP_COUNT 512
+#define CLIENT_MAX_RESPONSE_BACKLOG 32768
+#define CLIENT_RESPONSE_BACKLOG_DROP_COUNT 512
+#define CLIENT_MAX_CALLBACK_SUBSCRIPTIONS 256
+#define CLIENT_MAX_COALESCED_LENGTH 16384 // bytes
+#define CLIENT_METRICS_CHUNK_LENGTH 56
+
+// brickd specific functions of the Brick Daemon UID, in addition to the
+// authentication functions
+enum {
+	FUNCTION_SUBSCRIBE_CALLBACK = 3,
+	FUNCTION_UNSUBSCRIBE_CALLBACK = 4,
+	FUNCTION_CLEAR_CALLBACK_SUBSCRIPTIONS = 5,
+	FUNCTION_GET_METRICS_LOW_LEVEL = 6,
+	FUNCTION_DUMP_PACKET_TRACE = 7,
+	FUNCTION_REOPEN_USB_DEVICE = 8
+};
+
+#include <daemonlib/packed_begin.h>
+
+typedef struct {
+	PacketHeader header;
+	uint32_t uid; // always little endian, 0 matches all UIDs
+	uint8_t function_id; // 0 matches all function IDs
+} ATTRIBUTE_PACKED CallbackSubscriptionRequest;
+
+typedef struct {
+	PacketHeader header;
+	uint32_t chunk_offset; // always little endian
+} ATTRIBUTE_PACKED GetMetricsLowLevelRequest;
+
+typedef struct {
+	PacketHeader header;
+	uint32_t length; // always little endian
+	uint32_t chunk_offset; // always little endian
+	char chunk_data[CLIENT_METRICS_CHUNK_LENGTH];
+} ATTRIBUTE_PACKED GetMetricsLowLevelResponse;
+
+typedef struct {
+	PacketHeader header;
+	uint32_t event_count; // always little endian
+} ATTRIBUTE_PACKED DumpPacketTraceResponse;
+
+typedef struct {
+	PacketHeader header;
+	uint32_t uid; // always little endian, 0 selects the USB device by address
+	uint8_t bus_number;
+	uint8_t device_address;
+} ATTRIBUTE_PACKED ReopenUSBDeviceRequest;
+
+#include <daemonlib/packed_end.h>
+
+typedef struct {
+	uint32_t uid; // always little endian
+	uint8_t function_id;
+} CallbackSubscription;
 
 typedef struct _Client Client;
 typedef struct _Zombie Zombie;
@@ -55,10 +113,14 @@ typedef void (*ClientDestroyDoneFunction)(void);
 typedef struct _PendingRequest PendingRequest;
 
 struct _PendingRequest {
-	Node global_node;
+	Node key_node; // bucket in the (uid, function_id, sequence_number) index
+	Node uid_node; // bucket in the uid index
 	Node client_node; // also used as zombie_node
+	Node expiry_node; // slot in the expiry wheel
 	Client *client;
 	Zombie *zombie;
+	uint64_t timestamp; // microseconds, see monotonic_time.c
+	uint32_t trace_id; // see packet_trace.c
 	PacketHeader header;
 };
 
@@ -66,25 +128,43 @@ struct _Client {
 	char name[CLIENT_MAX_NAME_LENGTH]; // for display purpose
 	IO *io;
 	bool disconnected;
-	union {
-		uint8_t request_buffer[512];
-		Packet request;
-	};
-	int request_buffer_used;
-	bool request_header_checked;
+	PacketReader request_reader;
+	uint32_t read_count;
+	uint32_t request_count;
+	uint64_t request_bytes;
 	Node pending_request_sentinel;
 	int pending_request_count;
 	uint32_t dropped_pending_requests;
-	Writer response_writer;
+	uint32_t expired_pending_requests;
+	int unreported_expired_pending_requests;
+	PacketBuffer **response_backlog; // ring buffer of responses that could not be sent yet
+	int response_backlog_allocated; // always a power of two or 0
+	int response_backlog_start;
+	int response_backlog_count;
+	int response_backlog_length; // bytes
+	int response_backlog_offset; // bytes of the first response that are already sent
+	uint32_t dropped_responses;
+	bool coalesce_responses; // responses are gathered and flushed by the network subsystem
+	bool write_event_registered;
+	Node flush_node; // in the network list of clients with unflushed responses
+	uint64_t flush_deadline; // microseconds, see monotonic_time.c
+	uint32_t write_count;
+	uint32_t response_count;
+	uint64_t response_bytes;
+	Array callback_subscriptions; // empty means all callbacks are received
 	ClientAuthenticationState authentication_state;
 	uint32_t authentication_nonce; // server
+	char *metrics; // snapshot for FUNCTION_GET_METRICS_LOW_LEVEL, taken at chunk offset 0
+	int metrics_length;
 	ClientDestroyDoneFunction destroy_done;
+	uint32_t trace_source; // 0 if the packet trace is disabled
+	uint32_t capture_source; // 0 if the traffic capture is disabled
 };
 
 #define CLIENT_SIGNATURE_FORMAT "N: %s, T: %s, H: %d/%d, B: %d, P: %d, A: %s"
 #define client_expand_signature(client) (client)->name, (client)->io->type, \
 	(int)(client)->io->read_handle, (int)(client)->io->write_handle, \
-	(client)->request_buffer_used, (client)->pending_request_count, \
+	packet_reader_get_pending(&(client)->request_reader), (client)->pending_request_count, \
 	client_get_authentication_state_name((client)->authentication_state)
 
 void pending_request_remove_and_free(PendingRequest *pending_request);
@@ -96,8 +176,18 @@ int client_create(Client *client, const char *name, IO *io,
                   ClientDestroyDoneFunction destroy_done);
 void client_destroy(Client *client);
 
+void client_handle_requests(Client *client, uint8_t *data, int length);
+
+bool client_is_subscribed_to_callback(Client *client, Packet *callback);
+
 void client_dispatch_response(Client *client, PendingRequest *pending_request,
-                              Packet *response, bool force, bool ignore_authentication);
+                              Packet *response, PacketBuffer **response_buffer,
+                              bool force, bool ignore_authentication);
+void client_flush_responses(Client *client);
+
+void client_get_write_statistics(uint32_t *write_count, uint32_t *response_count);
+
+void client_collect_metrics(Client *client, Metrics *metrics);
 
 #ifdef BRICKD_WITH_RED_BRICK
 
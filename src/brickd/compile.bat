@@ -35,27 +35,38 @@
 
 %CC% /FIfixes_msvc.h^
  base64.c^
+ byte_order.c^
  client.c^
  config_options.c^
+ event_timing.c^
  event_winapi.c^
  fixes_msvc.c^
  hardware.c^
  hmac.c^
+ latency_histogram.c^
  log_winapi.c^
  mesh.c^
  mesh_packet.c^
  mesh_stack.c^
  main_winapi.c^
+ metrics.c^
+ metrics_server.c^
+ monotonic_time.c^
  network.c^
+ packet_buffer.c^
+ packet_reader.c^
+ packet_trace.c^
  service.c^
  sha1.c^
  stack.c^
+ traffic_capture.c^
  usb.c^
  usb_stack.c^
  usb_transfer.c^
  usb_winapi.c^
  usb_windows.c^
  websocket.c^
+ write_ring.c^
  zombie.c
 
 %RC% /fobrickd.res brickd.rc
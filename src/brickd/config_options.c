@@ -32,6 +32,10 @@
 	#include "bricklet_stack.h"
 #endif
 
+#include "packet_trace.h"
+#include "replay_stack.h"
+#include "virtual_stack.h"
+
 #ifdef BRICKD_WITH_RED_BRICK
 
 static EnumValueName _red_led_trigger_enum_value_names[] = {
@@ -94,9 +98,27 @@ ConfigOption config_options[] = {
 	CONFIG_OPTION_INTEGER_INITIALIZER("listen.websocket_port", 0, UINT16_MAX, 0), // default to enable: 4280
 	CONFIG_OPTION_INTEGER_INITIALIZER("listen.mesh_gateway_port", 0, UINT16_MAX, 4240),
 	CONFIG_OPTION_BOOLEAN_INITIALIZER("listen.dual_stack", false),
+	CONFIG_OPTION_INTEGER_INITIALIZER("network.worker_threads", 0, 16, 0), // 0 handles all clients in the main thread
 	CONFIG_OPTION_STRING_INITIALIZER("authentication.secret", 0, 64, NULL),
 	CONFIG_OPTION_SYMBOL_INITIALIZER("log.level", config_parse_log_level, config_format_log_level, LOG_LEVEL_INFO),
 	CONFIG_OPTION_STRING_INITIALIZER("log.debug_filter", 0, -1, NULL),
+	CONFIG_OPTION_INTEGER_INITIALIZER("pending_requests.max_age", 0, 3600000, 0), // milliseconds, 0 disables expiry
+	CONFIG_OPTION_INTEGER_INITIALIZER("client.receive_buffer_size", 512, 1048576, 8192), // bytes
+	CONFIG_OPTION_BOOLEAN_INITIALIZER("client.response_coalescing", true),
+	CONFIG_OPTION_INTEGER_INITIALIZER("client.response_coalescing_delay", 0, 100000, 0), // microseconds
+	CONFIG_OPTION_INTEGER_INITIALIZER("usb.min_write_transfers", 1, 1024, 10),
+	CONFIG_OPTION_INTEGER_INITIALIZER("usb.max_write_transfers", 1, 1024, 64),
+	CONFIG_OPTION_INTEGER_INITIALIZER("usb.write_transfer_idle_timeout", 100, 3600000, 10000), // milliseconds
+	CONFIG_OPTION_BOOLEAN_INITIALIZER("usb.event_thread", false),
+	CONFIG_OPTION_STRING_INITIALIZER("metrics.listen_address", 1, -1, "127.0.0.1"),
+	CONFIG_OPTION_INTEGER_INITIALIZER("metrics.listen_port", 0, UINT16_MAX, 0), // 0 disables the metrics listener
+	CONFIG_OPTION_INTEGER_INITIALIZER("virtual_stack.device_count", 0, VIRTUAL_STACK_MAX_DEVICE_COUNT, 0), // 0 disables the virtual stack
+	CONFIG_OPTION_INTEGER_INITIALIZER("virtual_stack.service_time", 0, 1000000, 0), // microseconds
+	CONFIG_OPTION_INTEGER_INITIALIZER("virtual_stack.callback_period", 0, 60000000, 0), // microseconds, 0 disables callbacks
+	CONFIG_OPTION_INTEGER_INITIALIZER("packet_trace.size", 0, PACKET_TRACE_MAX_SIZE, 65536), // events, 0 disables the packet trace
+	CONFIG_OPTION_STRING_INITIALIZER("traffic_capture.filename", 0, -1, NULL), // empty disables the traffic capture
+	CONFIG_OPTION_STRING_INITIALIZER("replay_stack.filename", 0, -1, NULL), // empty disables the replay stack
+	CONFIG_OPTION_INTEGER_INITIALIZER("replay_stack.speed", 0, REPLAY_STACK_MAX_SPEED, 100), // percent, 0 replays without delays
 #ifdef BRICKD_WITH_RED_BRICK
 	CONFIG_OPTION_SYMBOL_INITIALIZER("led_trigger.green", config_parse_red_led_trigger, config_format_red_led_trigger, RED_LED_TRIGGER_HEARTBEAT),
 	CONFIG_OPTION_SYMBOL_INITIALIZER("led_trigger.red", config_parse_red_led_trigger, config_format_red_led_trigger, RED_LED_TRIGGER_OFF),
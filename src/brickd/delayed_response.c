@@ -0,0 +1,199 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * delayed_response.c: Queue for responses of in-process stacks that are sent
+ *                     after a delay
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * the virtual and the replay stack answer requests in-process, but emulate
+ * the timing of real hardware by holding the responses back. the responses
+ * are sent in order, each one not before its deadline. a response gets its
+ * deadline from a delay after the current time (e.g. a recorded latency)
+ * that starts no earlier than the deadline of the response before it, plus
+ * an optional service time that is added on top of that (e.g. the time a
+ * single USB connection needs per request).
+ *
+ * all deadlines are taken from the monotonic clock, so a wall clock jump
+ * cannot hold the responses back or release them all at once.
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include <daemonlib/log.h>
+#include <daemonlib/utils.h>
+
+#include "delayed_response.h"
+
+#include "event_timing.h"
+#include "monotonic_time.h"
+#include "network.h"
+
+static LogSource _log_source = LOG_SOURCE_INITIALIZER;
+
+#define MAX_QUEUED_RESPONSES 32768
+
+typedef struct {
+	uint64_t deadline; // in microseconds
+	Packet response;
+} QueuedResponse;
+
+static const MetricFamily _delayed_response_queued_responses = {
+	"brickd_stack_queued_responses", METRIC_TYPE_GAUGE,
+	"Number of responses held back to emulate the timing of real hardware."
+};
+
+static const MetricFamily _delayed_response_dropped_responses = {
+	"brickd_stack_dropped_responses_total", METRIC_TYPE_COUNTER,
+	"Number of responses dropped because the delayed response queue was full."
+};
+
+static void delayed_response_queue_arm_timer(DelayedResponseQueue *queue, uint64_t now) {
+	QueuedResponse *queued_response = queue_peek(&queue->queue);
+
+	if (queued_response == NULL) {
+		return;
+	}
+
+	// a delay of 0 would disarm the timer
+	if (timer_configure(&queue->timer,
+	                    queued_response->deadline > now ? queued_response->deadline - now : 1, 0) < 0) {
+		log_error("Could not start service timer of %s stack: %s (%d)",
+		          queue->stack->name, get_errno_name(errno), errno);
+	}
+}
+
+static void delayed_response_queue_handle_timer(void *opaque) {
+	DelayedResponseQueue *queue = opaque;
+	uint64_t now = monotonic_microtime();
+	QueuedResponse *queued_response;
+
+	while ((queued_response = queue_peek(&queue->queue)) != NULL &&
+	       queued_response->deadline <= now) {
+		delayed_response_send(queue->stack, &queued_response->response);
+
+		queue_pop(&queue->queue, NULL);
+	}
+
+	delayed_response_queue_arm_timer(queue, now);
+}
+
+int delayed_response_queue_create(DelayedResponseQueue *queue, Stack *stack,
+                                  const char *timer_name) {
+	queue->stack = stack;
+	queue->busy_until = 0;
+	queue->dropped_responses = 0;
+
+	if (queue_create(&queue->queue, sizeof(QueuedResponse)) < 0) {
+		log_error("Could not create response queue for %s stack: %s (%d)",
+		          stack->name, get_errno_name(errno), errno);
+
+		return -1;
+	}
+
+	if (event_timing_create_timer(&queue->timer, timer_name,
+	                              delayed_response_queue_handle_timer, queue) < 0) {
+		log_error("Could not create service timer for %s stack: %s (%d)",
+		          stack->name, get_errno_name(errno), errno);
+
+		queue_destroy(&queue->queue, NULL);
+
+		return -1;
+	}
+
+	return 0;
+}
+
+void delayed_response_queue_destroy(DelayedResponseQueue *queue) {
+	event_timing_destroy_timer(&queue->timer);
+
+	queue_destroy(&queue->queue, NULL);
+}
+
+// sends the response after the given delay plus service time, but not before
+// the responses pushed before it. if nothing is queued and the deadline has
+// already passed then the response is sent immediately
+void delayed_response_queue_push(DelayedResponseQueue *queue, Packet *response,
+                                 uint64_t delay, uint64_t service_time) {
+	uint64_t now = monotonic_microtime();
+	uint64_t deadline = now + delay;
+	bool idle = queue->queue.count == 0;
+	QueuedResponse *queued_response;
+
+	if (deadline < queue->busy_until) {
+		deadline = queue->busy_until;
+	}
+
+	deadline += service_time;
+
+	if (idle && deadline <= now) {
+		queue->busy_until = deadline;
+
+		delayed_response_send(queue->stack, response);
+
+		return;
+	}
+
+	if (queue->queue.count >= MAX_QUEUED_RESPONSES) {
+		++queue->dropped_responses;
+
+		log_packet_debug("Response queue of %s stack is full, dropping response",
+		                 queue->stack->name);
+
+		return;
+	}
+
+	queued_response = queue_push(&queue->queue);
+
+	if (queued_response == NULL) {
+		log_error("Could not push response to queue of %s stack: %s (%d)",
+		          queue->stack->name, get_errno_name(errno), errno);
+
+		return;
+	}
+
+	queue->busy_until = deadline;
+
+	queued_response->deadline = deadline;
+
+	memcpy(&queued_response->response, response, response->header.length);
+
+	if (idle) {
+		delayed_response_queue_arm_timer(queue, now);
+	}
+}
+
+void delayed_response_queue_collect_metrics(DelayedResponseQueue *queue, Metrics *metrics) {
+	metrics_add(metrics, &_delayed_response_queued_responses,
+	            queue->queue.count, "stack", queue->stack->name, NULL);
+	metrics_add(metrics, &_delayed_response_dropped_responses,
+	            queue->dropped_responses, "stack", queue->stack->name, NULL);
+}
+
+// sends a response of an in-process stack without any delay
+void delayed_response_send(Stack *stack, Packet *response) {
+#ifdef DAEMONLIB_WITH_PACKET_TRACE
+	response->trace_id = packet_get_next_response_trace_id();
+#endif
+
+	packet_add_trace(response);
+
+	stack_count_response(stack, response);
+	network_dispatch_response(response);
+}
@@ -0,0 +1,53 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * delayed_response.h: Queue for responses of in-process stacks that are sent
+ *                     after a delay
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef BRICKD_DELAYED_RESPONSE_H
+#define BRICKD_DELAYED_RESPONSE_H
+
+#include <stdint.h>
+
+#include <daemonlib/packet.h>
+#include <daemonlib/queue.h>
+#include <daemonlib/timer.h>
+
+#include "stack.h"
+
+typedef struct {
+	Stack *stack;
+	Queue queue;
+	Timer timer;
+	uint64_t busy_until; // deadline of the last queued response
+	uint64_t dropped_responses;
+} DelayedResponseQueue;
+
+int delayed_response_queue_create(DelayedResponseQueue *queue, Stack *stack,
+                                  const char *timer_name);
+void delayed_response_queue_destroy(DelayedResponseQueue *queue);
+
+void delayed_response_queue_push(DelayedResponseQueue *queue, Packet *response,
+                                 uint64_t delay, uint64_t service_time);
+
+void delayed_response_queue_collect_metrics(DelayedResponseQueue *queue, Metrics *metrics);
+
+void delayed_response_send(Stack *stack, Packet *response);
+
+#endif // BRICKD_DELAYED_RESPONSE_H
@@ -0,0 +1,456 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * event_timing.c: Accounting of the time spent in event handlers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * the event sources and timers of brickd are registered through this module
+ * instead of directly with the event loop. it registers a trampoline per
+ * event that measures the time the actual handler takes and accounts it to
+ * the name of the event source, or to the name given for a timer. all event
+ * sources and timers with the same name share one record, e.g. all clients
+ * are accounted as "client".
+ *
+ * a handler can remove its own event source or destroy its own timer. the
+ * trampoline copies everything it needs before calling the handler, because
+ * the handler record is freed in that case.
+ *
+ * the handler records are kept in a hash table keyed by the I/O handle of the
+ * event source, or by the timer, so modifying the events of an event source
+ * does not have to walk all handler records. this is done for every client
+ * that starts or stops waiting for its socket to become writable.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <daemonlib/array.h>
+#include <daemonlib/log.h>
+#include <daemonlib/node.h>
+#include <daemonlib/utils.h>
+
+#include "event_timing.h"
+
+#include "latency_histogram.h"
+
+static LogSource _log_source = LOG_SOURCE_INITIALIZER;
+
+#define MAX_NAME_LENGTH 64
+#define EVENT_COUNT 4 // read, prio, write and error
+#define HANDLER_BUCKET_COUNT 1024 // must be a power of two
+
+typedef struct {
+	char name[MAX_NAME_LENGTH];
+	LatencyHistogram duration; // also tracks the slowest invocation
+} EventTimingRecord;
+
+typedef struct {
+	Node bucket_node;
+	IOHandle handle;
+	EventSourceType type;
+	Timer *timer; // NULL for event sources
+	int record_index;
+	EventFunction functions[EVENT_COUNT];
+	void *opaques[EVENT_COUNT];
+} EventTimingHandler;
+
+static Array _records;
+static Node _handler_buckets[HANDLER_BUCKET_COUNT];
+
+static const uint32_t _events[EVENT_COUNT] = {
+	EVENT_READ, EVENT_PRIO, EVENT_WRITE, EVENT_ERROR
+};
+
+static void event_timing_call(EventTimingHandler *handler, int event) {
+	int record_index = handler->record_index;
+	EventFunction function = handler->functions[event];
+	void *opaque = handler->opaques[event];
+	uint64_t start;
+	EventTimingRecord *record;
+
+	if (function == NULL) {
+		return;
+	}
+
+	start = microtime();
+
+	function(opaque); // might free the handler
+
+	record = array_get(&_records, record_index);
+
+	latency_histogram_record(&record->duration, microtime() - start);
+}
+
+static void event_timing_handle_read(void *opaque) {
+	event_timing_call(opaque, 0);
+}
+
+static void event_timing_handle_prio(void *opaque) {
+	event_timing_call(opaque, 1);
+}
+
+static void event_timing_handle_write(void *opaque) {
+	event_timing_call(opaque, 2);
+}
+
+static void event_timing_handle_error(void *opaque) {
+	event_timing_call(opaque, 3);
+}
+
+static const EventFunction _trampolines[EVENT_COUNT] = {
+	event_timing_handle_read, event_timing_handle_prio,
+	event_timing_handle_write, event_timing_handle_error
+};
+
+static int event_timing_get_record_index(const char *name) {
+	int i;
+	EventTimingRecord *record;
+
+	for (i = 0; i < _records.count; ++i) {
+		record = array_get(&_records, i);
+
+		if (strcmp(record->name, name) == 0) {
+			return i;
+		}
+	}
+
+	record = array_append(&_records);
+
+	if (record == NULL) {
+		log_error("Could not append to event timing record array: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		return -1;
+	}
+
+	string_copy(record->name, sizeof(record->name), name, -1);
+	latency_histogram_reset(&record->duration);
+
+	return _records.count - 1;
+}
+
+static Node *event_timing_get_bucket(uintptr_t key) {
+	return &_handler_buckets[(((uint32_t)key * 0x9E3779B1) >> 16) & (HANDLER_BUCKET_COUNT - 1)];
+}
+
+// the trampolines get pointers to the handlers, so they are allocated one by
+// one and stay in place until they are freed
+static EventTimingHandler *event_timing_create_handler(const char *name) {
+	int record_index = event_timing_get_record_index(name);
+	EventTimingHandler *handler;
+
+	if (record_index < 0) {
+		return NULL;
+	}
+
+	handler = calloc(1, sizeof(EventTimingHandler));
+
+	if (handler == NULL) {
+		log_error("Could not allocate event timing handler: %s (%d)",
+		          get_errno_name(ENOMEM), ENOMEM);
+
+		return NULL;
+	}
+
+	handler->record_index = record_index;
+
+	return handler;
+}
+
+static void event_timing_free_handler(EventTimingHandler *handler) {
+	node_remove(&handler->bucket_node);
+
+	free(handler);
+}
+
+static EventTimingHandler *event_timing_find_source(IOHandle handle, EventSourceType type) {
+	Node *bucket = event_timing_get_bucket((uintptr_t)handle);
+	Node *node;
+	EventTimingHandler *handler;
+
+	for (node = bucket->next; node != bucket; node = node->next) {
+		handler = containerof(node, EventTimingHandler, bucket_node);
+
+		if (handler->timer == NULL && handler->handle == handle && handler->type == type) {
+			return handler;
+		}
+	}
+
+	return NULL;
+}
+
+static EventTimingHandler *event_timing_find_timer(Timer *timer) {
+	Node *bucket = event_timing_get_bucket((uintptr_t)timer);
+	Node *node;
+	EventTimingHandler *handler;
+
+	for (node = bucket->next; node != bucket; node = node->next) {
+		handler = containerof(node, EventTimingHandler, bucket_node);
+
+		if (handler->timer == timer) {
+			return handler;
+		}
+	}
+
+	return NULL;
+}
+
+int event_timing_init(void) {
+	int i;
+
+	log_debug("Initializing event timing subsystem");
+
+	if (array_create(&_records, 32, sizeof(EventTimingRecord), true) < 0) {
+		log_error("Could not create event timing record array: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		return -1;
+	}
+
+	for (i = 0; i < HANDLER_BUCKET_COUNT; ++i) {
+		node_reset(&_handler_buckets[i]);
+	}
+
+	return 0;
+}
+
+void event_timing_exit(void) {
+	int i;
+
+	log_debug("Shutting down event timing subsystem");
+
+	event_timing_log_summary();
+
+	// normally all event sources and timers are gone by now
+	for (i = 0; i < HANDLER_BUCKET_COUNT; ++i) {
+		while (_handler_buckets[i].next != &_handler_buckets[i]) {
+			event_timing_free_handler(containerof(_handler_buckets[i].next,
+			                                      EventTimingHandler, bucket_node));
+		}
+	}
+
+	array_destroy(&_records, NULL);
+}
+
+int event_timing_add_source(IOHandle handle, EventSourceType type, const char *name,
+                            uint32_t events, EventFunction function, void *opaque) {
+	EventTimingHandler *handler = event_timing_create_handler(name);
+	int i;
+	bool added = false;
+
+	if (handler == NULL) {
+		return -1;
+	}
+
+	handler->handle = handle;
+	handler->type = type;
+
+	node_insert_before(event_timing_get_bucket((uintptr_t)handle), &handler->bucket_node);
+
+	// a trampoline only gets the handler as opaque, so each event needs its
+	// own trampoline to know which function to call
+	for (i = 0; i < EVENT_COUNT; ++i) {
+		if ((events & _events[i]) == 0) {
+			continue;
+		}
+
+		handler->functions[i] = function;
+		handler->opaques[i] = opaque;
+
+		if (!added) {
+			if (event_add_source(handle, type, name, _events[i], _trampolines[i], handler) < 0) {
+				event_timing_free_handler(handler);
+
+				return -1;
+			}
+
+			added = true;
+		} else if (event_modify_source(handle, type, 0, _events[i], _trampolines[i], handler) < 0) {
+			event_timing_remove_source(handle, type);
+
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+int event_timing_modify_source(IOHandle handle, EventSourceType type, uint32_t events_to_remove,
+                               uint32_t events_to_add, EventFunction function, void *opaque) {
+	EventTimingHandler *handler = event_timing_find_source(handle, type);
+	int i;
+
+	if (handler == NULL) {
+		// not added through event_timing_add_source, just pass it on
+		return event_modify_source(handle, type, events_to_remove, events_to_add,
+		                           function, opaque);
+	}
+
+	for (i = 0; i < EVENT_COUNT; ++i) {
+		if ((events_to_remove & _events[i]) != 0) {
+			handler->functions[i] = NULL;
+			handler->opaques[i] = NULL;
+		}
+	}
+
+	if (events_to_add == 0) {
+		return event_modify_source(handle, type, events_to_remove, 0, function, opaque);
+	}
+
+	for (i = 0; i < EVENT_COUNT; ++i) {
+		if ((events_to_add & _events[i]) == 0) {
+			continue;
+		}
+
+		handler->functions[i] = function;
+		handler->opaques[i] = opaque;
+
+		if (event_modify_source(handle, type, events_to_remove, _events[i],
+		                        _trampolines[i], handler) < 0) {
+			return -1;
+		}
+
+		events_to_remove = 0;
+	}
+
+	return 0;
+}
+
+void event_timing_remove_source(IOHandle handle, EventSourceType type) {
+	EventTimingHandler *handler = event_timing_find_source(handle, type);
+
+	event_remove_source(handle, type);
+
+	// the event loop does not call handlers of a removed event source anymore,
+	// even if it was removed during the current iteration
+	if (handler != NULL) {
+		event_timing_free_handler(handler);
+	}
+}
+
+int event_timing_create_timer(Timer *timer, const char *name, TimerFunction function, void *opaque) {
+	EventTimingHandler *handler = event_timing_create_handler(name);
+
+	if (handler == NULL) {
+		return -1;
+	}
+
+	handler->timer = timer;
+	handler->functions[0] = function;
+	handler->opaques[0] = opaque;
+
+	node_insert_before(event_timing_get_bucket((uintptr_t)timer), &handler->bucket_node);
+
+	if (timer_create_(timer, event_timing_handle_read, handler) < 0) {
+		event_timing_free_handler(handler);
+
+		return -1;
+	}
+
+	return 0;
+}
+
+void event_timing_destroy_timer(Timer *timer) {
+	EventTimingHandler *handler = event_timing_find_timer(timer);
+
+	timer_destroy(timer);
+
+	if (handler != NULL) {
+		event_timing_free_handler(handler);
+	}
+}
+
+static int event_timing_compare_records(const void *a, const void *b) {
+	const EventTimingRecord *record_a = *(const EventTimingRecord **)a;
+	const EventTimingRecord *record_b = *(const EventTimingRecord **)b;
+
+	if (record_a->duration.sum != record_b->duration.sum) {
+		return record_a->duration.sum < record_b->duration.sum ? 1 : -1;
+	}
+
+	return strcmp(record_a->name, record_b->name);
+}
+
+// logs the records sorted by their total handler time, the most expensive
+// event source first
+void event_timing_log_summary(void) {
+	EventTimingRecord **records;
+	EventTimingRecord *record;
+	int i;
+
+	if (_records.count == 0) {
+		return;
+	}
+
+	records = calloc(_records.count, sizeof(EventTimingRecord *));
+
+	if (records == NULL) {
+		log_error("Could not allocate event timing summary: %s (%d)",
+		          get_errno_name(ENOMEM), ENOMEM);
+
+		return;
+	}
+
+	for (i = 0; i < _records.count; ++i) {
+		records[i] = array_get(&_records, i);
+	}
+
+	qsort(records, _records.count, sizeof(EventTimingRecord *), event_timing_compare_records);
+
+	log_info("Event handler times (calls, total, average, 99th percentile, maximum):");
+
+	for (i = 0; i < _records.count; ++i) {
+		record = records[i];
+
+		log_info("  %s: %llu, %llu ms, %llu us, %u us, %u us", record->name,
+		         (unsigned long long)record->duration.count,
+		         (unsigned long long)(record->duration.sum / 1000),
+		         (unsigned long long)(record->duration.count > 0 ? record->duration.sum / record->duration.count : 0),
+		         latency_histogram_get_percentile(&record->duration, 0.99),
+		         record->duration.max);
+	}
+
+	free(records);
+}
+
+static const MetricFamily _event_handler_duration = {
+	"brickd_event_handler_duration_microseconds", METRIC_TYPE_SUMMARY,
+	"Time spent in the handlers of an event source or timer per invocation."
+};
+
+static const MetricFamily _event_handler_duration_max = {
+	"brickd_event_handler_duration_max_microseconds", METRIC_TYPE_GAUGE,
+	"Slowest invocation of the handlers of an event source or timer."
+};
+
+void event_timing_collect_metrics(Metrics *metrics) {
+	int i;
+	EventTimingRecord *record;
+
+	for (i = 0; i < _records.count; ++i) {
+		record = array_get(&_records, i);
+
+		latency_histogram_add_metrics(&record->duration, metrics, &_event_handler_duration,
+		                              "source", record->name, NULL);
+		metrics_add(metrics, &_event_handler_duration_max, record->duration.max,
+		            "source", record->name, NULL);
+	}
+}
@@ -0,0 +1,48 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * event_timing.h: Accounting of the time spent in event handlers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef BRICKD_EVENT_TIMING_H
+#define BRICKD_EVENT_TIMING_H
+
+#include <stdint.h>
+
+#include <daemonlib/event.h>
+#include <daemonlib/timer.h>
+
+#include "metrics.h"
+
+int event_timing_init(void);
+void event_timing_exit(void);
+
+int event_timing_add_source(IOHandle handle, EventSourceType type, const char *name,
+                            uint32_t events, EventFunction function, void *opaque);
+int event_timing_modify_source(IOHandle handle, EventSourceType type, uint32_t events_to_remove,
+                               uint32_t events_to_add, EventFunction function, void *opaque);
+void event_timing_remove_source(IOHandle handle, EventSourceType type);
+
+int event_timing_create_timer(Timer *timer, const char *name, TimerFunction function, void *opaque);
+void event_timing_destroy_timer(Timer *timer);
+
+void event_timing_log_summary(void);
+
+void event_timing_collect_metrics(Metrics *metrics);
+
+#endif // BRICKD_EVENT_TIMING_H
@@ -21,8 +21,10 @@
 
 #include <errno.h>
 #include <stdbool.h>
+#include <stdlib.h>
 
 #include <daemonlib/array.h>
+#include <daemonlib/base58.h>
 #include <daemonlib/log.h>
 #include <daemonlib/packet.h>
 #include <daemonlib/utils.h>
@@ -33,7 +35,71 @@
 
 static LogSource _log_source = LOG_SOURCE_INITIALIZER;
 
+#define INITIAL_ROUTE_CAPACITY 256 // must be a power of two
+
+// maps each known UID to the one stack that owns it. the table uses open
+// addressing with linear probing. UID 0 is the broadcast UID and can never
+// be a recipient, therefore it marks free slots
+typedef struct {
+	uint32_t uid; // always little endian
+	Stack *stack;
+	LatencyHistogram *response_latency; // allocated on first response, can be NULL
+} Route;
+
 static Array _stacks;
+static Route *_routes = NULL;
+static int _route_capacity = 0;
+static int _route_count = 0;
+
+static Route *hardware_find_route_slot(Route *routes, int capacity, uint32_t uid) {
+	int i = uid_get_hash(uid) & (capacity - 1);
+
+	while (routes[i].uid != 0 && routes[i].uid != uid) {
+		i = (i + 1) & (capacity - 1);
+	}
+
+	return &routes[i];
+}
+
+// rebuilds the routing table with the given capacity, leaving out all routes
+// to the given stack, if any
+static int hardware_rebuild_routes(int capacity, Stack *excluded_stack) {
+	Route *routes = calloc(capacity, sizeof(Route));
+	int count = 0;
+	int i;
+	Route *route;
+
+	if (routes == NULL) {
+		errno = ENOMEM;
+
+		return -1;
+	}
+
+	for (i = 0; i < _route_capacity; ++i) {
+		if (_routes[i].uid == 0) {
+			continue;
+		}
+
+		if (_routes[i].stack == excluded_stack) {
+			free(_routes[i].response_latency);
+
+			continue;
+		}
+
+		route = hardware_find_route_slot(routes, capacity, _routes[i].uid);
+
+		*route = _routes[i];
+		++count;
+	}
+
+	free(_routes);
+
+	_routes = routes;
+	_route_capacity = capacity;
+	_route_count = count;
+
+	return 0;
+}
 
 int hardware_init(void) {
 	log_debug("Initializing hardware subsystem");
@@ -46,16 +112,38 @@ int hardware_init(void) {
 		return -1;
 	}
 
+	// create routing table
+	if (hardware_rebuild_routes(INITIAL_ROUTE_CAPACITY, NULL) < 0) {
+		log_error("Could not create routing table: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		array_destroy(&_stacks, NULL);
+
+		return -1;
+	}
+
 	return 0;
 }
 
 void hardware_exit(void) {
+	int i;
+
 	log_debug("Shutting down hardware subsystem");
 
 	if (_stacks.count > 0) {
 		log_warn("Still %d stack(s) connected", _stacks.count);
 	}
 
+	for (i = 0; i < _route_capacity; ++i) {
+		free(_routes[i].response_latency);
+	}
+
+	free(_routes);
+
+	_routes = NULL;
+	_route_capacity = 0;
+	_route_count = 0;
+
 	array_destroy(&_stacks, NULL);
 }
 
@@ -83,6 +171,7 @@ int hardware_remove_stack(Stack *stack) {
 
 		if (candidate == stack) {
 			array_remove(&_stacks, i, NULL);
+			hardware_remove_routes(stack);
 
 			return 0;
 		}
@@ -93,6 +182,83 @@ int hardware_remove_stack(Stack *stack) {
 	return -1;
 }
 
+// makes the given stack the owner of the given UID. if the UID was owned by
+// another stack before, then the UID has moved (e.g. a Brick got unplugged
+// from one USB port and plugged into another one) and is removed from the
+// recipients of the other stack
+int hardware_add_route(Stack *stack, uint32_t uid /* always little endian */) {
+	Route *route;
+	Stack *previous_stack;
+	char base58[BASE58_MAX_LENGTH];
+
+	if (_routes == NULL || uid == 0) {
+		return 0;
+	}
+
+	route = hardware_find_route_slot(_routes, _route_capacity, uid);
+
+	if (route->uid == uid) {
+		if (route->stack == stack) {
+			return 0;
+		}
+
+		previous_stack = route->stack;
+		route->stack = stack;
+
+		log_debug("Moving %s from %s to %s",
+		          base58_encode(base58, uint32_from_le(uid)),
+		          previous_stack->name, stack->name);
+
+		stack_remove_recipient(previous_stack, uid);
+
+		return 0;
+	}
+
+	// keep the load factor at or below 1/2 to keep the probe sequences short
+	if ((_route_count + 1) * 2 > _route_capacity) {
+		if (hardware_rebuild_routes(_route_capacity * 2, NULL) < 0) {
+			log_error("Could not resize routing table to %d entries: %s (%d)",
+			          _route_capacity * 2, get_errno_name(errno), errno);
+
+			return -1;
+		}
+
+		route = hardware_find_route_slot(_routes, _route_capacity, uid);
+	}
+
+	route->uid = uid;
+	route->stack = stack;
+	route->response_latency = NULL;
+
+	++_route_count;
+
+	return 0;
+}
+
+void hardware_remove_routes(Stack *stack) {
+	if (_routes == NULL) {
+		return;
+	}
+
+	// stacks come and go rarely, just rebuild the routing table without them
+	if (hardware_rebuild_routes(_route_capacity, stack) < 0) {
+		log_error("Could not remove routes to %s: %s (%d)",
+		          stack->name, get_errno_name(errno), errno);
+	}
+}
+
+Stack *hardware_get_route(uint32_t uid /* always little endian */) {
+	Route *route;
+
+	if (_routes == NULL) {
+		return NULL;
+	}
+
+	route = hardware_find_route_slot(_routes, _route_capacity, uid);
+
+	return route->uid == uid ? route->stack : NULL;
+}
+
 bool hardware_dispatch_request(Packet *request) {
 	char packet_signature[PACKET_MAX_SIGNATURE_LENGTH];
 	int i;
@@ -124,20 +290,14 @@ bool hardware_dispatch_request(Packet *request) {
 			}
 		}
 	} else {
-		log_packet_debug("Dispatching request (%s) to %d stack(s)",
-		                 packet_get_request_signature(packet_signature, request),
-		                 _stacks.count);
-
-		packet_add_trace(request);
+		stack = hardware_get_route(request->header.uid);
 
-		// dispatch to all stacks, not only the first one that might claim to
-		// know the UID
+		if (stack != NULL) {
+			log_packet_debug("Dispatching request (%s) to %s",
+			                 packet_get_request_signature(packet_signature, request),
+			                 stack->name);
 
-		// FIXME: instead of sending to all stacks, dynamically update the routing
-		//        table and remove UIDs from a stack if the show up on another
-		//        stack. this ensures that the UID is only mapped to one stack
-		for (i = 0; i < _stacks.count; ++i) {
-			stack = *(Stack **)array_get(&_stacks, i);
+			packet_add_trace(request);
 
 			if (stack_dispatch_request(stack, request, false) > 0) {
 				dispatched = true;
@@ -163,6 +323,36 @@ bool hardware_dispatch_request(Packet *request) {
 	return dispatched;
 }
 
+// records the latency of a response in the histograms of the stack and the
+// device the response is from
+void hardware_record_response_latency(uint32_t uid /* always little endian */, uint64_t latency) {
+	Route *route;
+
+	if (_routes == NULL) {
+		return;
+	}
+
+	route = hardware_find_route_slot(_routes, _route_capacity, uid);
+
+	if (route->uid != uid) {
+		return;
+	}
+
+	latency_histogram_record(&route->stack->response_latency, latency);
+
+	if (route->response_latency == NULL) {
+		route->response_latency = malloc(sizeof(LatencyHistogram));
+
+		if (route->response_latency == NULL) {
+			return; // the stack histogram is still recorded, just skip the device
+		}
+
+		latency_histogram_reset(route->response_latency);
+	}
+
+	latency_histogram_record(route->response_latency, latency);
+}
+
 void hardware_announce_disconnect(void) {
 	int i;
 	Stack *stack;
@@ -173,3 +363,43 @@ void hardware_announce_disconnect(void) {
 		stack_announce_disconnect(stack);
 	}
 }
+
+static const MetricFamily _hardware_stacks = {
+	"brickd_stacks", METRIC_TYPE_GAUGE,
+	"Number of connected stacks."
+};
+
+static const MetricFamily _hardware_routes = {
+	"brickd_routes", METRIC_TYPE_GAUGE,
+	"Number of UIDs in the routing table."
+};
+
+static const MetricFamily _hardware_response_latency = {
+	"brickd_device_response_latency_microseconds", METRIC_TYPE_SUMMARY,
+	"Time from receiving a request from a client to dispatching the response of the device."
+};
+
+void hardware_collect_metrics(Metrics *metrics) {
+	int i;
+	Route *route;
+	char base58[BASE58_MAX_LENGTH];
+
+	metrics_add(metrics, &_hardware_stacks, _stacks.count, NULL);
+	metrics_add(metrics, &_hardware_routes, _route_count, NULL);
+
+	for (i = 0; i < _stacks.count; ++i) {
+		stack_collect_metrics(*(Stack **)array_get(&_stacks, i), metrics);
+	}
+
+	for (i = 0; i < _route_capacity; ++i) {
+		route = &_routes[i];
+
+		if (route->uid == 0 || route->response_latency == NULL) {
+			continue;
+		}
+
+		latency_histogram_add_metrics(route->response_latency, metrics, &_hardware_response_latency,
+		                              "stack", route->stack->name,
+		                              "uid", base58_encode(base58, uint32_from_le(route->uid)), NULL);
+	}
+}
@@ -24,6 +24,7 @@
 
 #include <daemonlib/packet.h>
 
+#include "metrics.h"
 #include "stack.h"
 
 int hardware_init(void);
@@ -32,8 +33,16 @@ void hardware_exit(void);
 int hardware_add_stack(Stack *stack);
 int hardware_remove_stack(Stack *stack);
 
+int hardware_add_route(Stack *stack, uint32_t uid /* always little endian */);
+void hardware_remove_routes(Stack *stack);
+Stack *hardware_get_route(uint32_t uid /* always little endian */);
+
 bool hardware_dispatch_request(Packet *request);
 
+void hardware_record_response_latency(uint32_t uid /* always little endian */, uint64_t latency /* microseconds */);
+
 void hardware_announce_disconnect(void);
 
+void hardware_collect_metrics(Metrics *metrics);
+
 #endif // BRICKD_HARDWARE_H
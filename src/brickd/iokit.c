@@ -38,6 +38,7 @@
 
 #include "iokit.h"
 
+#include "event_timing.h"
 #include "usb.h"
 
 static LogSource _log_source = LOG_SOURCE_INITIALIZER;
@@ -199,8 +200,8 @@ int iokit_init(void) {
 
 	phase = 1;
 
-	if (event_add_source(_notification_pipe.base.read_handle, EVENT_SOURCE_TYPE_GENERIC,
-	                     "iokit", EVENT_READ, iokit_forward_notifications, NULL) < 0) {
+	if (event_timing_add_source(_notification_pipe.base.read_handle, EVENT_SOURCE_TYPE_GENERIC,
+	                            "iokit", EVENT_READ, iokit_forward_notifications, NULL) < 0) {
 		goto cleanup;
 	}
 
@@ -233,7 +234,7 @@ cleanup:
 		// fall through
 
 	case 2:
-		event_remove_source(_notification_pipe.base.read_handle, EVENT_SOURCE_TYPE_GENERIC);
+		event_timing_remove_source(_notification_pipe.base.read_handle, EVENT_SOURCE_TYPE_GENERIC);
 		// fall through
 
 	case 1:
@@ -261,7 +262,7 @@ void iokit_exit(void) {
 
 	thread_destroy(&_poll_thread);
 
-	event_remove_source(_notification_pipe.base.read_handle, EVENT_SOURCE_TYPE_GENERIC);
+	event_timing_remove_source(_notification_pipe.base.read_handle, EVENT_SOURCE_TYPE_GENERIC);
 
 	pipe_destroy(&_notification_pipe);
 }
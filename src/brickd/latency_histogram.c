@@ -0,0 +1,159 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * latency_histogram.c: Log-linear histograms for latency percentiles
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * a latency histogram stores microsecond values in the same way as an HDR
+ * histogram does: the range of each power of two is divided into 16 linear
+ * sub-buckets. this bounds the relative error of a reported percentile to
+ * 1/16 over the whole range from 1 microsecond to 2^32 microseconds, with a
+ * fixed number of buckets. recording a value is a handful of shifts and an
+ * increment, so it can be done for every response.
+ */
+
+#include <string.h>
+
+#include "latency_histogram.h"
+
+#define SUB_BUCKET_BITS LATENCY_HISTOGRAM_SUB_BUCKET_BITS
+#define SUB_BUCKET_COUNT LATENCY_HISTOGRAM_SUB_BUCKET_COUNT
+
+static int latency_histogram_get_highest_bit(uint32_t value) {
+	int bit = 0;
+
+	if (value >= 1u << 16) { value >>= 16; bit += 16; }
+	if (value >= 1u << 8)  { value >>= 8;  bit += 8; }
+	if (value >= 1u << 4)  { value >>= 4;  bit += 4; }
+	if (value >= 1u << 2)  { value >>= 2;  bit += 2; }
+	if (value >= 1u << 1)  {               bit += 1; }
+
+	return bit;
+}
+
+static int latency_histogram_get_index(uint32_t value) {
+	int bit;
+
+	if (value < SUB_BUCKET_COUNT) {
+		return (int)value;
+	}
+
+	bit = latency_histogram_get_highest_bit(value);
+
+	return (bit - SUB_BUCKET_BITS + 1) * SUB_BUCKET_COUNT +
+	       (int)((value >> (bit - SUB_BUCKET_BITS)) & (SUB_BUCKET_COUNT - 1));
+}
+
+// returns the highest value that is recorded in the given bucket
+static uint32_t latency_histogram_get_value(int index) {
+	int shift;
+	uint64_t lower;
+
+	if (index < SUB_BUCKET_COUNT) {
+		return (uint32_t)index;
+	}
+
+	shift = index / SUB_BUCKET_COUNT - 1;
+	lower = (uint64_t)(SUB_BUCKET_COUNT + index % SUB_BUCKET_COUNT) << shift;
+
+	return (uint32_t)(lower + ((uint64_t)1 << shift) - 1);
+}
+
+void latency_histogram_reset(LatencyHistogram *histogram) {
+	memset(histogram, 0, sizeof(*histogram));
+}
+
+void latency_histogram_record(LatencyHistogram *histogram, uint64_t latency) {
+	uint32_t value = latency > UINT32_MAX ? UINT32_MAX : (uint32_t)latency;
+
+	++histogram->counts[latency_histogram_get_index(value)];
+	++histogram->count;
+	histogram->sum += value;
+
+	if (value > histogram->max) {
+		histogram->max = value;
+	}
+}
+
+// returns the value below or at which the given fraction of all recorded
+// values lies, e.g. 0.99 for the 99th percentile. the value is reported as
+// the upper end of its bucket, but never above the recorded maximum
+uint32_t latency_histogram_get_percentile(LatencyHistogram *histogram, double quantile) {
+	uint64_t rank;
+	uint64_t seen = 0;
+	int i;
+	uint32_t value;
+
+	if (histogram->count == 0) {
+		return 0;
+	}
+
+	// nearest rank, rounded up
+	rank = (uint64_t)(quantile * (double)histogram->count);
+
+	if ((double)rank < quantile * (double)histogram->count) {
+		++rank;
+	}
+
+	if (rank < 1) {
+		rank = 1;
+	} else if (rank > histogram->count) {
+		rank = histogram->count;
+	}
+
+	for (i = 0; i < LATENCY_HISTOGRAM_BUCKET_COUNT; ++i) {
+		seen += histogram->counts[i];
+
+		if (seen >= rank) {
+			value = latency_histogram_get_value(i);
+
+			return value < histogram->max ? value : histogram->max;
+		}
+	}
+
+	return histogram->max;
+}
+
+static void latency_histogram_add_metric(Metrics *metrics, const MetricFamily *family,
+                                         const char *suffix, uint64_t value,
+                                         const char *quantile, va_list labels) {
+	va_list copy;
+
+	va_copy(copy, labels);
+	metrics_add_v(metrics, family, suffix, value, quantile, copy);
+	va_end(copy);
+}
+
+// adds the histogram as summary with the 50th, 90th, 99th and 99.9th
+// percentile, the sum and the count of all recorded values
+void latency_histogram_add_metrics(LatencyHistogram *histogram, Metrics *metrics,
+                                   const MetricFamily *family, ...) {
+	va_list labels;
+
+	va_start(labels, family);
+
+	latency_histogram_add_metric(metrics, family, NULL, latency_histogram_get_percentile(histogram, 0.5), "0.5", labels);
+	latency_histogram_add_metric(metrics, family, NULL, latency_histogram_get_percentile(histogram, 0.9), "0.9", labels);
+	latency_histogram_add_metric(metrics, family, NULL, latency_histogram_get_percentile(histogram, 0.99), "0.99", labels);
+	latency_histogram_add_metric(metrics, family, NULL, latency_histogram_get_percentile(histogram, 0.999), "0.999", labels);
+	latency_histogram_add_metric(metrics, family, "_sum", histogram->sum, NULL, labels);
+	latency_histogram_add_metric(metrics, family, "_count", histogram->count, NULL, labels);
+
+	va_end(labels);
+}
@@ -0,0 +1,52 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * latency_histogram.h: Log-linear histograms for latency percentiles
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef BRICKD_LATENCY_HISTOGRAM_H
+#define BRICKD_LATENCY_HISTOGRAM_H
+
+#include <stdint.h>
+
+#include "metrics.h"
+
+#define LATENCY_HISTOGRAM_SUB_BUCKET_BITS 4
+#define LATENCY_HISTOGRAM_SUB_BUCKET_COUNT (1 << LATENCY_HISTOGRAM_SUB_BUCKET_BITS)
+// values below the sub-bucket count are recorded exactly, above that each
+// power of two up to 2^32 is split into sub-bucket count linear buckets
+#define LATENCY_HISTOGRAM_BUCKET_COUNT ((32 - LATENCY_HISTOGRAM_SUB_BUCKET_BITS + 1) * LATENCY_HISTOGRAM_SUB_BUCKET_COUNT)
+
+typedef struct {
+	uint32_t counts[LATENCY_HISTOGRAM_BUCKET_COUNT];
+	uint64_t count;
+	uint64_t sum; // microseconds
+	uint32_t max; // microseconds
+} LatencyHistogram;
+
+void latency_histogram_reset(LatencyHistogram *histogram);
+
+void latency_histogram_record(LatencyHistogram *histogram, uint64_t latency /* microseconds */);
+
+uint32_t latency_histogram_get_percentile(LatencyHistogram *histogram, double quantile);
+
+void latency_histogram_add_metrics(LatencyHistogram *histogram, Metrics *metrics,
+                                   const MetricFamily *family,
+                                   ... /* label name and value pairs, terminated by NULL */);
+
+#endif // BRICKD_LATENCY_HISTOGRAM_H
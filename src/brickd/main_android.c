@@ -29,8 +29,10 @@
 #include <daemonlib/signal.h>
 #include <daemonlib/utils.h>
 
+#include "event_timing.h"
 #include "hardware.h"
 #include "network.h"
+#include "packet_trace.h"
 #include "usb.h"
 #include "mesh.h"
 #include "version.h"
@@ -42,13 +44,17 @@ extern jobject android_service;
 extern bool android_debugger_connected;
 
 static void handle_event_cleanup(void) {
+	network_flush_responses();
 	network_cleanup_clients_and_zombies();
 	mesh_cleanup_stacks();
 }
 
 JNIEXPORT void JNICALL
-Java_com_tinkerforge_brickd_MainService_main(JNIEnv *env, jobject this, jobject service, jboolean debugger_connected) {
+Java_com_tinkerforge_brickd_MainService_main(JNIEnv *env, jobject this, jobject service, jboolean debugger_connected,
+                                             jstring packet_trace_filename) {
 	int phase = 0;
+	int rc;
+	const char *packet_trace_filename_utf8;
 
 	(void)this;
 
@@ -94,30 +100,55 @@ Java_com_tinkerforge_brickd_MainService_main(JNIEnv *env, jobject this, jobject
 
 	phase = 4;
 
-	if (hardware_init() < 0) {
+	// the app files directory is only known on the Java side
+	packet_trace_filename_utf8 = (*env)->GetStringUTFChars(env, packet_trace_filename, NULL);
+
+	if (packet_trace_filename_utf8 == NULL) {
+		log_error("Could not get packet trace dump filename");
+
+		goto cleanup;
+	}
+
+	rc = packet_trace_init(packet_trace_filename_utf8);
+
+	(*env)->ReleaseStringUTFChars(env, packet_trace_filename, packet_trace_filename_utf8);
+
+	if (rc < 0) {
 		goto cleanup;
 	}
 
 	phase = 5;
 
-	if (usb_init() < 0) {
+	if (event_timing_init() < 0) {
 		goto cleanup;
 	}
 
 	phase = 6;
 
-	if (network_init() < 0) {
+	if (hardware_init() < 0) {
 		goto cleanup;
 	}
 
 	phase = 7;
 
-	if (mesh_init() < 0) {
+	if (usb_init() < 0) {
 		goto cleanup;
 	}
 
 	phase = 8;
 
+	if (network_init() < 0) {
+		goto cleanup;
+	}
+
+	phase = 9;
+
+	if (mesh_init() < 0) {
+		goto cleanup;
+	}
+
+	phase = 10;
+
 	log_debug("Starting initial USB device scan");
 
 	if (usb_rescan() < 0) {
@@ -130,22 +161,30 @@ Java_com_tinkerforge_brickd_MainService_main(JNIEnv *env, jobject this, jobject
 
 cleanup:
 	switch (phase) { // no breaks, all cases fall through intentionally
-	case 8:
+	case 10:
 		mesh_exit();
 		// fall through
 
-	case 7:
+	case 9:
 		network_exit();
 		// fall through
 
-	case 6:
+	case 8:
 		usb_exit();
 		// fall through
 
-	case 5:
+	case 7:
 		hardware_exit();
 		// fall through
 
+	case 6:
+		event_timing_exit();
+		// fall through
+
+	case 5:
+		packet_trace_exit();
+		// fall through
+
 	case 4:
 		signal_exit();
 		// fall through
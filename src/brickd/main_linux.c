@@ -48,8 +48,12 @@
 #include <daemonlib/signal.h>
 #include <daemonlib/utils.h>
 
+#include "event_timing.h"
 #include "hardware.h"
 #include "network.h"
+#include "packet_trace.h"
+#include "replay_stack.h"
+#include "traffic_capture.h"
 #ifdef BRICKD_WITH_RED_BRICK
 	#include "redapid.h"
 	#include "red_stack.h"
@@ -62,6 +66,7 @@
 #include "usb.h"
 #include "mesh.h"
 #include "version.h"
+#include "virtual_stack.h"
 
 static LogSource _log_source = LOG_SOURCE_INITIALIZER;
 
@@ -72,6 +77,7 @@ static const char *_pid_filename = _pid_filename_default;
 static char _log_filename_default[1024] = LOCALSTATEDIR"/log/brickd.log";
 static const char *_log_filename = _log_filename_default;
 static File _log_file;
+static const char *_packet_trace_filename = LOCALSTATEDIR"/log/brickd-packet-trace.bin";
 
 #if defined __amd64__
 static const char *_architecture = "amd64";
@@ -257,6 +263,7 @@ static void handle_sigusr1(void) {
 }
 
 static void handle_event_cleanup(void) {
+	network_flush_responses();
 	network_cleanup_clients_and_zombies();
 	mesh_cleanup_stacks();
 }
@@ -441,60 +448,78 @@ int main(int argc, char **argv) {
 
 	phase = 7;
 
-	if (hardware_init() < 0) {
+	if (packet_trace_init(_packet_trace_filename) < 0) {
 		goto cleanup;
 	}
 
 	phase = 8;
 
-	if (usb_init() < 0) {
+	if (traffic_capture_init() < 0) {
 		goto cleanup;
 	}
 
 	phase = 9;
 
-	if (network_init() < 0) {
+	if (event_timing_init() < 0) {
 		goto cleanup;
 	}
 
 	phase = 10;
 
-	if (mesh_init() < 0) {
+	if (hardware_init() < 0) {
 		goto cleanup;
 	}
 
 	phase = 11;
 
+	if (usb_init() < 0) {
+		goto cleanup;
+	}
+
+	phase = 12;
+
+	if (network_init() < 0) {
+		goto cleanup;
+	}
+
+	phase = 13;
+
+	if (mesh_init() < 0) {
+		goto cleanup;
+	}
+
+	phase = 14;
+
 #ifdef BRICKD_WITH_RED_BRICK
 	if (gpio_red_init() < 0) {
 		goto cleanup;
 	}
 
-	phase = 12;
+	phase = 15;
 
 	if (redapid_init() < 0) {
 		goto cleanup;
 	}
 
-	phase = 13;
+	phase = 16;
 
 	if (red_stack_init() < 0) {
 		goto cleanup;
 	}
 
-	phase = 14;
+	phase = 17;
 
 	if (red_extension_init() < 0) {
 		goto cleanup;
 	}
 
-	phase = 15;
+	phase = 18;
 
 	if (red_usb_gadget_init() < 0) {
 		goto cleanup;
 	}
 
-	phase = 16;
+	phase = 19;
 
 	red_led_set_trigger(RED_LED_GREEN, config_get_option_value("led_trigger.green")->symbol);
 	red_led_set_trigger(RED_LED_RED, config_get_option_value("led_trigger.red")->symbol);
@@ -504,9 +529,21 @@ int main(int argc, char **argv) {
 		goto cleanup;
 	}
 
-	phase = 17;
+	phase = 20;
 #endif
 
+	if (virtual_stack_init() < 0) {
+		goto cleanup;
+	}
+
+	phase = 21;
+
+	if (replay_stack_init() < 0) {
+		goto cleanup;
+	}
+
+	phase = 22;
+
 	log_debug("Starting initial USB device scan");
 
 	if (usb_rescan() < 0) {
@@ -527,50 +564,70 @@ int main(int argc, char **argv) {
 
 cleanup:
 	switch (phase) { // no breaks, all cases fall through intentionally
+	case 22:
+		replay_stack_exit();
+		// fall through
+
+	case 21:
+		virtual_stack_exit();
+		// fall through
+
 #ifdef BRICKD_WITH_BRICKLET
-	case 17:
+	case 20:
 		bricklet_exit();
 #endif
 #ifdef BRICKD_WITH_RED_BRICK
 		// fall through
 
-	case 16:
+	case 19:
 		red_usb_gadget_exit();
 		// fall through
 
-	case 15:
+	case 18:
 		red_extension_exit();
 		// fall through
 
-	case 14:
+	case 17:
 		red_stack_exit();
 		// fall through
 
-	case 13:
+	case 16:
 		redapid_exit();
 		// fall through
 
-	case 12:
+	case 15:
 		//gpio_red_exit();
 #endif
 		// fall through
 
-	case 11:
+	case 14:
 		mesh_exit();
 		// fall through
 
-	case 10:
+	case 13:
 		network_exit();
 		// fall through
 
-	case 9:
+	case 12:
 		usb_exit();
 		// fall through
 
-	case 8:
+	case 11:
 		hardware_exit();
 		// fall through
 
+	case 10:
+		event_timing_exit();
+		// fall through
+
+	case 9:
+		traffic_capture_exit();
+		// fall through
+
+	case 8:
+		packet_trace_exit();
+		// fall through
+
 	case 7:
 		signal_exit();
 		// fall through
@@ -38,12 +38,17 @@
 #include <daemonlib/signal.h>
 #include <daemonlib/utils.h>
 
+#include "event_timing.h"
 #include "hardware.h"
 #include "iokit.h"
 #include "network.h"
+#include "packet_trace.h"
+#include "replay_stack.h"
+#include "traffic_capture.h"
 #include "usb.h"
 #include "mesh.h"
 #include "version.h"
+#include "virtual_stack.h"
 
 static LogSource _log_source = LOG_SOURCE_INITIALIZER;
 
@@ -51,6 +56,7 @@ static const char *_config_filename = SYSCONFDIR"/brickd.conf";
 static const char *_pid_filename = RUNSTATEDIR"/brickd.pid";
 static const char *_log_filename = LOCALSTATEDIR"/log/brickd.log";
 static File _log_file;
+static const char *_packet_trace_filename = LOCALSTATEDIR"/log/brickd-packet-trace.bin";
 
 static void print_usage(void) {
 	printf("Usage:\n"
@@ -81,6 +87,7 @@ static void handle_sigusr1(void) {
 }
 
 static void handle_event_cleanup(void) {
+	network_flush_responses();
 	network_cleanup_clients_and_zombies();
 	mesh_cleanup_stacks();
 }
@@ -243,36 +250,66 @@ int main(int argc, char **argv) {
 
 	phase = 5;
 
-	if (hardware_init() < 0) {
+	if (packet_trace_init(_packet_trace_filename) < 0) {
 		goto cleanup;
 	}
 
 	phase = 6;
 
-	if (usb_init() < 0) {
+	if (traffic_capture_init() < 0) {
 		goto cleanup;
 	}
 
 	phase = 7;
 
-	if (iokit_init() < 0) {
+	if (event_timing_init() < 0) {
 		goto cleanup;
 	}
 
 	phase = 8;
 
-	if (network_init() < 0) {
+	if (hardware_init() < 0) {
 		goto cleanup;
 	}
 
 	phase = 9;
 
-	if (mesh_init() < 0) {
+	if (usb_init() < 0) {
 		goto cleanup;
 	}
 
 	phase = 10;
 
+	if (iokit_init() < 0) {
+		goto cleanup;
+	}
+
+	phase = 11;
+
+	if (network_init() < 0) {
+		goto cleanup;
+	}
+
+	phase = 12;
+
+	if (mesh_init() < 0) {
+		goto cleanup;
+	}
+
+	phase = 13;
+
+	if (virtual_stack_init() < 0) {
+		goto cleanup;
+	}
+
+	phase = 14;
+
+	if (replay_stack_init() < 0) {
+		goto cleanup;
+	}
+
+	phase = 15;
+
 	if (usb_rescan() < 0) {
 		goto cleanup;
 	}
@@ -285,26 +322,46 @@ int main(int argc, char **argv) {
 
 cleanup:
 	switch (phase) { // no breaks, all cases fall through intentionally
-	case 10:
+	case 15:
+		replay_stack_exit();
+		// fall through
+
+	case 14:
+		virtual_stack_exit();
+		// fall through
+
+	case 13:
 		mesh_exit();
 		// fall through
 
-	case 9:
+	case 12:
 		network_exit();
 		// fall through
 
-	case 8:
+	case 11:
 		iokit_exit();
 		// fall through
 
-	case 7:
+	case 10:
 		usb_exit();
 		// fall through
 
-	case 6:
+	case 9:
 		hardware_exit();
 		// fall through
 
+	case 8:
+		event_timing_exit();
+		// fall through
+
+	case 7:
+		traffic_capture_exit();
+		// fall through
+
+	case 6:
+		packet_trace_exit();
+		// fall through
+
 	case 5:
 		signal_exit();
 		// fall through
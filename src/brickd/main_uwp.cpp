@@ -40,8 +40,10 @@ extern "C" {
 #include <daemonlib/utils_uwp.h>
 
 #include "app_service.h"
+#include "event_timing.h"
 #include "hardware.h"
 #include "network.h"
+#include "packet_trace.h"
 #include "usb.h"
 #include "mesh.h"
 #include "version.h"
@@ -71,6 +73,7 @@ static LogSource _log_source = LOG_SOURCE_INITIALIZER;
 static bool _main_running = false; // must be initialized here, there is no init function to do it
 static Pipe _cancellation_pipe;
 static Pipe _app_service_accept_pipe;
+static char _packet_trace_filename[MAX_PATH];
 
 static void debugf(const char *format, ...) {
 	va_list arguments;
@@ -276,6 +279,7 @@ static void accept_app_service(IBackgroundTaskInstance ^task_instance) {
 }
 
 static void handle_event_cleanup(void) {
+	network_flush_responses();
 	network_cleanup_clients_and_zombies();
 	mesh_cleanup_stacks();
 }
@@ -386,18 +390,43 @@ void brickd_uwp::MainTask::Run(IBackgroundTaskInstance ^taskInstance) {
 
 	phase = 5;
 
-	if (hardware_init() < 0) {
+	// the app can only write to its local folder
+	if (WideCharToMultiByte(CP_UTF8, 0, Windows::Storage::ApplicationData::Current->LocalFolder->Path->Data(), -1,
+	                        _packet_trace_filename, sizeof(_packet_trace_filename), nullptr, nullptr) == 0) {
+		rc = ERRNO_WINAPI_OFFSET + GetLastError();
+
+		log_error("Could not get local folder path: %s (%d)",
+		          get_errno_name(rc), rc);
+
+		goto cleanup;
+	}
+
+	string_append(_packet_trace_filename, sizeof(_packet_trace_filename), "\\brickd-packet-trace.bin");
+
+	if (packet_trace_init(_packet_trace_filename) < 0) {
 		goto cleanup;
 	}
 
 	phase = 6;
 
-	if (usb_init() < 0) {
+	if (event_timing_init() < 0) {
 		goto cleanup;
 	}
 
 	phase = 7;
 
+	if (hardware_init() < 0) {
+		goto cleanup;
+	}
+
+	phase = 8;
+
+	if (usb_init() < 0) {
+		goto cleanup;
+	}
+
+	phase = 9;
+
 	if (pipe_create(&_cancellation_pipe, PIPE_FLAG_NON_BLOCKING_READ) < 0) {
 		log_error("Could not create cancellation pipe: %s (%d)",
 		          get_errno_name(errno), errno);
@@ -405,14 +434,14 @@ void brickd_uwp::MainTask::Run(IBackgroundTaskInstance ^taskInstance) {
 		goto cleanup;
 	}
 
-	phase = 8;
+	phase = 10;
 
 	if (event_add_source(_cancellation_pipe.base.read_handle, EVENT_SOURCE_TYPE_GENERIC,
 	                     "cancellation", EVENT_READ, handle_cancellation, nullptr) < 0) {
 		goto cleanup;
 	}
 
-	phase = 9;
+	phase = 11;
 
 	taskInstance->Canceled += ref new BackgroundTaskCanceledEventHandler(
 	[](IBackgroundTaskInstance ^sender, BackgroundTaskCancellationReason reason) {
@@ -428,13 +457,13 @@ void brickd_uwp::MainTask::Run(IBackgroundTaskInstance ^taskInstance) {
 		goto cleanup;
 	}
 
-	phase = 10;
+	phase = 12;
 
 	if (mesh_init() < 0) {
 		goto cleanup;
 	}
 
-	phase = 11;
+	phase = 13;
 
 	if (pipe_create(&_app_service_accept_pipe, PIPE_FLAG_NON_BLOCKING_READ) < 0) {
 		log_error("Could not create AppService accept pipe: %s (%d)",
@@ -443,7 +472,7 @@ void brickd_uwp::MainTask::Run(IBackgroundTaskInstance ^taskInstance) {
 		goto cleanup;
 	}
 
-	phase = 12;
+	phase = 14;
 
 	if (event_add_source(_app_service_accept_pipe.base.read_handle,
 	                     EVENT_SOURCE_TYPE_GENERIC, "app-service-accept",
@@ -451,14 +480,14 @@ void brickd_uwp::MainTask::Run(IBackgroundTaskInstance ^taskInstance) {
 		goto cleanup;
 	}
 
-	phase = 13;
+	phase = 15;
 
 #ifdef BRICKD_WITH_BRICKLET
 	if (bricklet_init() < 0) {
 		goto cleanup;
 	}
 
-	phase = 14;
+	phase = 16;
 #endif
 
 	log_debug("Starting initial USB device scan");
@@ -476,43 +505,51 @@ void brickd_uwp::MainTask::Run(IBackgroundTaskInstance ^taskInstance) {
 cleanup:
 	switch (phase) { // no breaks, all cases fall through intentionally
 #ifdef BRICKD_WITH_BRICKLET
-	case 14:
+	case 16:
 		bricklet_exit();
 #endif
 		// fall through
 
-	case 13:
+	case 15:
 		event_remove_source(_app_service_accept_pipe.base.read_handle, EVENT_SOURCE_TYPE_GENERIC);
 		// fall through
 
-	case 12:
+	case 14:
 		pipe_destroy(&_app_service_accept_pipe);
 		// fall through
 
-	case 11:
+	case 13:
 		mesh_exit();
 		// fall through
 
-	case 10:
+	case 12:
 		network_exit();
 		// fall through
 
-	case 9:
+	case 11:
 		event_remove_source(_cancellation_pipe.base.read_handle, EVENT_SOURCE_TYPE_GENERIC);
 		// fall through
 
-	case 8:
+	case 10:
 		pipe_destroy(&_cancellation_pipe);
 		// fall through
 
-	case 7:
+	case 9:
 		usb_exit();
 		// fall through
 
-	case 6:
+	case 8:
 		hardware_exit();
 		// fall through
 
+	case 7:
+		event_timing_exit();
+		// fall through
+
+	case 6:
+		packet_trace_exit();
+		// fall through
+
 	case 5:
 		event_exit();
 		// fall through
@@ -40,8 +40,11 @@
 #include <daemonlib/log.h>
 #include <daemonlib/utils.h>
 
+#include "event_timing.h"
 #include "hardware.h"
 #include "network.h"
+#include "packet_trace.h"
+#include "traffic_capture.h"
 #include "service.h"
 #include "usb.h"
 #include "mesh.h"
@@ -58,6 +61,7 @@ static char _log_filename_default[MAX_PATH];
 static const char *_log_filename;
 static char _config_filename_default[MAX_PATH];
 static const char *_config_filename;
+static char _packet_trace_filename[MAX_PATH];
 static bool _run_as_service;
 static bool _pause_before_exit;
 static bool _running;
@@ -329,6 +333,7 @@ static int rotate_log_file(IO *output, LogLevel *level, char *message, int messa
 }
 
 static void handle_event_cleanup(void) {
+	network_flush_responses();
 	network_cleanup_clients_and_zombies();
 	mesh_cleanup_stacks();
 }
@@ -484,34 +489,55 @@ init:
 
 	phase = 1;
 
-	if (hardware_init() < 0) {
+	if (packet_trace_init(_packet_trace_filename) < 0) {
 		// FIXME: set service_exit_code
 		goto cleanup;
 	}
 
 	phase = 2;
 
-	if (usb_init() < 0) {
+	if (traffic_capture_init() < 0) {
 		// FIXME: set service_exit_code
 		goto cleanup;
 	}
 
 	phase = 3;
 
-	if (network_init() < 0) {
+	if (event_timing_init() < 0) {
 		// FIXME: set service_exit_code
 		goto cleanup;
 	}
 
 	phase = 4;
 
-	if (mesh_init() < 0) {
+	if (hardware_init() < 0) {
 		// FIXME: set service_exit_code
 		goto cleanup;
 	}
 
 	phase = 5;
 
+	if (usb_init() < 0) {
+		// FIXME: set service_exit_code
+		goto cleanup;
+	}
+
+	phase = 6;
+
+	if (network_init() < 0) {
+		// FIXME: set service_exit_code
+		goto cleanup;
+	}
+
+	phase = 7;
+
+	if (mesh_init() < 0) {
+		// FIXME: set service_exit_code
+		goto cleanup;
+	}
+
+	phase = 8;
+
 	log_debug("Starting initial USB device scan");
 
 	if (usb_rescan() < 0) {
@@ -533,22 +559,34 @@ init:
 
 cleanup:
 	switch (phase) { // no breaks, all cases fall through intentionally
-	case 5:
+	case 8:
 		mesh_exit();
 		// fall through
 
-	case 4:
+	case 7:
 		network_exit();
 		// fall through
 
-	case 3:
+	case 6:
 		usb_exit();
 		// fall through
 
-	case 2:
+	case 5:
 		hardware_exit();
 		// fall through
 
+	case 4:
+		event_timing_exit();
+		// fall through
+
+	case 3:
+		traffic_capture_exit();
+		// fall through
+
+	case 2:
+		packet_trace_exit();
+		// fall through
+
 	case 1:
 		event_exit();
 		// fall through
@@ -796,6 +834,9 @@ int main(int argc, char **argv) {
 		_log_filename = _log_filename_default;
 	}
 
+	string_copy(_packet_trace_filename, sizeof(_packet_trace_filename), _program_data_directory, -1);
+	string_append(_packet_trace_filename, sizeof(_packet_trace_filename), "brickd-packet-trace.bin");
+
 	string_copy(_config_filename_default, sizeof(_config_filename_default), _program_data_directory, -1);
 	string_append(_config_filename_default, sizeof(_config_filename_default), "brickd.ini");
 
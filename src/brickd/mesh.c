@@ -37,6 +37,7 @@
 
 #include "mesh.h"
 
+#include "event_timing.h"
 #include "mesh_stack.h"
 
 Array mesh_stacks;
@@ -45,7 +46,7 @@ static LogSource _log_source = LOG_SOURCE_INITIALIZER;
 static Array _server_sockets;
 
 static void mesh_destroy_server_socket(Socket *server_socket) {
-	event_remove_source(server_socket->handle, EVENT_SOURCE_TYPE_GENERIC);
+	event_timing_remove_source(server_socket->handle, EVENT_SOURCE_TYPE_GENERIC);
 	socket_destroy(server_socket);
 }
 
@@ -160,8 +161,8 @@ int mesh_start_listening(void) {
 		for (i = 0; i < _server_sockets.count; ++i) {
 			server_socket = array_get(&_server_sockets, i);
 
-			if (event_add_source(server_socket->handle, EVENT_SOURCE_TYPE_GENERIC, "mesh-server",
-			                     EVENT_READ, mesh_handle_accept, server_socket) < 0) {
+			if (event_timing_add_source(server_socket->handle, EVENT_SOURCE_TYPE_GENERIC, "mesh-server",
+			                            EVENT_READ, mesh_handle_accept, server_socket) < 0) {
 				break;
 			}
 		}
@@ -170,7 +171,7 @@ int mesh_start_listening(void) {
 			for (--i; i >= 0; --i) {
 				server_socket = array_get(&_server_sockets, i);
 
-				event_remove_source(server_socket->handle, EVENT_SOURCE_TYPE_GENERIC);
+				event_timing_remove_source(server_socket->handle, EVENT_SOURCE_TYPE_GENERIC);
 			}
 
 			for (i = 0; i < _server_sockets.count; ++i) {
@@ -32,6 +32,7 @@
 
 #include "mesh_stack.h"
 
+#include "event_timing.h"
 #include "hardware.h"
 #include "network.h"
 
@@ -372,6 +373,7 @@ void tfp_recv_handler(MeshStack *mesh_stack) {
 		return;
 	}
 
+	stack_count_response(&mesh_stack->base, &pkt_mesh_tfp->payload);
 	network_dispatch_response(&pkt_mesh_tfp->payload);
 
 	log_debug("TFP packet dispatched (L: %d)", pkt_mesh_tfp->payload.header.length);
@@ -385,12 +387,12 @@ void mesh_stack_destroy(MeshStack *mesh_stack) {
 	timer_configure(&mesh_stack->timer_cleanup_after_reset_sent, 0, 0);
 
 	// Cleanup the timers of the mesh stack.
-	timer_destroy(&mesh_stack->timer_wait_hello);
-	timer_destroy(&mesh_stack->timer_hb_do_ping);
-	timer_destroy(&mesh_stack->timer_hb_wait_pong);
-	timer_destroy(&mesh_stack->timer_cleanup_after_reset_sent);
+	event_timing_destroy_timer(&mesh_stack->timer_wait_hello);
+	event_timing_destroy_timer(&mesh_stack->timer_hb_do_ping);
+	event_timing_destroy_timer(&mesh_stack->timer_hb_wait_pong);
+	event_timing_destroy_timer(&mesh_stack->timer_cleanup_after_reset_sent);
 
-	event_remove_source(mesh_stack->sock->handle, EVENT_SOURCE_TYPE_GENERIC);
+	event_timing_remove_source(mesh_stack->sock->handle, EVENT_SOURCE_TYPE_GENERIC);
 
 	socket_destroy(mesh_stack->sock);
 	free(mesh_stack->sock);
@@ -431,8 +433,8 @@ int mesh_stack_create(char *name, Socket *sock) {
 	 */
 	mesh_stack->state = MESH_STACK_STATE_WAIT_HELLO;
 
-	if (event_add_source(sock->handle, EVENT_SOURCE_TYPE_GENERIC, "mesh-stack",
-	                     EVENT_READ, mesh_stack_recv_handler, mesh_stack) < 0) {
+	if (event_timing_add_source(sock->handle, EVENT_SOURCE_TYPE_GENERIC, "mesh-stack",
+	                            EVENT_READ, mesh_stack_recv_handler, mesh_stack) < 0) {
 		log_error("Failed to add stack receive event");
 
 		array_remove(&mesh_stacks,
@@ -451,7 +453,8 @@ int mesh_stack_create(char *name, Socket *sock) {
 	snprintf(mesh_stack->name, sizeof(mesh_stack->name), "%s", name);
 
 	// Initialise timers.
-	if (timer_create_(&mesh_stack->timer_wait_hello, timer_wait_hello_handler, mesh_stack) < 0) {
+	if (event_timing_create_timer(&mesh_stack->timer_wait_hello, "mesh-wait-hello",
+	                              timer_wait_hello_handler, mesh_stack) < 0) {
 		log_error("Failed to initialise wait hello timer: %s (%d)",
 		          get_errno_name(errno),
 		          errno);
@@ -463,7 +466,8 @@ int mesh_stack_create(char *name, Socket *sock) {
 		return -1;
 	}
 
-	if (timer_create_(&mesh_stack->timer_hb_do_ping, timer_hb_do_ping_handler, mesh_stack) < 0) {
+	if (event_timing_create_timer(&mesh_stack->timer_hb_do_ping, "mesh-ping",
+	                              timer_hb_do_ping_handler, mesh_stack) < 0) {
 		log_error("Failed to initialise do ping timer: %s (%d)",
 		          get_errno_name(errno),
 		          errno);
@@ -475,7 +479,8 @@ int mesh_stack_create(char *name, Socket *sock) {
 		return -1;
 	}
 
-	if (timer_create_(&mesh_stack->timer_hb_wait_pong, timer_hb_wait_pong_handler, mesh_stack) < 0) {
+	if (event_timing_create_timer(&mesh_stack->timer_hb_wait_pong, "mesh-wait-pong",
+	                              timer_hb_wait_pong_handler, mesh_stack) < 0) {
 		log_error("Failed to initialise wait pong timer: %s (%d)",
 		          get_errno_name(errno),
 		          errno);
@@ -487,9 +492,9 @@ int mesh_stack_create(char *name, Socket *sock) {
 		return -1;
 	}
 
-	if (timer_create_(&mesh_stack->timer_cleanup_after_reset_sent,
-	                  timer_cleanup_after_reset_sent_handler,
-	                  mesh_stack) < 0) {
+	if (event_timing_create_timer(&mesh_stack->timer_cleanup_after_reset_sent, "mesh-reset",
+	                              timer_cleanup_after_reset_sent_handler,
+	                              mesh_stack) < 0) {
 		log_error("Failed to initialise cleanup after reset sent timer: %s (%d)",
 		          get_errno_name(errno),
 		          errno);
@@ -921,6 +926,9 @@ int mesh_stack_dispatch_request(Stack *stack, Packet *request, Recipient *recipi
 	                          mesh_stack->gw_addr,
 	                          MESH_PACKET_TYPE_PAYLOAD);
 
+	// the mesh header and the request have to go out in one contiguous write,
+	// so this copy is the transport boundary. the request itself reaches this
+	// point without being copied
 	memcpy(&tfp_mesh_pkt.payload, request, request->header.length);
 
 	if (!is_broadcast) {
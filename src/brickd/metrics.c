@@ -0,0 +1,349 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * metrics.c: Collection and export of runtime metrics
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * the metrics are not kept up to date continuously. the stacks, clients and
+ * queues only maintain plain counters in their own structs. on request all
+ * subsystems add their current values as samples to a Metrics object that is
+ * then rendered in the Prometheus text exposition format. rates are not
+ * computed here, all packet and byte counts are monotonic counters and the
+ * rates are derived from two consecutive scrapes.
+ *
+ * the rendered text is available through the Brick Daemon UID and through an
+ * optional HTTP listener, see metrics_server.c.
+ */
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <daemonlib/log.h>
+#include <daemonlib/utils.h>
+
+#include "metrics.h"
+
+static LogSource _log_source = LOG_SOURCE_INITIALIZER;
+
+typedef struct {
+	char *data;
+	int length;
+	int allocated;
+} MetricsText;
+
+static int metrics_text_append(MetricsText *text, const char *data, int length) {
+	int allocated;
+	char *bigger;
+
+	if (length < 0) {
+		length = strlen(data);
+	}
+
+	if (text->length + length + 1 > text->allocated) {
+		allocated = text->allocated > 0 ? text->allocated : 4096;
+
+		while (text->length + length + 1 > allocated) {
+			allocated *= 2;
+		}
+
+		bigger = realloc(text->data, allocated);
+
+		if (bigger == NULL) {
+			errno = ENOMEM;
+
+			return -1;
+		}
+
+		text->data = bigger;
+		text->allocated = allocated;
+	}
+
+	memcpy(text->data + text->length, data, length);
+
+	text->length += length;
+	text->data[text->length] = '\0';
+
+	return 0;
+}
+
+// the C library has no portable format for uint64_t values
+static char *metrics_format_value(char *buffer, int length, uint64_t value) {
+	char *p = buffer + length - 1;
+
+	*p = '\0';
+
+	do {
+		*--p = '0' + (char)(value % 10);
+		value /= 10;
+	} while (value > 0 && p > buffer);
+
+	return p;
+}
+
+// escapes backslashes, double quotes and newlines. returns the number of
+// characters added or -1 if the escaped value does not fit
+static int metrics_escape_label_value(char *buffer, int length, const char *value) {
+	int i = 0;
+	char c;
+
+	for (; *value != '\0'; ++value) {
+		c = *value;
+
+		if (c == '\\' || c == '"' || c == '\n') {
+			if (i + 2 >= length) {
+				return -1;
+			}
+
+			buffer[i++] = '\\';
+			buffer[i++] = c == '\n' ? 'n' : c;
+		} else {
+			if (i + 1 >= length) {
+				return -1;
+			}
+
+			buffer[i++] = c;
+		}
+	}
+
+	buffer[i] = '\0';
+
+	return i;
+}
+
+static const char *metrics_get_type_name(MetricType type) {
+	switch (type) {
+	case METRIC_TYPE_COUNTER: return "counter";
+	case METRIC_TYPE_GAUGE:   return "gauge";
+	case METRIC_TYPE_SUMMARY: return "summary";
+
+	default:                  return "untyped";
+	}
+}
+
+int metrics_create(Metrics *metrics) {
+	return array_create(&metrics->samples, 128, sizeof(MetricSample), true);
+}
+
+void metrics_destroy(Metrics *metrics) {
+	array_destroy(&metrics->samples, NULL);
+}
+
+static int metrics_append_label(MetricSample *sample, int length, const char *name,
+                                const char *value) {
+	int value_length;
+
+	// 4 == strlen(",=\"\"")
+	if (length + (int)strlen(name) + 4 >= (int)sizeof(sample->labels)) {
+		return -1;
+	}
+
+	length += snprintf(sample->labels + length, sizeof(sample->labels) - length,
+	                   "%s%s=\"", length > 0 ? "," : "", name);
+
+	value_length = metrics_escape_label_value(sample->labels + length,
+	                                          sizeof(sample->labels) - length - 1,
+	                                          value);
+
+	if (value_length < 0) {
+		return -1;
+	}
+
+	length += value_length;
+
+	sample->labels[length++] = '"';
+	sample->labels[length] = '\0';
+
+	return length;
+}
+
+// adds a sample of the given family. the labels are given as name and value
+// pairs, terminated by NULL. a label that does not fit is left out
+void metrics_add(Metrics *metrics, const MetricFamily *family, uint64_t value, ...) {
+	va_list labels;
+
+	va_start(labels, value);
+
+	metrics_add_v(metrics, family, NULL, value, NULL, labels);
+
+	va_end(labels);
+}
+
+// the suffix is appended to the family name of this sample and the quantile,
+// if not NULL, is added as last label. both are only used for summaries
+void metrics_add_v(Metrics *metrics, const MetricFamily *family, const char *suffix,
+                   uint64_t value, const char *quantile, va_list labels) {
+	MetricSample *sample = array_append(&metrics->samples);
+	const char *name;
+	const char *label_value;
+	int length = 0;
+	int result;
+
+	if (sample == NULL) {
+		log_error("Could not append to metric sample array: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		return;
+	}
+
+	sample->family = family;
+	sample->suffix = suffix;
+	sample->labels[0] = '\0';
+	sample->value = value;
+	sample->index = metrics->samples.count - 1;
+	sample->first_index = -1;
+
+	while ((name = va_arg(labels, const char *)) != NULL) {
+		label_value = va_arg(labels, const char *);
+		result = metrics_append_label(sample, length, name, label_value);
+
+		if (result < 0) {
+			sample->labels[length] = '\0';
+
+			break;
+		}
+
+		length = result;
+	}
+
+	if (quantile != NULL && metrics_append_label(sample, length, "quantile", quantile) < 0) {
+		sample->labels[length] = '\0';
+	}
+}
+
+// orders the samples by family first, keeping the order of the samples
+// within a family
+static int metrics_compare_by_family(const void *a, const void *b) {
+	const MetricSample *sample_a = *(const MetricSample **)a;
+	const MetricSample *sample_b = *(const MetricSample **)b;
+
+	if (sample_a->family != sample_b->family) {
+		return (uintptr_t)sample_a->family < (uintptr_t)sample_b->family ? -1 : 1;
+	}
+
+	return sample_a->index - sample_b->index;
+}
+
+// orders the families by their first sample, keeping the order of the
+// samples within a family
+static int metrics_compare_by_first_index(const void *a, const void *b) {
+	const MetricSample *sample_a = *(const MetricSample **)a;
+	const MetricSample *sample_b = *(const MetricSample **)b;
+
+	if (sample_a->first_index != sample_b->first_index) {
+		return sample_a->first_index - sample_b->first_index;
+	}
+
+	return sample_a->index - sample_b->index;
+}
+
+// renders all samples in the Prometheus text exposition format, grouped by
+// family in order of their first sample. the samples are sorted once to
+// group them, so rendering stays O(n log n) in the number of samples.
+// returns the length of the malloc'ed text or -1 on error
+int metrics_render(Metrics *metrics, char **text) {
+	MetricsText output = { NULL, 0, 0 };
+	MetricSample **samples = NULL;
+	int i;
+	MetricSample *sample;
+	char buffer[32];
+	int result = 0;
+
+	if (metrics->samples.count > 0) {
+		samples = calloc(metrics->samples.count, sizeof(MetricSample *));
+
+		if (samples == NULL) {
+			errno = ENOMEM;
+
+			return -1;
+		}
+	}
+
+	for (i = 0; i < metrics->samples.count; ++i) {
+		samples[i] = array_get(&metrics->samples, i);
+	}
+
+	// the first sort puts the samples of each family next to each other, so
+	// the first sample of each family is known. the second sort then puts the
+	// families in order of their first sample
+	if (metrics->samples.count > 1) {
+		qsort(samples, metrics->samples.count, sizeof(MetricSample *), metrics_compare_by_family);
+
+		for (i = 0; i < metrics->samples.count; ++i) {
+			if (i > 0 && samples[i]->family == samples[i - 1]->family) {
+				samples[i]->first_index = samples[i - 1]->first_index;
+			} else {
+				samples[i]->first_index = samples[i]->index;
+			}
+		}
+
+		qsort(samples, metrics->samples.count, sizeof(MetricSample *), metrics_compare_by_first_index);
+	}
+
+	// ensure that an empty text is valid too
+	result |= metrics_text_append(&output, "", 0);
+
+	for (i = 0; i < metrics->samples.count && result == 0; ++i) {
+		sample = samples[i];
+
+		if (i == 0 || sample->family != samples[i - 1]->family) {
+			result |= metrics_text_append(&output, "# HELP ", -1);
+			result |= metrics_text_append(&output, sample->family->name, -1);
+			result |= metrics_text_append(&output, " ", 1);
+			result |= metrics_text_append(&output, sample->family->help, -1);
+			result |= metrics_text_append(&output, "\n# TYPE ", -1);
+			result |= metrics_text_append(&output, sample->family->name, -1);
+			result |= metrics_text_append(&output, " ", 1);
+			result |= metrics_text_append(&output, metrics_get_type_name(sample->family->type), -1);
+			result |= metrics_text_append(&output, "\n", 1);
+		}
+
+		result |= metrics_text_append(&output, sample->family->name, -1);
+
+		if (sample->suffix != NULL) {
+			result |= metrics_text_append(&output, sample->suffix, -1);
+		}
+
+		if (sample->labels[0] != '\0') {
+			result |= metrics_text_append(&output, "{", 1);
+			result |= metrics_text_append(&output, sample->labels, -1);
+			result |= metrics_text_append(&output, "}", 1);
+		}
+
+		result |= metrics_text_append(&output, " ", 1);
+		result |= metrics_text_append(&output, metrics_format_value(buffer, sizeof(buffer), sample->value), -1);
+		result |= metrics_text_append(&output, "\n", 1);
+	}
+
+	free(samples);
+
+	if (result < 0) {
+		free(output.data);
+
+		errno = ENOMEM;
+
+		return -1;
+	}
+
+	*text = output.data;
+
+	return output.length;
+}
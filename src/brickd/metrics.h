@@ -0,0 +1,72 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * metrics.h: Collection and export of runtime metrics
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef BRICKD_METRICS_H
+#define BRICKD_METRICS_H
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <daemonlib/array.h>
+
+#define METRICS_MAX_LABELS_LENGTH 320
+
+typedef enum {
+	METRIC_TYPE_COUNTER = 0,
+	METRIC_TYPE_GAUGE,
+	METRIC_TYPE_SUMMARY
+} MetricType;
+
+// describes a metric family. a family has to be a static object, because
+// samples refer to it and are grouped by it in the rendered text
+typedef struct {
+	const char *name;
+	MetricType type;
+	const char *help;
+} MetricFamily;
+
+typedef struct {
+	const MetricFamily *family;
+	const char *suffix; // e.g. "_sum" and "_count" for a summary, or NULL
+	char labels[METRICS_MAX_LABELS_LENGTH]; // already escaped, without braces
+	uint64_t value;
+	int index; // in the sample array
+	int first_index; // of the first sample of the same family, set while rendering
+} MetricSample;
+
+typedef struct _Metrics Metrics;
+
+struct _Metrics {
+	Array samples;
+};
+
+int metrics_create(Metrics *metrics);
+void metrics_destroy(Metrics *metrics);
+
+void metrics_add(Metrics *metrics, const MetricFamily *family, uint64_t value,
+                 ... /* label name and value pairs, terminated by NULL */);
+void metrics_add_v(Metrics *metrics, const MetricFamily *family, const char *suffix,
+                   uint64_t value, const char *quantile, va_list labels);
+
+int metrics_render(Metrics *metrics, char **text);
+
+#endif // BRICKD_METRICS_H
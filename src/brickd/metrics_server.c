@@ -0,0 +1,381 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * metrics_server.c: Export of runtime metrics over HTTP
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * collects the metrics of all subsystems and serves them over HTTP. the
+ * listener is meant for a Prometheus server or a similar scraper on the same
+ * host. it answers GET requests for / and /metrics with the current metrics
+ * and closes the connection after each response.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <daemonlib/config.h>
+#include <daemonlib/event.h>
+#include <daemonlib/log.h>
+#include <daemonlib/socket.h>
+#include <daemonlib/utils.h>
+
+#include "metrics_server.h"
+
+#include "event_timing.h"
+#include "hardware.h"
+#include "metrics.h"
+#include "network.h"
+
+static LogSource _log_source = LOG_SOURCE_INITIALIZER;
+
+#define MAX_METRICS_CONNECTIONS 8
+#define MAX_METRICS_REQUEST_LENGTH 2048
+
+typedef struct {
+	Socket *socket;
+	char request[MAX_METRICS_REQUEST_LENGTH + 1];
+	int request_length;
+	char *response;
+	int response_length;
+	int response_offset;
+} MetricsConnection;
+
+static Array _server_sockets;
+static Array _connections;
+
+// collects the current metrics of all subsystems. returns the length of the
+// malloc'ed text or -1 on error
+int metrics_get_text(char **text) {
+	Metrics metrics;
+	int length;
+
+	if (metrics_create(&metrics) < 0) {
+		return -1;
+	}
+
+	hardware_collect_metrics(&metrics);
+	network_collect_metrics(&metrics);
+	event_timing_collect_metrics(&metrics);
+
+	length = metrics_render(&metrics, text);
+
+	metrics_destroy(&metrics);
+
+	return length;
+}
+
+static void metrics_destroy_connection(MetricsConnection *connection) {
+	event_timing_remove_source(connection->socket->handle, EVENT_SOURCE_TYPE_GENERIC);
+	socket_destroy(connection->socket);
+	free(connection->socket);
+	free(connection->response);
+}
+
+static void metrics_remove_connection(MetricsConnection *connection) {
+	int i;
+
+	for (i = 0; i < _connections.count; ++i) {
+		if (array_get(&_connections, i) == connection) {
+			array_remove(&_connections, i, (ItemDestroyFunction)metrics_destroy_connection);
+
+			return;
+		}
+	}
+}
+
+static void metrics_handle_write(void *opaque) {
+	MetricsConnection *connection = opaque;
+	int length;
+
+	length = socket_send(connection->socket, connection->response + connection->response_offset,
+	                     connection->response_length - connection->response_offset);
+
+	if (length < 0) {
+		if (errno_interrupted() || errno_would_block()) {
+			return;
+		}
+
+		log_debug("Could not send metrics response (socket: %d): %s (%d)",
+		          connection->socket->handle, get_errno_name(errno), errno);
+
+		metrics_remove_connection(connection);
+
+		return;
+	}
+
+	connection->response_offset += length;
+
+	if (connection->response_offset >= connection->response_length) {
+		metrics_remove_connection(connection);
+	}
+}
+
+static int metrics_prepare_response(MetricsConnection *connection) {
+	const char *status = "200 OK";
+	char *body = NULL;
+	int body_length;
+	char header[256];
+	int header_length;
+
+	if (strncmp(connection->request, "GET ", 4) != 0) {
+		status = "405 Method Not Allowed";
+		body_length = 0;
+	} else if (strncmp(connection->request + 4, "/ ", 2) != 0 &&
+	           strncmp(connection->request + 4, "/metrics ", 9) != 0 &&
+	           strncmp(connection->request + 4, "/metrics?", 9) != 0) {
+		status = "404 Not Found";
+		body_length = 0;
+	} else {
+		body_length = metrics_get_text(&body);
+
+		if (body_length < 0) {
+			log_error("Could not collect metrics: %s (%d)",
+			          get_errno_name(errno), errno);
+
+			status = "500 Internal Server Error";
+			body_length = 0;
+		}
+	}
+
+	header_length = snprintf(header, sizeof(header),
+	                         "HTTP/1.0 %s\r\n"
+	                         "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+	                         "Content-Length: %d\r\n"
+	                         "Connection: close\r\n"
+	                         "\r\n", status, body_length);
+
+	connection->response = malloc(header_length + body_length);
+
+	if (connection->response == NULL) {
+		free(body);
+
+		errno = ENOMEM;
+
+		return -1;
+	}
+
+	memcpy(connection->response, header, header_length);
+
+	if (body_length > 0) {
+		memcpy(connection->response + header_length, body, body_length);
+	}
+
+	free(body);
+
+	connection->response_length = header_length + body_length;
+	connection->response_offset = 0;
+
+	return 0;
+}
+
+static void metrics_handle_read(void *opaque) {
+	MetricsConnection *connection = opaque;
+	int length;
+
+	length = socket_receive(connection->socket, connection->request + connection->request_length,
+	                        MAX_METRICS_REQUEST_LENGTH - connection->request_length);
+
+	if (length < 0 && (errno_interrupted() || errno_would_block())) {
+		return;
+	}
+
+	if (length <= 0) {
+		metrics_remove_connection(connection);
+
+		return;
+	}
+
+	connection->request_length += length;
+	connection->request[connection->request_length] = '\0';
+
+	// the request body, if any, is ignored
+	if (strstr(connection->request, "\r\n\r\n") == NULL &&
+	    strstr(connection->request, "\n\n") == NULL) {
+		if (connection->request_length >= MAX_METRICS_REQUEST_LENGTH) {
+			log_debug("Metrics request (socket: %d) is too long, closing connection",
+			          connection->socket->handle);
+
+			metrics_remove_connection(connection);
+		}
+
+		return;
+	}
+
+	if (metrics_prepare_response(connection) < 0) {
+		log_error("Could not prepare metrics response: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		metrics_remove_connection(connection);
+
+		return;
+	}
+
+	if (event_timing_modify_source(connection->socket->handle, EVENT_SOURCE_TYPE_GENERIC,
+	                               EVENT_READ, EVENT_WRITE, metrics_handle_write, connection) < 0) {
+		metrics_remove_connection(connection);
+
+		return;
+	}
+}
+
+static void metrics_handle_accept(void *opaque) {
+	Socket *server_socket = opaque;
+	Socket *client_socket;
+	struct sockaddr_storage address;
+	socklen_t length = sizeof(address);
+	MetricsConnection *connection;
+
+	client_socket = socket_accept(server_socket, (struct sockaddr *)&address, &length);
+
+	if (client_socket == NULL) {
+		if (!errno_interrupted()) {
+			log_error("Could not accept new metrics socket: %s (%d)",
+			          get_errno_name(errno), errno);
+		}
+
+		return;
+	}
+
+	if (_connections.count >= MAX_METRICS_CONNECTIONS) {
+		log_warn("Too many concurrent metrics connections, rejecting new connection");
+
+		socket_destroy(client_socket);
+		free(client_socket);
+
+		return;
+	}
+
+	connection = array_append(&_connections);
+
+	if (connection == NULL) {
+		log_error("Could not append to metrics connection array: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		socket_destroy(client_socket);
+		free(client_socket);
+
+		return;
+	}
+
+	connection->socket = client_socket;
+	connection->request_length = 0;
+	connection->response = NULL;
+	connection->response_length = 0;
+	connection->response_offset = 0;
+
+	if (event_timing_add_source(client_socket->handle, EVENT_SOURCE_TYPE_GENERIC, "metrics",
+	                            EVENT_READ, metrics_handle_read, connection) < 0) {
+		socket_destroy(client_socket);
+		free(client_socket);
+
+		array_remove(&_connections, _connections.count - 1, NULL);
+
+		return;
+	}
+}
+
+static void metrics_destroy_server_socket(Socket *server_socket) {
+	event_timing_remove_source(server_socket->handle, EVENT_SOURCE_TYPE_GENERIC);
+	socket_destroy(server_socket);
+}
+
+int metrics_server_init(void) {
+	int phase = 0;
+	const char *address = config_get_option_value("metrics.listen_address")->string;
+	uint16_t port = (uint16_t)config_get_option_value("metrics.listen_port")->integer;
+	bool dual_stack = config_get_option_value("listen.dual_stack")->boolean;
+	int i = 0;
+	Socket *server_socket;
+
+	log_debug("Initializing metrics server subsystem");
+
+	// create connection array. the MetricsConnection struct is not relocatable,
+	// because a pointer to it is passed as opaque parameter to the event subsystem
+	if (array_create(&_connections, MAX_METRICS_CONNECTIONS, sizeof(MetricsConnection), false) < 0) {
+		log_error("Could not create metrics connection array: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 1;
+
+	// create server sockets. the Socket struct is not relocatable, because a
+	// pointer to it is passed as opaque parameter to accept function
+	if (array_create(&_server_sockets, 8, sizeof(Socket), false) < 0) {
+		log_error("Could not create metrics server socket array: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 2;
+
+	if (port != 0) {
+		socket_open_server(&_server_sockets, address, port, dual_stack, socket_create_allocated);
+
+		for (i = 0; i < _server_sockets.count; ++i) {
+			server_socket = array_get(&_server_sockets, i);
+
+			if (event_timing_add_source(server_socket->handle, EVENT_SOURCE_TYPE_GENERIC, "metrics-server",
+			                            EVENT_READ, metrics_handle_accept, server_socket) < 0) {
+				goto cleanup;
+			}
+		}
+
+		if (_server_sockets.count == 0) {
+			log_warn("Could not open any socket to serve metrics on");
+		} else {
+			log_info("Serving metrics on %s:%u", address, port);
+		}
+	}
+
+	phase = 3;
+
+cleanup:
+	switch (phase) { // no breaks, all cases fall through intentionally
+	case 2:
+		for (--i; i >= 0; --i) {
+			server_socket = array_get(&_server_sockets, i);
+
+			event_timing_remove_source(server_socket->handle, EVENT_SOURCE_TYPE_GENERIC);
+		}
+
+		array_destroy(&_server_sockets, (ItemDestroyFunction)socket_destroy);
+		// fall through
+
+	case 1:
+		array_destroy(&_connections, NULL);
+		// fall through
+
+	default:
+		break;
+	}
+
+	return phase == 3 ? 0 : -1;
+}
+
+void metrics_server_exit(void) {
+	log_debug("Shutting down metrics server subsystem");
+
+	array_destroy(&_connections, (ItemDestroyFunction)metrics_destroy_connection);
+	array_destroy(&_server_sockets, (ItemDestroyFunction)metrics_destroy_server_socket);
+}
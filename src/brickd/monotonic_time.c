@@ -0,0 +1,70 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * monotonic_time.c: Monotonic clock with microsecond resolution
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * microtime from daemonlib returns the wall-clock time. it jumps whenever
+ * NTP or the user changes the system clock, therefore it cannot be used to
+ * timestamp events that are later compared with each other. the value
+ * returned here has an arbitrary origin and is only meaningful relative to
+ * other values returned by this function.
+ */
+
+#ifdef _WIN32
+	#include <windows.h>
+#elif defined __APPLE__
+	#include <mach/mach_time.h>
+#else
+	#include <time.h>
+#endif
+
+#include "monotonic_time.h"
+
+uint64_t monotonic_microtime(void) {
+#ifdef _WIN32
+	static LARGE_INTEGER frequency = {{0, 0}};
+	LARGE_INTEGER counter;
+
+	// QueryPerformanceFrequency cannot fail since Windows XP
+	if (frequency.QuadPart == 0) {
+		QueryPerformanceFrequency(&frequency);
+	}
+
+	QueryPerformanceCounter(&counter);
+
+	return (uint64_t)(counter.QuadPart / frequency.QuadPart) * 1000000 +
+	       (uint64_t)(counter.QuadPart % frequency.QuadPart) * 1000000 / frequency.QuadPart;
+#elif defined __APPLE__
+	// clock_gettime is only available since macOS 10.12
+	static mach_timebase_info_data_t timebase = {0, 0};
+
+	if (timebase.denom == 0) {
+		mach_timebase_info(&timebase);
+	}
+
+	return mach_absolute_time() / 1000 * timebase.numer / timebase.denom;
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+#endif
+}
@@ -39,11 +39,22 @@
 #include <daemonlib/node.h>
 #include <daemonlib/packet.h>
 #include <daemonlib/socket.h>
+#include <daemonlib/timer.h>
 #include <daemonlib/utils.h>
 
 #include "network.h"
 
+#include "event_timing.h"
+#include "hardware.h"
 #include "hmac.h"
+#include "metrics_server.h"
+#include "monotonic_time.h"
+#ifndef _WIN32
+	#include "network_shard.h"
+#endif
+#include "packet_buffer.h"
+#include "packet_trace.h"
+#include "traffic_capture.h"
 #include "websocket.h"
 #include "zombie.h"
 
@@ -54,7 +65,62 @@ static Array _zombies;
 static Array _plain_server_sockets;
 static Array _websocket_server_sockets;
 static uint32_t _next_authentication_nonce = 0; // static initialized to ensure uniqueness
-static Node _pending_request_sentinel;
+
+#define PENDING_REQUEST_INITIAL_BUCKET_COUNT 256 // must be a power of two
+#define PENDING_REQUEST_MAX_BUCKET_COUNT 1048576 // must be a power of two
+#define PENDING_REQUEST_MAX_LOAD_FACTOR 2
+
+// all pending requests are indexed twice. the key index maps the (uid,
+// function_id, sequence_number) tuple that packet_is_matching_response checks
+// to a bucket, the UID index maps the UID alone to a bucket. new pending
+// requests are appended to the end of their buckets. therefore, the first
+// matching pending request in a bucket is always the oldest one, as it was
+// the case with the former global pending request list
+static Node *_pending_request_key_buckets = NULL;
+static Node *_pending_request_uid_buckets = NULL;
+static uint32_t _pending_request_bucket_count = 0;
+static int _pending_request_count = 0;
+
+#define PENDING_REQUESTS_PER_SLAB 512
+#define PENDING_REQUEST_SLAB_IDLE_TIMEOUT 10000000 // 10 seconds in microseconds
+
+// PendingRequest objects are allocated in slabs and kept in a free list
+// instead of being allocated and freed one by one. the slabs are shared by
+// all clients and zombies. if a client turns into a zombie then its pending
+// requests are taken over as they are
+static Array _pending_request_slabs;
+static Node _free_pending_request_sentinel; // linked by key_node
+static int _live_pending_requests = 0;
+static int _max_live_pending_requests = 0; // high-water mark
+static int _peak_live_pending_requests = 0; // since the last idle check
+static Timer _pending_request_slab_idle_timer;
+
+#define PENDING_REQUEST_EXPIRY_WHEEL_SIZE 64 // must be a power of two
+#define PENDING_REQUEST_EXPIRY_TICKS_PER_MAX_AGE 32 // must be smaller than the wheel size
+#define PENDING_REQUEST_EXPIRY_MIN_TICK 10000 // microseconds
+
+// pending requests older than the configured maximum age are expired using a
+// hashed timer wheel. each pending request is put into the slot of the tick
+// after its deadline. the timer processes one slot per tick and only has to
+// look at the pending requests that are actually due
+static uint64_t _pending_request_max_age = 0; // microseconds, 0 disables expiry
+static uint64_t _pending_request_expiry_tick = 0; // microseconds
+static uint64_t _next_pending_request_expiry_tick = 0;
+static Node _pending_request_expiry_wheel[PENDING_REQUEST_EXPIRY_WHEEL_SIZE];
+static Timer _pending_request_expiry_timer;
+static uint32_t _expired_pending_requests = 0;
+
+// responses to plain socket clients are coalesced. they are collected in the
+// client backlog and flushed with a single write at the end of the event loop
+// iteration. if a coalescing delay is configured then a backlog is held back
+// until its oldest response reaches the delay or the backlog is large enough,
+// similar to TCP_CORK. websocket clients are not coalesced, because every
+// websocket frame is limited to one packet
+static bool _response_coalescing = false;
+static uint64_t _response_coalescing_delay = 0; // microseconds, 0 flushes every iteration
+static Node _unflushed_client_sentinel;
+static Timer _response_flush_timer;
+static uint64_t _response_flush_timer_deadline = 0; // microseconds, 0 if not armed
 
 static void network_handle_accept(void *opaque) {
 	Socket *server_socket = opaque;
@@ -65,7 +131,9 @@ static void network_handle_accept(void *opaque) {
 	char port[NI_MAXSERV];
 	char buffer[NI_MAXHOST + NI_MAXSERV + 4]; // 4 == strlen("[]:") + 1
 	char *name = "<unknown>";
-	Client *client;
+	bool websocket = server_socket->create_allocated == websocket_create_allocated;
+	bool sharded = false;
+	Client *client = NULL;
 
 	// accept new client socket
 	client_socket = socket_accept(server_socket, (struct sockaddr *)&address, &length);
@@ -94,8 +162,17 @@ static void network_handle_accept(void *opaque) {
 		name = buffer;
 	}
 
-	// create new client
-	client = network_create_client(name, &client_socket->base);
+	// create new client, preferably with its socket handled by a network shard
+#ifndef _WIN32
+	if (network_shard_get_count() > 0) {
+		client = network_shard_create_client(name, client_socket, websocket);
+		sharded = client != NULL;
+	}
+#endif
+
+	if (client == NULL) {
+		client = network_create_client(name, &client_socket->base);
+	}
 
 	if (client == NULL) {
 		socket_destroy(client_socket);
@@ -104,6 +181,12 @@ static void network_handle_accept(void *opaque) {
 		return;
 	}
 
+	// a network shard sends every packet to a websocket client in its own
+	// frame, so sharded websocket clients can be coalesced as well
+	if (_response_coalescing && (!websocket || sharded)) {
+		client->coalesce_responses = true;
+	}
+
 #ifdef BRICKD_WITH_RED_BRICK
 	client_send_red_brick_enumerate(client, ENUMERATION_TYPE_CONNECTED);
 #endif
@@ -121,8 +204,8 @@ static void network_open_server(Array *server_sockets, uint16_t port,
 	for (i = 0; i < server_sockets->count; ++i) {
 		server_socket = array_get(server_sockets, i);
 
-		if (event_add_source(server_socket->handle, EVENT_SOURCE_TYPE_GENERIC, "server",
-		                     EVENT_READ, network_handle_accept, server_socket) < 0) {
+		if (event_timing_add_source(server_socket->handle, EVENT_SOURCE_TYPE_GENERIC, "server",
+		                            EVENT_READ, network_handle_accept, server_socket) < 0) {
 			break;
 		}
 	}
@@ -131,7 +214,7 @@ static void network_open_server(Array *server_sockets, uint16_t port,
 		for (--i; i >= 0; --i) {
 			server_socket = array_get(server_sockets, i);
 
-			event_remove_source(server_socket->handle, EVENT_SOURCE_TYPE_GENERIC);
+			event_timing_remove_source(server_socket->handle, EVENT_SOURCE_TYPE_GENERIC);
 		}
 
 		for (i = 0; i < server_sockets->count; ++i) {
@@ -141,21 +224,366 @@ static void network_open_server(Array *server_sockets, uint16_t port,
 }
 
 static void network_destroy_server_socket(Socket *server_socket) {
-	event_remove_source(server_socket->handle, EVENT_SOURCE_TYPE_GENERIC);
+	event_timing_remove_source(server_socket->handle, EVENT_SOURCE_TYPE_GENERIC);
 	socket_destroy(server_socket);
 }
 
-// drop all pending requests for the given UID from the global list
+static uint32_t network_get_uid_hash(uint32_t uid) {
+	uint32_t hash = uid;
+
+	hash ^= hash >> 16;
+	hash *= 0x85EBCA6B;
+	hash ^= hash >> 13;
+	hash *= 0xC2B2AE35;
+	hash ^= hash >> 16;
+
+	return hash;
+}
+
+static uint32_t network_get_key_hash(PacketHeader *header) {
+	uint32_t key = (uint32_t)header->function_id << 4 |
+	               packet_header_get_sequence_number(header);
+
+	return network_get_uid_hash(header->uid ^ (key * 0x9E3779B1));
+}
+
+static Node *network_get_key_bucket(PacketHeader *header) {
+	return &_pending_request_key_buckets[network_get_key_hash(header) & (_pending_request_bucket_count - 1)];
+}
+
+static Node *network_get_uid_bucket(uint32_t uid) {
+	return &_pending_request_uid_buckets[network_get_uid_hash(uid) & (_pending_request_bucket_count - 1)];
+}
+
+static int network_resize_pending_request_index(uint32_t bucket_count) {
+	Node *key_buckets;
+	Node *uid_buckets;
+	Node *old_key_buckets = _pending_request_key_buckets;
+	Node *old_uid_buckets = _pending_request_uid_buckets;
+	uint32_t old_bucket_count = _pending_request_bucket_count;
+	uint32_t i;
+	Node *node;
+	PendingRequest *pending_request;
+
+	key_buckets = calloc(bucket_count, sizeof(Node));
+	uid_buckets = calloc(bucket_count, sizeof(Node));
+
+	if (key_buckets == NULL || uid_buckets == NULL) {
+		free(key_buckets);
+		free(uid_buckets);
+
+		errno = ENOMEM;
+
+		return -1;
+	}
+
+	for (i = 0; i < bucket_count; ++i) {
+		node_reset(&key_buckets[i]);
+		node_reset(&uid_buckets[i]);
+	}
+
+	_pending_request_key_buckets = key_buckets;
+	_pending_request_uid_buckets = uid_buckets;
+	_pending_request_bucket_count = bucket_count;
+
+	// all pending requests with the same key (or UID) are in the same old
+	// bucket. moving them in order to the end of their new bucket keeps their
+	// relative order intact
+	for (i = 0; i < old_bucket_count; ++i) {
+		while (old_key_buckets[i].next != &old_key_buckets[i]) {
+			node = old_key_buckets[i].next;
+			pending_request = containerof(node, PendingRequest, key_node);
+
+			node_remove(node);
+			node_insert_before(network_get_key_bucket(&pending_request->header), node);
+		}
+
+		while (old_uid_buckets[i].next != &old_uid_buckets[i]) {
+			node = old_uid_buckets[i].next;
+			pending_request = containerof(node, PendingRequest, uid_node);
+
+			node_remove(node);
+			node_insert_before(network_get_uid_bucket(pending_request->header.uid), node);
+		}
+	}
+
+	free(old_key_buckets);
+	free(old_uid_buckets);
+
+	return 0;
+}
+
+static int network_add_pending_request_slab(void) {
+	PendingRequest **slab = array_append(&_pending_request_slabs);
+	int i;
+
+	if (slab == NULL) {
+		return -1;
+	}
+
+	*slab = calloc(PENDING_REQUESTS_PER_SLAB, sizeof(PendingRequest));
+
+	if (*slab == NULL) {
+		array_remove(&_pending_request_slabs, _pending_request_slabs.count - 1, NULL);
+
+		errno = ENOMEM;
+
+		return -1;
+	}
+
+	for (i = 0; i < PENDING_REQUESTS_PER_SLAB; ++i) {
+		node_insert_before(&_free_pending_request_sentinel, &(*slab)[i].key_node);
+	}
+
+	log_debug("Added pending request slab, %d slab(s) for %d pending request(s) in total",
+	          _pending_request_slabs.count, _pending_request_slabs.count * PENDING_REQUESTS_PER_SLAB);
+
+	// the first slab is always kept, check for idle slabs beyond it
+	if (_pending_request_slabs.count == 2) {
+		_peak_live_pending_requests = _live_pending_requests;
+
+		if (timer_configure(&_pending_request_slab_idle_timer, PENDING_REQUEST_SLAB_IDLE_TIMEOUT,
+		                    PENDING_REQUEST_SLAB_IDLE_TIMEOUT) < 0) {
+			log_error("Could not start pending request slab idle timer: %s (%d)",
+			          get_errno_name(errno), errno);
+		}
+	}
+
+	return 0;
+}
+
+static void network_free_pending_request_slab(PendingRequest **slab) {
+	free(*slab);
+}
+
+// release all slabs after the given number of slabs, only valid while no
+// pending request is live
+static void network_trim_pending_request_slabs(int count) {
+	PendingRequest *slab;
+	int i;
+	int k;
+
+	// iterate backwards to avoid memmove in array_remove call
+	for (i = _pending_request_slabs.count - 1; i >= count; --i) {
+		array_remove(&_pending_request_slabs, i, (ItemDestroyFunction)network_free_pending_request_slab);
+	}
+
+	node_reset(&_free_pending_request_sentinel);
+
+	for (k = 0; k < _pending_request_slabs.count; ++k) {
+		slab = *(PendingRequest **)array_get(&_pending_request_slabs, k);
+
+		for (i = 0; i < PENDING_REQUESTS_PER_SLAB; ++i) {
+			node_insert_before(&_free_pending_request_sentinel, &slab[i].key_node);
+		}
+	}
+
+	log_debug("Trimmed pending request slabs to %d slab(s) (high-water mark: %d)",
+	          _pending_request_slabs.count, _max_live_pending_requests);
+}
+
+// release the slabs that were not needed since the last check, down to one
+// slab. the live pending requests are spread over all slabs, therefore slabs
+// are only released while no pending request is live. otherwise the next
+// check tries again. a client with bursts of pending requests keeps its slabs
+// as long as its bursts are less than a check interval apart
+static void network_release_idle_pending_request_slabs(void *opaque) {
+	int needed = MAX(1, (_peak_live_pending_requests + PENDING_REQUESTS_PER_SLAB - 1) / PENDING_REQUESTS_PER_SLAB);
+
+	(void)opaque;
+
+	if (_live_pending_requests == 0 && _pending_request_slabs.count > needed) {
+		network_trim_pending_request_slabs(needed);
+	}
+
+	_peak_live_pending_requests = _live_pending_requests;
+
+	if (_pending_request_slabs.count <= 1) {
+		timer_configure(&_pending_request_slab_idle_timer, 0, 0);
+	}
+}
+
+static PendingRequest *network_allocate_pending_request(void) {
+	Node *node;
+	PendingRequest *pending_request;
+
+	if (_free_pending_request_sentinel.next == &_free_pending_request_sentinel &&
+	    network_add_pending_request_slab() < 0) {
+		return NULL;
+	}
+
+	node = _free_pending_request_sentinel.next;
+
+	node_remove(node);
+
+	pending_request = containerof(node, PendingRequest, key_node);
+
+	memset(pending_request, 0, sizeof(PendingRequest));
+
+	++_live_pending_requests;
+
+	if (_live_pending_requests > _max_live_pending_requests) {
+		_max_live_pending_requests = _live_pending_requests;
+	}
+
+	if (_live_pending_requests > _peak_live_pending_requests) {
+		_peak_live_pending_requests = _live_pending_requests;
+	}
+
+	return pending_request;
+}
+
+// all pending requests have to be removed before destroying the index
+static void network_destroy_pending_request_index(void) {
+	if (_pending_request_count > 0) {
+		log_warn("Destroying pending request index while %d request(s) are still pending",
+		         _pending_request_count);
+	}
+
+	free(_pending_request_key_buckets);
+	free(_pending_request_uid_buckets);
+
+	_pending_request_key_buckets = NULL;
+	_pending_request_uid_buckets = NULL;
+	_pending_request_bucket_count = 0;
+}
+
+static void network_add_pending_request(PendingRequest *pending_request) {
+	node_insert_before(network_get_key_bucket(&pending_request->header), &pending_request->key_node);
+	node_insert_before(network_get_uid_bucket(pending_request->header.uid), &pending_request->uid_node);
+
+	++_pending_request_count;
+
+	if ((uint32_t)_pending_request_count > _pending_request_bucket_count * PENDING_REQUEST_MAX_LOAD_FACTOR &&
+	    _pending_request_bucket_count < PENDING_REQUEST_MAX_BUCKET_COUNT) {
+		log_debug("Growing pending request index to %u buckets for %d pending request(s)",
+		          _pending_request_bucket_count * 2, _pending_request_count);
+
+		if (network_resize_pending_request_index(_pending_request_bucket_count * 2) < 0) {
+			// not fatal, the index just stays more crowded than intended
+			log_warn("Could not grow pending request index to %u buckets: %s (%d)",
+			         _pending_request_bucket_count * 2, get_errno_name(errno), errno);
+		}
+	}
+}
+
+static void network_report_expired_pending_requests(void) {
+	int i;
+	Client *client;
+
+	for (i = 0; i < _clients.count; ++i) {
+		client = array_get(&_clients, i);
+
+		if (client->unreported_expired_pending_requests == 0) {
+			continue;
+		}
+
+		log_warn("Expired %d pending request(s) of client ("CLIENT_SIGNATURE_FORMAT") older than %d msec, %u expired in total",
+		         client->unreported_expired_pending_requests, client_expand_signature(client),
+		         (int)(_pending_request_max_age / 1000), client->expired_pending_requests);
+
+		client->unreported_expired_pending_requests = 0;
+	}
+}
+
+static void network_handle_pending_request_expiry(void *opaque) {
+	uint64_t now = monotonic_microtime();
+	uint64_t tick = now / _pending_request_expiry_tick;
+	int slots = 0;
+	Node *slot;
+	Node *pending_request_expiry_node;
+	Node *pending_request_expiry_node_next;
+	PendingRequest *pending_request;
+	Zombie *zombie;
+	int expired = 0;
+
+	(void)opaque;
+
+	while (_next_pending_request_expiry_tick <= tick && slots < PENDING_REQUEST_EXPIRY_WHEEL_SIZE) {
+		slot = &_pending_request_expiry_wheel[_next_pending_request_expiry_tick & (PENDING_REQUEST_EXPIRY_WHEEL_SIZE - 1)];
+		pending_request_expiry_node = slot->next;
+
+		while (pending_request_expiry_node != slot) {
+			pending_request = containerof(pending_request_expiry_node,
+			                              PendingRequest, expiry_node);
+			pending_request_expiry_node_next = pending_request_expiry_node->next;
+
+			// the slot might also contain pending requests that are due in a
+			// later round of the wheel
+			if (pending_request->timestamp + _pending_request_max_age <= now) {
+				zombie = pending_request->zombie;
+
+				if (pending_request->client != NULL) {
+					++pending_request->client->expired_pending_requests;
+					++pending_request->client->unreported_expired_pending_requests;
+				}
+
+				pending_request_remove_and_free(pending_request);
+
+				if (zombie != NULL && zombie->pending_request_count == 0) {
+					zombie->finished = true;
+				}
+
+				++expired;
+			}
+
+			pending_request_expiry_node = pending_request_expiry_node_next;
+		}
+
+		++_next_pending_request_expiry_tick;
+		++slots;
+	}
+
+	// if the timer was delayed by more than a whole round of the wheel then
+	// all slots got processed once, continue with the current tick
+	if (_next_pending_request_expiry_tick <= tick) {
+		_next_pending_request_expiry_tick = tick + 1;
+	}
+
+	if (expired > 0) {
+		_expired_pending_requests += expired;
+
+		network_report_expired_pending_requests();
+	}
+}
+
+static void network_handle_response_flush(void *opaque) {
+	(void)opaque;
+
+	// nothing to do here, the backlogs that reached the coalescing delay are
+	// flushed at the end of this event loop iteration
+	_response_flush_timer_deadline = 0;
+}
+
+static void network_schedule_pending_request_expiry(PendingRequest *pending_request) {
+	uint64_t tick;
+
+	if (_pending_request_max_age == 0) {
+		node_reset(&pending_request->expiry_node);
+
+		return;
+	}
+
+	// use the tick after the deadline to ensure that all pending requests in
+	// a slot are due once the slot gets processed
+	tick = (pending_request->timestamp + _pending_request_max_age) / _pending_request_expiry_tick + 1;
+
+	node_insert_before(&_pending_request_expiry_wheel[tick & (PENDING_REQUEST_EXPIRY_WHEEL_SIZE - 1)],
+	                   &pending_request->expiry_node);
+}
+
+// drop all pending requests for the given UID from the index
 static int network_drop_pending_requests(uint32_t uid) {
-	Node *pending_request_global_node = _pending_request_sentinel.next;
-	Node *pending_request_global_node_next;
+	Node *bucket = network_get_uid_bucket(uid);
+	Node *pending_request_uid_node = bucket->next;
+	Node *pending_request_uid_node_next;
 	PendingRequest *pending_request;
 	int count = 0;
 
-	while (pending_request_global_node != &_pending_request_sentinel) {
-		pending_request = containerof(pending_request_global_node,
-		                              PendingRequest, global_node);
-		pending_request_global_node_next = pending_request_global_node->next;
+	while (pending_request_uid_node != bucket) {
+		pending_request = containerof(pending_request_uid_node,
+		                              PendingRequest, uid_node);
+		pending_request_uid_node_next = pending_request_uid_node->next;
 
 		if (pending_request->header.uid == uid) {
 			pending_request_remove_and_free(pending_request);
@@ -163,7 +591,7 @@ static int network_drop_pending_requests(uint32_t uid) {
 			++count;
 		}
 
-		pending_request_global_node = pending_request_global_node_next;
+		pending_request_uid_node = pending_request_uid_node_next;
 	}
 
 	return count;
@@ -171,19 +599,112 @@ static int network_drop_pending_requests(uint32_t uid) {
 
 int network_init(void) {
 	int phase = 0;
+	int i;
 	uint16_t plain_port = (uint16_t)config_get_option_value("listen.plain_port")->integer;
 	uint16_t websocket_port = (uint16_t)config_get_option_value("listen.websocket_port")->integer;
+	int worker_threads = config_get_option_value("network.worker_threads")->integer;
 
 	log_debug("Initializing network subsystem");
 
-	node_reset(&_pending_request_sentinel);
-
 	if (config_get_option_value("authentication.secret")->string != NULL) {
 		log_info("Authentication is enabled");
 
 		_next_authentication_nonce = get_random_uint32();
 	}
 
+	_pending_request_max_age = (uint64_t)config_get_option_value("pending_requests.max_age")->integer * 1000;
+	_response_coalescing = config_get_option_value("client.response_coalescing")->boolean;
+	_response_coalescing_delay = (uint64_t)config_get_option_value("client.response_coalescing_delay")->integer;
+
+	node_reset(&_unflushed_client_sentinel);
+
+	// create pending request slab array
+	if (array_create(&_pending_request_slabs, 8, sizeof(PendingRequest *), true) < 0) {
+		log_error("Could not create pending request slab array: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	node_reset(&_free_pending_request_sentinel);
+
+	phase = 1;
+
+	// create pending request slab idle timer
+	if (event_timing_create_timer(&_pending_request_slab_idle_timer, "pending-request-slab-idle",
+	                              network_release_idle_pending_request_slabs, NULL) < 0) {
+		log_error("Could not create pending request slab idle timer: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 2;
+
+	// create pending request index
+	if (network_resize_pending_request_index(PENDING_REQUEST_INITIAL_BUCKET_COUNT) < 0) {
+		log_error("Could not create pending request index: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 3;
+
+	// create pending request expiry timer
+	for (i = 0; i < PENDING_REQUEST_EXPIRY_WHEEL_SIZE; ++i) {
+		node_reset(&_pending_request_expiry_wheel[i]);
+	}
+
+	if (_pending_request_max_age > 0) {
+		_pending_request_expiry_tick = _pending_request_max_age / PENDING_REQUEST_EXPIRY_TICKS_PER_MAX_AGE;
+
+		if (_pending_request_expiry_tick < PENDING_REQUEST_EXPIRY_MIN_TICK) {
+			_pending_request_expiry_tick = PENDING_REQUEST_EXPIRY_MIN_TICK;
+		}
+
+		_next_pending_request_expiry_tick = monotonic_microtime() / _pending_request_expiry_tick;
+
+		log_info("Expiring pending requests older than %d msec",
+		         (int)(_pending_request_max_age / 1000));
+
+		if (event_timing_create_timer(&_pending_request_expiry_timer, "pending-request-expiry",
+		                              network_handle_pending_request_expiry, NULL) < 0) {
+			log_error("Could not create pending request expiry timer: %s (%d)",
+			          get_errno_name(errno), errno);
+
+			goto cleanup;
+		}
+
+		phase = 4;
+
+		if (timer_configure(&_pending_request_expiry_timer, _pending_request_expiry_tick,
+		                    _pending_request_expiry_tick) < 0) {
+			log_error("Could not start pending request expiry timer: %s (%d)",
+			          get_errno_name(errno), errno);
+
+			goto cleanup;
+		}
+	}
+
+	phase = 4;
+
+	// create response flush timer
+	if (_response_coalescing && _response_coalescing_delay > 0) {
+		log_info("Coalescing responses to clients for up to %d usec",
+		         (int)_response_coalescing_delay);
+
+		if (event_timing_create_timer(&_response_flush_timer, "response-flush",
+		                              network_handle_response_flush, NULL) < 0) {
+			log_error("Could not create response flush timer: %s (%d)",
+			          get_errno_name(errno), errno);
+
+			goto cleanup;
+		}
+	}
+
+	phase = 5;
+
 	// create client array. the Client struct is not relocatable, because a
 	// pointer to it is passed as opaque parameter to the event subsystem
 	if (array_create(&_clients, 32, sizeof(Client), false) < 0) {
@@ -193,7 +714,21 @@ int network_init(void) {
 		goto cleanup;
 	}
 
-	phase = 1;
+	phase = 6;
+
+	// start network shards. they are only stopped after all clients are
+	// destroyed, the sharded clients have to remove themselves from them
+#ifdef _WIN32
+	if (worker_threads > 0) {
+		log_warn("Network worker threads are not supported on Windows, ignoring network.worker_threads option");
+	}
+#else
+	if (network_shard_init(worker_threads) < 0) {
+		goto cleanup;
+	}
+#endif
+
+	phase = 7;
 
 	// create zombie array. the Zombie struct is not relocatable, because a
 	// pointer to it is passed as opaque parameter to its timer object
@@ -204,7 +739,7 @@ int network_init(void) {
 		goto cleanup;
 	}
 
-	phase = 2;
+	phase = 8;
 
 	// create plain server sockets. the Socket struct is not relocatable, because a
 	// pointer to it is passed as opaque parameter to accept function
@@ -217,7 +752,7 @@ int network_init(void) {
 
 	network_open_server(&_plain_server_sockets, plain_port, socket_create_allocated);
 
-	phase = 3;
+	phase = 9;
 
 	// create websocket server sockets. the Socket struct is not relocatable, because a
 	// pointer to it is passed as opaque parameter to accept function
@@ -236,7 +771,7 @@ int network_init(void) {
 		network_open_server(&_websocket_server_sockets, websocket_port, websocket_create_allocated);
 	}
 
-	phase = 4;
+	phase = 10;
 
 	if (_plain_server_sockets.count + _websocket_server_sockets.count == 0) {
 		log_error("Could not open any socket to listen to");
@@ -244,40 +779,114 @@ int network_init(void) {
 		goto cleanup;
 	}
 
-	phase = 5;
+	phase = 11;
+
+	// start metrics listener, if enabled
+	if (metrics_server_init() < 0) {
+		goto cleanup;
+	}
+
+	phase = 12;
 
 cleanup:
 	switch (phase) { // no breaks, all cases fall through intentionally
-	case 4:
+	case 11:
+	case 10:
 		array_destroy(&_websocket_server_sockets, (ItemDestroyFunction)network_destroy_server_socket);
 		// fall through
 
-	case 3:
+	case 9:
 		array_destroy(&_plain_server_sockets, (ItemDestroyFunction)network_destroy_server_socket);
 		// fall through
 
-	case 2:
+	case 8:
 		array_destroy(&_zombies, (ItemDestroyFunction)zombie_destroy);
 		// fall through
 
-	case 1:
+	case 7:
+#ifndef _WIN32
+		network_shard_exit();
+#endif
+		// fall through
+
+	case 6:
 		array_destroy(&_clients, (ItemDestroyFunction)client_destroy);
 		// fall through
 
+	case 5:
+		if (_response_coalescing && _response_coalescing_delay > 0) {
+			event_timing_destroy_timer(&_response_flush_timer);
+		}
+
+		// fall through
+
+	case 4:
+		if (_pending_request_max_age > 0) {
+			event_timing_destroy_timer(&_pending_request_expiry_timer);
+		}
+
+		// fall through
+
+	case 3:
+		network_destroy_pending_request_index();
+		// fall through
+
+	case 2:
+		event_timing_destroy_timer(&_pending_request_slab_idle_timer);
+		// fall through
+
+	case 1:
+		array_destroy(&_pending_request_slabs, (ItemDestroyFunction)network_free_pending_request_slab);
+		// fall through
+
 	default:
 		break;
 	}
 
-	return phase == 5 ? 0 : -1;
+	return phase == 12 ? 0 : -1;
 }
 
 void network_exit(void) {
+	uint32_t write_count;
+	uint32_t response_count;
+
 	log_debug("Shutting down network subsystem");
 
+	metrics_server_exit();
+
 	array_destroy(&_websocket_server_sockets, (ItemDestroyFunction)network_destroy_server_socket);
 	array_destroy(&_plain_server_sockets, (ItemDestroyFunction)network_destroy_server_socket);
 	array_destroy(&_clients, (ItemDestroyFunction)client_destroy); // might call network_create_zombie
 	array_destroy(&_zombies, (ItemDestroyFunction)zombie_destroy);
+
+#ifndef _WIN32
+	network_shard_exit();
+#endif
+
+	client_get_write_statistics(&write_count, &response_count);
+
+	log_debug("Sent %u response(s) to clients in %u write(s)", response_count, write_count);
+
+	if (_response_coalescing && _response_coalescing_delay > 0) {
+		event_timing_destroy_timer(&_response_flush_timer);
+	}
+
+	packet_buffer_free_pool();
+
+	if (_pending_request_max_age > 0) {
+		log_debug("Expired %u pending request(s) in total", _expired_pending_requests);
+
+		event_timing_destroy_timer(&_pending_request_expiry_timer);
+	}
+
+	network_destroy_pending_request_index();
+
+	log_debug("Releasing %d pending request slab(s) (high-water mark: %d)",
+	          _pending_request_slabs.count, _max_live_pending_requests);
+
+	event_timing_destroy_timer(&_pending_request_slab_idle_timer);
+
+	array_destroy(&_pending_request_slabs, (ItemDestroyFunction)network_free_pending_request_slab);
 }
 
 Client *network_create_client(const char *name, IO *io) {
@@ -331,6 +940,69 @@ int network_create_zombie(Client *client) {
 	return 0;
 }
 
+// puts a coalescing client with a new backlog into the list of clients that
+// network_flush_responses has to look at. its coalescing delay starts now
+void network_add_unflushed_client(Client *client) {
+	if (client->flush_node.next != &client->flush_node) {
+		return; // already in the list
+	}
+
+	client->flush_deadline = monotonic_microtime() + _response_coalescing_delay;
+
+	node_insert_before(&_unflushed_client_sentinel, &client->flush_node);
+}
+
+// flushes the backlogs of all coalescing clients that have unflushed
+// responses, called at the end of every event loop iteration
+void network_flush_responses(void) {
+	Node *node = _unflushed_client_sentinel.next;
+	Node *next;
+	Client *client;
+	uint64_t now = 0;
+	uint64_t next_deadline = 0;
+
+	while (node != &_unflushed_client_sentinel) {
+		next = node->next;
+		client = containerof(node, Client, flush_node);
+
+		if (_response_coalescing_delay > 0 && !client->disconnected &&
+		    client->response_backlog_length < CLIENT_MAX_COALESCED_LENGTH) {
+			if (now == 0) {
+				now = monotonic_microtime();
+			}
+
+			if (now < client->flush_deadline) {
+				if (next_deadline == 0 || client->flush_deadline < next_deadline) {
+					next_deadline = client->flush_deadline;
+				}
+
+				node = next;
+
+				continue;
+			}
+		}
+
+		node_remove(node);
+		node_reset(node);
+
+		client_flush_responses(client);
+
+		node = next;
+	}
+
+	// the timer has to wake up the event loop for the next deadline, unless
+	// it is already armed for an earlier one
+	if (next_deadline > 0 &&
+	    (_response_flush_timer_deadline == 0 || next_deadline < _response_flush_timer_deadline)) {
+		if (timer_configure(&_response_flush_timer, next_deadline - now, 0) < 0) {
+			log_error("Could not start response flush timer: %s (%d)",
+			          get_errno_name(errno), errno);
+		} else {
+			_response_flush_timer_deadline = next_deadline;
+		}
+	}
+}
+
 // remove clients that got marked as disconnected and finished zombies
 void network_cleanup_clients_and_zombies(void) {
 	int i;
@@ -366,7 +1038,9 @@ PendingRequest *network_client_expects_response(Client *client, Packet *request)
 	PendingRequest *pending_request;
 	char packet_signature[PACKET_MAX_SIGNATURE_LENGTH];
 
-	// FIXME: drop pending requests that are older than configurable maximum age
+	// pending requests older than pending_requests.max_age are expired by the
+	// expiry timer, but the list can still fill up if the maximum age is too
+	// long or disabled
 	if (client->pending_request_count >= CLIENT_MAX_PENDING_REQUESTS) {
 		pending_requests_to_drop = client->pending_request_count - CLIENT_MAX_PENDING_REQUESTS + CLIENT_PENDING_REQUESTS_DROP_COUNT;
 
@@ -385,25 +1059,28 @@ PendingRequest *network_client_expects_response(Client *client, Packet *request)
 		}
 	}
 
-	pending_request = calloc(1, sizeof(PendingRequest));
+	pending_request = network_allocate_pending_request();
 
 	if (pending_request == NULL) {
 		log_error("Could not allocate pending request: %s (%d)",
-		          get_errno_name(ENOMEM), ENOMEM);
+		          get_errno_name(errno), errno);
 
 		return NULL;
 	}
 
-	node_insert_before(&_pending_request_sentinel, &pending_request->global_node);
-	node_insert_before(&client->pending_request_sentinel, &pending_request->client_node);
-
-	++client->pending_request_count;
-
 	pending_request->client = client;
 	pending_request->zombie = NULL;
+	pending_request->timestamp = monotonic_microtime();
+	pending_request->trace_id = packet_trace_get_current_id();
 
 	memcpy(&pending_request->header, &request->header, sizeof(PacketHeader));
 
+	network_add_pending_request(pending_request);
+	network_schedule_pending_request_expiry(pending_request);
+	node_insert_before(&client->pending_request_sentinel, &pending_request->client_node);
+
+	++client->pending_request_count;
+
 	log_packet_debug("Added pending request (%s) for client ("CLIENT_SIGNATURE_FORMAT")",
 	                 packet_get_request_signature(packet_signature, request),
 	                 client_expand_signature(client));
@@ -411,6 +1088,49 @@ PendingRequest *network_client_expects_response(Client *client, Packet *request)
 	return pending_request;
 }
 
+void network_remove_pending_request(PendingRequest *pending_request) {
+	node_remove(&pending_request->key_node);
+	node_remove(&pending_request->uid_node);
+	node_remove(&pending_request->expiry_node);
+
+	--_pending_request_count;
+}
+
+// return a pending request that was already removed from the index to its slab
+void network_free_pending_request(PendingRequest *pending_request) {
+	node_insert_after(&_free_pending_request_sentinel, &pending_request->key_node);
+
+	--_live_pending_requests;
+}
+
+void network_get_pending_request_usage(int *live, int *max_live, int *allocated) {
+	*live = _live_pending_requests;
+	*max_live = _max_live_pending_requests;
+	*allocated = _pending_request_slabs.count * PENDING_REQUESTS_PER_SLAB;
+}
+
+// returns the oldest pending request matching the response. if a client is
+// given then only pending requests of this client are considered
+PendingRequest *network_find_pending_request(Packet *response, Client *client) {
+	Node *bucket = network_get_key_bucket(&response->header);
+	Node *pending_request_key_node = bucket->next;
+	PendingRequest *pending_request;
+
+	while (pending_request_key_node != bucket) {
+		pending_request = containerof(pending_request_key_node,
+		                              PendingRequest, key_node);
+
+		if ((client == NULL || pending_request->client == client) &&
+		    packet_is_matching_response(response, &pending_request->header)) {
+			return pending_request;
+		}
+
+		pending_request_key_node = pending_request_key_node->next;
+	}
+
+	return NULL;
+}
+
 void network_dispatch_response(Packet *response) {
 	EnumerateCallback *enumerate_callback;
 	int dropped_requests;
@@ -418,11 +1138,19 @@ void network_dispatch_response(Packet *response) {
 	char packet_signature[PACKET_MAX_SIGNATURE_LENGTH];
 	int i;
 	Client *client;
-	Node *pending_request_global_node;
 	PendingRequest *pending_request;
+	PacketBuffer *response_buffer = NULL;
+	Stack *stack;
 
 	packet_add_trace(response);
 
+	if (traffic_capture_is_enabled()) {
+		stack = hardware_get_route(response->header.uid);
+
+		traffic_capture_record(TRAFFIC_CAPTURE_RECORD_RESPONSE, 0,
+		                       stack != NULL ? stack->capture_source : 0, response);
+	}
+
 	if (packet_header_get_sequence_number(&response->header) == 0) {
 		if (response->header.function_id == CALLBACK_ENUMERATE) {
 			enumerate_callback = (EnumerateCallback *)response;
@@ -432,8 +1160,8 @@ void network_dispatch_response(Packet *response) {
 			// device are stale. the device can never have received the requests
 			// and will never respond to them.
 			//
-			// if a new request is received then it is added to the end of the
-			// global pending request list. if the response for this request
+			// if a new request is received then it is added to the end of its
+			// bucket in the pending request index. if the response for this request
 			// arrives then one of the stale pending requests will match it.
 			// this can result in misrouting responses. to avoid this drop all
 			// pending request for a given UID if an enumerate-connected
@@ -475,34 +1203,38 @@ void network_dispatch_response(Packet *response) {
 		for (i = 0; i < _clients.count; ++i) {
 			client = array_get(&_clients, i);
 
-			client_dispatch_response(client, NULL, response, true, false);
+			if (!client_is_subscribed_to_callback(client, response)) {
+				continue;
+			}
+
+			client_dispatch_response(client, NULL, response, &response_buffer, true, false);
+		}
+
+		if (response_buffer != NULL) {
+			packet_buffer_unref(response_buffer);
 		}
 	} else if (_clients.count + _zombies.count > 0) {
 		log_packet_debug("Dispatching response (%s) to %d client(s) and %d zombies(s)",
 		                 packet_get_response_signature(packet_signature, response),
 		                 _clients.count, _zombies.count);
 
-		pending_request_global_node = _pending_request_sentinel.next;
+		pending_request = network_find_pending_request(response, NULL);
 
-		while (pending_request_global_node != &_pending_request_sentinel) {
-			pending_request = containerof(pending_request_global_node,
-			                              PendingRequest, global_node);
+		if (pending_request != NULL) {
+			hardware_record_response_latency(response->header.uid,
+			                                 monotonic_microtime() - pending_request->timestamp);
 
-			if (packet_is_matching_response(response, &pending_request->header)) {
-				if (pending_request->client != NULL) {
-					packet_add_trace(response);
-					client_dispatch_response(pending_request->client, pending_request,
-					                         response, false, false);
-				} else {
-					packet_add_trace(response);
-					zombie_dispatch_response(pending_request->zombie, pending_request,
-					                         response);
-				}
-
-				return;
+			if (pending_request->client != NULL) {
+				packet_add_trace(response);
+				client_dispatch_response(pending_request->client, pending_request,
+				                         response, NULL, false, false);
+			} else {
+				packet_add_trace(response);
+				zombie_dispatch_response(pending_request->zombie, pending_request,
+				                         response);
 			}
 
-			pending_request_global_node = pending_request_global_node->next;
+			return;
 		}
 
 		log_warn("Broadcasting response (%s) because no client/zombie has a matching pending request",
@@ -513,7 +1245,11 @@ void network_dispatch_response(Packet *response) {
 		for (i = 0; i < _clients.count; ++i) {
 			client = array_get(&_clients, i);
 
-			client_dispatch_response(client, NULL, response, true, false);
+			client_dispatch_response(client, NULL, response, &response_buffer, true, false);
+		}
+
+		if (response_buffer != NULL) {
+			packet_buffer_unref(response_buffer);
 		}
 	} else {
 		log_packet_debug("No clients/zombies connected, dropping response (%s)",
@@ -523,6 +1259,89 @@ void network_dispatch_response(Packet *response) {
 	}
 }
 
+static const MetricFamily _network_clients = {
+	"brickd_clients", METRIC_TYPE_GAUGE,
+	"Number of connected clients."
+};
+
+static const MetricFamily _network_zombies = {
+	"brickd_zombies", METRIC_TYPE_GAUGE,
+	"Number of disconnected clients still waiting for responses to pending requests."
+};
+
+static const MetricFamily _network_pending_requests = {
+	"brickd_pending_requests", METRIC_TYPE_GAUGE,
+	"Number of pending requests of all clients and zombies."
+};
+
+static const MetricFamily _network_pending_requests_max = {
+	"brickd_pending_requests_max", METRIC_TYPE_GAUGE,
+	"Highest number of pending requests since start."
+};
+
+static const MetricFamily _network_pending_requests_allocated = {
+	"brickd_pending_requests_allocated", METRIC_TYPE_GAUGE,
+	"Number of allocated pending request slots."
+};
+
+static const MetricFamily _network_expired_pending_requests = {
+	"brickd_expired_pending_requests_total", METRIC_TYPE_COUNTER,
+	"Number of pending requests that expired without a response."
+};
+
+static const MetricFamily _network_packet_buffers = {
+	"brickd_packet_buffers", METRIC_TYPE_GAUGE,
+	"Number of packet buffers held by response backlogs."
+};
+
+static const MetricFamily _network_pooled_packet_buffers = {
+	"brickd_packet_buffers_pooled", METRIC_TYPE_GAUGE,
+	"Number of released packet buffers kept for reuse."
+};
+
+static const MetricFamily _network_writes = {
+	"brickd_client_writes_all_total", METRIC_TYPE_COUNTER,
+	"Number of writes to all clients since start, including disconnected ones."
+};
+
+static const MetricFamily _network_responses = {
+	"brickd_client_responses_all_total", METRIC_TYPE_COUNTER,
+	"Number of responses sent to all clients since start, including disconnected ones."
+};
+
+void network_collect_metrics(Metrics *metrics) {
+	int live;
+	int max_live;
+	int allocated;
+	int pooled;
+	uint32_t write_count;
+	uint32_t response_count;
+	int i;
+
+	network_get_pending_request_usage(&live, &max_live, &allocated);
+
+	metrics_add(metrics, &_network_clients, _clients.count, NULL);
+	metrics_add(metrics, &_network_zombies, _zombies.count, NULL);
+	metrics_add(metrics, &_network_pending_requests, live, NULL);
+	metrics_add(metrics, &_network_pending_requests_max, max_live, NULL);
+	metrics_add(metrics, &_network_pending_requests_allocated, allocated, NULL);
+	metrics_add(metrics, &_network_expired_pending_requests, _expired_pending_requests, NULL);
+
+	packet_buffer_get_usage(&live, &pooled);
+
+	metrics_add(metrics, &_network_packet_buffers, live, NULL);
+	metrics_add(metrics, &_network_pooled_packet_buffers, pooled, NULL);
+
+	client_get_write_statistics(&write_count, &response_count);
+
+	metrics_add(metrics, &_network_writes, write_count, NULL);
+	metrics_add(metrics, &_network_responses, response_count, NULL);
+
+	for (i = 0; i < _clients.count; ++i) {
+		client_collect_metrics(array_get(&_clients, i), metrics);
+	}
+}
+
 #ifdef BRICKD_WITH_RED_BRICK
 
 void network_announce_red_brick_disconnect(void) {
@@ -26,6 +26,7 @@
 #include <daemonlib/packet.h>
 
 #include "client.h"
+#include "metrics.h"
 
 int network_init(void);
 void network_exit(void);
@@ -33,11 +34,19 @@ void network_exit(void);
 Client *network_create_client(const char *name, IO *io);
 int network_create_zombie(Client *client);
 
+void network_add_unflushed_client(Client *client);
+void network_flush_responses(void);
 void network_cleanup_clients_and_zombies(void);
 
 PendingRequest *network_client_expects_response(Client *client, Packet *request);
+void network_remove_pending_request(PendingRequest *pending_request);
+void network_free_pending_request(PendingRequest *pending_request);
+void network_get_pending_request_usage(int *live, int *max_live, int *allocated);
+PendingRequest *network_find_pending_request(Packet *response, Client *client);
 void network_dispatch_response(Packet *response);
 
+void network_collect_metrics(Metrics *metrics);
+
 #ifdef BRICKD_WITH_RED_BRICK
 
 void network_announce_red_brick_disconnect(void);
@@ -0,0 +1,1096 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * network_shard.c: Client I/O on worker threads with their own event loops
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * a network shard is a worker thread that owns the sockets of a subset of the
+ * clients. it runs its own poll loop, does all socket reads and writes for
+ * its clients, including the WebSocket framing, and splits the received byte
+ * stream into validated requests.
+ *
+ * the Client objects themselves stay on the main thread, together with the
+ * pending requests, the authentication and the hardware. a sharded client
+ * uses a NetworkShardIO object as its I/O object. each shard is connected to
+ * the main thread by two lock-free single producer, single consumer queues:
+ *
+ * - inbound (shard -> main): blocks of complete requests and disconnects
+ * - outbound (main -> shard): new sockets, removed clients and responses
+ *
+ * a pipe per direction wakes up the other side if a record is committed to
+ * an empty queue. if the outbound queue is full then the main thread keeps
+ * the responses in the client backlogs and the shard reports back once it
+ * made room again. the daemonlib event loop is a process wide singleton,
+ * therefore the shards use poll directly instead.
+ *
+ * client IDs are a combination of a slot index and a generation counter. a
+ * slot is reused only with a new generation, so records for an already
+ * removed client that are still in a queue are ignored.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <daemonlib/config.h>
+#include <daemonlib/event.h>
+#include <daemonlib/log.h>
+#include <daemonlib/packet.h>
+#include <daemonlib/pipe.h>
+#include <daemonlib/threads.h>
+#include <daemonlib/utils.h>
+
+#include "network_shard.h"
+
+#include "event_timing.h"
+#include "network.h"
+#include "packet_reader.h"
+#include "shard_queue.h"
+#include "websocket.h"
+
+static LogSource _log_source = LOG_SOURCE_INITIALIZER;
+
+#define NETWORK_SHARD_QUEUE_SIZE (1024 * 1024) // must be a power of two
+#define NETWORK_SHARD_MAX_RECEIVE_SIZE 32768 // has to fit into a queue record
+#define NETWORK_SHARD_MAX_OUTPUT_LENGTH (2 * 1024 * 1024) // per client
+#define NETWORK_SHARD_MAX_RECORDS_PER_NOTIFY 256
+#define NETWORK_SHARD_BLOCKED_POLL_TIMEOUT 1 // milliseconds
+
+typedef enum {
+	NETWORK_SHARD_RECORD_ADD = 0, // outbound
+	NETWORK_SHARD_RECORD_REMOVE, // outbound
+	NETWORK_SHARD_RECORD_DATA, // both directions
+	NETWORK_SHARD_RECORD_DISCONNECTED, // inbound
+	NETWORK_SHARD_RECORD_STOP, // outbound
+	NETWORK_SHARD_RECORD_DRAINED // inbound
+} NetworkShardRecordType;
+
+typedef struct {
+	Socket *socket;
+	bool packet_writes;
+} NetworkShardAddRecord;
+
+typedef struct {
+	uint32_t id;
+	Socket *socket; // NULL after the connection got closed
+	bool packet_writes; // send every packet in its own WebSocket frame
+	bool blocked; // received requests are waiting for room in the inbound queue
+	bool disconnect_pending; // disconnect is waiting for room in the inbound queue
+	int live_index;
+	PacketReader reader;
+	uint8_t *output;
+	int output_allocated;
+	int output_offset;
+	int output_length;
+	int frame_offset; // bytes of the WebSocket frame of the first packet that are already sent
+	uint32_t dropped_responses;
+} NetworkShardConnection;
+
+typedef struct _NetworkShard NetworkShard;
+
+struct _NetworkShard {
+	int index;
+	Thread thread;
+	Pipe wakeup_pipe; // main -> shard
+	Pipe notify_pipe; // shard -> main
+	ShardQueue inbound; // shard -> main
+	ShardQueue outbound; // main -> shard
+	bool outbound_full; // set by the main thread, cleared by the shard thread
+
+	// only accessed by the main thread
+	Client *clients[NETWORK_SHARD_MAX_CLIENTS];
+	uint32_t client_ids[NETWORK_SHARD_MAX_CLIENTS];
+	uint16_t next_generation;
+	int client_count;
+
+	// only accessed by the shard thread
+	NetworkShardConnection *connections[NETWORK_SHARD_MAX_CLIENTS];
+	int live_slots[NETWORK_SHARD_MAX_CLIENTS];
+	int live_count;
+	int receive_size;
+	bool drained_pending; // drained record is waiting for room in the inbound queue
+	uint32_t read_count;
+	uint32_t write_count;
+};
+
+typedef struct {
+	IO base;
+	NetworkShard *shard;
+	uint32_t id;
+} NetworkShardIO;
+
+static NetworkShard *_shards = NULL;
+static int _shard_count = 0;
+
+#define network_shard_get_slot(id) ((int)((id) & 0xFFFF))
+
+static void network_shard_wake(Pipe *pipe) {
+	uint8_t byte = 0;
+
+	// a full pipe already guarantees a wake-up, therefore the pipe is
+	// non-blocking and would-block errors can be ignored
+	if (pipe_write(pipe, &byte, sizeof(byte)) < 0 && !errno_would_block()) {
+		log_error("Could not write to network shard pipe: %s (%d)",
+		          get_errno_name(errno), errno);
+	}
+}
+
+static void network_shard_drain(Pipe *pipe) {
+	uint8_t bytes[64];
+
+	while (pipe_read(pipe, bytes, sizeof(bytes)) > 0) {
+	}
+}
+
+/*
+ * shard thread
+ */
+
+static void network_shard_close_connection(NetworkShard *shard, NetworkShardConnection *connection) {
+	ShardQueueRecord *record;
+
+	if (connection->socket != NULL) {
+		socket_destroy(connection->socket);
+		free(connection->socket);
+
+		connection->socket = NULL;
+		connection->disconnect_pending = true;
+	}
+
+	if (!connection->disconnect_pending) {
+		return;
+	}
+
+	record = shard_queue_reserve(&shard->inbound, 0);
+
+	if (record == NULL) {
+		return; // retried by the shard loop
+	}
+
+	record->id = connection->id;
+	record->type = NETWORK_SHARD_RECORD_DISCONNECTED;
+
+	if (shard_queue_commit(&shard->inbound)) {
+		network_shard_wake(&shard->notify_pipe);
+	}
+
+	connection->disconnect_pending = false;
+}
+
+// forwards all complete requests in the receive buffer to the main thread
+static void network_shard_deliver_requests(NetworkShard *shard, NetworkShardConnection *connection) {
+	int start = connection->reader.start;
+	int length;
+	int result;
+	Packet *request;
+	const char *message = NULL;
+	ShardQueueRecord *record;
+	char packet_dump[PACKET_MAX_DUMP_LENGTH];
+
+	while ((result = packet_reader_next(&connection->reader, &request, &message)) > 0) {
+	}
+
+	length = connection->reader.start - start;
+
+	if (length > 0) {
+		record = shard_queue_reserve(&shard->inbound, length);
+
+		if (record == NULL) {
+			// the main thread is behind, stop reading from this connection
+			// until there is room in the inbound queue again
+			connection->reader.start = start;
+			connection->reader.header_checked = false;
+			connection->blocked = true;
+
+			return;
+		}
+
+		record->id = connection->id;
+		record->type = NETWORK_SHARD_RECORD_DATA;
+
+		memcpy(record->data, connection->reader.buffer + start, length);
+
+		if (shard_queue_commit(&shard->inbound)) {
+			network_shard_wake(&shard->notify_pipe);
+		}
+	}
+
+	connection->blocked = false;
+
+	if (result < 0) {
+		log_error("Network shard %d received invalid request (packet: %s) from client (id: %08X), disconnecting client: %s",
+		          shard->index, packet_get_dump(packet_dump, request, packet_reader_get_pending(&connection->reader)),
+		          connection->id, message);
+
+		network_shard_close_connection(shard, connection);
+	}
+}
+
+static void network_shard_read(NetworkShard *shard, NetworkShardConnection *connection) {
+	uint8_t *buffer;
+	int length;
+
+	buffer = packet_reader_get_free(&connection->reader, &length);
+	length = io_read(&connection->socket->base, buffer, length);
+
+	if (length == 0) {
+		log_debug("Network shard %d lost client (id: %08X), disconnected by peer",
+		          shard->index, connection->id);
+
+		network_shard_close_connection(shard, connection);
+
+		return;
+	}
+
+	if (length < 0) {
+		if (length == IO_CONTINUE || errno_interrupted() || errno_would_block()) {
+			// no actual data received
+		} else if (errno_connection_reset()) {
+			log_debug("Network shard %d lost client (id: %08X), disconnected by peer (connection reset)",
+			          shard->index, connection->id);
+
+			network_shard_close_connection(shard, connection);
+		} else {
+			log_error("Network shard %d could not receive from client (id: %08X), disconnecting client: %s (%d)",
+			          shard->index, connection->id, get_errno_name(errno), errno);
+
+			network_shard_close_connection(shard, connection);
+		}
+
+		return;
+	}
+
+	packet_reader_commit(&connection->reader, length);
+
+	++shard->read_count;
+
+	network_shard_deliver_requests(shard, connection);
+}
+
+static void network_shard_write(NetworkShard *shard, NetworkShardConnection *connection) {
+	uint8_t *data;
+	int length;
+	int result;
+
+	while (connection->output_offset < connection->output_length) {
+		data = connection->output + connection->output_offset;
+		length = connection->output_length - connection->output_offset;
+
+		if (connection->packet_writes) {
+			length = ((PacketHeader *)data)->length;
+			result = websocket_send_partial(connection->socket, data, length,
+			                                connection->frame_offset);
+		} else {
+			result = io_write(&connection->socket->base, data, length);
+		}
+
+		if (result < 0) {
+			if (errno_interrupted() || errno_would_block()) {
+				return;
+			}
+
+			log_error("Network shard %d could not send to client (id: %08X), disconnecting client: %s (%d)",
+			          shard->index, connection->id, get_errno_name(errno), errno);
+
+			network_shard_close_connection(shard, connection);
+
+			return;
+		}
+
+		++shard->write_count;
+
+		if (!connection->packet_writes) {
+			connection->output_offset += result;
+
+			continue;
+		}
+
+		// the next packet is only sent after the whole frame of this one
+		connection->frame_offset += result;
+
+		if (connection->frame_offset >= websocket_get_frame_length(length)) {
+			connection->output_offset += length;
+			connection->frame_offset = 0;
+		}
+	}
+
+	connection->output_offset = 0;
+	connection->output_length = 0;
+}
+
+// appends responses to the output buffer of the connection. the responses
+// are dropped if the client does not keep up and the buffer is full
+static void network_shard_append_output(NetworkShard *shard, NetworkShardConnection *connection,
+                                        uint8_t *data, int length) {
+	int pending = connection->output_length - connection->output_offset;
+	int allocated;
+	uint8_t *output;
+
+	if (pending + length > NETWORK_SHARD_MAX_OUTPUT_LENGTH) {
+		if (connection->dropped_responses++ == 0) {
+			log_warn("Output buffer of client (id: %08X) in network shard %d is full, dropping responses",
+			         connection->id, shard->index);
+		}
+
+		return;
+	}
+
+	if (connection->output_offset > 0) {
+		memmove(connection->output, connection->output + connection->output_offset, pending);
+
+		connection->output_offset = 0;
+		connection->output_length = pending;
+	}
+
+	if (pending + length > connection->output_allocated) {
+		allocated = connection->output_allocated > 0 ? connection->output_allocated : 4096;
+
+		while (allocated < pending + length) {
+			allocated *= 2;
+		}
+
+		output = realloc(connection->output, allocated);
+
+		if (output == NULL) {
+			log_error("Could not grow output buffer of client (id: %08X) in network shard %d to %d bytes: %s (%d)",
+			          connection->id, shard->index, allocated, get_errno_name(ENOMEM), ENOMEM);
+
+			return;
+		}
+
+		connection->output = output;
+		connection->output_allocated = allocated;
+	}
+
+	memcpy(connection->output + connection->output_length, data, length);
+
+	connection->output_length += length;
+}
+
+static void network_shard_add_connection(NetworkShard *shard, uint32_t id,
+                                         NetworkShardAddRecord *add) {
+	int slot = network_shard_get_slot(id);
+	NetworkShardConnection *connection = calloc(1, sizeof(NetworkShardConnection));
+
+	if (connection == NULL) {
+		log_error("Could not allocate connection for client (id: %08X) in network shard %d: %s (%d)",
+		          id, shard->index, get_errno_name(ENOMEM), ENOMEM);
+
+		socket_destroy(add->socket);
+		free(add->socket);
+
+		return;
+	}
+
+	connection->id = id;
+	connection->socket = add->socket;
+	connection->packet_writes = add->packet_writes;
+	connection->live_index = shard->live_count;
+
+	shard->connections[slot] = connection;
+	shard->live_slots[shard->live_count++] = slot;
+
+	if (packet_reader_create(&connection->reader, shard->receive_size) < 0) {
+		log_error("Could not create request reader for client (id: %08X) in network shard %d: %s (%d)",
+		          id, shard->index, get_errno_name(errno), errno);
+
+		network_shard_close_connection(shard, connection);
+	}
+}
+
+static void network_shard_remove_connection(NetworkShard *shard, NetworkShardConnection *connection) {
+	int slot = network_shard_get_slot(connection->id);
+	int last_slot = shard->live_slots[--shard->live_count];
+
+	shard->live_slots[connection->live_index] = last_slot;
+	shard->connections[last_slot]->live_index = connection->live_index;
+	shard->connections[slot] = NULL;
+
+	if (connection->socket != NULL) {
+		socket_destroy(connection->socket);
+		free(connection->socket);
+	}
+
+	if (connection->dropped_responses > 0) {
+		log_warn("Network shard %d dropped %u response(s) for client (id: %08X)",
+		         shard->index, connection->dropped_responses, connection->id);
+	}
+
+	if (connection->reader.buffer != NULL) {
+		packet_reader_destroy(&connection->reader);
+	}
+
+	free(connection->output);
+	free(connection);
+}
+
+static NetworkShardConnection *network_shard_get_connection(NetworkShard *shard, uint32_t id) {
+	NetworkShardConnection *connection = shard->connections[network_shard_get_slot(id)];
+
+	if (connection == NULL || connection->id != id) {
+		return NULL;
+	}
+
+	return connection;
+}
+
+// returns false if the shard was asked to stop
+static bool network_shard_handle_outbound(NetworkShard *shard) {
+	ShardQueueRecord *record;
+	NetworkShardConnection *connection;
+	NetworkShardAddRecord add;
+
+	while ((record = shard_queue_peek(&shard->outbound)) != NULL) {
+		switch (record->type) {
+		case NETWORK_SHARD_RECORD_ADD:
+			memcpy(&add, record->data, sizeof(add));
+			network_shard_add_connection(shard, record->id, &add);
+
+			break;
+
+		case NETWORK_SHARD_RECORD_REMOVE:
+			connection = network_shard_get_connection(shard, record->id);
+
+			if (connection != NULL) {
+				network_shard_remove_connection(shard, connection);
+			}
+
+			break;
+
+		case NETWORK_SHARD_RECORD_DATA:
+			connection = network_shard_get_connection(shard, record->id);
+
+			if (connection != NULL && connection->socket != NULL) {
+				network_shard_append_output(shard, connection, record->data, record->length);
+			}
+
+			break;
+
+		case NETWORK_SHARD_RECORD_STOP:
+			shard_queue_pop(&shard->outbound);
+
+			return false;
+
+		default:
+			log_error("Network shard %d received unknown record type %u",
+			          shard->index, record->type);
+
+			break;
+		}
+
+		shard_queue_pop(&shard->outbound);
+	}
+
+	return true;
+}
+
+// tells the main thread that the outbound queue got drained after it was
+// found full, so the main thread can retry the responses in client backlogs
+static void network_shard_notify_drained(NetworkShard *shard) {
+	ShardQueueRecord *record = shard_queue_reserve(&shard->inbound, 0);
+
+	if (record == NULL) {
+		shard->drained_pending = true; // retried by the shard loop
+
+		return;
+	}
+
+	record->id = 0;
+	record->type = NETWORK_SHARD_RECORD_DRAINED;
+
+	if (shard_queue_commit(&shard->inbound)) {
+		network_shard_wake(&shard->notify_pipe);
+	}
+
+	shard->drained_pending = false;
+}
+
+static void network_shard_run(void *opaque) {
+	NetworkShard *shard = opaque;
+	struct pollfd *pollfds;
+	uint32_t *polled_ids;
+	int polled_count;
+	int timeout;
+	int i;
+	int result;
+	NetworkShardConnection *connection;
+	bool running = true;
+
+	pollfds = calloc(NETWORK_SHARD_MAX_CLIENTS + 1, sizeof(struct pollfd));
+	polled_ids = calloc(NETWORK_SHARD_MAX_CLIENTS, sizeof(uint32_t));
+
+	if (pollfds == NULL || polled_ids == NULL) {
+		log_error("Could not allocate poll array for network shard %d: %s (%d)",
+		          shard->index, get_errno_name(ENOMEM), ENOMEM);
+
+		free(pollfds);
+		free(polled_ids);
+
+		return;
+	}
+
+	log_debug("Started network shard %d", shard->index);
+
+	while (running) {
+		pollfds[0].fd = shard->wakeup_pipe.base.read_handle;
+		pollfds[0].events = POLLIN;
+		pollfds[0].revents = 0;
+
+		polled_count = 0;
+		timeout = shard->drained_pending ? NETWORK_SHARD_BLOCKED_POLL_TIMEOUT : -1;
+
+		for (i = 0; i < shard->live_count; ++i) {
+			connection = shard->connections[shard->live_slots[i]];
+
+			if (connection->blocked || connection->disconnect_pending) {
+				timeout = NETWORK_SHARD_BLOCKED_POLL_TIMEOUT;
+			}
+
+			if (connection->socket == NULL) {
+				continue;
+			}
+
+			pollfds[1 + polled_count].fd = connection->socket->base.read_handle;
+			pollfds[1 + polled_count].events = connection->blocked ? 0 : POLLIN;
+			pollfds[1 + polled_count].revents = 0;
+
+			if (connection->output_length > connection->output_offset) {
+				pollfds[1 + polled_count].events |= POLLOUT;
+			}
+
+			polled_ids[polled_count++] = connection->id;
+		}
+
+		result = poll(pollfds, 1 + polled_count, timeout);
+
+		if (result < 0) {
+			if (errno_interrupted()) {
+				continue;
+			}
+
+			log_error("Could not poll in network shard %d: %s (%d)",
+			          shard->index, get_errno_name(errno), errno);
+
+			break;
+		}
+
+		if (pollfds[0].revents != 0) {
+			network_shard_drain(&shard->wakeup_pipe);
+		}
+
+		// handle the outbound queue before the sockets, it might have removed
+		// some of the polled connections
+		running = network_shard_handle_outbound(shard);
+
+		if (!running) {
+			break;
+		}
+
+		// the outbound queue is empty now. the exchange is ordered after the
+		// fenced tail store of the last shard_queue_pop, see
+		// network_shard_write_io for the other side
+		if (shard->drained_pending ||
+		    __atomic_exchange_n(&shard->outbound_full, false, __ATOMIC_SEQ_CST)) {
+			network_shard_notify_drained(shard);
+		}
+
+		for (i = 0; i < polled_count; ++i) {
+			connection = network_shard_get_connection(shard, polled_ids[i]);
+
+			if (connection == NULL || connection->socket == NULL) {
+				continue; // removed or closed in the meantime
+			}
+
+			// a blocked connection is not polled for POLLIN, but POLLHUP and
+			// POLLERR are always reported. read again after it got unblocked
+			if (!connection->blocked &&
+			    (pollfds[1 + i].revents & (POLLIN | POLLHUP | POLLERR)) != 0) {
+				network_shard_read(shard, connection);
+			}
+		}
+
+		// retry what had to wait for room in the inbound queue and send all
+		// responses right away, without waiting for POLLOUT first
+		for (i = shard->live_count - 1; i >= 0; --i) {
+			connection = shard->connections[shard->live_slots[i]];
+
+			if (connection->disconnect_pending) {
+				network_shard_close_connection(shard, connection);
+			} else if (connection->blocked && connection->socket != NULL) {
+				network_shard_deliver_requests(shard, connection);
+			}
+
+			if (connection->socket != NULL && connection->output_length > connection->output_offset) {
+				network_shard_write(shard, connection);
+			}
+		}
+	}
+
+	while (shard->live_count > 0) {
+		network_shard_remove_connection(shard, shard->connections[shard->live_slots[0]]);
+	}
+
+	free(pollfds);
+	free(polled_ids);
+
+	log_debug("Stopped network shard %d", shard->index);
+}
+
+/*
+ * main thread
+ */
+
+static void network_shard_destroy_io(NetworkShardIO *io);
+
+static int network_shard_read_io(NetworkShardIO *io, void *buffer, int length) {
+	(void)io;
+	(void)buffer;
+	(void)length;
+
+	// requests are delivered by the shard, there is nothing to read here
+	errno = EINVAL;
+
+	return -1;
+}
+
+// never blocks. if the outbound queue is full then the shard is far behind
+// and the write fails with ENOBUFS. the client keeps the response in its
+// backlog and the shard sends a drained record once it made room again
+static int network_shard_write_io(NetworkShardIO *io, const void *buffer, int length) {
+	NetworkShard *shard = io->shard;
+	ShardQueueRecord *record = shard_queue_reserve(&shard->outbound, length);
+
+	if (record == NULL) {
+		// the flag has to be visible before the queue is checked again. if
+		// the shard drained the queue before seeing the flag then the retry
+		// finds room, otherwise the shard sees the flag and reports back
+		__atomic_store_n(&shard->outbound_full, true, __ATOMIC_SEQ_CST);
+
+		record = shard_queue_reserve(&shard->outbound, length);
+	}
+
+	if (record == NULL) {
+		errno = ENOBUFS;
+
+		return -1;
+	}
+
+	record->id = io->id;
+	record->type = NETWORK_SHARD_RECORD_DATA;
+
+	memcpy(record->data, buffer, length);
+
+	if (shard_queue_commit(&shard->outbound)) {
+		network_shard_wake(&shard->wakeup_pipe);
+	}
+
+	return length;
+}
+
+// pushes a record without data to the outbound queue. if the queue is full
+// then this waits for the shard, because this record must not be lost
+static void network_shard_push_control(NetworkShard *shard, uint32_t id, NetworkShardRecordType type) {
+	ShardQueueRecord *record;
+	bool warned = false;
+
+	while ((record = shard_queue_reserve(&shard->outbound, 0)) == NULL) {
+		if (!warned) {
+			log_warn("Outbound queue of network shard %d is full, waiting", shard->index);
+
+			warned = true;
+		}
+
+		network_shard_wake(&shard->wakeup_pipe);
+		millisleep(1);
+	}
+
+	record->id = id;
+	record->type = type;
+
+	if (shard_queue_commit(&shard->outbound)) {
+		network_shard_wake(&shard->wakeup_pipe);
+	}
+}
+
+static void network_shard_destroy_io(NetworkShardIO *io) {
+	NetworkShard *shard = io->shard;
+	int slot = network_shard_get_slot(io->id);
+
+	shard->clients[slot] = NULL;
+	shard->client_ids[slot] = 0;
+	--shard->client_count;
+
+	// the shard owns the socket and destroys it
+	network_shard_push_control(shard, io->id, NETWORK_SHARD_RECORD_REMOVE);
+}
+
+static Client *network_shard_get_client(NetworkShard *shard, uint32_t id) {
+	int slot = network_shard_get_slot(id);
+
+	if (shard->clients[slot] == NULL || shard->client_ids[slot] != id) {
+		return NULL;
+	}
+
+	return shard->clients[slot];
+}
+
+// retries the responses that are queued in client backlogs, because the
+// outbound queue was full before
+static void network_shard_flush_clients(NetworkShard *shard) {
+	int slot;
+	Client *client;
+
+	for (slot = 0; slot < NETWORK_SHARD_MAX_CLIENTS; ++slot) {
+		client = shard->clients[slot];
+
+		if (client != NULL && client->response_backlog_count > 0) {
+			client_flush_responses(client);
+		}
+	}
+}
+
+static void network_shard_handle_notify(void *opaque) {
+	NetworkShard *shard = opaque;
+	ShardQueueRecord *record;
+	Client *client;
+	int i;
+
+	// drain the pipe first, a record committed after this point comes with
+	// a new wake-up
+	network_shard_drain(&shard->notify_pipe);
+
+	for (i = 0; i < NETWORK_SHARD_MAX_RECORDS_PER_NOTIFY; ++i) {
+		record = shard_queue_peek(&shard->inbound);
+
+		if (record == NULL) {
+			return;
+		}
+
+		if (record->type == NETWORK_SHARD_RECORD_DRAINED) {
+			shard_queue_pop(&shard->inbound);
+			network_shard_flush_clients(shard);
+
+			continue;
+		}
+
+		client = network_shard_get_client(shard, record->id);
+
+		if (client != NULL) {
+			switch (record->type) {
+			case NETWORK_SHARD_RECORD_DATA:
+				client_handle_requests(client, record->data, record->length);
+
+				break;
+
+			case NETWORK_SHARD_RECORD_DISCONNECTED:
+				if (!client->disconnected) {
+					log_info("Client ("CLIENT_SIGNATURE_FORMAT") disconnected",
+					         client_expand_signature(client));
+
+					client->disconnected = true;
+				}
+
+				break;
+
+			default:
+				log_error("Received unknown record type %u from network shard %d",
+				          record->type, shard->index);
+
+				break;
+			}
+		}
+
+		shard_queue_pop(&shard->inbound);
+	}
+
+	// more records are left, come back after the other event sources had
+	// their turn
+	network_shard_wake(&shard->notify_pipe);
+}
+
+static int network_shard_create(NetworkShard *shard, int index, int receive_size) {
+	int phase = 0;
+
+	memset(shard, 0, sizeof(NetworkShard));
+
+	shard->index = index;
+	shard->next_generation = 1;
+	shard->receive_size = receive_size;
+
+	if (shard_queue_create(&shard->inbound, NETWORK_SHARD_QUEUE_SIZE) < 0) {
+		log_error("Could not create inbound queue for network shard %d: %s (%d)",
+		          index, get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 1;
+
+	if (shard_queue_create(&shard->outbound, NETWORK_SHARD_QUEUE_SIZE) < 0) {
+		log_error("Could not create outbound queue for network shard %d: %s (%d)",
+		          index, get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 2;
+
+	if (pipe_create(&shard->wakeup_pipe, PIPE_FLAG_NON_BLOCKING_READ | PIPE_FLAG_NON_BLOCKING_WRITE) < 0) {
+		log_error("Could not create wakeup pipe for network shard %d: %s (%d)",
+		          index, get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 3;
+
+	if (pipe_create(&shard->notify_pipe, PIPE_FLAG_NON_BLOCKING_READ | PIPE_FLAG_NON_BLOCKING_WRITE) < 0) {
+		log_error("Could not create notify pipe for network shard %d: %s (%d)",
+		          index, get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 4;
+
+	if (event_timing_add_source(shard->notify_pipe.base.read_handle, EVENT_SOURCE_TYPE_GENERIC,
+	                            "network-shard", EVENT_READ, network_shard_handle_notify, shard) < 0) {
+		goto cleanup;
+	}
+
+	phase = 5;
+
+	thread_create(&shard->thread, network_shard_run, shard);
+
+	phase = 6;
+
+cleanup:
+	switch (phase) { // no breaks, all cases fall through intentionally
+	case 5:
+		event_timing_remove_source(shard->notify_pipe.base.read_handle, EVENT_SOURCE_TYPE_GENERIC);
+		// fall through
+
+	case 4:
+		pipe_destroy(&shard->notify_pipe);
+		// fall through
+
+	case 3:
+		pipe_destroy(&shard->wakeup_pipe);
+		// fall through
+
+	case 2:
+		shard_queue_destroy(&shard->outbound);
+		// fall through
+
+	case 1:
+		shard_queue_destroy(&shard->inbound);
+		// fall through
+
+	default:
+		break;
+	}
+
+	return phase == 6 ? 0 : -1;
+}
+
+static void network_shard_destroy(NetworkShard *shard) {
+	network_shard_push_control(shard, 0, NETWORK_SHARD_RECORD_STOP);
+
+	thread_join(&shard->thread);
+	thread_destroy(&shard->thread);
+
+	log_debug("Network shard %d handled %u read(s) and %u write(s)",
+	          shard->index, shard->read_count, shard->write_count);
+
+	event_timing_remove_source(shard->notify_pipe.base.read_handle, EVENT_SOURCE_TYPE_GENERIC);
+
+	pipe_destroy(&shard->notify_pipe);
+	pipe_destroy(&shard->wakeup_pipe);
+
+	shard_queue_destroy(&shard->outbound);
+	shard_queue_destroy(&shard->inbound);
+}
+
+int network_shard_init(int count) {
+	int i;
+	int receive_size = config_get_option_value("client.receive_buffer_size")->integer;
+
+	if (count <= 0) {
+		return 0;
+	}
+
+	if (receive_size > NETWORK_SHARD_MAX_RECEIVE_SIZE) {
+		receive_size = NETWORK_SHARD_MAX_RECEIVE_SIZE;
+	}
+
+	log_info("Handling client I/O in %d network worker thread(s)", count);
+
+	_shards = calloc(count, sizeof(NetworkShard));
+
+	if (_shards == NULL) {
+		log_error("Could not allocate %d network shard(s): %s (%d)",
+		          count, get_errno_name(ENOMEM), ENOMEM);
+
+		return -1;
+	}
+
+	for (i = 0; i < count; ++i) {
+		if (network_shard_create(&_shards[i], i, receive_size) < 0) {
+			while (--i >= 0) {
+				network_shard_destroy(&_shards[i]);
+			}
+
+			free(_shards);
+
+			_shards = NULL;
+
+			return -1;
+		}
+	}
+
+	_shard_count = count;
+
+	return 0;
+}
+
+// all sharded clients have to be destroyed before
+void network_shard_exit(void) {
+	int i;
+
+	for (i = 0; i < _shard_count; ++i) {
+		network_shard_destroy(&_shards[i]);
+	}
+
+	free(_shards);
+
+	_shards = NULL;
+	_shard_count = 0;
+}
+
+int network_shard_get_count(void) {
+	return _shard_count;
+}
+
+// creates a client whose socket is handled by the least loaded shard. the
+// shard takes ownership of the socket on success. returns NULL if all shards
+// are full or on error, then the caller has to handle the client itself
+Client *network_shard_create_client(const char *name, Socket *socket, bool packet_writes) {
+	NetworkShard *shard = NULL;
+	NetworkShardIO *io;
+	NetworkShardAddRecord add;
+	ShardQueueRecord *record;
+	Client *client;
+	int slot;
+	int i;
+	uint32_t id;
+
+	for (i = 0; i < _shard_count; ++i) {
+		if (_shards[i].client_count < NETWORK_SHARD_MAX_CLIENTS &&
+		    (shard == NULL || _shards[i].client_count < shard->client_count)) {
+			shard = &_shards[i];
+		}
+	}
+
+	if (shard == NULL) {
+		log_warn("All network shards are full, handling client in main thread");
+
+		return NULL;
+	}
+
+	for (slot = 0; slot < NETWORK_SHARD_MAX_CLIENTS; ++slot) {
+		if (shard->clients[slot] == NULL) {
+			break;
+		}
+	}
+
+	// the ADD record is only committed after the client got created, the
+	// client creation does not write to the outbound queue
+	record = shard_queue_reserve(&shard->outbound, sizeof(add));
+
+	if (record == NULL) {
+		log_warn("Outbound queue of network shard %d is full, handling client in main thread",
+		         shard->index);
+
+		return NULL;
+	}
+
+	io = calloc(1, sizeof(NetworkShardIO));
+
+	if (io == NULL) {
+		log_error("Could not allocate network shard I/O object: %s (%d)",
+		          get_errno_name(ENOMEM), ENOMEM);
+
+		return NULL;
+	}
+
+	if (io_create(&io->base, "network-shard",
+	              (IODestroyFunction)network_shard_destroy_io,
+	              (IOReadFunction)network_shard_read_io,
+	              (IOWriteFunction)network_shard_write_io,
+	              NULL) < 0) {
+		log_error("Could not create network shard I/O object: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		free(io);
+
+		return NULL;
+	}
+
+	id = ((uint32_t)shard->next_generation << 16) | (uint32_t)slot;
+
+	if (++shard->next_generation == 0) {
+		shard->next_generation = 1;
+	}
+
+	io->shard = shard;
+	io->id = id;
+
+	shard->client_ids[slot] = id;
+	++shard->client_count;
+
+	client = network_create_client(name, &io->base);
+
+	if (client == NULL) {
+		// the I/O object was not destroyed, release the slot directly
+		shard->client_ids[slot] = 0;
+		--shard->client_count;
+
+		free(io);
+
+		return NULL;
+	}
+
+	shard->clients[slot] = client;
+
+	add.socket = socket;
+	add.packet_writes = packet_writes;
+
+	// the record is still reserved, creating the client did not push anything
+	record->id = id;
+	record->type = NETWORK_SHARD_RECORD_ADD;
+
+	memcpy(record->data, &add, sizeof(add));
+
+	if (shard_queue_commit(&shard->outbound)) {
+		network_shard_wake(&shard->wakeup_pipe);
+	}
+
+	return client;
+}
@@ -0,0 +1,41 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * network_shard.h: Client I/O on worker threads with their own event loops
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef BRICKD_NETWORK_SHARD_H
+#define BRICKD_NETWORK_SHARD_H
+
+#include <stdbool.h>
+
+#include <daemonlib/socket.h>
+
+#include "client.h"
+
+#define NETWORK_SHARD_MAX_COUNT 16
+#define NETWORK_SHARD_MAX_CLIENTS 1024 // per shard
+
+int network_shard_init(int count);
+void network_shard_exit(void);
+
+int network_shard_get_count(void);
+
+Client *network_shard_create_client(const char *name, Socket *socket, bool packet_writes);
+
+#endif // BRICKD_NETWORK_SHARD_H
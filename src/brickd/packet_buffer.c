@@ -0,0 +1,125 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * packet_buffer.c: Reference counted packet buffers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * a packet buffer holds a copy of a packet that has to outlive the call that
+ * received it, e.g. a response that could not be sent to a client right away.
+ * the buffer is reference counted, so a callback that is broadcast to many
+ * clients is stored only once no matter how many client backlogs hold it.
+ *
+ * released buffers are kept in a pool for reuse, to avoid a malloc and free
+ * per packet under high load.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <daemonlib/log.h>
+#include <daemonlib/utils.h>
+
+#include "packet_buffer.h"
+
+static LogSource _log_source = LOG_SOURCE_INITIALIZER;
+
+#define MAX_POOLED_PACKET_BUFFERS 4096
+
+static PacketBuffer *_pool = NULL;
+static int _pooled = 0;
+static int _live = 0;
+
+// returns a buffer with a reference count of 1 holding a copy of the packet
+PacketBuffer *packet_buffer_create(Packet *packet) {
+	PacketBuffer *buffer = _pool;
+
+	if (buffer != NULL) {
+		_pool = buffer->next_free;
+		--_pooled;
+	} else {
+		buffer = malloc(sizeof(PacketBuffer));
+
+		if (buffer == NULL) {
+			errno = ENOMEM;
+
+			return NULL;
+		}
+	}
+
+	buffer->next_free = NULL;
+	buffer->ref_count = 1;
+
+	memcpy(&buffer->packet, packet, packet->header.length);
+
+#ifdef DAEMONLIB_WITH_PACKET_TRACE
+	buffer->packet.trace_id = packet->trace_id;
+#endif
+
+	++_live;
+
+	return buffer;
+}
+
+PacketBuffer *packet_buffer_ref(PacketBuffer *buffer) {
+	++buffer->ref_count;
+
+	return buffer;
+}
+
+void packet_buffer_unref(PacketBuffer *buffer) {
+	if (--buffer->ref_count > 0) {
+		return;
+	}
+
+	--_live;
+
+	if (_pooled >= MAX_POOLED_PACKET_BUFFERS) {
+		free(buffer);
+
+		return;
+	}
+
+	buffer->next_free = _pool;
+	_pool = buffer;
+
+	++_pooled;
+}
+
+void packet_buffer_get_usage(int *live, int *pooled) {
+	*live = _live;
+	*pooled = _pooled;
+}
+
+void packet_buffer_free_pool(void) {
+	PacketBuffer *buffer;
+
+	if (_live > 0) {
+		log_warn("Still %d packet buffer(s) in use", _live);
+	}
+
+	while (_pool != NULL) {
+		buffer = _pool;
+		_pool = buffer->next_free;
+
+		free(buffer);
+	}
+
+	_pooled = 0;
+}
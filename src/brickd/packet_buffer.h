@@ -0,0 +1,42 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * packet_buffer.h: Reference counted packet buffers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef BRICKD_PACKET_BUFFER_H
+#define BRICKD_PACKET_BUFFER_H
+
+#include <daemonlib/packet.h>
+
+typedef struct _PacketBuffer PacketBuffer;
+
+struct _PacketBuffer {
+	PacketBuffer *next_free; // only valid while in the pool
+	int ref_count;
+	Packet packet;
+};
+
+PacketBuffer *packet_buffer_create(Packet *packet);
+PacketBuffer *packet_buffer_ref(PacketBuffer *buffer);
+void packet_buffer_unref(PacketBuffer *buffer);
+
+void packet_buffer_get_usage(int *live, int *pooled);
+void packet_buffer_free_pool(void);
+
+#endif // BRICKD_PACKET_BUFFER_H
@@ -0,0 +1,134 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * packet_reader.c: Framing of packets received from a byte stream
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * a packet reader splits a byte stream into packets. the caller reads as
+ * much data as fits into the free part of the buffer and then takes all
+ * complete packets out of it. packets are handed out in place, the parser
+ * only advances an offset. the buffer is allocated with sizeof(Packet) bytes
+ * of slack at its end, so a packet at the end of the buffer can be accessed
+ * as a whole Packet without reading past the allocation.
+ *
+ * the only memmove left happens once per read and moves an incomplete
+ * packet (less than sizeof(Packet) bytes) from the end of the buffer to
+ * its beginning if there is not enough free space left at the end.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "packet_reader.h"
+
+// resets the reader to an empty state without buffer. the owner logs the
+// number of pending bytes, this has to be valid even if the buffer could not
+// be allocated or is already freed
+static void packet_reader_reset(PacketReader *reader) {
+	reader->buffer = NULL;
+	reader->size = 0;
+	reader->start = 0;
+	reader->end = 0;
+	reader->header_checked = false;
+}
+
+int packet_reader_create(PacketReader *reader, int size) {
+	packet_reader_reset(reader);
+
+	if (size < PACKET_READER_MIN_SIZE) {
+		size = PACKET_READER_MIN_SIZE;
+	}
+
+	reader->buffer = malloc(size + sizeof(Packet));
+
+	if (reader->buffer == NULL) {
+		errno = ENOMEM;
+
+		return -1;
+	}
+
+	reader->size = size;
+
+	return 0;
+}
+
+void packet_reader_destroy(PacketReader *reader) {
+	free(reader->buffer);
+
+	packet_reader_reset(reader);
+}
+
+// returns the free part of the buffer to read into
+uint8_t *packet_reader_get_free(PacketReader *reader, int *length) {
+	int pending = reader->end - reader->start;
+
+	if (pending == 0) {
+		reader->start = 0;
+		reader->end = 0;
+	} else if (reader->size - reader->end < (int)sizeof(Packet)) {
+		memmove(reader->buffer, reader->buffer + reader->start, pending);
+
+		reader->start = 0;
+		reader->end = pending;
+	}
+
+	*length = reader->size - reader->end;
+
+	return reader->buffer + reader->end;
+}
+
+void packet_reader_commit(PacketReader *reader, int length) {
+	reader->end += length;
+}
+
+// returns -1 if the next packet has an invalid header, 0 if there is no
+// complete packet left and 1 if a packet was returned. the returned packet
+// stays valid until the next call of packet_reader_get_free
+int packet_reader_next(PacketReader *reader, Packet **packet, const char **message) {
+	int pending = reader->end - reader->start;
+	Packet *candidate = (Packet *)(reader->buffer + reader->start);
+
+	if (pending < (int)sizeof(PacketHeader)) {
+		// wait for complete header
+		return 0;
+	}
+
+	if (!reader->header_checked) {
+		if (!packet_header_is_valid_request(&candidate->header, message)) {
+			*packet = candidate;
+
+			return -1;
+		}
+
+		reader->header_checked = true;
+	}
+
+	if (pending < candidate->header.length) {
+		// wait for complete packet
+		return 0;
+	}
+
+	*packet = candidate;
+
+	reader->start += candidate->header.length;
+	reader->header_checked = false;
+
+	return 1;
+}
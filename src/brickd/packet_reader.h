@@ -0,0 +1,50 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * packet_reader.h: Framing of packets received from a byte stream
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef BRICKD_PACKET_READER_H
+#define BRICKD_PACKET_READER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <daemonlib/packet.h>
+
+#define PACKET_READER_MIN_SIZE 512
+
+typedef struct {
+	uint8_t *buffer;
+	int size;
+	int start; // offset of the first byte that is not parsed yet
+	int end; // offset of the first free byte
+	bool header_checked;
+} PacketReader;
+
+#define packet_reader_get_pending(reader) ((reader)->end - (reader)->start)
+
+int packet_reader_create(PacketReader *reader, int size);
+void packet_reader_destroy(PacketReader *reader);
+
+uint8_t *packet_reader_get_free(PacketReader *reader, int *length);
+void packet_reader_commit(PacketReader *reader, int length);
+
+int packet_reader_next(PacketReader *reader, Packet **packet, const char **message);
+
+#endif // BRICKD_PACKET_READER_H
@@ -0,0 +1,322 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * packet_trace.c: Always-on binary ring of packet trace events
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * the packet trace ring records a compact binary event for each hop of a
+ * packet through the Brick Daemon. unlike the packet trace of the daemonlib
+ * and the packet debug log it is cheap enough to be always enabled: an event
+ * is a fixed size struct that is written into a preallocated ring without
+ * any formatting or allocation, the oldest events are overwritten.
+ *
+ * all hops are recorded on the main thread, stacks with their own threads
+ * hand their responses over to the main thread before they are counted.
+ * therefore the ring has exactly one writer and needs no locking. the dump
+ * happens on the main thread as well.
+ *
+ * each request received from a client gets a trace ID. it is the current ID
+ * while the request is dispatched and is stored in its pending request, so
+ * the response can be related to it. responses received from a stack are
+ * recorded without trace ID, the decoder relates them by UID, function ID
+ * and sequence number.
+ *
+ * clients and stacks are identified by source IDs. their names are kept
+ * separately and are written to the dump, together with the names of the
+ * most recently removed sources.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <daemonlib/array.h>
+#include <daemonlib/config.h>
+#include <daemonlib/log.h>
+#include <daemonlib/utils.h>
+
+#include "packet_trace.h"
+
+#include "byte_order.h"
+#include "monotonic_time.h"
+
+static LogSource _log_source = LOG_SOURCE_INITIALIZER;
+
+static PacketTraceEvent *_events = NULL; // NULL if disabled
+static uint32_t _size; // always a power of two
+static uint64_t _next_event; // free running
+static uint32_t _next_trace_id;
+static uint32_t _current_trace_id;
+static uint32_t _next_source;
+static Array _sources;
+static PacketTraceDumpSource _removed_sources[PACKET_TRACE_MAX_REMOVED_SOURCES];
+static int _removed_source_count;
+static int _removed_source_next;
+static char _dump_filename[1024];
+
+int packet_trace_init(const char *dump_filename) {
+	int size = config_get_option_value("packet_trace.size")->integer;
+
+	_next_event = 0;
+	_next_trace_id = 0;
+	_current_trace_id = 0;
+	_next_source = 0;
+	_removed_source_count = 0;
+	_removed_source_next = 0;
+
+	string_copy(_dump_filename, sizeof(_dump_filename), dump_filename, -1);
+
+	if (size == 0) {
+		log_debug("Packet trace is disabled");
+
+		return 0;
+	}
+
+	_size = 1;
+
+	while ((int)_size < size) {
+		_size *= 2;
+	}
+
+	log_debug("Initializing packet trace with %u events", _size);
+
+	if (array_create(&_sources, 32, sizeof(PacketTraceDumpSource), true) < 0) {
+		log_error("Could not create packet trace source array: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		return -1;
+	}
+
+	_events = calloc(_size, sizeof(PacketTraceEvent));
+
+	if (_events == NULL) {
+		log_error("Could not allocate packet trace of %u events: %s (%d)",
+		          _size, get_errno_name(ENOMEM), ENOMEM);
+
+		array_destroy(&_sources, NULL);
+
+		return -1;
+	}
+
+	return 0;
+}
+
+void packet_trace_exit(void) {
+	if (_events == NULL) {
+		return;
+	}
+
+	log_debug("Shutting down packet trace");
+
+	free(_events);
+	array_destroy(&_sources, NULL);
+
+	_events = NULL;
+}
+
+// returns the ID of the new source, or 0 if the packet trace is disabled
+uint32_t packet_trace_add_source(PacketTraceSourceType type, const char *name) {
+	PacketTraceDumpSource *source;
+
+	if (_events == NULL) {
+		return 0;
+	}
+
+	source = array_append(&_sources);
+
+	if (source == NULL) {
+		log_error("Could not append to packet trace source array: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		return 0;
+	}
+
+	memset(source, 0, sizeof(*source));
+
+	if (++_next_source == 0) {
+		++_next_source; // 0 means no source
+	}
+
+	source->id = _next_source;
+	source->type = (uint8_t)type;
+
+	string_copy(source->name, sizeof(source->name), name, -1);
+
+	return source->id;
+}
+
+void packet_trace_remove_source(uint32_t id) {
+	int i;
+	PacketTraceDumpSource *source;
+
+	if (_events == NULL || id == 0) {
+		return;
+	}
+
+	for (i = 0; i < _sources.count; ++i) {
+		source = array_get(&_sources, i);
+
+		if (source->id != id) {
+			continue;
+		}
+
+		memcpy(&_removed_sources[_removed_source_next], source, sizeof(*source));
+
+		_removed_source_next = (_removed_source_next + 1) % PACKET_TRACE_MAX_REMOVED_SOURCES;
+
+		if (_removed_source_count < PACKET_TRACE_MAX_REMOVED_SOURCES) {
+			++_removed_source_count;
+		}
+
+		array_remove(&_sources, i, NULL);
+
+		return;
+	}
+}
+
+// assigns a new trace ID to the request that is about to be handled
+uint32_t packet_trace_begin_request(void) {
+	if (++_next_trace_id == 0) {
+		++_next_trace_id; // 0 means no trace ID
+	}
+
+	_current_trace_id = _next_trace_id;
+
+	return _current_trace_id;
+}
+
+void packet_trace_end_request(void) {
+	_current_trace_id = 0;
+}
+
+uint32_t packet_trace_get_current_id(void) {
+	return _current_trace_id;
+}
+
+void packet_trace_record(PacketTraceHop hop, uint32_t trace_id, uint32_t source, Packet *packet) {
+	PacketTraceEvent *event;
+
+	if (_events == NULL) {
+		return;
+	}
+
+	event = &_events[_next_event++ & (_size - 1)];
+
+	event->timestamp = monotonic_microtime();
+	event->trace_id = trace_id;
+	event->uid = packet->header.uid;
+	event->source = source;
+	event->hop = (uint8_t)hop;
+	event->function_id = packet->header.function_id;
+	event->sequence_number_and_options = packet->header.sequence_number_and_options;
+	event->error_code_and_future_use = packet->header.error_code_and_future_use;
+	event->length = packet->header.length;
+}
+
+static int packet_trace_write(FILE *fp, const void *data, size_t length) {
+	if (fwrite(data, 1, length, fp) != length) {
+		errno = ferror(fp) ? errno : EIO;
+
+		return -1;
+	}
+
+	return 0;
+}
+
+// writes the content of the ring to the dump file. returns the number of
+// written events or -1 on error
+int packet_trace_dump(void) {
+	uint32_t count;
+	uint64_t i;
+	int k;
+	FILE *fp;
+	PacketTraceDumpHeader header;
+	PacketTraceDumpSource source;
+	PacketTraceEvent event;
+	int result = 0;
+
+	if (_events == NULL) {
+		log_warn("Cannot dump packet trace, it is disabled");
+
+		return -1;
+	}
+
+	count = _next_event < _size ? (uint32_t)_next_event : _size;
+	fp = fopen(_dump_filename, "wb");
+
+	if (fp == NULL) {
+		log_error("Could not open packet trace dump file '%s' for writing: %s (%d)",
+		          _dump_filename, get_errno_name(errno), errno);
+
+		return -1;
+	}
+
+	memcpy(header.magic, PACKET_TRACE_DUMP_MAGIC, sizeof(header.magic));
+
+	header.version = uint32_to_le(PACKET_TRACE_DUMP_VERSION);
+	header.event_size = uint32_to_le(sizeof(PacketTraceEvent));
+	header.event_count = uint32_to_le(count);
+	header.source_count = uint32_to_le(_sources.count + _removed_source_count);
+	header.timestamp = uint64_to_le(monotonic_microtime());
+
+	result |= packet_trace_write(fp, &header, sizeof(header));
+
+	for (k = 0; k < _sources.count + _removed_source_count && result == 0; ++k) {
+		if (k < _sources.count) {
+			memcpy(&source, array_get(&_sources, k), sizeof(source));
+		} else {
+			memcpy(&source, &_removed_sources[k - _sources.count], sizeof(source));
+		}
+
+		source.id = uint32_to_le(source.id);
+
+		result |= packet_trace_write(fp, &source, sizeof(source));
+	}
+
+	for (i = _next_event - count; i != _next_event && result == 0; ++i) {
+		memcpy(&event, &_events[i & (_size - 1)], sizeof(event));
+
+		event.timestamp = uint64_to_le(event.timestamp);
+		event.trace_id = uint32_to_le(event.trace_id);
+		event.source = uint32_to_le(event.source);
+
+		result |= packet_trace_write(fp, &event, sizeof(event));
+	}
+
+	if (result < 0) {
+		log_error("Could not write packet trace dump file '%s': %s (%d)",
+		          _dump_filename, get_errno_name(errno), errno);
+
+		fclose(fp);
+
+		return -1;
+	}
+
+	if (fclose(fp) != 0) {
+		log_error("Could not close packet trace dump file '%s': %s (%d)",
+		          _dump_filename, get_errno_name(errno), errno);
+
+		return -1;
+	}
+
+	log_info("Dumped %u packet trace event(s) to '%s'", count, _dump_filename);
+
+	return (int)count;
+}
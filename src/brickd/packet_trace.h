@@ -0,0 +1,98 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * packet_trace.h: Always-on binary ring of packet trace events
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef BRICKD_PACKET_TRACE_H
+#define BRICKD_PACKET_TRACE_H
+
+#include <stdint.h>
+
+#include <daemonlib/packet.h>
+
+#define PACKET_TRACE_MAX_SIZE 1048576 // events
+#define PACKET_TRACE_MAX_SOURCE_NAME_LENGTH 64
+#define PACKET_TRACE_MAX_REMOVED_SOURCES 64
+
+// the dump file format, see packet_trace_decoder.py. all values are little
+// endian. the header is followed by the sources and then the events from
+// oldest to newest
+#define PACKET_TRACE_DUMP_MAGIC "BRICKDPT"
+#define PACKET_TRACE_DUMP_VERSION 1
+
+typedef enum {
+	PACKET_TRACE_HOP_CLIENT_REQUEST = 1, // received from a client
+	PACKET_TRACE_HOP_STACK_REQUEST, // dispatched to a stack
+	PACKET_TRACE_HOP_STACK_RESPONSE, // received from a stack
+	PACKET_TRACE_HOP_CLIENT_RESPONSE // matched to the pending request of a client
+} PacketTraceHop;
+
+typedef enum {
+	PACKET_TRACE_SOURCE_CLIENT = 1,
+	PACKET_TRACE_SOURCE_STACK
+} PacketTraceSourceType;
+
+#include <daemonlib/packed_begin.h>
+
+typedef struct {
+	uint64_t timestamp; // microseconds, monotonic, arbitrary origin
+	uint32_t trace_id; // 0 if the hop cannot be related to a request
+	uint32_t uid; // always little endian
+	uint32_t source; // client or stack, depending on the hop
+	uint8_t hop;
+	uint8_t function_id;
+	uint8_t sequence_number_and_options;
+	uint8_t error_code_and_future_use;
+	uint8_t length;
+	uint8_t padding[7];
+} ATTRIBUTE_PACKED PacketTraceEvent;
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t event_size;
+	uint32_t event_count;
+	uint32_t source_count;
+	uint64_t timestamp; // microseconds, monotonic, time of the dump
+} ATTRIBUTE_PACKED PacketTraceDumpHeader;
+
+typedef struct {
+	uint32_t id;
+	uint8_t type;
+	char name[PACKET_TRACE_MAX_SOURCE_NAME_LENGTH];
+	uint8_t padding[3];
+} ATTRIBUTE_PACKED PacketTraceDumpSource;
+
+#include <daemonlib/packed_end.h>
+
+int packet_trace_init(const char *dump_filename);
+void packet_trace_exit(void);
+
+uint32_t packet_trace_add_source(PacketTraceSourceType type, const char *name);
+void packet_trace_remove_source(uint32_t source);
+
+uint32_t packet_trace_begin_request(void);
+void packet_trace_end_request(void);
+uint32_t packet_trace_get_current_id(void);
+
+void packet_trace_record(PacketTraceHop hop, uint32_t trace_id, uint32_t source, Packet *packet);
+
+int packet_trace_dump(void);
+
+#endif // BRICKD_PACKET_TRACE_H
@@ -0,0 +1,244 @@
+#!/usr/bin/python3
+# -*- coding: utf-8 -*-
+
+# decodes a packet trace dump written by the Brick Daemon, see packet_trace.h
+# for the file format. the dump is requested with the dump-packet-trace
+# function of the Brick Daemon UID, --request-dump can be used for that
+
+import sys
+import socket
+import struct
+import argparse
+
+HEADER_FORMAT = '<8sIIIIQ'
+SOURCE_FORMAT = '<IB64s3x'
+EVENT_FORMAT = '<QIIIBBBBB7x'
+
+MAGIC = b'BRICKDPT'
+VERSION = 1
+
+HOP_CLIENT_REQUEST = 1
+HOP_STACK_REQUEST = 2
+HOP_STACK_RESPONSE = 3
+HOP_CLIENT_RESPONSE = 4
+
+HOP_NAMES = {
+    HOP_CLIENT_REQUEST: 'client-request',
+    HOP_STACK_REQUEST: 'stack-request',
+    HOP_STACK_RESPONSE: 'stack-response',
+    HOP_CLIENT_RESPONSE: 'client-response'
+}
+
+SOURCE_TYPE_NAMES = {1: 'client', 2: 'stack'}
+
+UID_BRICK_DAEMON = 1
+FUNCTION_DUMP_PACKET_TRACE = 7
+
+BASE58_ALPHABET = '123456789abcdefghijkmnopqrstuvwxyzABCDEFGHJKLMNPQRSTUVWXYZ'
+
+def base58_encode(value):
+    encoded = ''
+
+    while value >= 58:
+        encoded = BASE58_ALPHABET[value % 58] + encoded
+        value //= 58
+
+    return BASE58_ALPHABET[value] + encoded
+
+class Event:
+    def __init__(self, data):
+        self.timestamp, self.trace_id, self.uid, self.source, self.hop, \
+        self.function_id, sequence_number_and_options, error_code_and_future_use, \
+        self.length = struct.unpack(EVENT_FORMAT, data)
+
+        self.sequence_number = (sequence_number_and_options >> 4) & 0x0F
+        self.error_code = (error_code_and_future_use >> 6) & 0x03
+
+    def key(self):
+        return (self.uid, self.function_id, self.sequence_number)
+
+def read_dump(filename):
+    with open(filename, 'rb') as f:
+        data = f.read()
+
+    header_size = struct.calcsize(HEADER_FORMAT)
+    source_size = struct.calcsize(SOURCE_FORMAT)
+
+    if len(data) < header_size:
+        raise Exception('Dump is too short for its header')
+
+    magic, version, event_size, event_count, source_count, timestamp = \
+        struct.unpack_from(HEADER_FORMAT, data, 0)
+
+    if magic != MAGIC:
+        raise Exception('Dump has wrong magic {0}'.format(magic))
+
+    if version != VERSION:
+        raise Exception('Dump has unsupported version {0}'.format(version))
+
+    if event_size != struct.calcsize(EVENT_FORMAT):
+        raise Exception('Dump has unexpected event size {0}'.format(event_size))
+
+    if len(data) != header_size + source_count * source_size + event_count * event_size:
+        raise Exception('Dump has wrong length {0}'.format(len(data)))
+
+    offset = header_size
+    sources = {}
+
+    for _ in range(source_count):
+        source_id, source_type, name = struct.unpack_from(SOURCE_FORMAT, data, offset)
+        name = name.split(b'\0', 1)[0].decode('utf-8', 'replace')
+
+        # sources that were removed are written last, don't let them
+        # shadow a current source with a reused ID
+        if source_id not in sources:
+            sources[source_id] = (SOURCE_TYPE_NAMES.get(source_type, '?'), name)
+
+        offset += source_size
+
+    events = []
+
+    for _ in range(event_count):
+        events.append(Event(data[offset:offset + event_size]))
+        offset += event_size
+
+    return timestamp, sources, events
+
+def format_source(sources, source_id):
+    if source_id == 0:
+        return '-'
+
+    source_type, name = sources.get(source_id, ('?', '<unknown>'))
+
+    return '{0} {1} ({2})'.format(source_type, source_id, name)
+
+def format_packet(event):
+    return 'U: {0}, L: {1}, F: {2}, S: {3}, E: {4}'.format(base58_encode(event.uid), event.length,
+                                                           event.function_id, event.sequence_number,
+                                                           event.error_code)
+
+def print_events(sources, events, dump_timestamp):
+    for event in events:
+        print('{0:+14.6f} {1:>15} {2:>10} {3} [{4}]'.format((event.timestamp - dump_timestamp) / 1000000.0,
+                                                           HOP_NAMES.get(event.hop, '?'),
+                                                           event.trace_id if event.trace_id != 0 else '-',
+                                                           format_packet(event),
+                                                           format_source(sources, event.source)))
+
+# groups the events by trace ID. stack responses have no trace ID, they are
+# assigned to the oldest unanswered stack request with the same UID, function
+# ID and sequence number
+def correlate(events):
+    requests = {}
+    unanswered = {}
+
+    for event in events:
+        if event.hop == HOP_STACK_RESPONSE:
+            candidates = unanswered.get(event.key())
+
+            if candidates:
+                requests[candidates.pop(0)].append(event)
+
+            continue
+
+        if event.trace_id == 0:
+            continue
+
+        hops = requests.setdefault(event.trace_id, [])
+
+        # the beginning of the request fell out of the ring
+        if len(hops) == 0 and event.hop != HOP_CLIENT_REQUEST:
+            del requests[event.trace_id]
+            continue
+
+        hops.append(event)
+
+        if event.hop == HOP_STACK_REQUEST:
+            unanswered.setdefault(event.key(), []).append(event.trace_id)
+
+    return requests
+
+def print_requests(sources, requests, slowest):
+    complete = [hops for hops in requests.values() if hops[-1].hop == HOP_CLIENT_RESPONSE]
+
+    if slowest is not None:
+        complete.sort(key=lambda hops: hops[-1].timestamp - hops[0].timestamp, reverse=True)
+        complete = complete[:slowest]
+
+    for hops in complete:
+        first = hops[0]
+
+        print('trace {0}: {1}, {2} us [{3}]'.format(first.trace_id, format_packet(first),
+                                                    hops[-1].timestamp - first.timestamp,
+                                                    format_source(sources, first.source)))
+
+        previous = first
+
+        for event in hops[1:]:
+            print('  {0:>15} {1:+10} us [{2}]'.format(HOP_NAMES.get(event.hop, '?'),
+                                                     event.timestamp - previous.timestamp,
+                                                     format_source(sources, event.source)))
+
+            previous = event
+
+    print('{0} complete of {1} traced request(s)'.format(len([hops for hops in requests.values()
+                                                              if hops[-1].hop == HOP_CLIENT_RESPONSE]),
+                                                         len(requests)))
+
+def request_dump(host, port):
+    request = struct.pack('<IBBBB', UID_BRICK_DAEMON, 8, FUNCTION_DUMP_PACKET_TRACE, (1 << 4) | (1 << 3), 0)
+    connection = socket.create_connection((host, port), timeout=5)
+
+    try:
+        connection.sendall(request)
+
+        response = b''
+
+        while len(response) < 12:
+            data = connection.recv(12 - len(response))
+
+            if len(data) == 0:
+                raise Exception('Connection was closed before the response was received')
+
+            response += data
+    finally:
+        connection.close()
+
+    error_code = (response[7] >> 6) & 0x03
+    event_count = struct.unpack_from('<I', response, 8)[0]
+
+    if error_code != 0:
+        raise Exception('Dump failed with error code {0}, see the log of the Brick Daemon'.format(error_code))
+
+    print('>>> dumped {0} event(s)'.format(event_count))
+
+def main():
+    parser = argparse.ArgumentParser(description='Decode a packet trace dump of the Brick Daemon')
+    parser.add_argument('filename', nargs='?', help='dump file to decode')
+    parser.add_argument('--request-dump', metavar='HOST[:PORT]', help='ask the Brick Daemon to write a dump first')
+    parser.add_argument('--requests', action='store_true', help='show per-request hop deltas instead of events')
+    parser.add_argument('--slowest', type=int, metavar='N', help='only show the N slowest requests, implies --requests')
+
+    args = parser.parse_args()
+
+    if args.request_dump != None:
+        host, _, port = args.request_dump.partition(':')
+
+        request_dump(host, int(port) if len(port) > 0 else 4223)
+
+    if args.filename == None:
+        return
+
+    dump_timestamp, sources, events = read_dump(args.filename)
+
+    if args.requests or args.slowest != None:
+        print_requests(sources, correlate(events), args.slowest)
+    else:
+        print_events(sources, events, dump_timestamp)
+
+if __name__ == '__main__':
+    try:
+        main()
+    except Exception as e:
+        print('>>> error: {0}'.format(e))
+        sys.exit(1)
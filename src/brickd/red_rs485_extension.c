@@ -51,6 +51,7 @@
 
 #include "red_rs485_extension.h"
 
+#include "event_timing.h"
 #include "hardware.h"
 #include "network.h"
 #include "stack.h"
@@ -556,6 +557,7 @@ void verify_buffer(void) {
 			stack_add_recipient(&_red_rs485_extension.base, _receive.packet.header.uid, _receive.frame.address); // FIXME: check return value
 
 			// Send message into brickd dispatcher
+			stack_count_response(&_red_rs485_extension.base, &_receive.packet);
 			network_dispatch_response(&_receive.packet);
 		}
 
@@ -1010,9 +1012,9 @@ int red_rs485_extension_init(ExtensionRS485Config *rs485_config) {
 	phase = 3;
 
 	// Adding serial data available event
-	if (event_add_source(_red_rs485_serial_fd, EVENT_SOURCE_TYPE_GENERIC,
-	                     "rs485-serial", EVENT_READ,
-	                     serial_data_available_handler, NULL) < 0) {
+	if (event_timing_add_source(_red_rs485_serial_fd, EVENT_SOURCE_TYPE_GENERIC,
+	                            "rs485-serial", EVENT_READ,
+	                            serial_data_available_handler, NULL) < 0) {
 		log_error("Could not add new serial data event");
 
 		goto cleanup;
@@ -1024,8 +1026,8 @@ int red_rs485_extension_init(ExtensionRS485Config *rs485_config) {
 	_master_timer_event = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
 
 	if (!(_master_timer_event < 0)) {
-		if (event_add_source(_master_timer_event, EVENT_SOURCE_TYPE_GENERIC,
-		                     "rs485-timer", EVENT_READ, master_timeout_handler, NULL) < 0) {
+		if (event_timing_add_source(_master_timer_event, EVENT_SOURCE_TYPE_GENERIC,
+		                            "rs485-timer", EVENT_READ, master_timeout_handler, NULL) < 0) {
 			log_error("Could not add RS485 master timer notification pipe as event source");
 
 			goto cleanup;
@@ -1066,12 +1068,12 @@ int red_rs485_extension_init(ExtensionRS485Config *rs485_config) {
 cleanup:
 	switch (phase) { // no breaks, all cases fall through intentionally
 	case 5:
-		event_remove_source(_master_timer_event, EVENT_SOURCE_TYPE_GENERIC);
+		event_timing_remove_source(_master_timer_event, EVENT_SOURCE_TYPE_GENERIC);
 		robust_close(_master_timer_event);
 		// fall through
 
 	case 4:
-		event_remove_source(_red_rs485_serial_fd, EVENT_SOURCE_TYPE_GENERIC);
+		event_timing_remove_source(_red_rs485_serial_fd, EVENT_SOURCE_TYPE_GENERIC);
 		robust_close(_red_rs485_serial_fd);
 		// fall through
 
@@ -1112,8 +1114,8 @@ void red_rs485_extension_exit(void) {
 	}
 
 	// Remove event as possible poll source
-	event_remove_source(_red_rs485_serial_fd, EVENT_SOURCE_TYPE_GENERIC);
-	event_remove_source(_master_timer_event, EVENT_SOURCE_TYPE_GENERIC);
+	event_timing_remove_source(_red_rs485_serial_fd, EVENT_SOURCE_TYPE_GENERIC);
+	event_timing_remove_source(_master_timer_event, EVENT_SOURCE_TYPE_GENERIC);
 
 	// We can also free the queue and stack now, nobody will use them anymore
 	hardware_remove_stack(&_red_rs485_extension.base);
@@ -1130,7 +1132,7 @@ void red_rs485_extension_exit(void) {
 	}
 
 	conf_file_destroy(&crc_error_count_file);
-	timer_destroy(&crc_error_count_update_timer);
+	event_timing_destroy_timer(&crc_error_count_update_timer);
 }
 
 bool init_crc_error_count_to_fs(void) {
@@ -1182,7 +1184,8 @@ bool init_crc_error_count_to_fs(void) {
 	}
 
 	// Setup and start CRC error count value update timer
-	if (timer_create_(&crc_error_count_update_timer, update_crc_error_count_to_fs, &crc_error_count_value) < 0) {
+	if (event_timing_create_timer(&crc_error_count_update_timer, "rs485-crc-error-count",
+	                              update_crc_error_count_to_fs, &crc_error_count_value) < 0) {
 		log_error("Could not create CRC error count update timer: %s (%d)",
 		          get_errno_name(errno), errno);
 
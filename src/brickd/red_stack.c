@@ -48,6 +48,7 @@
 
 #include "red_stack.h"
 
+#include "event_timing.h"
 #include "hardware.h"
 #include "network.h"
 #include "red_usb_gadget.h"
@@ -569,7 +570,7 @@ static void red_stack_spi_handle_reset(void) {
 	int slave;
 
 	stack_announce_disconnect(&_red_stack.base);
-	_red_stack.base.recipients.count = 0; // FIXME: properly clear the array
+	stack_clear_recipients(&_red_stack.base);
 
 	log_info("Starting reinitialization of SPI slaves");
 
@@ -823,6 +824,7 @@ static void red_stack_dispatch_from_spi(void *opaque) {
 		}
 
 		// Send message into brickd dispatcher
+		stack_count_response(&_red_stack.base, &response->packet);
 		network_dispatch_response(&response->packet);
 
 		mutex_lock(&_red_stack.response_queue_mutex);
@@ -947,9 +949,9 @@ int red_stack_init(void) {
 
 	// Add notification pipe as event source.
 	// Event is used to dispatch packets.
-	if (event_add_source(_red_stack_notification_event, EVENT_SOURCE_TYPE_GENERIC,
-	                     "red-stack-notification", EVENT_READ,
-	                     red_stack_dispatch_from_spi, NULL) < 0) {
+	if (event_timing_add_source(_red_stack_notification_event, EVENT_SOURCE_TYPE_GENERIC,
+	                            "red-stack-notification", EVENT_READ,
+	                            red_stack_dispatch_from_spi, NULL) < 0) {
 		log_error("Could not add red stack notification pipe as event source");
 
 		goto cleanup;
@@ -994,9 +996,9 @@ int red_stack_init(void) {
 		lseek(_red_stack_reset_fd, 0, SEEK_SET);
 		if (robust_read(_red_stack_reset_fd, buf, 2) < 0) {} // ignore return value
 
-		if (event_add_source(_red_stack_reset_fd, EVENT_SOURCE_TYPE_GENERIC,
-		                     "red-stack-reset", EVENT_PRIO | EVENT_ERROR,
-		                     red_stack_reset_handler, NULL) < 0) {
+		if (event_timing_add_source(_red_stack_reset_fd, EVENT_SOURCE_TYPE_GENERIC,
+		                            "red-stack-reset", EVENT_PRIO | EVENT_ERROR,
+		                            red_stack_reset_handler, NULL) < 0) {
 			log_error("Could not add reset fd event");
 
 			goto cleanup;
@@ -1025,7 +1027,7 @@ cleanup:
 			queue_destroy(&_red_stack.slaves[k].request_queue, NULL);
 		}
 
-		event_remove_source(_red_stack_notification_event, EVENT_SOURCE_TYPE_GENERIC);
+		event_timing_remove_source(_red_stack_notification_event, EVENT_SOURCE_TYPE_GENERIC);
 		// fall through
 
 	case 3:
@@ -1053,11 +1055,11 @@ void red_stack_exit(void) {
 
 	// Remove reset interrupt as event source
 	if (_red_stack_reset_fd > 0) {
-		event_remove_source(_red_stack_reset_fd, EVENT_SOURCE_TYPE_GENERIC);
+		event_timing_remove_source(_red_stack_reset_fd, EVENT_SOURCE_TYPE_GENERIC);
 	}
 
 	// Remove event as possible poll source
-	event_remove_source(_red_stack_notification_event, EVENT_SOURCE_TYPE_GENERIC);
+	event_timing_remove_source(_red_stack_notification_event, EVENT_SOURCE_TYPE_GENERIC);
 
 	// Make sure that Thread shuts down properly
 	if (_red_stack_spi_thread_running) {
@@ -53,6 +53,7 @@
 
 #include "red_usb_gadget.h"
 
+#include "event_timing.h"
 #include "network.h"
 
 static LogSource _log_source = LOG_SOURCE_INITIALIZER;
@@ -223,8 +224,8 @@ int red_usb_gadget_init(void) {
 
 	phase = 1;
 
-	if (event_add_source(_state_file.handle, EVENT_SOURCE_TYPE_GENERIC, "usb-gadget",
-	                     EVENT_READ, red_usb_gadget_handle_state_change, NULL) < 0) {
+	if (event_timing_add_source(_state_file.handle, EVENT_SOURCE_TYPE_GENERIC, "usb-gadget",
+	                            EVENT_READ, red_usb_gadget_handle_state_change, NULL) < 0) {
 		goto cleanup;
 	}
 
@@ -246,7 +247,7 @@ int red_usb_gadget_init(void) {
 cleanup:
 	switch (phase) { // no breaks, all cases fall through intentionally
 	case 2:
-		event_remove_source(_state_file.handle, EVENT_SOURCE_TYPE_GENERIC);
+		event_timing_remove_source(_state_file.handle, EVENT_SOURCE_TYPE_GENERIC);
 		// fall through
 
 	case 1:
@@ -267,7 +268,7 @@ void red_usb_gadget_exit(void) {
 		red_usb_gadget_disconnect();
 	}
 
-	event_remove_source(_state_file.handle, EVENT_SOURCE_TYPE_GENERIC);
+	event_timing_remove_source(_state_file.handle, EVENT_SOURCE_TYPE_GENERIC);
 
 	file_destroy(&_state_file);
 }
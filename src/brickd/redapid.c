@@ -32,6 +32,7 @@
 
 #include "redapid.h"
 
+#include "event_timing.h"
 #include "hardware.h"
 #include "network.h"
 #include "red_usb_gadget.h"
@@ -66,7 +67,7 @@ uint8_t _redapid_version[3] = {2, 0, 0};
 static void redapid_disconnect(bool reconnect) {
 	writer_destroy(&_redapid.request_writer);
 
-	event_remove_source(_redapid.socket.handle, EVENT_SOURCE_TYPE_GENERIC);
+	event_timing_remove_source(_redapid.socket.handle, EVENT_SOURCE_TYPE_GENERIC);
 	socket_destroy(&_redapid.socket);
 
 	_connected = false;
@@ -154,6 +155,7 @@ static void redapid_handle_read(void *opaque) {
 
 		stack_add_recipient(&_redapid.base, _redapid.response.header.uid, 0);
 
+		stack_count_response(&_redapid.base, &_redapid.response);
 		network_dispatch_response(&_redapid.response);
 
 		memmove(_redapid.response_buffer, _redapid.response_buffer + length,
@@ -279,8 +281,8 @@ static void redapid_handle_reconnect(void *opaque) {
 	}
 
 	// add socket as event source
-	if (event_add_source(_redapid.socket.handle, EVENT_SOURCE_TYPE_GENERIC,
-	                     "redapid", EVENT_READ, redapid_handle_read, NULL) < 0) {
+	if (event_timing_add_source(_redapid.socket.handle, EVENT_SOURCE_TYPE_GENERIC,
+	                            "redapid", EVENT_READ, redapid_handle_read, NULL) < 0) {
 		goto cleanup;
 	}
 
@@ -320,7 +322,7 @@ cleanup:
 		// fall through
 
 	case 2:
-		event_remove_source(_redapid.socket.handle, EVENT_SOURCE_TYPE_GENERIC);
+		event_timing_remove_source(_redapid.socket.handle, EVENT_SOURCE_TYPE_GENERIC);
 		// fall through
 
 	case 1:
@@ -413,7 +415,8 @@ int redapid_init(void) {
 	phase = 1;
 
 	// create reconnect timer
-	if (timer_create_(&_reconnect_timer, redapid_handle_reconnect, NULL) < 0) {
+	if (event_timing_create_timer(&_reconnect_timer, "redapid-reconnect",
+	                              redapid_handle_reconnect, NULL) < 0) {
 		log_error("Could not create reconnect timer: %s (%d)",
 		          get_errno_name(errno), errno);
 
@@ -441,7 +444,7 @@ int redapid_init(void) {
 cleanup:
 	switch (phase) { // no breaks, all cases fall through intentionally
 	case 2:
-		timer_destroy(&_reconnect_timer);
+		event_timing_destroy_timer(&_reconnect_timer);
 		// fall through
 
 	case 1:
@@ -464,7 +467,7 @@ void redapid_exit(void) {
 		redapid_disconnect(false);
 	}
 
-	timer_destroy(&_reconnect_timer);
+	event_timing_destroy_timer(&_reconnect_timer);
 
 	stack_destroy(&_redapid.base);
 }
@@ -0,0 +1,716 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * replay_stack.c: Stack that answers with the responses of a traffic capture
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * the replay stack plays the device side of a traffic capture, the
+ * traffic_replay tool plays the client side. it is only created if the
+ * replay_stack.filename option is set.
+ *
+ * every device that sent a response in the capture becomes a recipient of
+ * the replay stack. a request is answered with the next recorded response
+ * for its UID and function ID, after the recorded time between the request
+ * and its response. if all recorded responses for a UID and function ID are
+ * used up then they are used again from the beginning. an enumerate request
+ * is answered with the last recorded enumerate callback of each device.
+ * all other callbacks are sent once at their recorded time, counted from the
+ * start of the Brick Daemon.
+ *
+ * all delays are scaled by the replay_stack.speed option, given in percent
+ * of the recorded speed. responses are sent in the order of their requests,
+ * like responses on a single USB connection.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <daemonlib/array.h>
+#include <daemonlib/config.h>
+#include <daemonlib/log.h>
+#include <daemonlib/timer.h>
+#include <daemonlib/utils.h>
+
+#include "replay_stack.h"
+
+#include "byte_order.h"
+#include "delayed_response.h"
+#include "event_timing.h"
+#include "hardware.h"
+#include "stack.h"
+#include "traffic_capture.h"
+
+static LogSource _log_source = LOG_SOURCE_INITIALIZER;
+
+#define MAX_OPEN_REQUESTS 256 // recorded requests still waiting for their response
+
+typedef struct {
+	uint32_t uid; // always little endian, 0 marks a matched request
+	uint8_t function_id;
+	uint8_t sequence_number;
+	uint64_t timestamp; // microseconds
+} OpenRequest;
+
+typedef struct {
+	uint32_t uid; // always little endian
+	bool has_enumerate_callback;
+	EnumerateCallback enumerate_callback; // last recorded one
+} ReplayDevice;
+
+typedef struct {
+	uint64_t latency; // recorded time from request to response in microseconds
+	int next; // index of the next response for the same UID and function ID, -1 if none
+	Packet response;
+} ReplayResponse;
+
+typedef struct {
+	uint32_t uid; // always little endian, 0 marks a free slot
+	uint8_t function_id;
+	int first; // index into the responses
+	int last;
+	int current; // index of the response to replay next
+} ReplayKey;
+
+typedef struct {
+	uint64_t offset; // recorded time since the first record in microseconds
+	Packet callback;
+} ReplayCallback;
+
+typedef struct {
+	Stack base;
+
+	bool enabled;
+	int speed; // in percent, 0 replays without any delay
+	Array devices;
+	Array responses;
+	ReplayKey *keys;
+	int key_slot_count; // always a power of two
+	Array callbacks;
+	int next_callback;
+	uint64_t start; // in microseconds
+	DelayedResponseQueue response_queue;
+	Timer callback_timer;
+	uint64_t unknown_requests;
+} ReplayStack;
+
+static ReplayStack _replay_stack;
+
+// scales a recorded duration to the configured speed
+static uint64_t replay_stack_scale(uint64_t duration) {
+	return duration * 100 / _replay_stack.speed;
+}
+
+static ReplayKey *replay_stack_find_key(uint32_t uid, uint8_t function_id) {
+	int mask = _replay_stack.key_slot_count - 1;
+	int slot = (uid_get_hash(uid) ^ function_id) & mask;
+	ReplayKey *key;
+
+	for (;;) {
+		key = &_replay_stack.keys[slot];
+
+		if (key->uid == 0 || (key->uid == uid && key->function_id == function_id)) {
+			return key;
+		}
+
+		slot = (slot + 1) & mask;
+	}
+}
+
+// sends the response after its recorded latency, but not before the
+// responses to earlier requests
+static void replay_stack_respond(Packet *response, uint64_t latency) {
+	if (_replay_stack.speed == 0) {
+		delayed_response_send(&_replay_stack.base, response);
+
+		return;
+	}
+
+	delayed_response_queue_push(&_replay_stack.response_queue, response,
+	                            replay_stack_scale(latency), 0);
+}
+
+static void replay_stack_enumerate(void) {
+	int i;
+	ReplayDevice *device;
+	union {
+		EnumerateCallback enumerate_callback;
+		Packet packet;
+	} u;
+
+	for (i = 0; i < _replay_stack.devices.count; ++i) {
+		device = array_get(&_replay_stack.devices, i);
+
+		if (!device->has_enumerate_callback) {
+			continue;
+		}
+
+		memcpy(&u.enumerate_callback, &device->enumerate_callback, sizeof(u.enumerate_callback));
+
+		u.enumerate_callback.enumeration_type = ENUMERATION_TYPE_AVAILABLE;
+
+		replay_stack_respond(&u.packet, 0);
+	}
+}
+
+static int replay_stack_dispatch_request(Stack *stack, Packet *request,
+                                         Recipient *recipient) {
+	ReplayKey *key;
+	ReplayResponse *replay_response;
+	Packet response;
+
+	(void)stack;
+
+	if (request->header.function_id == FUNCTION_ENUMERATE) {
+		log_packet_debug("Received enumerate request, sending recorded enumerate callback(s)");
+
+		replay_stack_enumerate();
+
+		return 0;
+	}
+
+	if (recipient == NULL) {
+		// broadcast or request for an unknown UID
+		return 0;
+	}
+
+	if (!packet_header_get_response_expected(&request->header)) {
+		return 0;
+	}
+
+	key = replay_stack_find_key(request->header.uid, request->header.function_id);
+
+	if (key->uid == 0) {
+		++_replay_stack.unknown_requests;
+
+		memset(&response, 0, sizeof(response));
+
+		response.header = request->header;
+		response.header.length = sizeof(PacketHeader);
+
+		packet_header_set_error_code(&response.header, PACKET_E_FUNCTION_NOT_SUPPORTED);
+
+		replay_stack_respond(&response, 0);
+
+		return 0;
+	}
+
+	replay_response = array_get(&_replay_stack.responses, key->current);
+	key->current = replay_response->next >= 0 ? replay_response->next : key->first;
+
+	memcpy(&response, &replay_response->response, replay_response->response.header.length);
+
+	// the recorded response belongs to a request with another sequence number
+	response.header.sequence_number_and_options = request->header.sequence_number_and_options;
+
+	replay_stack_respond(&response, replay_response->latency);
+
+	return 0;
+}
+
+static void replay_stack_arm_callback_timer(uint64_t elapsed) {
+	ReplayCallback *callback;
+
+	if (_replay_stack.next_callback >= _replay_stack.callbacks.count) {
+		log_info("Replayed all %d recorded callback(s)", _replay_stack.callbacks.count);
+
+		return;
+	}
+
+	callback = array_get(&_replay_stack.callbacks, _replay_stack.next_callback);
+
+	// a delay of 0 would disarm the timer
+	if (timer_configure(&_replay_stack.callback_timer,
+	                    callback->offset > elapsed ? replay_stack_scale(callback->offset - elapsed) + 1 : 1, 0) < 0) {
+		log_error("Could not start callback timer of replay stack: %s (%d)",
+		          get_errno_name(errno), errno);
+	}
+}
+
+static void replay_stack_handle_callback(void *opaque) {
+	uint64_t elapsed = UINT64_MAX;
+	ReplayCallback *callback;
+
+	(void)opaque;
+
+	if (_replay_stack.speed > 0) {
+		elapsed = (microtime() - _replay_stack.start) * _replay_stack.speed / 100;
+	}
+
+	while (_replay_stack.next_callback < _replay_stack.callbacks.count) {
+		callback = array_get(&_replay_stack.callbacks, _replay_stack.next_callback);
+
+		if (callback->offset > elapsed) {
+			break;
+		}
+
+		delayed_response_send(&_replay_stack.base, &callback->callback);
+
+		++_replay_stack.next_callback;
+	}
+
+	replay_stack_arm_callback_timer(elapsed);
+}
+
+static int replay_stack_add_device(uint32_t uid, ReplayDevice **device) {
+	Recipient *recipient = stack_get_recipient(&_replay_stack.base, uid);
+
+	if (recipient != NULL) {
+		*device = array_get(&_replay_stack.devices, (int)recipient->opaque);
+
+		return 0;
+	}
+
+	*device = array_append(&_replay_stack.devices);
+
+	if (*device == NULL) {
+		log_error("Could not append to device array of replay stack: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		return -1;
+	}
+
+	memset(*device, 0, sizeof(**device));
+
+	(*device)->uid = uid;
+
+	if (stack_add_recipient(&_replay_stack.base, uid, _replay_stack.devices.count - 1) < 0) {
+		array_remove(&_replay_stack.devices, _replay_stack.devices.count - 1, NULL);
+
+		return -1;
+	}
+
+	return 0;
+}
+
+// remembers a recorded request until its response is recorded
+static void replay_stack_open_request(OpenRequest *open_requests, int *next_open_request,
+                                      Packet *request, uint64_t timestamp) {
+	OpenRequest *open_request = &open_requests[*next_open_request];
+
+	open_request->uid = request->header.uid;
+	open_request->function_id = request->header.function_id;
+	open_request->sequence_number = packet_header_get_sequence_number(&request->header);
+	open_request->timestamp = timestamp;
+
+	*next_open_request = (*next_open_request + 1) % MAX_OPEN_REQUESTS;
+}
+
+// returns the recorded time between the request and the given response, or 0
+// if the request is unknown
+static uint64_t replay_stack_close_request(OpenRequest *open_requests, int next_open_request,
+                                           Packet *response, uint64_t timestamp) {
+	int i;
+	OpenRequest *open_request;
+	uint8_t sequence_number = packet_header_get_sequence_number(&response->header);
+
+	// search backwards, starting at the most recent request
+	for (i = 1; i <= MAX_OPEN_REQUESTS; ++i) {
+		open_request = &open_requests[(next_open_request + MAX_OPEN_REQUESTS - i) % MAX_OPEN_REQUESTS];
+
+		if (open_request->uid == response->header.uid &&
+		    open_request->function_id == response->header.function_id &&
+		    open_request->sequence_number == sequence_number) {
+			open_request->uid = 0;
+
+			return timestamp > open_request->timestamp ? timestamp - open_request->timestamp : 0;
+		}
+	}
+
+	return 0;
+}
+
+static int replay_stack_add_response(Packet *response, uint64_t timestamp,
+                                     uint64_t first_timestamp, uint64_t latency) {
+	ReplayDevice *device;
+	ReplayCallback *callback;
+	ReplayResponse *replay_response;
+	EnumerateCallback *enumerate_callback;
+
+	if (replay_stack_add_device(response->header.uid, &device) < 0) {
+		return -1;
+	}
+
+	if (packet_header_get_sequence_number(&response->header) != 0) {
+		replay_response = array_append(&_replay_stack.responses);
+
+		if (replay_response == NULL) {
+			log_error("Could not append to response array of replay stack: %s (%d)",
+			          get_errno_name(errno), errno);
+
+			return -1;
+		}
+
+		replay_response->latency = latency;
+		replay_response->next = -1;
+
+		memcpy(&replay_response->response, response, response->header.length);
+
+		return 0;
+	}
+
+	if (response->header.function_id == CALLBACK_ENUMERATE &&
+	    response->header.length == sizeof(EnumerateCallback)) {
+		enumerate_callback = (EnumerateCallback *)response;
+
+		memcpy(&device->enumerate_callback, enumerate_callback, sizeof(*enumerate_callback));
+
+		device->has_enumerate_callback = true;
+
+		// enumerate-available callbacks are the answer to an enumerate
+		// request, they are sent when such a request is replayed
+		if (enumerate_callback->enumeration_type == ENUMERATION_TYPE_AVAILABLE) {
+			return 0;
+		}
+	}
+
+	callback = array_append(&_replay_stack.callbacks);
+
+	if (callback == NULL) {
+		log_error("Could not append to callback array of replay stack: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		return -1;
+	}
+
+	callback->offset = timestamp - first_timestamp;
+
+	memcpy(&callback->callback, response, response->header.length);
+
+	return 0;
+}
+
+// links all recorded responses with the same UID and function ID
+static int replay_stack_index_responses(void) {
+	int i;
+	ReplayResponse *replay_response;
+	ReplayResponse *last_response;
+	ReplayKey *key;
+
+	_replay_stack.key_slot_count = 64;
+
+	while (_replay_stack.key_slot_count < _replay_stack.responses.count * 2) {
+		_replay_stack.key_slot_count *= 2;
+	}
+
+	_replay_stack.keys = calloc(_replay_stack.key_slot_count, sizeof(ReplayKey));
+
+	if (_replay_stack.keys == NULL) {
+		log_error("Could not allocate response index of replay stack: %s (%d)",
+		          get_errno_name(ENOMEM), ENOMEM);
+
+		return -1;
+	}
+
+	for (i = 0; i < _replay_stack.responses.count; ++i) {
+		replay_response = array_get(&_replay_stack.responses, i);
+		key = replay_stack_find_key(replay_response->response.header.uid,
+		                            replay_response->response.header.function_id);
+
+		if (key->uid == 0) {
+			key->uid = replay_response->response.header.uid;
+			key->function_id = replay_response->response.header.function_id;
+			key->first = i;
+			key->current = i;
+		} else {
+			last_response = array_get(&_replay_stack.responses, key->last);
+			last_response->next = i;
+		}
+
+		key->last = i;
+	}
+
+	return 0;
+}
+
+static int replay_stack_load(const char *filename) {
+	FILE *fp;
+	TrafficCaptureHeader header;
+	TrafficCaptureRecordHeader record_header;
+	uint64_t timestamp;
+	uint64_t first_timestamp = 0;
+	bool first = true;
+	OpenRequest open_requests[MAX_OPEN_REQUESTS];
+	int next_open_request = 0;
+	uint64_t latency;
+	union {
+		Packet packet;
+		uint8_t data[256];
+	} u;
+	int result = -1;
+
+	memset(open_requests, 0, sizeof(open_requests));
+
+	fp = fopen(filename, "rb");
+
+	if (fp == NULL) {
+		log_error("Could not open traffic capture file '%s' for reading: %s (%d)",
+		          filename, get_errno_name(errno), errno);
+
+		return -1;
+	}
+
+	if (fread(&header, 1, sizeof(header), fp) != sizeof(header) ||
+	    memcmp(header.magic, TRAFFIC_CAPTURE_MAGIC, sizeof(header.magic)) != 0 ||
+	    uint32_from_le(header.version) != TRAFFIC_CAPTURE_VERSION ||
+	    uint32_from_le(header.record_header_size) != sizeof(record_header)) {
+		log_error("Traffic capture file '%s' has an invalid or unsupported header", filename);
+
+		goto cleanup;
+	}
+
+	while (fread(&record_header, 1, sizeof(record_header), fp) == sizeof(record_header)) {
+		if (fread(u.data, 1, record_header.length, fp) != record_header.length) {
+			log_error("Traffic capture file '%s' is truncated", filename);
+
+			goto cleanup;
+		}
+
+		timestamp = uint64_from_le(record_header.timestamp);
+
+		if (first) {
+			first_timestamp = timestamp;
+			first = false;
+		}
+
+		if (record_header.type != TRAFFIC_CAPTURE_RECORD_REQUEST &&
+		    record_header.type != TRAFFIC_CAPTURE_RECORD_RESPONSE) {
+			continue;
+		}
+
+		if (record_header.length < sizeof(PacketHeader) ||
+		    record_header.length > sizeof(Packet) ||
+		    record_header.length != u.packet.header.length) {
+			log_error("Traffic capture file '%s' contains a malformed packet", filename);
+
+			goto cleanup;
+		}
+
+		if (record_header.type == TRAFFIC_CAPTURE_RECORD_REQUEST) {
+			if (packet_header_get_sequence_number(&u.packet.header) != 0 &&
+			    packet_header_get_response_expected(&u.packet.header)) {
+				replay_stack_open_request(open_requests, &next_open_request, &u.packet, timestamp);
+			}
+
+			continue;
+		}
+
+		latency = 0;
+
+		if (packet_header_get_sequence_number(&u.packet.header) != 0) {
+			latency = replay_stack_close_request(open_requests, next_open_request,
+			                                     &u.packet, timestamp);
+		}
+
+		if (replay_stack_add_response(&u.packet, timestamp, first_timestamp, latency) < 0) {
+			goto cleanup;
+		}
+	}
+
+	if (ferror(fp)) {
+		log_error("Could not read traffic capture file '%s': %s (%d)",
+		          filename, get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	result = 0;
+
+cleanup:
+	fclose(fp);
+
+	return result;
+}
+
+static const MetricFamily _replay_stack_unknown_requests = {
+	"brickd_replay_stack_unknown_requests_total", METRIC_TYPE_COUNTER,
+	"Number of requests without a recorded response for their UID and function ID."
+};
+
+static void replay_stack_collect_metrics(Stack *stack, Metrics *metrics) {
+	delayed_response_queue_collect_metrics(&_replay_stack.response_queue, metrics);
+
+	metrics_add(metrics, &_replay_stack_unknown_requests,
+	            _replay_stack.unknown_requests, "stack", stack->name, NULL);
+}
+
+int replay_stack_init(void) {
+	int phase = 0;
+	const char *filename = config_get_option_value("replay_stack.filename")->string;
+
+	if (filename == NULL || *filename == '\0') {
+		return 0;
+	}
+
+	log_info("Initializing replay stack from '%s'", filename);
+
+	_replay_stack.speed = config_get_option_value("replay_stack.speed")->integer;
+	_replay_stack.keys = NULL;
+	_replay_stack.next_callback = 0;
+	_replay_stack.unknown_requests = 0;
+
+	// create base stack
+	if (stack_create(&_replay_stack.base, "replay", replay_stack_dispatch_request) < 0) {
+		log_error("Could not create base stack for replay stack: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	_replay_stack.base.collect_metrics = replay_stack_collect_metrics;
+
+	phase = 1;
+
+	// create device, response and callback arrays
+	if (array_create(&_replay_stack.devices, 32, sizeof(ReplayDevice), true) < 0) {
+		log_error("Could not create device array for replay stack: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 2;
+
+	if (array_create(&_replay_stack.responses, 1024, sizeof(ReplayResponse), true) < 0) {
+		log_error("Could not create response array for replay stack: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 3;
+
+	if (array_create(&_replay_stack.callbacks, 1024, sizeof(ReplayCallback), true) < 0) {
+		log_error("Could not create callback array for replay stack: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 4;
+
+	if (replay_stack_load(filename) < 0 || replay_stack_index_responses() < 0) {
+		goto cleanup;
+	}
+
+	log_info("Loaded %d device(s), %d response(s) and %d callback(s) for replay stack",
+	         _replay_stack.devices.count, _replay_stack.responses.count,
+	         _replay_stack.callbacks.count);
+
+	phase = 5;
+
+	// create response queue
+	if (delayed_response_queue_create(&_replay_stack.response_queue, &_replay_stack.base,
+	                                  "replay-stack-service") < 0) {
+		goto cleanup;
+	}
+
+	phase = 6;
+
+	// create callback timer
+	if (event_timing_create_timer(&_replay_stack.callback_timer, "replay-stack-callback",
+	                              replay_stack_handle_callback, NULL) < 0) {
+		log_error("Could not create callback timer for replay stack: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 7;
+
+	// add to stacks array
+	if (hardware_add_stack(&_replay_stack.base) < 0) {
+		goto cleanup;
+	}
+
+	phase = 8;
+
+	_replay_stack.start = microtime();
+
+	replay_stack_arm_callback_timer(0);
+
+	_replay_stack.enabled = true;
+
+	phase = 9;
+
+cleanup:
+	switch (phase) { // no breaks, all cases fall through intentionally
+	case 8:
+		hardware_remove_stack(&_replay_stack.base);
+		// fall through
+
+	case 7:
+		event_timing_destroy_timer(&_replay_stack.callback_timer);
+		// fall through
+
+	case 6:
+		delayed_response_queue_destroy(&_replay_stack.response_queue);
+		// fall through
+
+	case 5:
+		free(_replay_stack.keys);
+		// fall through
+
+	case 4:
+		array_destroy(&_replay_stack.callbacks, NULL);
+		// fall through
+
+	case 3:
+		array_destroy(&_replay_stack.responses, NULL);
+		// fall through
+
+	case 2:
+		array_destroy(&_replay_stack.devices, NULL);
+		// fall through
+
+	case 1:
+		stack_destroy(&_replay_stack.base);
+		// fall through
+
+	default:
+		break;
+	}
+
+	return phase == 9 ? 0 : -1;
+}
+
+void replay_stack_exit(void) {
+	if (!_replay_stack.enabled) {
+		return;
+	}
+
+	log_debug("Shutting down replay stack");
+
+	hardware_remove_stack(&_replay_stack.base);
+
+	event_timing_destroy_timer(&_replay_stack.callback_timer);
+
+	delayed_response_queue_destroy(&_replay_stack.response_queue);
+
+	free(_replay_stack.keys);
+
+	array_destroy(&_replay_stack.callbacks, NULL);
+	array_destroy(&_replay_stack.responses, NULL);
+	array_destroy(&_replay_stack.devices, NULL);
+
+	stack_destroy(&_replay_stack.base);
+
+	_replay_stack.enabled = false;
+}
@@ -0,0 +1,165 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * shard_queue.c: Lock-free single producer, single consumer record queue
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * a shard queue passes variable length records from exactly one producer
+ * thread to exactly one consumer thread without locking. head and tail are
+ * free running counters, the producer only writes the head and the consumer
+ * only writes the tail. a record is always stored contiguously. if it does
+ * not fit between the head and the end of the buffer then the rest of the
+ * buffer is filled with a skip record and the record starts at the
+ * beginning of the buffer.
+ *
+ * the buffer is allocated with sizeof(Packet) bytes of slack at its end, so
+ * a packet in a record at the end of the buffer can be accessed as a whole
+ * Packet without reading past the allocation.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+
+#include <daemonlib/packet.h>
+
+#include "shard_queue.h"
+
+#define SHARD_QUEUE_ALIGNMENT 8
+
+#define shard_queue_load(pointer) __atomic_load_n(pointer, __ATOMIC_ACQUIRE)
+#define shard_queue_store(pointer, value) __atomic_store_n(pointer, value, __ATOMIC_RELEASE)
+#define shard_queue_fence() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+static uint32_t shard_queue_get_record_size(int length) {
+	return (sizeof(ShardQueueRecord) + length + SHARD_QUEUE_ALIGNMENT - 1) & ~(SHARD_QUEUE_ALIGNMENT - 1);
+}
+
+int shard_queue_create(ShardQueue *queue, uint32_t size) {
+	if (size == 0 || (size & (size - 1)) != 0) {
+		errno = EINVAL;
+
+		return -1;
+	}
+
+	queue->buffer = malloc(size + sizeof(Packet));
+
+	if (queue->buffer == NULL) {
+		errno = ENOMEM;
+
+		return -1;
+	}
+
+	queue->size = size;
+	queue->head = 0;
+	queue->tail = 0;
+	queue->reserved_head = 0;
+
+	return 0;
+}
+
+void shard_queue_destroy(ShardQueue *queue) {
+	free(queue->buffer);
+}
+
+// returns a record with room for the given number of data bytes, or NULL if
+// the queue is full. the record is not visible to the consumer before it is
+// committed. only one record can be reserved at a time
+ShardQueueRecord *shard_queue_reserve(ShardQueue *queue, int length) {
+	uint32_t record_size = shard_queue_get_record_size(length);
+	uint32_t position = queue->head & (queue->size - 1);
+	uint32_t contiguous = queue->size - position;
+	uint32_t required = record_size;
+	ShardQueueRecord *record;
+
+	if (length < 0 || length > UINT16_MAX || record_size > queue->size / 2) {
+		return NULL;
+	}
+
+	if (contiguous < record_size) {
+		required += contiguous;
+	}
+
+	if (queue->size - (queue->head - shard_queue_load(&queue->tail)) < required) {
+		return NULL;
+	}
+
+	if (contiguous < record_size) {
+		record = (ShardQueueRecord *)(queue->buffer + position);
+		record->type = SHARD_QUEUE_RECORD_SKIP;
+
+		position = 0;
+	}
+
+	record = (ShardQueueRecord *)(queue->buffer + position);
+	record->length = (uint16_t)length;
+
+	queue->reserved_head = queue->head + required;
+
+	return record;
+}
+
+// makes the reserved record visible to the consumer. returns true if the
+// queue was empty before, then the consumer might have to be woken up
+bool shard_queue_commit(ShardQueue *queue) {
+	uint32_t head = queue->head;
+
+	shard_queue_store(&queue->head, queue->reserved_head);
+
+	// the store of the head must not be reordered after the load of the
+	// tail. otherwise the consumer can pop the last record and find the
+	// queue empty, while the producer still sees the old tail and does not
+	// wake the consumer up. the consumer side has the matching fence
+	shard_queue_fence();
+
+	return shard_queue_load(&queue->tail) == head;
+}
+
+// returns the oldest record or NULL if the queue is empty
+ShardQueueRecord *shard_queue_peek(ShardQueue *queue) {
+	uint32_t tail = queue->tail;
+	ShardQueueRecord *record;
+
+	if (shard_queue_load(&queue->head) == tail) {
+		return NULL;
+	}
+
+	record = (ShardQueueRecord *)(queue->buffer + (tail & (queue->size - 1)));
+
+	if (record->type == SHARD_QUEUE_RECORD_SKIP) {
+		// the producer never commits a skip record on its own
+		tail += queue->size - (tail & (queue->size - 1));
+
+		shard_queue_store(&queue->tail, tail);
+
+		record = (ShardQueueRecord *)queue->buffer;
+	}
+
+	return record;
+}
+
+// removes the record returned by the last call of shard_queue_peek
+void shard_queue_pop(ShardQueue *queue) {
+	ShardQueueRecord *record = (ShardQueueRecord *)(queue->buffer + (queue->tail & (queue->size - 1)));
+
+	shard_queue_store(&queue->tail, queue->tail + shard_queue_get_record_size(record->length));
+
+	// pairs with the fence in shard_queue_commit, the next shard_queue_peek
+	// has to see a head committed before the producer saw this tail
+	shard_queue_fence();
+}
@@ -0,0 +1,54 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * shard_queue.h: Lock-free single producer, single consumer record queue
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef BRICKD_SHARD_QUEUE_H
+#define BRICKD_SHARD_QUEUE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define SHARD_QUEUE_RECORD_SKIP 0xFFFF // reserved record type
+
+typedef struct {
+	uint32_t id;
+	uint16_t type;
+	uint16_t length; // of the data
+	uint8_t data[];
+} ShardQueueRecord;
+
+typedef struct {
+	uint8_t *buffer;
+	uint32_t size; // always a power of two
+	uint32_t head; // only written by the producer
+	uint32_t tail; // only written by the consumer
+	uint32_t reserved_head; // producer only
+} ShardQueue;
+
+int shard_queue_create(ShardQueue *queue, uint32_t size);
+void shard_queue_destroy(ShardQueue *queue);
+
+ShardQueueRecord *shard_queue_reserve(ShardQueue *queue, int length);
+bool shard_queue_commit(ShardQueue *queue);
+
+ShardQueueRecord *shard_queue_peek(ShardQueue *queue);
+void shard_queue_pop(ShardQueue *queue);
+
+#endif // BRICKD_SHARD_QUEUE_H
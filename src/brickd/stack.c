@@ -30,6 +30,11 @@
  * of known UIDs for a stack and provides a generic dispatch function to send
  * requests to a stack. the interface specific implementation of the dispatch
  * function is done in the specific stack types such as the USBStack.
+ *
+ * the recipients are stored in an array and indexed by an open addressing
+ * hash table with linear probing. stack_add_recipient is called for every
+ * response received from a stack, so lookups have to be cheap even for big
+ * stacks such as a mesh network with many nodes.
  */
 
 #include <errno.h>
@@ -41,16 +46,74 @@
 #include <daemonlib/log.h>
 #include <daemonlib/utils.h>
 
+#include "hardware.h"
 #include "network.h"
 #include "stack.h"
 
 static LogSource _log_source = LOG_SOURCE_INITIALIZER;
 
+#define INITIAL_RECIPIENT_SLOT_COUNT 64 // must be a power of two
+
+static int stack_find_recipient_slot(Stack *stack, uint32_t uid) {
+	int mask = stack->recipient_slot_count - 1;
+	int slot = uid_get_hash(uid) & mask;
+	Recipient *recipient;
+
+	while (stack->recipient_slots[slot] != 0) {
+		recipient = array_get(&stack->recipients, stack->recipient_slots[slot] - 1);
+
+		if (recipient->uid == uid) {
+			break;
+		}
+
+		slot = (slot + 1) & mask;
+	}
+
+	return slot;
+}
+
+// rebuilds the index for the current content of the recipient array
+static int stack_rebuild_recipient_index(Stack *stack, int slot_count) {
+	int *recipient_slots = calloc(slot_count, sizeof(int));
+	int i;
+	int slot;
+	Recipient *recipient;
+
+	if (recipient_slots == NULL) {
+		errno = ENOMEM;
+
+		return -1;
+	}
+
+	free(stack->recipient_slots);
+
+	stack->recipient_slots = recipient_slots;
+	stack->recipient_slot_count = slot_count;
+
+	for (i = 0; i < stack->recipients.count; ++i) {
+		recipient = array_get(&stack->recipients, i);
+		slot = stack_find_recipient_slot(stack, recipient->uid);
+
+		stack->recipient_slots[slot] = i + 1;
+	}
+
+	return 0;
+}
+
 int stack_create(Stack *stack, const char *name,
                  StackDispatchRequestFunction dispatch_request) {
 	string_copy(stack->name, sizeof(stack->name), name, -1);
 
 	stack->dispatch_request = dispatch_request;
+	stack->recipient_slots = NULL;
+	stack->recipient_slot_count = 0;
+	stack->collect_metrics = NULL;
+	stack->request_count = 0;
+	stack->request_bytes = 0;
+	stack->response_count = 0;
+	stack->response_bytes = 0;
+
+	latency_histogram_reset(&stack->response_latency);
 
 	if (array_create(&stack->recipients, 32, sizeof(Recipient), true) < 0) {
 		log_error("Could not create recipient array: %s (%d)",
@@ -59,26 +122,53 @@ int stack_create(Stack *stack, const char *name,
 		return -1;
 	}
 
+	if (stack_rebuild_recipient_index(stack, INITIAL_RECIPIENT_SLOT_COUNT) < 0) {
+		log_error("Could not create recipient index: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		array_destroy(&stack->recipients, NULL);
+
+		return -1;
+	}
+
+	stack->trace_source = packet_trace_add_source(PACKET_TRACE_SOURCE_STACK, stack->name);
+	stack->capture_source = traffic_capture_add_source(TRAFFIC_CAPTURE_RECORD_STACK, stack->name);
+
 	return 0;
 }
 
 void stack_destroy(Stack *stack) {
+	hardware_remove_routes(stack);
+
+	packet_trace_remove_source(stack->trace_source);
+
+	free(stack->recipient_slots);
+
 	array_destroy(&stack->recipients, NULL);
 }
 
 int stack_add_recipient(Stack *stack, uint32_t uid /* always little endian */, uint64_t opaque) {
-	int i;
+	int slot = stack_find_recipient_slot(stack, uid);
 	Recipient *recipient;
 	char base58[BASE58_MAX_LENGTH];
 
-	for (i = 0; i < stack->recipients.count; ++i) {
-		recipient = array_get(&stack->recipients, i);
+	if (stack->recipient_slots[slot] != 0) {
+		recipient = array_get(&stack->recipients, stack->recipient_slots[slot] - 1);
+		recipient->opaque = opaque;
 
-		if (recipient->uid == uid) {
-			recipient->opaque = opaque;
+		return hardware_add_route(stack, uid);
+	}
 
-			return 0;
+	// keep the load factor at or below 1/2 to keep the probe sequences short
+	if ((stack->recipients.count + 1) * 2 > stack->recipient_slot_count) {
+		if (stack_rebuild_recipient_index(stack, stack->recipient_slot_count * 2) < 0) {
+			log_error("Could not resize recipient index to %d slots: %s (%d)",
+			          stack->recipient_slot_count * 2, get_errno_name(errno), errno);
+
+			return -1;
 		}
+
+		slot = stack_find_recipient_slot(stack, uid);
 	}
 
 	recipient = array_append(&stack->recipients);
@@ -94,22 +184,118 @@ int stack_add_recipient(Stack *stack, uint32_t uid /* always little endian */, u
 	recipient->uid = uid;
 	recipient->opaque = opaque;
 
-	return 0;
+	stack->recipient_slots[slot] = stack->recipients.count;
+
+	return hardware_add_route(stack, uid);
+}
+
+void stack_remove_recipient(Stack *stack, uint32_t uid /* always little endian */) {
+	int mask = stack->recipient_slot_count - 1;
+	int slot = stack_find_recipient_slot(stack, uid);
+	int index = stack->recipient_slots[slot] - 1;
+	int last = stack->recipients.count - 1;
+	Recipient *recipient;
+	int next;
+	int home;
+
+	if (index < 0) {
+		return;
+	}
+
+	// move the last recipient into the gap to avoid a memmove and to keep
+	// the indices of all other recipients valid
+	if (index != last) {
+		recipient = array_get(&stack->recipients, last);
+
+		// look up the slot before the copy, otherwise the lookup would match
+		// the slot of the removed recipient
+		stack->recipient_slots[stack_find_recipient_slot(stack, recipient->uid)] = index + 1;
+
+		memcpy(array_get(&stack->recipients, index), recipient, sizeof(Recipient));
+	}
+
+	array_remove(&stack->recipients, last, NULL);
+
+	// close the gap in the probe sequence by moving back all following
+	// entries that would not be reachable anymore otherwise
+	next = slot;
+
+	for (;;) {
+		next = (next + 1) & mask;
+
+		if (stack->recipient_slots[next] == 0) {
+			break;
+		}
+
+		recipient = array_get(&stack->recipients, stack->recipient_slots[next] - 1);
+		home = uid_get_hash(recipient->uid) & mask;
+
+		// the entry can stay if its home slot is cyclically in (slot, next]
+		if (slot <= next ? (home > slot && home <= next) : (home > slot || home <= next)) {
+			continue;
+		}
+
+		stack->recipient_slots[slot] = stack->recipient_slots[next];
+		slot = next;
+	}
+
+	stack->recipient_slots[slot] = 0;
 }
 
 Recipient *stack_get_recipient(Stack *stack, uint32_t uid /* always little endian */) {
+	int slot = stack_find_recipient_slot(stack, uid);
+
+	if (stack->recipient_slots[slot] == 0) {
+		return NULL;
+	}
+
+	return array_get(&stack->recipients, stack->recipient_slots[slot] - 1);
+}
+
+void stack_clear_recipients(Stack *stack) {
+	int i;
+
+	hardware_remove_routes(stack);
+
+	// iterate backwards to avoid memmove in array_remove call
+	for (i = stack->recipients.count - 1; i >= 0; --i) {
+		array_remove(&stack->recipients, i, NULL);
+	}
+
+	memset(stack->recipient_slots, 0, sizeof(int) * stack->recipient_slot_count);
+}
+
+// exchanges the recipients of the stack with the given array and updates
+// the routes accordingly
+int stack_swap_recipients(Stack *stack, Array *recipients) {
+	int slot_count = INITIAL_RECIPIENT_SLOT_COUNT;
 	int i;
 	Recipient *recipient;
 
+	hardware_remove_routes(stack);
+
+	array_swap(&stack->recipients, recipients);
+
+	while (stack->recipients.count * 2 > slot_count) {
+		slot_count *= 2;
+	}
+
+	if (stack_rebuild_recipient_index(stack, slot_count) < 0) {
+		log_error("Could not rebuild recipient index with %d slots: %s (%d)",
+		          slot_count, get_errno_name(errno), errno);
+
+		array_swap(&stack->recipients, recipients);
+
+		return -1;
+	}
+
 	for (i = 0; i < stack->recipients.count; ++i) {
 		recipient = array_get(&stack->recipients, i);
 
-		if (recipient->uid == uid) {
-			return recipient;
-		}
+		hardware_add_route(stack, recipient->uid);
 	}
 
-	return NULL;
+	return 0;
 }
 
 // returns -1 on error, 0 if the request was not dispatched and 1 if it was dispatch
@@ -130,6 +316,12 @@ int stack_dispatch_request(Stack *stack, Packet *request, bool force) {
 		return -1;
 	}
 
+	++stack->request_count;
+	stack->request_bytes += request->header.length;
+
+	packet_trace_record(PACKET_TRACE_HOP_STACK_REQUEST, packet_trace_get_current_id(),
+	                    stack->trace_source, request);
+
 	if (force) {
 		log_packet_debug("Forced to sent request to %s", stack->name);
 	} else {
@@ -139,6 +331,60 @@ int stack_dispatch_request(Stack *stack, Packet *request, bool force) {
 	return 1;
 }
 
+// has to be called for every response received from the stack, before it is
+// passed to network_dispatch_response
+void stack_count_response(Stack *stack, Packet *response) {
+	++stack->response_count;
+	stack->response_bytes += response->header.length;
+
+	packet_trace_record(PACKET_TRACE_HOP_STACK_RESPONSE, 0, stack->trace_source, response);
+}
+
+static const MetricFamily _stack_requests = {
+	"brickd_stack_requests_total", METRIC_TYPE_COUNTER,
+	"Number of requests sent to the stack."
+};
+
+static const MetricFamily _stack_request_bytes = {
+	"brickd_stack_request_bytes_total", METRIC_TYPE_COUNTER,
+	"Number of request bytes sent to the stack."
+};
+
+static const MetricFamily _stack_responses = {
+	"brickd_stack_responses_total", METRIC_TYPE_COUNTER,
+	"Number of responses and callbacks received from the stack."
+};
+
+static const MetricFamily _stack_response_bytes = {
+	"brickd_stack_response_bytes_total", METRIC_TYPE_COUNTER,
+	"Number of response and callback bytes received from the stack."
+};
+
+static const MetricFamily _stack_response_latency = {
+	"brickd_stack_response_latency_microseconds", METRIC_TYPE_SUMMARY,
+	"Time from receiving a request from a client to dispatching its response from the stack."
+};
+
+static const MetricFamily _stack_recipients = {
+	"brickd_stack_recipients", METRIC_TYPE_GAUGE,
+	"Number of UIDs known to be reachable through the stack."
+};
+
+void stack_collect_metrics(Stack *stack, Metrics *metrics) {
+	metrics_add(metrics, &_stack_requests, stack->request_count, "stack", stack->name, NULL);
+	metrics_add(metrics, &_stack_request_bytes, stack->request_bytes, "stack", stack->name, NULL);
+	metrics_add(metrics, &_stack_responses, stack->response_count, "stack", stack->name, NULL);
+	metrics_add(metrics, &_stack_response_bytes, stack->response_bytes, "stack", stack->name, NULL);
+	metrics_add(metrics, &_stack_recipients, stack->recipients.count, "stack", stack->name, NULL);
+
+	latency_histogram_add_metrics(&stack->response_latency, metrics, &_stack_response_latency,
+	                              "stack", stack->name, NULL);
+
+	if (stack->collect_metrics != NULL) {
+		stack->collect_metrics(stack, metrics);
+	}
+}
+
 void stack_announce_disconnect(Stack *stack) {
 	log_debug("Disconnecting %s stack", stack->name);
 
@@ -170,3 +416,15 @@ void recipients_announce_disconnect(Array *recipients) {
 		network_dispatch_response((Packet *)&enumerate_callback);
 	}
 }
+
+uint32_t uid_get_hash(uint32_t uid /* always little endian */) {
+	// finalizer of MurmurHash3, UIDs are not evenly distributed in the
+	// lower bits
+	uid ^= uid >> 16;
+	uid *= 0x85EBCA6B;
+	uid ^= uid >> 13;
+	uid *= 0xC2B2AE35;
+	uid ^= uid >> 16;
+
+	return uid;
+}
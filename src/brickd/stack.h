@@ -28,6 +28,11 @@
 #include <daemonlib/array.h>
 #include <daemonlib/packet.h>
 
+#include "latency_histogram.h"
+#include "metrics.h"
+#include "packet_trace.h"
+#include "traffic_capture.h"
+
 typedef struct _Stack Stack;
 
 typedef struct {
@@ -36,13 +41,24 @@ typedef struct {
 } Recipient;
 
 typedef int (*StackDispatchRequestFunction)(Stack *stack, Packet *request, Recipient *recipient);
+typedef void (*StackCollectMetricsFunction)(Stack *stack, Metrics *metrics);
 
 #define STACK_MAX_NAME_LENGTH 128
 
 struct _Stack {
 	char name[STACK_MAX_NAME_LENGTH]; // for display purpose
 	StackDispatchRequestFunction dispatch_request;
-	Array recipients;
+	Array recipients; // order is not preserved on removal
+	int *recipient_slots; // index + 1 into recipients, 0 marks a free slot
+	int recipient_slot_count; // always a power of two
+	StackCollectMetricsFunction collect_metrics; // optional, for stack type specific metrics
+	uint64_t request_count;
+	uint64_t request_bytes;
+	uint64_t response_count;
+	uint64_t response_bytes;
+	LatencyHistogram response_latency; // from request received to response dispatched
+	uint32_t trace_source; // 0 if the packet trace is disabled
+	uint32_t capture_source; // 0 if the traffic capture is disabled
 };
 
 int stack_create(Stack *stack, const char *name,
@@ -50,12 +66,20 @@ int stack_create(Stack *stack, const char *name,
 void stack_destroy(Stack *stack);
 
 int stack_add_recipient(Stack *stack, uint32_t uid /* always little endian */, uint64_t opaque);
+void stack_remove_recipient(Stack *stack, uint32_t uid /* always little endian */);
 Recipient *stack_get_recipient(Stack *stack, uint32_t uid /* always little endian */);
+void stack_clear_recipients(Stack *stack);
+int stack_swap_recipients(Stack *stack, Array *recipients);
 
 int stack_dispatch_request(Stack *stack, Packet *request, bool force);
+void stack_count_response(Stack *stack, Packet *response);
+
+void stack_collect_metrics(Stack *stack, Metrics *metrics);
 
 void stack_announce_disconnect(Stack *stack);
 
 void recipients_announce_disconnect(Array *recipients);
 
+uint32_t uid_get_hash(uint32_t uid);
+
 #endif // BRICKD_STACK_H
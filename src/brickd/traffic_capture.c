@@ -0,0 +1,191 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * traffic_capture.c: Binary capture of the request and response traffic
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * if the traffic_capture.filename option is set then every request received
+ * from a client and every response received from a stack is appended to the
+ * capture file, together with a timestamp and the client or stack it belongs
+ * to. the capture can be fed back into a Brick Daemon by the replay stack
+ * (responses) and the traffic_replay tool (requests) to reproduce a traffic
+ * pattern without the original clients and hardware.
+ *
+ * records are written through a large stdio buffer on the main thread. if a
+ * write fails the capture is stopped, the Brick Daemon keeps running.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <daemonlib/config.h>
+#include <daemonlib/log.h>
+#include <daemonlib/utils.h>
+
+#include "traffic_capture.h"
+
+#include "byte_order.h"
+
+static LogSource _log_source = LOG_SOURCE_INITIALIZER;
+
+#define WRITE_BUFFER_SIZE 65536 // bytes
+
+static FILE *_fp = NULL; // NULL if disabled
+static const char *_filename;
+static uint32_t _next_source;
+static uint64_t _record_count;
+
+static void traffic_capture_stop(void) {
+	if (fclose(_fp) != 0) {
+		log_error("Could not close traffic capture file '%s': %s (%d)",
+		          _filename, get_errno_name(errno), errno);
+	}
+
+	_fp = NULL;
+}
+
+static void traffic_capture_write(const TrafficCaptureRecordHeader *record_header,
+                                  const void *data) {
+	if (fwrite(record_header, 1, sizeof(*record_header), _fp) != sizeof(*record_header) ||
+	    fwrite(data, 1, record_header->length, _fp) != record_header->length) {
+		log_error("Could not write to traffic capture file '%s', stopping capture: %s (%d)",
+		          _filename, get_errno_name(errno), errno);
+
+		traffic_capture_stop();
+
+		return;
+	}
+
+	++_record_count;
+}
+
+int traffic_capture_init(void) {
+	TrafficCaptureHeader header;
+
+	_filename = config_get_option_value("traffic_capture.filename")->string;
+	_next_source = 0;
+	_record_count = 0;
+
+	if (_filename == NULL || *_filename == '\0') {
+		return 0;
+	}
+
+	log_info("Capturing traffic to '%s'", _filename);
+
+	_fp = fopen(_filename, "wb");
+
+	if (_fp == NULL) {
+		log_error("Could not open traffic capture file '%s' for writing: %s (%d)",
+		          _filename, get_errno_name(errno), errno);
+
+		return -1;
+	}
+
+	if (setvbuf(_fp, NULL, _IOFBF, WRITE_BUFFER_SIZE) != 0) {
+		log_warn("Could not set buffer size of traffic capture file '%s', continuing with default buffer size",
+		         _filename);
+	}
+
+	memcpy(header.magic, TRAFFIC_CAPTURE_MAGIC, sizeof(header.magic));
+
+	header.version = uint32_to_le(TRAFFIC_CAPTURE_VERSION);
+	header.record_header_size = uint32_to_le(sizeof(TrafficCaptureRecordHeader));
+
+	if (fwrite(&header, 1, sizeof(header), _fp) != sizeof(header)) {
+		log_error("Could not write header to traffic capture file '%s': %s (%d)",
+		          _filename, get_errno_name(errno), errno);
+
+		fclose(_fp);
+
+		_fp = NULL;
+
+		return -1;
+	}
+
+	return 0;
+}
+
+void traffic_capture_exit(void) {
+	if (_fp == NULL) {
+		return;
+	}
+
+	log_info("Captured %llu record(s) to '%s'",
+	         (unsigned long long)_record_count, _filename);
+
+	traffic_capture_stop();
+}
+
+bool traffic_capture_is_enabled(void) {
+	return _fp != NULL;
+}
+
+// returns the ID of the new client or stack, or 0 if the capture is disabled
+uint32_t traffic_capture_add_source(TrafficCaptureRecordType type, const char *name) {
+	TrafficCaptureRecordHeader record_header;
+	int length = (int)strlen(name);
+
+	if (_fp == NULL) {
+		return 0;
+	}
+
+	if (++_next_source == 0) {
+		++_next_source; // 0 means unknown
+	}
+
+	if (length > TRAFFIC_CAPTURE_MAX_NAME_LENGTH) {
+		length = TRAFFIC_CAPTURE_MAX_NAME_LENGTH;
+	}
+
+	memset(&record_header, 0, sizeof(record_header));
+
+	record_header.timestamp = uint64_to_le(microtime());
+	record_header.type = (uint8_t)type;
+	record_header.length = (uint8_t)length;
+
+	if (type == TRAFFIC_CAPTURE_RECORD_CLIENT) {
+		record_header.client = uint32_to_le(_next_source);
+	} else {
+		record_header.stack = uint32_to_le(_next_source);
+	}
+
+	traffic_capture_write(&record_header, name);
+
+	return _next_source;
+}
+
+void traffic_capture_record(TrafficCaptureRecordType type, uint32_t client,
+                            uint32_t stack, Packet *packet) {
+	TrafficCaptureRecordHeader record_header;
+
+	if (_fp == NULL) {
+		return;
+	}
+
+	record_header.timestamp = uint64_to_le(microtime());
+	record_header.client = uint32_to_le(client);
+	record_header.stack = uint32_to_le(stack);
+	record_header.type = (uint8_t)type;
+	record_header.length = packet->header.length;
+	record_header.padding[0] = 0;
+	record_header.padding[1] = 0;
+
+	traffic_capture_write(&record_header, packet);
+}
@@ -0,0 +1,75 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * traffic_capture.h: Binary capture of the request and response traffic
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef BRICKD_TRAFFIC_CAPTURE_H
+#define BRICKD_TRAFFIC_CAPTURE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <daemonlib/packet.h>
+
+// the capture file format, also read by the replay stack and the
+// traffic_replay tool. all values are little endian. the header is followed
+// by records, each record is followed by length bytes of data: the name of
+// the client or stack for source records, the packet for request and
+// response records
+#define TRAFFIC_CAPTURE_MAGIC "BRICKDTC"
+#define TRAFFIC_CAPTURE_VERSION 1
+#define TRAFFIC_CAPTURE_MAX_NAME_LENGTH 128
+
+typedef enum {
+	TRAFFIC_CAPTURE_RECORD_CLIENT = 1, // new client, its ID is in the client field
+	TRAFFIC_CAPTURE_RECORD_STACK, // new stack, its ID is in the stack field
+	TRAFFIC_CAPTURE_RECORD_REQUEST, // received from a client
+	TRAFFIC_CAPTURE_RECORD_RESPONSE // received from a stack
+} TrafficCaptureRecordType;
+
+#include <daemonlib/packed_begin.h>
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t record_header_size;
+} ATTRIBUTE_PACKED TrafficCaptureHeader;
+
+typedef struct {
+	uint64_t timestamp; // microseconds, monotonic
+	uint32_t client; // 0 if unknown
+	uint32_t stack; // 0 if unknown or broadcast
+	uint8_t type;
+	uint8_t length;
+	uint8_t padding[2];
+} ATTRIBUTE_PACKED TrafficCaptureRecordHeader;
+
+#include <daemonlib/packed_end.h>
+
+int traffic_capture_init(void);
+void traffic_capture_exit(void);
+
+bool traffic_capture_is_enabled(void);
+
+uint32_t traffic_capture_add_source(TrafficCaptureRecordType type, const char *name);
+
+void traffic_capture_record(TrafficCaptureRecordType type, uint32_t client,
+                            uint32_t stack, Packet *packet);
+
+#endif // BRICKD_TRAFFIC_CAPTURE_H
@@ -26,6 +26,7 @@
 #include <string.h>
 
 #include <daemonlib/array.h>
+#include <daemonlib/base58.h>
 #include <daemonlib/event.h>
 #include <daemonlib/log.h>
 #include <daemonlib/pipe.h>
@@ -33,6 +34,8 @@
 
 #include "usb.h"
 
+#include "event_timing.h"
+#include "hardware.h"
 #include "stack.h"
 #include "network.h"
 #include "usb_transfer.h"
@@ -40,9 +43,38 @@
 static LogSource _log_source = LOG_SOURCE_INITIALIZER;
 static LogSource _libusb_log_source = LOG_SOURCE_INITIALIZER;
 
+#define INITIAL_USB_STACK_SLOT_CAPACITY 32 // must be a power of two
+
+typedef enum {
+	USB_HOTPLUG_EVENT_RESCAN = 0,
+	USB_HOTPLUG_EVENT_ARRIVED,
+	USB_HOTPLUG_EVENT_LEFT,
+	USB_HOTPLUG_EVENT_DISCARD
+} USBHotplugEventType;
+
+typedef struct {
+	libusb_device *device; // referenced, only for arrived events
+	uint8_t type;
+	uint8_t bus_number;
+	uint8_t device_address;
+} USBHotplugEvent;
+
+// maps the (bus, device) address of each known USB stack to the USB stack.
+// the table uses open addressing with linear probing. a configured USB device
+// never has address 0, therefore key 0 marks free slots
+typedef struct {
+	uint16_t key; // bus number << 8 | device address
+	USBStack *usb_stack;
+} USBStackSlot;
+
 static libusb_context *_context;
 static Pipe _hotplug_pipe;
-static Array _usb_stacks;
+static USBHotplugEvent _hotplug_event; // the pipe might deliver an event in parts
+static int _hotplug_event_length = 0;
+static Array _usb_stacks; // of USBStack pointers, see USBStack.index
+static USBStackSlot *_usb_stack_slots = NULL;
+static int _usb_stack_slot_capacity = 0;
+static int _usb_stack_slot_count = 0;
 
 extern int usb_init_platform(libusb_context *context);
 extern void usb_exit_platform(libusb_context *context);
@@ -124,153 +156,401 @@ static void LIBUSB_CALL usb_forward_message(libusb_context *ctx,
 
 #endif
 
-static void usb_forward_hotplug(void *opaque) {
-	uint8_t byte;
-	int repeat;
+static uint16_t usb_get_slot_key(uint8_t bus_number, uint8_t device_address) {
+	return (uint16_t)(bus_number << 8 | device_address);
+}
 
-	(void)opaque;
+static int usb_get_slot_home(uint16_t key, int capacity) {
+	return (int)((key * 2654435761u) >> 16) & (capacity - 1);
+}
 
-	if (pipe_read(&_hotplug_pipe, &byte, sizeof(byte)) < 0) {
-		log_error("Could not read from USB hotplug pipe: %s (%d)",
-		          get_errno_name(errno), errno);
+static USBStackSlot *usb_find_slot(USBStackSlot *slots, int capacity, uint16_t key) {
+	int i = usb_get_slot_home(key, capacity);
 
-		// FIXME: recreate socket pair on error, especially WSAECONNABORTED and WSAECONNRESET
+	while (slots[i].key != 0 && slots[i].key != key) {
+		i = (i + 1) & (capacity - 1);
+	}
+
+	return &slots[i];
+}
 
+static int usb_resize_slots(int capacity) {
+	USBStackSlot *slots = calloc(capacity, sizeof(USBStackSlot));
+	int i;
+
+	if (slots == NULL) {
+		errno = ENOMEM;
+
+		return -1;
+	}
+
+	for (i = 0; i < _usb_stack_slot_capacity; ++i) {
+		if (_usb_stack_slots[i].key != 0) {
+			*usb_find_slot(slots, capacity, _usb_stack_slots[i].key) = _usb_stack_slots[i];
+		}
+	}
+
+	free(_usb_stack_slots);
+
+	_usb_stack_slots = slots;
+	_usb_stack_slot_capacity = capacity;
+
+	return 0;
+}
+
+static int usb_add_slot(USBStack *usb_stack) {
+	uint16_t key = usb_get_slot_key(usb_stack->bus_number, usb_stack->device_address);
+	USBStackSlot *slot;
+
+	// keep the load factor at or below 1/2 to keep the probe sequences short
+	if ((_usb_stack_slot_count + 1) * 2 > _usb_stack_slot_capacity) {
+		if (usb_resize_slots(_usb_stack_slot_capacity * 2) < 0) {
+			log_error("Could not resize USB stack table to %d entries: %s (%d)",
+			          _usb_stack_slot_capacity * 2, get_errno_name(errno), errno);
+
+			return -1;
+		}
+	}
+
+	slot = usb_find_slot(_usb_stack_slots, _usb_stack_slot_capacity, key);
+
+	if (slot->key == 0) {
+		++_usb_stack_slot_count;
+	}
+
+	slot->key = key;
+	slot->usb_stack = usb_stack;
+
+	return 0;
+}
+
+// removes the slot and moves later slots of the same probe sequence back into
+// the gap. unlike a rebuild this cannot fail, so the table never refers to a
+// destroyed USB stack
+static void usb_remove_slot(uint8_t bus_number, uint8_t device_address) {
+	uint16_t key = usb_get_slot_key(bus_number, device_address);
+	USBStackSlot *slot = usb_find_slot(_usb_stack_slots, _usb_stack_slot_capacity, key);
+	int mask = _usb_stack_slot_capacity - 1;
+	int gap;
+	int i;
+	int home;
+
+	if (slot->key == 0) {
 		return;
 	}
 
-	for (repeat = 0; repeat < 100; ++repeat) {
-		// consume all accumulated hotplug events in one go, but atmost
-		// 100 to avoid getting stuck here forever
-		if (pipe_read(&_hotplug_pipe, &byte, sizeof(byte)) < 0) {
-			if (errno_would_block()) {
-				break;
-			}
+	gap = (int)(slot - _usb_stack_slots);
 
-			log_error("Could not read from USB hotplug pipe: %s (%d)",
-			          get_errno_name(errno), errno);
+	for (i = (gap + 1) & mask; _usb_stack_slots[i].key != 0; i = (i + 1) & mask) {
+		home = usb_get_slot_home(_usb_stack_slots[i].key, _usb_stack_slot_capacity);
 
-			return;
+		// the slot can only move back if its home is not between the gap and
+		// the slot, cyclically
+		if (((i - home) & mask) >= ((i - gap) & mask)) {
+			_usb_stack_slots[gap] = _usb_stack_slots[i];
+			gap = i;
 		}
 	}
 
-	log_debug("Starting USB device scan, triggered by hotplug (repeat: %d)", repeat);
+	_usb_stack_slots[gap].key = 0;
+	_usb_stack_slots[gap].usb_stack = NULL;
 
-	usb_rescan();
+	--_usb_stack_slot_count;
 }
 
-static int usb_enumerate(void) {
-	int result = -1;
-	libusb_device **devices;
-	libusb_device *device;
-	int rc;
-	int i = 0;
+static USBStack *usb_get_stack(uint8_t bus_number, uint8_t device_address) {
+	uint16_t key = usb_get_slot_key(bus_number, device_address);
+	USBStackSlot *slot = usb_find_slot(_usb_stack_slots, _usb_stack_slot_capacity, key);
+
+	return slot->key == key ? slot->usb_stack : NULL;
+}
+
+// returns false if the USB device is not a Brick or RED Brick that is supported
+static bool usb_check_device(libusb_device *device, bool *red_brick) {
+	uint8_t bus_number = libusb_get_bus_number(device);
+	uint8_t device_address = libusb_get_device_address(device);
 	struct libusb_device_descriptor descriptor;
-	uint8_t bus_number;
-	uint8_t device_address;
-	bool red_brick;
-	bool known;
-	int k;
-	USBStack *usb_stack;
+	int rc;
 
-	// get all devices
-	rc = libusb_get_device_list(_context, &devices);
+	rc = libusb_get_device_descriptor(device, &descriptor);
 
 	if (rc < 0) {
-		log_error("Could not get USB device list: %s (%d)",
-		          usb_get_error_name(rc), rc);
+		log_warn("Could not get device descriptor for USB device (bus: %u, device: %u), ignoring USB device: %s (%d)",
+		         bus_number, device_address, usb_get_error_name(rc), rc);
+
+		return false;
+	}
+
+	if (descriptor.idVendor == USB_BRICK_VENDOR_ID &&
+	    descriptor.idProduct == USB_BRICK_PRODUCT_ID) {
+		if (descriptor.bcdDevice < USB_BRICK_DEVICE_RELEASE) {
+			log_warn("USB device (bus: %u, device: %u) has unsupported protocol 1.0 firmware, please update firmware, ignoring USB device",
+			         bus_number, device_address);
+
+			return false;
+		}
+
+		*red_brick = false;
+	} else if (descriptor.idVendor == USB_RED_BRICK_VENDOR_ID &&
+	           descriptor.idProduct == USB_RED_BRICK_PRODUCT_ID) {
+		if (descriptor.bcdDevice < USB_RED_BRICK_DEVICE_RELEASE) {
+			log_warn("USB device (bus: %u, device: %u) has unexpected release version, ignoring USB device",
+			         bus_number, device_address);
+
+			return false;
+		}
+
+		*red_brick = true;
+	} else {
+		return false;
+	}
+
+	return true;
+}
+
+static void usb_free_stack(USBStack **usb_stack) {
+	usb_stack_destroy(*usb_stack);
+	free(*usb_stack);
+}
+
+// marks the USB stack of a known USB device as connected or creates a new USB
+// stack for it. returns -1 if the USB stack array is broken
+static int usb_add_device(libusb_device *device, bool red_brick) {
+	uint8_t bus_number = libusb_get_bus_number(device);
+	uint8_t device_address = libusb_get_device_address(device);
+	USBStack *usb_stack = usb_get_stack(bus_number, device_address);
+	USBStack **new_usb_stack;
+
+	if (usb_stack != NULL) {
+		// mark known USBStack as connected
+		usb_stack->connected = true;
+
+		return 0;
+	}
+
+	// create new USBStack object
+	log_debug("Found new USB device (bus: %u, device: %u)",
+	          bus_number, device_address);
+
+	new_usb_stack = array_append(&_usb_stacks);
+
+	if (new_usb_stack == NULL) {
+		log_error("Could not append to USB stacks array: %s (%d)",
+		          get_errno_name(errno), errno);
 
 		return -1;
 	}
 
-	log_debug("Found %d USB device(s)", rc);
+	usb_stack = calloc(1, sizeof(USBStack));
 
-	// check for stacks
-	for (device = devices[0]; device != NULL; device = devices[++i]) {
-		bus_number = libusb_get_bus_number(device);
-		device_address = libusb_get_device_address(device);
+	if (usb_stack == NULL) {
+		array_remove(&_usb_stacks, _usb_stacks.count - 1, NULL);
 
-		rc = libusb_get_device_descriptor(device, &descriptor);
+		log_error("Could not allocate USB stack: %s (%d)",
+		          get_errno_name(ENOMEM), ENOMEM);
 
-		if (rc < 0) {
-			log_warn("Could not get device descriptor for USB device (bus: %u, device: %u), ignoring USB device: %s (%d)",
-			         bus_number, device_address, usb_get_error_name(rc), rc);
+		return -1;
+	}
 
-			continue;
-		}
+	if (usb_stack_create(usb_stack, _context, device, red_brick) < 0) {
+		array_remove(&_usb_stacks, _usb_stacks.count - 1, NULL);
+		free(usb_stack);
 
-		if (descriptor.idVendor == USB_BRICK_VENDOR_ID &&
-		    descriptor.idProduct == USB_BRICK_PRODUCT_ID) {
-			if (descriptor.bcdDevice < USB_BRICK_DEVICE_RELEASE) {
-				log_warn("USB device (bus: %u, device: %u) has unsupported protocol 1.0 firmware, please update firmware, ignoring USB device",
-				         bus_number, device_address);
+		log_warn("USB device (bus: %u, device: %u) could not be acquired correctly, ignoring USB device",
+		         bus_number, device_address);
 
-				continue;
-			}
+		return 0;
+	}
 
-			red_brick = false;
-		} else if (descriptor.idVendor == USB_RED_BRICK_VENDOR_ID &&
-		           descriptor.idProduct == USB_RED_BRICK_PRODUCT_ID) {
-			if (descriptor.bcdDevice < USB_RED_BRICK_DEVICE_RELEASE) {
-				log_warn("USB device (bus: %u, device: %u) has unexpected release version, ignoring USB device",
-				         bus_number, device_address);
+	*new_usb_stack = usb_stack;
+	usb_stack->index = _usb_stacks.count - 1;
 
-				continue;
-			}
+	if (usb_add_slot(usb_stack) < 0) {
+		array_remove(&_usb_stacks, _usb_stacks.count - 1, (ItemDestroyFunction)usb_free_stack);
 
-			red_brick = true;
-		} else {
-			continue;
+		log_warn("USB device (bus: %u, device: %u) could not be added to USB stack table, ignoring USB device",
+		         bus_number, device_address);
+
+		return 0;
+	}
+
+	// mark new stack as connected
+	usb_stack->connected = true;
+
+	log_info("Added USB device (bus: %u, device: %u) at index %d: %s",
+	         usb_stack->bus_number, usb_stack->device_address,
+	         _usb_stacks.count - 1, usb_stack->base.name);
+
+	return 0;
+}
+
+// the last USB stack in the array takes the place of the removed one, instead
+// of moving all USB stacks after it. the USB stack array is not ordered
+static void usb_remove_stack(USBStack *usb_stack) {
+	int index = usb_stack->index;
+	USBStack *last_usb_stack;
+
+	log_info("Removing USB device (bus: %u, device: %u) at index %d: %s",
+	         usb_stack->bus_number, usb_stack->device_address, index,
+	         usb_stack->base.name);
+
+	stack_announce_disconnect(&usb_stack->base);
+
+	usb_remove_slot(usb_stack->bus_number, usb_stack->device_address);
+
+	last_usb_stack = *(USBStack **)array_get(&_usb_stacks, _usb_stacks.count - 1);
+	last_usb_stack->index = index;
+
+	*(USBStack **)array_get(&_usb_stacks, index) = last_usb_stack;
+
+	array_remove(&_usb_stacks, _usb_stacks.count - 1, NULL);
+
+	usb_free_stack(&usb_stack);
+}
+
+static void usb_remove_device(uint8_t bus_number, uint8_t device_address) {
+	USBStack *usb_stack = usb_get_stack(bus_number, device_address);
+
+	if (usb_stack == NULL) {
+		log_debug("Ignoring removal of unknown USB device (bus: %u, device: %u)",
+		          bus_number, device_address);
+
+		return;
+	}
+
+	usb_remove_stack(usb_stack);
+}
+
+static void usb_write_hotplug_event(USBHotplugEvent *event) {
+	if (pipe_write(&_hotplug_pipe, event, sizeof(*event)) < 0) {
+		log_error("Could not write to USB hotplug pipe: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		if (event->device != NULL) {
+			libusb_unref_device(event->device);
 		}
 
-		// check all known stacks
-		known = false;
+		// FIXME: recreate socket pair on error, especially WSAECONNABORTED and WSAECONNRESET
+	}
+}
 
-		for (k = 0; k < _usb_stacks.count; ++k) {
-			usb_stack = array_get(&_usb_stacks, k);
+// handles the hotplug events in the main thread. arrived and left events only
+// touch the USB device they are about, a full scan of all USB devices is only
+// done for platforms that cannot tell which USB device was (un)plugged
+static void usb_forward_hotplug(void *opaque) {
+	USBHotplugEvent event;
+	int count = 0;
+	int length;
+	bool rescan = false;
+	bool red_brick;
+	USBStack *usb_stack;
+
+	(void)opaque;
 
-			if (usb_stack->bus_number == bus_number &&
-			    usb_stack->device_address == device_address) {
-				// mark known USBStack as connected
-				usb_stack->connected = true;
-				known = true;
+	// handle all accumulated hotplug events in one go, but atmost 100 to
+	// avoid getting stuck here forever
+	while (count < 100) {
+		length = pipe_read(&_hotplug_pipe, (uint8_t *)&_hotplug_event + _hotplug_event_length,
+		                   (int)sizeof(_hotplug_event) - _hotplug_event_length);
 
-				break;
+		if (length <= 0) {
+			if (length < 0 && !errno_would_block()) {
+				log_error("Could not read from USB hotplug pipe: %s (%d)",
+				          get_errno_name(errno), errno);
+
+				// FIXME: recreate socket pair on error, especially WSAECONNABORTED and WSAECONNRESET
 			}
+
+			break;
 		}
 
-		if (known) {
+		// on Windows the pipe is a socket pair that might deliver an event in
+		// parts. the rest of it is read here or on the next read event
+		_hotplug_event_length += length;
+
+		if (_hotplug_event_length < (int)sizeof(_hotplug_event)) {
 			continue;
 		}
 
-		// create new USBStack object
-		log_debug("Found new USB device (bus: %u, device: %u)",
-		          bus_number, device_address);
+		memcpy(&event, &_hotplug_event, sizeof(event));
 
-		usb_stack = array_append(&_usb_stacks);
+		_hotplug_event_length = 0;
+		++count;
 
-		if (usb_stack == NULL) {
-			log_error("Could not append to USB stacks array: %s (%d)",
-			          get_errno_name(errno), errno);
+		switch (event.type) {
+		case USB_HOTPLUG_EVENT_ARRIVED:
+			// a pending rescan will find the USB device anyway
+			if (!rescan && usb_check_device(event.device, &red_brick)) {
+				usb_add_device(event.device, red_brick);
+			}
 
-			goto cleanup;
+			libusb_unref_device(event.device);
+
+			break;
+
+		case USB_HOTPLUG_EVENT_LEFT:
+			if (!rescan) {
+				usb_remove_device(event.bus_number, event.device_address);
+			}
+
+			break;
+
+		case USB_HOTPLUG_EVENT_DISCARD:
+			usb_stack = usb_get_stack(event.bus_number, event.device_address);
+
+			// a rescan might have removed the USB stack already
+			if (usb_stack != NULL && usb_stack->discarded) {
+				usb_remove_stack(usb_stack);
+			}
+
+			// the USB device gets a new USB stack if it is still connected
+			rescan = true;
+
+			break;
+
+		default:
+			rescan = true;
+
+			break;
 		}
+	}
 
-		if (usb_stack_create(usb_stack, _context, device, red_brick) < 0) {
-			array_remove(&_usb_stacks, _usb_stacks.count - 1, NULL);
+	if (rescan) {
+		log_debug("Starting USB device scan, triggered by hotplug (events: %d)", count);
 
-			log_warn("USB device (bus: %u, device: %u) could not be acquired correctly, ignoring USB device",
-			         bus_number, device_address);
+		usb_rescan();
+	}
+}
+
+static int usb_enumerate(void) {
+	int result = -1;
+	libusb_device **devices;
+	libusb_device *device;
+	int rc;
+	int i = 0;
+	bool red_brick;
+
+	// get all devices
+	rc = libusb_get_device_list(_context, &devices);
+
+	if (rc < 0) {
+		log_error("Could not get USB device list: %s (%d)",
+		          usb_get_error_name(rc), rc);
 
+		return -1;
+	}
+
+	log_debug("Found %d USB device(s)", rc);
+
+	// check for stacks
+	for (device = devices[0]; device != NULL; device = devices[++i]) {
+		if (!usb_check_device(device, &red_brick)) {
 			continue;
 		}
 
-		// mark new stack as connected
-		usb_stack->connected = true;
-
-		log_info("Added USB device (bus: %u, device: %u) at index %d: %s",
-		         usb_stack->bus_number, usb_stack->device_address,
-		         _usb_stacks.count - 1, usb_stack->base.name);
+		if (usb_add_device(device, red_brick) < 0) {
+			goto cleanup;
+		}
 	}
 
 	result = 0;
@@ -317,10 +597,12 @@ int usb_init(void) {
 		goto cleanup;
 	}
 
+	_hotplug_event_length = 0;
+
 	phase = 1;
 
-	if (event_add_source(_hotplug_pipe.base.read_handle, EVENT_SOURCE_TYPE_GENERIC,
-	                     "usb-hotplug", EVENT_READ, usb_forward_hotplug, NULL) < 0) {
+	if (event_timing_add_source(_hotplug_pipe.base.read_handle, EVENT_SOURCE_TYPE_GENERIC,
+	                            "usb-hotplug", EVENT_READ, usb_forward_hotplug, NULL) < 0) {
 		goto cleanup;
 	}
 
@@ -399,9 +681,9 @@ int usb_init(void) {
 
 	phase = 4;
 
-	// create USB stack array. the USBStack struct is not relocatable, because
-	// its USB transfers keep a pointer to it
-	if (array_create(&_usb_stacks, 32, sizeof(USBStack), false) < 0) {
+	// create USB stack array. every USBStack is allocated on its own and
+	// never moves, because its USB transfers keep a pointer to it
+	if (array_create(&_usb_stacks, 32, sizeof(USBStack *), true) < 0) {
 		log_error("Could not create USB stack array: %s (%d)",
 		          get_errno_name(errno), errno);
 
@@ -410,8 +692,22 @@ int usb_init(void) {
 
 	phase = 5;
 
+	// create USB stack table
+	if (usb_resize_slots(INITIAL_USB_STACK_SLOT_CAPACITY) < 0) {
+		log_error("Could not create USB stack table: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 6;
+
 cleanup:
 	switch (phase) { // no breaks, all cases fall through intentionally
+	case 5:
+		array_destroy(&_usb_stacks, NULL);
+		// fall through
+
 	case 4:
 		usb_exit_platform(_context);
 		// fall through
@@ -421,7 +717,7 @@ cleanup:
 		// fall through
 
 	case 2:
-		event_remove_source(_hotplug_pipe.base.read_handle, EVENT_SOURCE_TYPE_GENERIC);
+		event_timing_remove_source(_hotplug_pipe.base.read_handle, EVENT_SOURCE_TYPE_GENERIC);
 		// fall through
 
 	case 1:
@@ -432,19 +728,25 @@ cleanup:
 		break;
 	}
 
-	return phase == 5 ? 0 : -1;
+	return phase == 6 ? 0 : -1;
 }
 
 void usb_exit(void) {
 	log_debug("Shutting down USB subsystem");
 
-	array_destroy(&_usb_stacks, (ItemDestroyFunction)usb_stack_destroy);
+	array_destroy(&_usb_stacks, (ItemDestroyFunction)usb_free_stack);
+
+	free(_usb_stack_slots);
+
+	_usb_stack_slots = NULL;
+	_usb_stack_slot_capacity = 0;
+	_usb_stack_slot_count = 0;
 
 	usb_exit_platform(_context);
 
 	libusb_exit(_context);
 
-	event_remove_source(_hotplug_pipe.base.read_handle, EVENT_SOURCE_TYPE_GENERIC);
+	event_timing_remove_source(_hotplug_pipe.base.read_handle, EVENT_SOURCE_TYPE_GENERIC);
 	pipe_destroy(&_hotplug_pipe);
 
 #ifdef LIBUSB_BRICKD_PATCH
@@ -462,15 +764,33 @@ void usb_handle_events(void) {
 	usb_handle_events_platform(_context);
 }
 
+// can be called from any thread, triggers a full scan of all USB devices
 void usb_handle_hotplug(void) {
-	uint8_t byte = 0;
+	USBHotplugEvent event;
 
-	if (pipe_write(&_hotplug_pipe, &byte, sizeof(byte)) < 0) {
-		log_error("Could not write to USB hotplug pipe: %s (%d)",
-		          get_errno_name(errno), errno);
+	memset(&event, 0, sizeof(event));
 
-		// FIXME: recreate socket pair on error, especially WSAECONNABORTED and WSAECONNRESET
+	event.type = USB_HOTPLUG_EVENT_RESCAN;
+
+	usb_write_hotplug_event(&event);
+}
+
+// can be called from any thread, including libusb hotplug callbacks
+void usb_handle_hotplug_device(libusb_device *device, bool arrived) {
+	USBHotplugEvent event;
+
+	memset(&event, 0, sizeof(event));
+
+	event.type = arrived ? USB_HOTPLUG_EVENT_ARRIVED : USB_HOTPLUG_EVENT_LEFT;
+	event.bus_number = libusb_get_bus_number(device);
+	event.device_address = libusb_get_device_address(device);
+
+	// keep the USB device alive until the main thread handled the event
+	if (arrived) {
+		event.device = libusb_ref_device(device);
 	}
+
+	usb_write_hotplug_event(&event);
 }
 
 int usb_rescan(void) {
@@ -481,7 +801,7 @@ int usb_rescan(void) {
 
 	// mark all known USB stacks as potentially removed
 	for (i = 0; i < _usb_stacks.count; ++i) {
-		usb_stack = array_get(&_usb_stacks, i);
+		usb_stack = *(USBStack **)array_get(&_usb_stacks, i);
 
 		usb_stack->connected = false;
 	}
@@ -493,97 +813,97 @@ int usb_rescan(void) {
 	}
 
 	// remove all USB stacks that are not marked as connected. iterate backwards
-	// so array_remove can be used without invalidating the current index
+	// so the USB stack that takes the place of a removed one was checked already
 	for (i = _usb_stacks.count - 1; i >= 0; --i) {
-		usb_stack = array_get(&_usb_stacks, i);
+		usb_stack = *(USBStack **)array_get(&_usb_stacks, i);
 
-		if (usb_stack->connected) {
-			continue;
+		if (!usb_stack->connected) {
+			usb_remove_stack(usb_stack);
 		}
-
-		log_info("Removing USB device (bus: %u, device: %u) at index %d: %s",
-		         usb_stack->bus_number, usb_stack->device_address, i,
-		         usb_stack->base.name);
-
-		stack_announce_disconnect(&usb_stack->base);
-
-		array_remove(&_usb_stacks, i, (ItemDestroyFunction)usb_stack_destroy);
 	}
 
 	return 0;
 }
 
+// reopens the USB devices in place, see usb_stack_reopen. this doesn't
+// block, the USB stacks stay known and keep their routes and recipients
 int usb_reopen(USBStack *usb_stack) {
-	Array recipients;
 	int i;
-	USBStack *candidate;
-	uint8_t bus_number;
-	uint8_t device_address;
-	libusb_device *device;
-	bool red_brick;
-	bool found = false;
 
-	if (usb_stack == NULL) {
-		log_info("Reopening all USB devices");
+	if (usb_stack != NULL) {
+		return usb_stack_reopen(usb_stack);
 	}
 
-	if (array_create(&recipients, 1, sizeof(Recipient), true) < 0) {
-		log_error("Could not create temporary recipient array: %s (%d)",
-		          get_errno_name(errno), errno);
+	log_info("Reopening all USB devices");
 
-		return -1;
+	for (i = 0; i < _usb_stacks.count; ++i) {
+		usb_stack_reopen(*(USBStack **)array_get(&_usb_stacks, i));
 	}
 
-	// iterate backwards for simpler index handling and to avoid memmove in
-	// array_remove call
-	for (i = _usb_stacks.count - 1; i >= 0; --i) {
-		candidate = array_get(&_usb_stacks, i);
+	return usb_rescan();
+}
 
-		if (usb_stack != NULL && candidate != usb_stack) {
-			continue;
-		}
+// reopens the USB device that the UID is routed to or, for a zero UID, the
+// USB device at the given (bus, device) address
+int usb_reopen_device(uint32_t uid /* always little endian */,
+                      uint8_t bus_number, uint8_t device_address) {
+	Stack *stack;
+	int i;
+	USBStack *usb_stack = NULL;
+	char base58[BASE58_MAX_LENGTH];
 
-		log_info("Reopening USB device (bus: %u, device: %u) at index %d: %s",
-		         candidate->bus_number, candidate->device_address, i,
-		         candidate->base.name);
+	if (uid != 0) {
+		stack = hardware_get_route(uid);
 
-		bus_number = candidate->bus_number;
-		device_address = candidate->device_address;
-		device = libusb_ref_device(candidate->device);
-		red_brick = candidate->red_brick;
+		for (i = 0; stack != NULL && i < _usb_stacks.count; ++i) {
+			if (&(*(USBStack **)array_get(&_usb_stacks, i))->base == stack) {
+				usb_stack = *(USBStack **)array_get(&_usb_stacks, i);
 
-		array_swap(&candidate->base.recipients, &recipients);
+				break;
+			}
+		}
 
-		usb_stack_destroy(candidate);
+		if (usb_stack == NULL) {
+			log_warn("Could not find USB device for UID %s to reopen",
+			         base58_encode(base58, uint32_from_le(uid)));
 
-		if (usb_stack_create(candidate, _context, device, red_brick) < 0) {
-			array_remove(&_usb_stacks, i, NULL);
+			return -1;
+		}
+	} else {
+		usb_stack = usb_get_stack(bus_number, device_address);
 
-			log_warn("Could not reopen USB device (bus: %u, device: %u) due to an error",
+		if (usb_stack == NULL) {
+			log_warn("Could not find USB device (bus: %u, device: %u) to reopen",
 			         bus_number, device_address);
 
-			recipients_announce_disconnect(&recipients);
-		} else {
-			array_swap(&recipients, &candidate->base.recipients);
+			return -1;
 		}
+	}
 
-		libusb_unref_device(device);
+	return usb_stack_reopen(usb_stack);
+}
 
-		if (usb_stack != NULL && candidate == usb_stack) {
-			found = true;
+// marks a USB stack that could not be reopened for removal. this is called
+// from timers of the USB stack itself and while reopening all USB stacks,
+// therefore the USB stack is not removed here, but by usb_forward_hotplug in
+// the main loop. a rescan follows, so the USB device gets a new USB stack if
+// it is still connected
+void usb_discard_stack(USBStack *usb_stack) {
+	USBHotplugEvent event;
 
-			break;
-		}
+	if (usb_stack->discarded) {
+		return;
 	}
 
-	if (usb_stack != NULL && !found) {
-		log_error("Could not find USB device (bus: %u, device: %u) to reopen: %s",
-		          usb_stack->bus_number, usb_stack->device_address, usb_stack->base.name);
-	}
+	usb_stack->discarded = true;
 
-	array_destroy(&recipients, NULL);
+	memset(&event, 0, sizeof(event));
 
-	return usb_rescan();
+	event.type = USB_HOTPLUG_EVENT_DISCARD;
+	event.bus_number = usb_stack->bus_number;
+	event.device_address = usb_stack->device_address;
+
+	usb_write_hotplug_event(&event);
 }
 
 int usb_get_interface_endpoints(libusb_device_handle *device_handle, int interface_number,
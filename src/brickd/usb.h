@@ -47,9 +47,13 @@ void usb_exit(void);
 
 void usb_handle_events(void);
 void usb_handle_hotplug(void);
+void usb_handle_hotplug_device(libusb_device *device, bool arrived);
 
 int usb_rescan(void);
 int usb_reopen(USBStack *usb_stack);
+int usb_reopen_device(uint32_t uid /* always little endian */,
+                      uint8_t bus_number, uint8_t device_address);
+void usb_discard_stack(USBStack *usb_stack);
 
 int usb_get_interface_endpoints(libusb_device_handle *device_handle, int interface_number,
                                 uint8_t *endpoint_in, uint8_t *endpoint_out);
@@ -34,6 +34,7 @@
 #include <errno.h>
 #include <libusb.h>
 #include <stdlib.h>
+#include <string.h>
 #ifdef __linux__
 	#include <sys/sysmacros.h>
 #endif
@@ -42,17 +43,38 @@
 #include <fcntl.h>
 #include <unistd.h>
 
+#include <daemonlib/config.h>
 #include <daemonlib/event.h>
 #include <daemonlib/log.h>
 #include <daemonlib/macros.h>
+#include <daemonlib/pipe.h>
+#include <daemonlib/threads.h>
+#include <daemonlib/utils.h>
 
 #include "usb.h"
 
+#include "event_timing.h"
+#include "shard_queue.h"
+
+#define USB_TRANSFER_QUEUE_SIZE 65536 // bytes, room for 4096 finished transfers
+#define USB_MAX_TRANSFERS_PER_WAKEUP 256
+#define USB_EVENT_THREAD_TIMEOUT 250000 // microseconds
+
+#define usb_get_event_running() __atomic_load_n(&_usb_event_running, __ATOMIC_ACQUIRE)
+#define usb_set_event_running(value) __atomic_store_n(&_usb_event_running, value, __ATOMIC_RELEASE)
+
 static LogSource _log_source = LOG_SOURCE_INITIALIZER;
 
 static bool _has_hotplug;
 static libusb_hotplug_callback_handle _brick_hotplug_handle;
 static libusb_hotplug_callback_handle _red_brick_hotplug_handle;
+static bool _has_event_thread;
+static bool _usb_event_running; // shared with the USB event thread, only accessed atomically
+static Thread _usb_event_thread;
+static ShardQueue _transfer_queue; // USB event thread -> main thread
+static Pipe _transfer_pipe;
+
+extern void usb_transfer_finish(struct libusb_transfer *handle);
 
 #ifdef BRICKD_WITH_LIBUSB_HOTPLUG_MKNOD
 bool usb_hotplug_mknod = false;
@@ -94,7 +116,7 @@ static int LIBUSB_CALL usb_hotplug_callback(libusb_context *context, libusb_devi
 		}
 #endif
 
-		usb_handle_hotplug();
+		usb_handle_hotplug_device(device, true);
 
 		break;
 
@@ -115,7 +137,7 @@ static int LIBUSB_CALL usb_hotplug_callback(libusb_context *context, libusb_devi
 		}
 #endif
 
-		usb_handle_hotplug();
+		usb_handle_hotplug_device(device, false);
 
 		break;
 
@@ -153,8 +175,8 @@ static void LIBUSB_CALL usb_add_pollfd(int fd, short events, void *opaque) {
 	// FIXME: handle error?
 	// add EVENT_ERROR to events because libusb will use it to also detect
 	// device unplug, but doesn't register for it
-	event_add_source(fd, EVENT_SOURCE_TYPE_USB, "usb-poll", events | EVENT_ERROR,
-	                 usb_handle_events_internal, context);
+	event_timing_add_source(fd, EVENT_SOURCE_TYPE_USB, "usb-poll", events | EVENT_ERROR,
+	                        usb_handle_events_internal, context);
 }
 
 static void LIBUSB_CALL usb_remove_pollfd(int fd, void *opaque) {
@@ -162,16 +184,272 @@ static void LIBUSB_CALL usb_remove_pollfd(int fd, void *opaque) {
 
 	log_event_debug("Got told to remove libusb pollfd (handle: %d)", fd);
 
-	event_remove_source(fd, EVENT_SOURCE_TYPE_USB);
+	event_timing_remove_source(fd, EVENT_SOURCE_TYPE_USB);
 }
 
-int usb_init_platform(libusb_context *context) {
+static void usb_wake_main_thread(void) {
+	uint8_t byte = 0;
+
+	// a full pipe already guarantees a wake-up, therefore the pipe is
+	// non-blocking and would-block errors can be ignored
+	if (pipe_write(&_transfer_pipe, &byte, sizeof(byte)) < 0 && !errno_would_block()) {
+		log_error("Could not write to USB transfer pipe: %s (%d)",
+		          get_errno_name(errno), errno);
+	}
+}
+
+// finishes up to the given number of transfers that were finished by the USB
+// event thread. returns false if no transfers are left
+static bool usb_forward_transfers_internal(int max_transfers) {
+	ShardQueueRecord *record;
+	struct libusb_transfer *handle;
+	int i;
+
+	for (i = 0; i < max_transfers; ++i) {
+		record = shard_queue_peek(&_transfer_queue);
+
+		if (record == NULL) {
+			return false;
+		}
+
+		memcpy(&handle, record->data, sizeof(handle));
+
+		// pop first, finishing the transfer might handle USB events again
+		shard_queue_pop(&_transfer_queue);
+
+		usb_transfer_finish(handle);
+	}
+
+	return true;
+}
+
+static void usb_forward_transfers(void *opaque) {
+	uint8_t bytes[64];
+
+	(void)opaque;
+
+	// drain the pipe first, a transfer queued after this point comes with
+	// a new wake-up
+	while (pipe_read(&_transfer_pipe, bytes, sizeof(bytes)) > 0) {
+	}
+
+	// more transfers are left, come back after the other event sources had
+	// their turn
+	if (usb_forward_transfers_internal(USB_MAX_TRANSFERS_PER_WAKEUP)) {
+		usb_wake_main_thread();
+	}
+}
+
+// libusb calls this for every finished transfer. without the USB event thread
+// this happens in the main thread and the transfer is finished right away.
+// otherwise the USB event thread queues the transfer for the main thread, so
+// no USBStack or USBTransfer state is touched outside the main thread
+void LIBUSB_CALL usb_transfer_callback(struct libusb_transfer *handle) {
+	ShardQueueRecord *record;
+
+	if (!_has_event_thread) {
+		usb_transfer_finish(handle);
+
+		return;
+	}
+
+	// the main thread never waits for the USB event thread while it is
+	// running, therefore it will make room eventually
+	while ((record = shard_queue_reserve(&_transfer_queue, sizeof(handle))) == NULL) {
+		if (!usb_get_event_running()) {
+			log_error("Could not append finished USB transfer (handle: %p) to full USB transfer queue",
+			          handle);
+
+			return;
+		}
+
+		usb_wake_main_thread();
+		millisleep(1);
+	}
+
+	record->id = 0;
+	record->type = 0;
+
+	memcpy(record->data, &handle, sizeof(handle));
+
+	// the main thread polls without a timeout, so the wake-up must not get
+	// lost. shard_queue_commit and shard_queue_pop are fenced, so either
+	// this sees the queue as empty and wakes the main thread up, or the
+	// main thread sees this transfer before it goes back to poll
+	if (shard_queue_commit(&_transfer_queue)) {
+		usb_wake_main_thread();
+	}
+}
+
+static void usb_handle_events_thread(void *opaque) {
+	libusb_context *context = opaque;
+	struct timeval tv;
+	int rc;
+
+	log_debug("Started USB event handler thread");
+
+	while (usb_get_event_running()) {
+		// libusb_interrupt_event_handler is only available since libusb
+		// 1.0.21, return regularly instead to check if the thread should stop
+		tv.tv_sec = 0;
+		tv.tv_usec = USB_EVENT_THREAD_TIMEOUT;
+
+		rc = libusb_handle_events_timeout(context, &tv);
+
+		if (rc < 0) {
+			log_warn("Could not handle USB events: %s (%d)",
+			         usb_get_error_name(rc), rc);
+		}
+	}
+
+	log_debug("Stopped USB event handler thread");
+}
+
+static int usb_start_event_thread(libusb_context *context) {
+	int phase = 0;
+
+	if (shard_queue_create(&_transfer_queue, USB_TRANSFER_QUEUE_SIZE) < 0) {
+		log_error("Could not create USB transfer queue: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 1;
+
+	if (pipe_create(&_transfer_pipe, PIPE_FLAG_NON_BLOCKING_READ | PIPE_FLAG_NON_BLOCKING_WRITE) < 0) {
+		log_error("Could not create USB transfer pipe: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 2;
+
+	if (event_timing_add_source(_transfer_pipe.base.read_handle, EVENT_SOURCE_TYPE_GENERIC,
+	                            "usb-transfer", EVENT_READ, usb_forward_transfers, NULL) < 0) {
+		goto cleanup;
+	}
+
+	phase = 3;
+
+	log_debug("Starting USB event handler thread");
+
+	usb_set_event_running(true);
+
+	thread_create(&_usb_event_thread, usb_handle_events_thread, context);
+
+	phase = 4;
+
+cleanup:
+	switch (phase) { // no breaks, all cases fall through intentionally
+	case 2:
+		pipe_destroy(&_transfer_pipe);
+		// fall through
+
+	case 1:
+		shard_queue_destroy(&_transfer_queue);
+		// fall through
+
+	default:
+		break;
+	}
+
+	return phase == 4 ? 0 : -1;
+}
+
+static void usb_stop_event_thread(void) {
+	log_debug("Stopping USB event handler thread");
+
+	usb_set_event_running(false);
+
+	thread_join(&_usb_event_thread);
+	thread_destroy(&_usb_event_thread);
+
+	// all USB stacks are destroyed at this point, transfers that are still
+	// queued cannot be finished anymore and are dropped with the queue
+	event_timing_remove_source(_transfer_pipe.base.read_handle, EVENT_SOURCE_TYPE_GENERIC);
+	pipe_destroy(&_transfer_pipe);
+	shard_queue_destroy(&_transfer_queue);
+}
+
+static int usb_add_pollfds(libusb_context *context) {
 	int phase = 0;
 	const struct libusb_pollfd **pollfds = NULL;
 	const struct libusb_pollfd **pollfd;
 	const struct libusb_pollfd **last_added_pollfd = NULL;
+
+	// get pollfds from libusb context
+	pollfds = libusb_get_pollfds(context);
+
+	if (pollfds == NULL) {
+		log_error("Could not get pollfds from libusb context");
+
+		goto cleanup;
+	}
+
+	for (pollfd = pollfds; *pollfd != NULL; ++pollfd) {
+		if (event_timing_add_source((*pollfd)->fd, EVENT_SOURCE_TYPE_USB, "usb-poll",
+		                            (*pollfd)->events, usb_handle_events_internal, context) < 0) {
+			goto cleanup;
+		}
+
+		last_added_pollfd = pollfd;
+		phase = 1;
+	}
+
+	// register pollfd notifiers
+	libusb_set_pollfd_notifiers(context, usb_add_pollfd, usb_remove_pollfd, context);
+
+	phase = 2;
+
+cleanup:
+	switch (phase) { // no breaks, all cases fall through intentionally
+	case 1:
+		for (pollfd = pollfds; pollfd != last_added_pollfd; ++pollfd) {
+			event_timing_remove_source((*pollfd)->fd, EVENT_SOURCE_TYPE_USB);
+		}
+
+		if (last_added_pollfd != NULL) {
+			event_timing_remove_source((*last_added_pollfd)->fd, EVENT_SOURCE_TYPE_USB);
+		}
+
+		// fall through
+
+	default:
+		break;
+	}
+
+	libusb_free_pollfds(pollfds);
+
+	return phase == 2 ? 0 : -1;
+}
+
+static void usb_remove_pollfds(libusb_context *context) {
+	const struct libusb_pollfd **pollfds = NULL;
+	const struct libusb_pollfd **pollfd;
+
+	libusb_set_pollfd_notifiers(context, NULL, NULL, NULL);
+
+	pollfds = libusb_get_pollfds(context);
+
+	if (pollfds == NULL) {
+		log_error("Could not get pollfds from libusb context");
+	} else {
+		for (pollfd = pollfds; *pollfd != NULL; ++pollfd) {
+			event_timing_remove_source((*pollfd)->fd, EVENT_SOURCE_TYPE_USB);
+		}
+
+		libusb_free_pollfds(pollfds);
+	}
+}
+
+int usb_init_platform(libusb_context *context) {
+	int phase = 0;
 	int rc;
 
+	_has_event_thread = config_get_option_value("usb.event_thread")->boolean;
+
 	_has_hotplug = libusb_has_capability(LIBUSB_CAP_HAS_CAPABILITY) != 0 &&
 	               libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG) != 0;
 
@@ -204,7 +482,7 @@ int usb_init_platform(libusb_context *context) {
 		                                      USB_RED_BRICK_VENDOR_ID, USB_RED_BRICK_PRODUCT_ID,
 		                                      LIBUSB_HOTPLUG_MATCH_ANY,
 		                                      usb_hotplug_callback, NULL,
-		                                      &_brick_hotplug_handle);
+		                                      &_red_brick_hotplug_handle);
 
 		if (rc < 0) {
 			log_error("Could not register libusb hotplug callback: %s (%d)",
@@ -216,43 +494,22 @@ int usb_init_platform(libusb_context *context) {
 		phase = 2;
 	}
 
-	// get pollfds from libusb context
-	pollfds = libusb_get_pollfds(context);
-
-	if (pollfds == NULL) {
-		log_error("Could not get pollfds from libusb context");
-
-		goto cleanup;
-	}
-
-	for (pollfd = pollfds; *pollfd != NULL; ++pollfd) {
-		if (event_add_source((*pollfd)->fd, EVENT_SOURCE_TYPE_USB, "usb-poll",
-		                     (*pollfd)->events, usb_handle_events_internal, context) < 0) {
+	// handle USB events either on their own thread or in the event loop of
+	// the main thread
+	if (_has_event_thread) {
+		if (usb_start_event_thread(context) < 0) {
+			goto cleanup;
+		}
+	} else {
+		if (usb_add_pollfds(context) < 0) {
 			goto cleanup;
 		}
-
-		last_added_pollfd = pollfd;
-		phase = 3;
 	}
 
-	// register pollfd notifiers
-	libusb_set_pollfd_notifiers(context, usb_add_pollfd, usb_remove_pollfd, context);
-
-	phase = 4;
+	phase = 3;
 
 cleanup:
 	switch (phase) { // no breaks, all cases fall through intentionally
-	case 3:
-		for (pollfd = pollfds; pollfd != last_added_pollfd; ++pollfd) {
-			event_remove_source((*pollfd)->fd, EVENT_SOURCE_TYPE_USB);
-		}
-
-		if (last_added_pollfd != NULL) {
-			event_remove_source((*last_added_pollfd)->fd, EVENT_SOURCE_TYPE_USB);
-		}
-
-		// fall through
-
 	case 2:
 		if (_has_hotplug) {
 			libusb_hotplug_deregister_callback(context, _red_brick_hotplug_handle);
@@ -271,27 +528,14 @@ cleanup:
 		break;
 	}
 
-	libusb_free_pollfds(pollfds);
-
-	return phase == 4 ? 0 : -1;
+	return phase == 3 ? 0 : -1;
 }
 
 void usb_exit_platform(libusb_context *context) {
-	const struct libusb_pollfd **pollfds = NULL;
-	const struct libusb_pollfd **pollfd;
-
-	libusb_set_pollfd_notifiers(context, NULL, NULL, NULL);
-
-	pollfds = libusb_get_pollfds(context);
-
-	if (pollfds == NULL) {
-		log_error("Could not get pollfds from libusb context");
+	if (_has_event_thread) {
+		usb_stop_event_thread();
 	} else {
-		for (pollfd = pollfds; *pollfd != NULL; ++pollfd) {
-			event_remove_source((*pollfd)->fd, EVENT_SOURCE_TYPE_USB);
-		}
-
-		libusb_free_pollfds(pollfds);
+		usb_remove_pollfds(context);
 	}
 
 	if (_has_hotplug) {
@@ -301,5 +545,11 @@ void usb_exit_platform(libusb_context *context) {
 }
 
 void usb_handle_events_platform(libusb_context *context) {
-	usb_handle_events_internal(context);
+	if (_has_event_thread) {
+		microsleep(0); // give USB event handler thread a chance
+
+		usb_forward_transfers_internal(INT32_MAX);
+	} else {
+		usb_handle_events_internal(context);
+	}
 }
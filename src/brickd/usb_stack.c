@@ -30,11 +30,14 @@
 #include <string.h>
 
 #include <daemonlib/array.h>
+#include <daemonlib/base58.h>
+#include <daemonlib/config.h>
 #include <daemonlib/log.h>
 #include <daemonlib/utils.h>
 
 #include "usb_stack.h"
 
+#include "event_timing.h"
 #include "hardware.h"
 #include "network.h"
 #include "usb.h"
@@ -43,12 +46,15 @@
 static LogSource _log_source = LOG_SOURCE_INITIALIZER;
 
 #define MAX_READ_TRANSFERS 10
-#define MAX_WRITE_TRANSFERS 10
-#define MAX_QUEUED_WRITES 32768
-#define QUEUED_WRITES_DROP_COUNT 512
+#define WRITE_RING_INITIAL_SIZE 4096 // bytes, must be a power of two
+#define WRITE_RING_MAX_SIZE 1048576 // bytes, must be a power of two
+#define MAX_QUEUED_WRITES_PER_UID 4096 // the oldest is dropped beyond this
+#define DROPPED_WRITES_LOG_INTERVAL 512
 #define PENDING_ERROR_TIMER_DELAY 1000000 // 1 second in microseconds
 #define PENDING_TRANSFERS_TIMEOUT 1000 // milliseconds
 #define PENDING_TRANSFERS_CHECK_INTERVAL 10 // milliseconds
+#define MAX_PENDING_ERROR_RECOVERIES 3 // within the window, then the device gets reopened
+#define PENDING_ERROR_RECOVERY_WINDOW 60000 // milliseconds
 
 static void usb_stack_handle_pending_error(void *opaque) {
 	USBStack *usb_stack = opaque;
@@ -57,11 +63,33 @@ static void usb_stack_handle_pending_error(void *opaque) {
 	bool read_stall = false;
 	bool write_stall = false;
 	int rc;
+	uint64_t now = millitime();
 
 	if (usb_stack->expecting_removal) {
 		return;
 	}
 
+	// a device that keeps failing is reopened instead of recovering it over
+	// and over again
+	if (usb_stack->pending_error_recoveries == 0 ||
+	    now < usb_stack->first_pending_error_recovery ||
+	    now > usb_stack->first_pending_error_recovery + PENDING_ERROR_RECOVERY_WINDOW) {
+		usb_stack->pending_error_recoveries = 0;
+		usb_stack->first_pending_error_recovery = now;
+	}
+
+	if (++usb_stack->pending_error_recoveries > MAX_PENDING_ERROR_RECOVERIES) {
+		log_warn("Reopening %s after %d recoveries from failed transfer(s) within %d seconds",
+		         usb_stack->base.name, MAX_PENDING_ERROR_RECOVERIES,
+		         PENDING_ERROR_RECOVERY_WINDOW / 1000);
+
+		usb_stack->pending_error_recoveries = 0;
+
+		usb_stack_reopen(usb_stack);
+
+		return;
+	}
+
 	// check read transfers
 	for (i = 0; i < usb_stack->read_transfers.count; ++i) {
 		usb_transfer = array_get(&usb_stack->read_transfers, i);
@@ -136,17 +164,27 @@ static void usb_stack_handle_pending_error(void *opaque) {
 reopen:
 	log_warn("Reopening %s to recover from stalled transfer(s)", usb_stack->base.name);
 
-	usb_reopen(usb_stack);
+	usb_stack_reopen(usb_stack);
 }
 
+// a read transfer can carry multiple responses back-to-back. they are
+// dispatched in place, one after the other, from a moving offset
 static void usb_stack_read_callback(USBTransfer *usb_transfer) {
+	USBStack *usb_stack = usb_transfer->usb_stack;
 	const char *message = NULL;
 	char packet_dump[PACKET_MAX_DUMP_LENGTH];
 	char packet_signature[PACKET_MAX_SIGNATURE_LENGTH];
-	int buffer_used = usb_transfer->handle->actual_length;
+	uint8_t *buffer = usb_transfer->buffer;
+	int length = usb_transfer->handle->actual_length;
+	int offset = 0;
+	int remaining;
+	Packet *response;
+#ifdef DAEMONLIB_WITH_PACKET_TRACE
+	Packet traced_response;
+#endif
 
 	// check if packet is too short
-	if (buffer_used < (int)sizeof(PacketHeader)) {
+	if (length < (int)sizeof(PacketHeader)) {
 		// there is a problem with the first USB transfer send by the RED
 		// Brick. if the first USB transfer was queued to the A10s USB hardware
 		// before the USB OTG connection got established then the payload of
@@ -155,18 +193,16 @@ static void usb_stack_read_callback(USBTransfer *usb_transfer) {
 		// the RED Brick sends a USB transfer with one byte payload before
 		// sending anything else. this short response with 0xA1/0xAA as payload
 		// is detected here and dropped
-		if (usb_transfer->usb_stack->expecting_short_Ax_response &&
-		    buffer_used == 1 &&
-		    (*(uint8_t *)usb_transfer->buffer == 0xA1 ||
-		     *(uint8_t *)usb_transfer->buffer == 0xAA)) {
-			usb_transfer->usb_stack->expecting_short_Ax_response = false;
+		if (usb_stack->expecting_short_Ax_response &&
+		    length == 1 && (buffer[0] == 0xA1 || buffer[0] == 0xAA)) {
+			usb_stack->expecting_short_Ax_response = false;
 
 			log_debug("Read transfer %p returned expected short 0x%02X response from %s, dropping response",
-			          usb_transfer, *(uint8_t *)usb_transfer->buffer, usb_transfer->usb_stack->base.name);
+			          usb_transfer, buffer[0], usb_stack->base.name);
 		} else {
 			log_error("Read transfer %p returned response (packet: %s) with incomplete header (actual: %u < minimum: %d) from %s",
-			          usb_transfer, packet_get_dump(packet_dump, usb_transfer->buffer, buffer_used),
-			          buffer_used, (int)sizeof(PacketHeader), usb_transfer->usb_stack->base.name);
+			          usb_transfer, packet_get_dump(packet_dump, (Packet *)buffer, length),
+			          length, (int)sizeof(PacketHeader), usb_stack->base.name);
 		}
 
 		return;
@@ -175,228 +211,386 @@ static void usb_stack_read_callback(USBTransfer *usb_transfer) {
 	// only the first response from the RED Brick is expected to be a short
 	// 0xA1/0xAA response. after the first non-short response arrived stop
 	// expecting a short response
-	usb_transfer->usb_stack->expecting_short_Ax_response = false;
+	usb_stack->expecting_short_Ax_response = false;
+
+	while (offset < length) {
+		response = (Packet *)(buffer + offset);
+		remaining = length - offset;
 
-	while (buffer_used > 0) {
 		// check if packet is too short
-		if (buffer_used < (int)sizeof(PacketHeader)) {
+		if (remaining < (int)sizeof(PacketHeader)) {
 			log_error("Read transfer %p returned response (packet: %s) with incomplete header (actual: %u < minimum: %d) from %s",
-			          usb_transfer, packet_get_dump(packet_dump, usb_transfer->buffer, buffer_used),
-			          buffer_used, (int)sizeof(PacketHeader), usb_transfer->usb_stack->base.name);
+			          usb_transfer, packet_get_dump(packet_dump, response, remaining),
+			          remaining, (int)sizeof(PacketHeader), usb_stack->base.name);
 
 			return;
 		}
 
 		// check if packet is a valid response
-		if (!packet_header_is_valid_response(&((Packet *)usb_transfer->buffer)->header, &message)) {
+		if (!packet_header_is_valid_response(&response->header, &message)) {
 			log_error("Received invalid response (packet: %s) from %s: %s",
-			          packet_get_dump(packet_dump, usb_transfer->buffer, buffer_used),
-			          usb_transfer->usb_stack->base.name, message);
+			          packet_get_dump(packet_dump, response, remaining),
+			          usb_stack->base.name, message);
 
 			return;
 		}
 
 		// check if packet is complete
-		if (buffer_used < ((Packet *)usb_transfer->buffer)->header.length) {
+		if (remaining < response->header.length) {
 			log_error("Read transfer %p returned incomplete response (packet: %s, actual: %u != expected: %u) from %s",
-			          usb_transfer, packet_get_dump(packet_dump, usb_transfer->buffer, buffer_used),
-			          buffer_used, ((Packet *)usb_transfer->buffer)->header.length,
-			          usb_transfer->usb_stack->base.name);
+			          usb_transfer, packet_get_dump(packet_dump, response, remaining),
+			          remaining, response->header.length, usb_stack->base.name);
 
 			return;
 		}
 
-		log_packet_debug("Received %s (%s) from %s",
-		                 packet_get_response_type(usb_transfer->buffer),
-		                 packet_get_response_signature(packet_signature, usb_transfer->buffer),
-		                 usb_transfer->usb_stack->base.name);
+		offset += response->header.length;
 
 #ifdef DAEMONLIB_WITH_PACKET_TRACE
-		((Packet *)usb_transfer->buffer)->trace_id = packet_get_next_response_trace_id();
+		// the trace ID is stored behind the packet data, setting it in place
+		// would overwrite the beginning of the next response
+		memcpy(&traced_response, response, response->header.length);
+
+		response = &traced_response;
+		response->trace_id = packet_get_next_response_trace_id();
 #endif
 
-		packet_add_trace(usb_transfer->buffer);
+		log_packet_debug("Received %s (%s) from %s",
+		                 packet_get_response_type(response),
+		                 packet_get_response_signature(packet_signature, response),
+		                 usb_stack->base.name);
 
-		if (stack_add_recipient(&usb_transfer->usb_stack->base,
-		                        ((Packet *)usb_transfer->buffer)->header.uid, 0) < 0) {
+		packet_add_trace(response);
+
+		if (stack_add_recipient(&usb_stack->base, response->header.uid, 0) < 0) {
 			return;
 		}
 
-		network_dispatch_response(usb_transfer->buffer);
-
-		memmove(usb_transfer->buffer,
-		        (uint8_t *)usb_transfer->buffer + ((Packet *)usb_transfer->buffer)->header.length,
-		        buffer_used - ((Packet *)usb_transfer->buffer)->header.length);
-
-		buffer_used -= ((Packet *)usb_transfer->buffer)->header.length;
+		stack_count_response(&usb_stack->base, response);
+		network_dispatch_response(response);
 	}
 }
 
-static void usb_stack_write_callback(USBTransfer *usb_transfer) {
+// submits the next queued request in-place from the write ring, the UIDs take
+// turns. the request stays in the write ring until the write transfer has
+// finished
+static int usb_stack_send_queued_request(USBTransfer *usb_transfer) {
+	USBStack *usb_stack = usb_transfer->usb_stack;
 	Packet *request;
 	char packet_signature[PACKET_MAX_SIGNATURE_LENGTH];
 
-	if (!usb_transfer->usb_stack->expecting_removal &&
-	    usb_transfer->usb_stack->write_queue.count > 0) {
-		request = queue_peek(&usb_transfer->usb_stack->write_queue);
+	if (usb_stack->expecting_removal) {
+		return -1;
+	}
 
-		memcpy(usb_transfer->buffer, request, request->header.length);
+	request = write_ring_peek(&usb_stack->write_ring);
 
-		if (usb_transfer_submit(usb_transfer) < 0) {
-			log_error("Could not send queued request (%s) to %s: %s (%d)",
-			          packet_get_request_signature(packet_signature, usb_transfer->buffer),
-			          usb_transfer->usb_stack->base.name,
-			          get_errno_name(errno), errno);
+	if (request == NULL) {
+		return -1;
+	}
 
-			return;
-		}
+	usb_transfer->buffer = request;
 
-		queue_pop(&usb_transfer->usb_stack->write_queue, NULL);
+	if (usb_transfer_submit(usb_transfer) < 0) {
+		usb_transfer->buffer = NULL;
 
-		log_packet_debug("Sent queued request (%s) to %s, %d request(s) left in write queue",
-		                 packet_get_request_signature(packet_signature, usb_transfer->buffer),
-		                 usb_transfer->usb_stack->base.name,
-		                 usb_transfer->usb_stack->write_queue.count);
+		log_error("Could not send queued request (%s) to %s: %s (%d)",
+		          packet_get_request_signature(packet_signature, request),
+		          usb_stack->base.name, get_errno_name(errno), errno);
+
+		return -1;
 	}
+
+	write_ring_pop(&usb_stack->write_ring);
+
+	log_packet_debug("Sent queued request (%s) to %s, %d request(s) left in write queue",
+	                 packet_get_request_signature(packet_signature, request),
+	                 usb_stack->base.name, usb_stack->write_ring.queued);
+
+	return 0;
 }
 
-static int usb_stack_dispatch_request(Stack *stack, Packet *request,
-                                      Recipient *recipient) {
-	USBStack *usb_stack = (USBStack *)stack;
-	int i;
+static void usb_stack_write_callback(USBTransfer *usb_transfer) {
+	usb_stack_send_queued_request(usb_transfer);
+}
+
+static USBTransfer *usb_stack_add_write_transfer(USBStack *usb_stack) {
 	USBTransfer *usb_transfer;
-	Packet *queued_request;
-	char packet_signature[PACKET_MAX_SIGNATURE_LENGTH];
-	uint32_t writes_to_drop;
 
-	(void)recipient;
+	// the write transfer array was created with room for the maximum number of
+	// write transfers. appending never reallocates it and the libusb transfers
+	// can keep pointing to their USBTransfer
+	usb_transfer = array_append(&usb_stack->write_transfers);
 
-	if (usb_stack->expecting_removal) {
-		log_debug("Cannot dispatch request (%s) to %s that is about to be removed, dropping request",
-		          packet_get_request_signature(packet_signature, request),
-		          usb_stack->base.name);
+	if (usb_transfer == NULL) {
+		log_error("Could not append to write transfer array for %s: %s (%d)",
+		          usb_stack->base.name, get_errno_name(errno), errno);
 
-		return 0;
+		return NULL;
 	}
 
-	// find free write transfer
-	for (i = 0; i < usb_stack->write_transfers.count; ++i) {
-		usb_transfer = array_get(&usb_stack->write_transfers, i);
+	if (usb_transfer_create(usb_transfer, usb_stack, USB_TRANSFER_TYPE_WRITE,
+	                        usb_stack_write_callback) < 0) {
+		array_remove(&usb_stack->write_transfers,
+		             usb_stack->write_transfers.count - 1, NULL);
 
-		if (!usb_transfer_is_submittable(usb_transfer)) {
-			continue;
-		}
+		return NULL;
+	}
 
-		memcpy(usb_transfer->buffer, request, request->header.length);
+	return usb_transfer;
+}
 
-		if (usb_transfer_submit(usb_transfer) < 0) {
-			// FIXME: how to handle a failed submission, try to re-submit?
+// while requests have to wait in the write queue add write transfers, up to
+// the maximum. the USB host controller can handle more transfers in flight
+// than the minimum number of write transfers allows for
+static void usb_stack_grow_write_transfers(USBStack *usb_stack) {
+	USBTransfer *usb_transfer;
+	int added = 0;
 
-			continue;
+	while (usb_stack->write_ring.queued > 0 &&
+	       usb_stack->write_transfers.count < usb_stack->max_write_transfers) {
+		usb_transfer = usb_stack_add_write_transfer(usb_stack);
+
+		if (usb_transfer == NULL) {
+			break;
 		}
 
-		return 0;
+		++added;
+
+		if (usb_stack_send_queued_request(usb_transfer) < 0) {
+			break;
+		}
+	}
+
+	if (added == 0) {
+		return;
 	}
 
-	// no free write transfer available, push request to write queue
-	log_packet_debug("Could not find a free write transfer for %s, pushing request to write queue (count: %d + 1)",
-	                 usb_stack->base.name, usb_stack->write_queue.count);
+	// start checking for idle write transfers on the first growth
+	if (usb_stack->write_transfers.count - added <= usb_stack->min_write_transfers) {
+		usb_stack->peak_write_transfers = usb_stack->pending_write_transfers;
 
-	if (usb_stack->write_queue.count >= MAX_QUEUED_WRITES) {
-		writes_to_drop = usb_stack->write_queue.count - MAX_QUEUED_WRITES + QUEUED_WRITES_DROP_COUNT;
+		if (timer_configure(&usb_stack->write_transfer_idle_timer,
+		                    usb_stack->write_transfer_idle_timeout,
+		                    usb_stack->write_transfer_idle_timeout) < 0) {
+			log_error("Could not start write transfer idle timer for %s: %s (%d)",
+			          usb_stack->base.name, get_errno_name(errno), errno);
+		}
+	}
 
-		log_warn("Write queue for %s is full, dropping %u queued write(s), %u + %u dropped in total",
-		         usb_stack->base.name, writes_to_drop, usb_stack->dropped_writes, writes_to_drop);
+	usb_stack->added_write_transfers += added;
 
-		while (writes_to_drop > 0) {
-			queue_pop(&usb_stack->write_queue, NULL);
+	log_debug("Added %d write transfer(s) to %s, %d write transfer(s) in total",
+	          added, usb_stack->base.name, usb_stack->write_transfers.count);
+}
 
-			--writes_to_drop;
-			++usb_stack->dropped_writes;
+// release the write transfers that were not needed since the last check,
+// down to the minimum. free write transfers are taken from the front of the
+// array, the write transfers at its end are the first to become idle
+static void usb_stack_release_idle_write_transfers(void *opaque) {
+	USBStack *usb_stack = opaque;
+	int needed = MAX(usb_stack->min_write_transfers, usb_stack->peak_write_transfers);
+	USBTransfer *usb_transfer;
+	int released = 0;
+
+	while (usb_stack->write_transfers.count > needed) {
+		usb_transfer = array_get(&usb_stack->write_transfers,
+		                         usb_stack->write_transfers.count - 1);
+
+		if (usb_transfer->submitted ||
+		    usb_transfer->pending_error != USB_TRANSFER_PENDING_ERROR_NONE) {
+			break;
 		}
+
+		array_remove(&usb_stack->write_transfers, usb_stack->write_transfers.count - 1,
+		             (ItemDestroyFunction)usb_transfer_destroy);
+
+		++released;
 	}
 
-	queued_request = queue_push(&usb_stack->write_queue);
+	usb_stack->peak_write_transfers = usb_stack->pending_write_transfers;
 
-	if (queued_request == NULL) {
-		log_error("Could not push request (%s) to write queue for %s, dropping request: %s (%d)",
-		          packet_get_request_signature(packet_signature, request),
-		          usb_stack->base.name,
-		          get_errno_name(errno), errno);
+	if (released > 0) {
+		usb_stack->released_write_transfers += released;
 
-		return -1;
+		log_debug("Released %d idle write transfer(s) of %s, %d write transfer(s) left",
+		          released, usb_stack->base.name, usb_stack->write_transfers.count);
 	}
 
-	memcpy(queued_request, request, request->header.length);
-
-	return 0;
+	if (usb_stack->write_transfers.count <= usb_stack->min_write_transfers) {
+		timer_configure(&usb_stack->write_transfer_idle_timer, 0, 0);
+	}
 }
 
-int usb_stack_create(USBStack *usb_stack, libusb_context *context, libusb_device *device, bool red_brick) {
-	int phase = 0;
-	int rc;
-	int i = 0;
-	char preliminary_name[STACK_MAX_NAME_LENGTH];
-	int retries = 0;
+static void usb_stack_send_queued_requests(USBStack *usb_stack) {
+	int i;
 	USBTransfer *usb_transfer;
 
-	usb_stack->bus_number = libusb_get_bus_number(device);
-	usb_stack->device_address = libusb_get_device_address(device);
-	usb_stack->context = context;
-	usb_stack->device = libusb_ref_device(device);
+	// find free write transfers for the queued requests
+	for (i = 0; i < usb_stack->write_transfers.count && usb_stack->write_ring.queued > 0; ++i) {
+		usb_transfer = array_get(&usb_stack->write_transfers, i);
 
-	log_debug("Acquiring USB device (bus: %u, device: %u)",
-	          usb_stack->bus_number, usb_stack->device_address);
+		if (!usb_transfer_is_submittable(usb_transfer)) {
+			continue;
+		}
 
-	phase = 1;
+		// FIXME: how to handle a failed submission, try to re-submit?
+		usb_stack_send_queued_request(usb_transfer);
+	}
 
-	usb_stack->device_handle = NULL;
-	usb_stack->pending_transfers = 0;
-	usb_stack->dropped_writes = 0;
-	usb_stack->connected = true;
-	usb_stack->red_brick = red_brick;
-	usb_stack->expecting_removal = false;
+	if (usb_stack->write_ring.queued == 0) {
+		return;
+	}
 
-	if (red_brick) {
-		usb_stack->interface_number = USB_RED_BRICK_INTERFACE;
-		usb_stack->expecting_short_Ax_response = true;
-#ifdef _WIN32
-		usb_stack->expecting_read_stall_before_removal = true;
-#else
-		usb_stack->expecting_read_stall_before_removal = false;
-#endif
-	} else {
-		usb_stack->interface_number = USB_BRICK_INTERFACE;
-		usb_stack->expecting_short_Ax_response = false;
-		usb_stack->expecting_read_stall_before_removal = false;
+	// no free write transfer available, the request stays in the write queue
+	log_packet_debug("Could not find a free write transfer for %s, keeping request in write queue (count: %d)",
+	                 usb_stack->base.name, usb_stack->write_ring.queued);
+
+	usb_stack_grow_write_transfers(usb_stack);
+}
+
+static int usb_stack_dispatch_request(Stack *stack, Packet *request,
+                                      Recipient *recipient) {
+	USBStack *usb_stack = (USBStack *)stack;
+	char packet_signature[PACKET_MAX_SIGNATURE_LENGTH];
+	char base58[BASE58_MAX_LENGTH];
+	uint32_t dropped_writes = usb_stack->write_ring.dropped;
+	Packet *queued_request;
+
+	(void)recipient;
+
+	if (usb_stack->expecting_removal && !usb_stack->reopening) {
+		log_debug("Cannot dispatch request (%s) to %s that is about to be removed, dropping request",
+		          packet_get_request_signature(packet_signature, request),
+		          usb_stack->base.name);
+
+		return 0;
 	}
 
-	// create stack base
-	snprintf(preliminary_name, sizeof(preliminary_name),
-	         "USB device (bus: %u, device: %u)",
-	         usb_stack->bus_number, usb_stack->device_address);
+	// the request is copied into the write ring once and is sent from there.
+	// if its UID has too many requests queued then its oldest queued request
+	// is dropped. if the write ring is full then the request itself is dropped
+	queued_request = write_ring_push(&usb_stack->write_ring, request);
+
+	// a push drops up to two requests, log for the first and every
+	// DROPPED_WRITES_LOG_INTERVAL drop
+	if (usb_stack->write_ring.dropped != dropped_writes &&
+	    (dropped_writes % DROPPED_WRITES_LOG_INTERVAL == 0 ||
+	     (usb_stack->write_ring.dropped - 1) % DROPPED_WRITES_LOG_INTERVAL == 0)) {
+		log_warn("Dropping request(s) for UID %s from write queue of %s, %u dropped in total",
+		         base58_encode(base58, uint32_from_le(request->header.uid)),
+		         usb_stack->base.name, usb_stack->write_ring.dropped);
+	}
 
-	if (stack_create(&usb_stack->base, preliminary_name,
-	                 usb_stack_dispatch_request) < 0) {
-		log_error("Could not create base stack for %s: %s (%d)",
-		          preliminary_name, get_errno_name(errno), errno);
+	if (queued_request == NULL) {
+		return 0;
+	}
 
-		goto cleanup;
+	// the request is sent after the device got reopened
+	if (usb_stack->reopening) {
+		log_packet_debug("Keeping request (%s) in write queue of %s that is being reopened (count: %d)",
+		                 packet_get_request_signature(packet_signature, request),
+		                 usb_stack->base.name, usb_stack->write_ring.queued);
+
+		return 0;
 	}
 
-	phase = 2;
+	usb_stack_send_queued_requests(usb_stack);
 
-	// open device
-	rc = libusb_open(device, &usb_stack->device_handle);
+	return 0;
+}
+
+static const MetricFamily _usb_stack_pending_transfers = {
+	"brickd_usb_stack_pending_transfers", METRIC_TYPE_GAUGE,
+	"Number of USB transfers submitted to the device and not completed yet."
+};
+
+static const MetricFamily _usb_stack_write_queue_length = {
+	"brickd_usb_stack_write_queue_length", METRIC_TYPE_GAUGE,
+	"Number of requests waiting for a free USB write transfer."
+};
+
+static const MetricFamily _usb_stack_write_ring_used = {
+	"brickd_usb_stack_write_ring_used_bytes", METRIC_TYPE_GAUGE,
+	"Number of bytes in use by queued and submitted requests in the USB write ring."
+};
+
+static const MetricFamily _usb_stack_dropped_writes = {
+	"brickd_usb_stack_dropped_writes_total", METRIC_TYPE_COUNTER,
+	"Number of requests dropped from the USB write queue."
+};
+
+static const MetricFamily _usb_stack_uid_dropped_writes = {
+	"brickd_usb_stack_uid_dropped_writes_total", METRIC_TYPE_COUNTER,
+	"Number of requests dropped from the USB write queue per UID."
+};
+
+static const MetricFamily _usb_stack_write_transfers = {
+	"brickd_usb_stack_write_transfers", METRIC_TYPE_GAUGE,
+	"Number of USB write transfers currently allocated."
+};
+
+static const MetricFamily _usb_stack_added_write_transfers = {
+	"brickd_usb_stack_added_write_transfers_total", METRIC_TYPE_COUNTER,
+	"Number of USB write transfers added because requests had to wait in the write queue."
+};
+
+static const MetricFamily _usb_stack_released_write_transfers = {
+	"brickd_usb_stack_released_write_transfers_total", METRIC_TYPE_COUNTER,
+	"Number of idle USB write transfers released again."
+};
+
+static const MetricFamily _usb_stack_reopens = {
+	"brickd_usb_stack_reopens_total", METRIC_TYPE_COUNTER,
+	"Number of times the USB device was reopened in place."
+};
+
+static void usb_stack_collect_metrics(Stack *stack, Metrics *metrics) {
+	USBStack *usb_stack = (USBStack *)stack;
+	int i;
+	WriteRingDrops *drops;
+	char base58[BASE58_MAX_LENGTH];
+
+	metrics_add(metrics, &_usb_stack_pending_transfers, usb_stack->pending_transfers,
+	            "stack", stack->name, NULL);
+	metrics_add(metrics, &_usb_stack_write_queue_length, usb_stack->write_ring.queued,
+	            "stack", stack->name, NULL);
+	metrics_add(metrics, &_usb_stack_write_ring_used, write_ring_get_used(&usb_stack->write_ring),
+	            "stack", stack->name, NULL);
+	metrics_add(metrics, &_usb_stack_dropped_writes, usb_stack->write_ring.dropped,
+	            "stack", stack->name, NULL);
+	metrics_add(metrics, &_usb_stack_write_transfers, usb_stack->write_transfers.count,
+	            "stack", stack->name, NULL);
+	metrics_add(metrics, &_usb_stack_added_write_transfers, usb_stack->added_write_transfers,
+	            "stack", stack->name, NULL);
+	metrics_add(metrics, &_usb_stack_released_write_transfers, usb_stack->released_write_transfers,
+	            "stack", stack->name, NULL);
+	metrics_add(metrics, &_usb_stack_reopens, usb_stack->reopens,
+	            "stack", stack->name, NULL);
+
+	for (i = 0; i < usb_stack->write_ring.drops.count; ++i) {
+		drops = array_get(&usb_stack->write_ring.drops, i);
+
+		metrics_add(metrics, &_usb_stack_uid_dropped_writes, drops->count, "stack", stack->name,
+		            "uid", base58_encode(base58, uint32_from_le(drops->uid)), NULL);
+	}
+}
+
+// opens the device and claims its interface
+static int usb_stack_open(USBStack *usb_stack) {
+	int rc;
+	int retries = 0;
+
+	rc = libusb_open(usb_stack->device, &usb_stack->device_handle);
 
 	if (rc < 0) {
 		log_warn("Could not open %s: %s (%d)",
 		         usb_stack->base.name, usb_get_error_name(rc), rc);
 
-		goto cleanup;
-	}
+		usb_stack->device_handle = NULL;
 
-	phase = 3;
+		return -1;
+	}
 
 	log_debug("Found %s", usb_stack->base.name);
 
@@ -408,7 +602,7 @@ int usb_stack_create(USBStack *usb_stack, libusb_context *context, libusb_device
 		log_error("Could not get interface endpoints of %s: %s (%d)",
 		          usb_stack->base.name, usb_get_error_name(rc), rc);
 
-		goto cleanup;
+		goto error;
 	}
 
 	log_debug("Got interface endpoints (in: 0x%02X, out: 0x%02X) for %s",
@@ -448,7 +642,9 @@ int usb_stack_create(USBStack *usb_stack, libusb_context *context, libusb_device
 				log_error("Could not reopen %s: %s (%d)",
 				          usb_stack->base.name, usb_get_error_name(rc), rc);
 
-				goto cleanup;
+				usb_stack->device_handle = NULL;
+
+				return -1;
 			}
 #endif
 
@@ -461,7 +657,7 @@ int usb_stack_create(USBStack *usb_stack, libusb_context *context, libusb_device
 			log_error("Could not claim interface of %s after %d retry(s): %s (%d)",
 			          usb_stack->base.name, retries, usb_get_error_name(rc), rc);
 
-			goto cleanup;
+			goto error;
 		}
 
 		log_debug("Claimed interface %d of %s after %d retry(s)",
@@ -471,48 +667,41 @@ int usb_stack_create(USBStack *usb_stack, libusb_context *context, libusb_device
 		          usb_stack->interface_number, usb_stack->base.name);
 	}
 
-	phase = 4;
+	return 0;
 
-	// update stack name
-	if (usb_get_device_name(usb_stack->device_handle, usb_stack->base.name,
-	                        sizeof(usb_stack->base.name)) < 0) {
-		goto cleanup;
-	}
+error:
+	libusb_close(usb_stack->device_handle);
 
-	log_debug("Got display name for %s: %s",
-	          preliminary_name, usb_stack->base.name);
+	usb_stack->device_handle = NULL;
 
-	// create pending error timer
-	if (timer_create_(&usb_stack->pending_error_timer, usb_stack_handle_pending_error, usb_stack) < 0) {
-		log_error("Could not create pending error timer for %s: %s (%d)",
-		          usb_stack->base.name, get_errno_name(errno), errno);
+	return -1;
+}
 
-		goto cleanup;
+static void usb_stack_close(USBStack *usb_stack) {
+	if (usb_stack->device_handle == NULL) {
+		return;
 	}
 
-	phase = 5;
+	libusb_release_interface(usb_stack->device_handle, usb_stack->interface_number);
 
-	// allocate and submit read transfers
-	if (array_create(&usb_stack->read_transfers, MAX_READ_TRANSFERS,
-	                 sizeof(USBTransfer), true) < 0) {
-		log_error("Could not create read transfer array for %s: %s (%d)",
-		          usb_stack->base.name, get_errno_name(errno), errno);
+	libusb_close(usb_stack->device_handle);
 
-		goto cleanup;
-	}
+	usb_stack->device_handle = NULL;
+}
 
-	phase = 6;
+static int usb_stack_submit_read_transfers(USBStack *usb_stack) {
+	USBTransfer *usb_transfer;
 
 	log_debug("Submitting read transfers to %s", usb_stack->base.name);
 
-	for (i = 0; i < MAX_READ_TRANSFERS; ++i) {
+	while (usb_stack->read_transfers.count < MAX_READ_TRANSFERS) {
 		usb_transfer = array_append(&usb_stack->read_transfers);
 
 		if (usb_transfer == NULL) {
 			log_error("Could not append to read transfer array for %s: %s (%d)",
 			          usb_stack->base.name, get_errno_name(errno), errno);
 
-			goto cleanup;
+			return -1;
 		}
 
 		if (usb_transfer_create(usb_transfer, usb_stack, USB_TRANSFER_TYPE_READ,
@@ -520,50 +709,282 @@ int usb_stack_create(USBStack *usb_stack, libusb_context *context, libusb_device
 			array_remove(&usb_stack->read_transfers,
 			             usb_stack->read_transfers.count -1, NULL);
 
-			goto cleanup;
+			return -1;
 		}
 
 		if (usb_transfer_submit(usb_transfer) < 0) {
-			goto cleanup;
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static void usb_stack_cancel_transfers(USBStack *usb_stack) {
+	int i;
+	USBTransfer *usb_transfer;
+
+	for (i = 0; i < usb_stack->read_transfers.count; ++i) {
+		usb_transfer = array_get(&usb_stack->read_transfers, i);
+
+		if (usb_transfer->submitted && !usb_transfer->cancelled) {
+			usb_transfer_cancel(usb_transfer);
+		}
+	}
+
+	for (i = 0; i < usb_stack->write_transfers.count; ++i) {
+		usb_transfer = array_get(&usb_stack->write_transfers, i);
+
+		if (usb_transfer->submitted && !usb_transfer->cancelled) {
+			usb_transfer_cancel(usb_transfer);
 		}
 	}
+}
+
+// the second half of usb_stack_reopen. it runs as soon as all cancelled
+// transfers have finished and replaces the device handle and the transfers.
+// everything else stays in place: the stack with its recipients and routes
+// and the write ring with its queued requests, including the requests of the
+// cancelled write transfers
+static void usb_stack_finish_reopen(void *opaque) {
+	USBStack *usb_stack = opaque;
+	uint64_t now = millitime();
+	int i;
+	uint32_t dropped_writes;
+	int requeued_writes;
+
+	if (usb_stack->pending_transfers > 0 && now >= usb_stack->reopen_start &&
+	    usb_stack->reopen_start + PENDING_TRANSFERS_TIMEOUT >= now) {
+		return;
+	}
+
+	timer_configure(&usb_stack->reopen_timer, 0, 0);
+
+	if (usb_stack->pending_transfers > 0) {
+		log_warn("Could not cancel %d pending transfer(s) of %s for reopening",
+		         usb_stack->pending_transfers, usb_stack->base.name);
+
+		goto error;
+	}
+
+	// the requests of the cancelled write transfers are sent first after the
+	// device got reopened
+	dropped_writes = usb_stack->write_ring.dropped;
+	requeued_writes = write_ring_requeue(&usb_stack->write_ring);
+
+	if (usb_stack->write_ring.dropped != dropped_writes) {
+		log_warn("Could not requeue %u request(s) of cancelled write transfer(s) of %s, dropping them",
+		         usb_stack->write_ring.dropped - dropped_writes, usb_stack->base.name);
+	}
+
+	if (requeued_writes > 0) {
+		log_debug("Requeued %d request(s) of cancelled write transfer(s) of %s",
+		          requeued_writes, usb_stack->base.name);
+	}
+
+	// iterate backwards to avoid memmove in array_remove call
+	for (i = usb_stack->read_transfers.count - 1; i >= 0; --i) {
+		array_remove(&usb_stack->read_transfers, i, (ItemDestroyFunction)usb_transfer_destroy);
+	}
+
+	for (i = usb_stack->write_transfers.count - 1; i >= 0; --i) {
+		array_remove(&usb_stack->write_transfers, i, (ItemDestroyFunction)usb_transfer_destroy);
+	}
+
+	usb_stack_close(usb_stack);
+
+	if (usb_stack_open(usb_stack) < 0) {
+		goto error;
+	}
+
+	usb_stack->reopening = false;
+	usb_stack->expecting_removal = false;
+	usb_stack->peak_write_transfers = 0;
+
+	if (usb_stack_submit_read_transfers(usb_stack) < 0) {
+		goto error;
+	}
+
+	for (i = 0; i < usb_stack->min_write_transfers; ++i) {
+		if (usb_stack_add_write_transfer(usb_stack) == NULL) {
+			goto error;
+		}
+	}
+
+	++usb_stack->reopens;
+
+	log_info("Reopened %s, %d request(s) left in write queue",
+	         usb_stack->base.name, usb_stack->write_ring.queued);
+
+	usb_stack_send_queued_requests(usb_stack);
+
+	return;
+
+error:
+	log_warn("Could not reopen %s, removing it", usb_stack->base.name);
+
+	// drop all further requests until the USB stack got removed
+	usb_stack->reopening = false;
+	usb_stack->expecting_removal = true;
+
+	usb_discard_stack(usb_stack);
+}
+
+int usb_stack_create(USBStack *usb_stack, libusb_context *context, libusb_device *device, bool red_brick) {
+	int phase = 0;
+	char preliminary_name[STACK_MAX_NAME_LENGTH];
+	int i;
+
+	usb_stack->bus_number = libusb_get_bus_number(device);
+	usb_stack->device_address = libusb_get_device_address(device);
+	usb_stack->context = context;
+	usb_stack->device = libusb_ref_device(device);
+
+	log_debug("Acquiring USB device (bus: %u, device: %u)",
+	          usb_stack->bus_number, usb_stack->device_address);
+
+	phase = 1;
+
+	usb_stack->device_handle = NULL;
+	usb_stack->min_write_transfers = config_get_option_value("usb.min_write_transfers")->integer;
+	usb_stack->max_write_transfers = MAX(usb_stack->min_write_transfers,
+	                                     config_get_option_value("usb.max_write_transfers")->integer);
+	usb_stack->write_transfer_idle_timeout = (uint64_t)config_get_option_value("usb.write_transfer_idle_timeout")->integer * 1000;
+	usb_stack->pending_transfers = 0;
+	usb_stack->pending_write_transfers = 0;
+	usb_stack->peak_write_transfers = 0;
+	usb_stack->added_write_transfers = 0;
+	usb_stack->released_write_transfers = 0;
+	usb_stack->pending_error_recoveries = 0;
+	usb_stack->first_pending_error_recovery = 0;
+	usb_stack->reopen_start = 0;
+	usb_stack->reopens = 0;
+	usb_stack->connected = true;
+	usb_stack->red_brick = red_brick;
+	usb_stack->expecting_removal = false;
+	usb_stack->reopening = false;
+	usb_stack->discarded = false;
+
+	if (red_brick) {
+		usb_stack->interface_number = USB_RED_BRICK_INTERFACE;
+		usb_stack->expecting_short_Ax_response = true;
+#ifdef _WIN32
+		usb_stack->expecting_read_stall_before_removal = true;
+#else
+		usb_stack->expecting_read_stall_before_removal = false;
+#endif
+	} else {
+		usb_stack->interface_number = USB_BRICK_INTERFACE;
+		usb_stack->expecting_short_Ax_response = false;
+		usb_stack->expecting_read_stall_before_removal = false;
+	}
+
+	// create stack base
+	snprintf(preliminary_name, sizeof(preliminary_name),
+	         "USB device (bus: %u, device: %u)",
+	         usb_stack->bus_number, usb_stack->device_address);
+
+	if (stack_create(&usb_stack->base, preliminary_name,
+	                 usb_stack_dispatch_request) < 0) {
+		log_error("Could not create base stack for %s: %s (%d)",
+		          preliminary_name, get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	usb_stack->base.collect_metrics = usb_stack_collect_metrics;
+
+	phase = 2;
+
+	// open device and claim its interface
+	if (usb_stack_open(usb_stack) < 0) {
+		goto cleanup;
+	}
+
+	phase = 3;
+
+	// update stack name
+	if (usb_get_device_name(usb_stack->device_handle, usb_stack->base.name,
+	                        sizeof(usb_stack->base.name)) < 0) {
+		goto cleanup;
+	}
+
+	log_debug("Got display name for %s: %s",
+	          preliminary_name, usb_stack->base.name);
 
-	// allocate write queue
-	if (queue_create(&usb_stack->write_queue, sizeof(Packet)) < 0) {
-		log_error("Could not create write queue for %s: %s (%d)",
+	// create pending error timer
+	if (event_timing_create_timer(&usb_stack->pending_error_timer, "usb-stack-pending-error",
+	                              usb_stack_handle_pending_error, usb_stack) < 0) {
+		log_error("Could not create pending error timer for %s: %s (%d)",
 		          usb_stack->base.name, get_errno_name(errno), errno);
 
 		goto cleanup;
 	}
 
-	phase = 7;
+	phase = 4;
+
+	// create write transfer idle timer
+	if (event_timing_create_timer(&usb_stack->write_transfer_idle_timer, "usb-stack-write-transfer-idle",
+	                              usb_stack_release_idle_write_transfers, usb_stack) < 0) {
+		log_error("Could not create write transfer idle timer for %s: %s (%d)",
+		          usb_stack->base.name, get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 5;
+
+	// create reopen timer
+	if (event_timing_create_timer(&usb_stack->reopen_timer, "usb-stack-reopen",
+	                              usb_stack_finish_reopen, usb_stack) < 0) {
+		log_error("Could not create reopen timer for %s: %s (%d)",
+		          usb_stack->base.name, get_errno_name(errno), errno);
 
-	// allocate write transfers
-	if (array_create(&usb_stack->write_transfers, MAX_WRITE_TRANSFERS,
+		goto cleanup;
+	}
+
+	phase = 6;
+
+	// allocate and submit read transfers
+	if (array_create(&usb_stack->read_transfers, MAX_READ_TRANSFERS,
 	                 sizeof(USBTransfer), true) < 0) {
-		log_error("Could not create write transfer array for %s: %s (%d)",
+		log_error("Could not create read transfer array for %s: %s (%d)",
 		          usb_stack->base.name, get_errno_name(errno), errno);
 
 		goto cleanup;
 	}
 
-	phase = 8;
+	phase = 7;
+
+	if (usb_stack_submit_read_transfers(usb_stack) < 0) {
+		goto cleanup;
+	}
 
-	for (i = 0; i < MAX_WRITE_TRANSFERS; ++i) {
-		usb_transfer = array_append(&usb_stack->write_transfers);
+	// allocate write ring
+	if (write_ring_create(&usb_stack->write_ring, WRITE_RING_INITIAL_SIZE,
+	                      WRITE_RING_MAX_SIZE, MAX_QUEUED_WRITES_PER_UID) < 0) {
+		log_error("Could not create write ring for %s: %s (%d)",
+		          usb_stack->base.name, get_errno_name(errno), errno);
 
-		if (usb_transfer == NULL) {
-			log_error("Could not append to write transfer array for %s: %s (%d)",
-			          usb_stack->base.name, get_errno_name(errno), errno);
+		goto cleanup;
+	}
 
-			goto cleanup;
-		}
+	phase = 8;
 
-		if (usb_transfer_create(usb_transfer, usb_stack, USB_TRANSFER_TYPE_WRITE,
-		                        usb_stack_write_callback) < 0) {
-			array_remove(&usb_stack->write_transfers,
-			             usb_stack->write_transfers.count -1, NULL);
+	// allocate write transfers, the array is created with room for the
+	// maximum number of write transfers to never reallocate it
+	if (array_create(&usb_stack->write_transfers, usb_stack->max_write_transfers,
+	                 sizeof(USBTransfer), true) < 0) {
+		log_error("Could not create write transfer array for %s: %s (%d)",
+		          usb_stack->base.name, get_errno_name(errno), errno);
 
+		goto cleanup;
+	}
+
+	phase = 9;
+
+	for (i = 0; i < usb_stack->min_write_transfers; ++i) {
+		if (usb_stack_add_write_transfer(usb_stack) == NULL) {
 			goto cleanup;
 		}
 	}
@@ -573,32 +994,36 @@ int usb_stack_create(USBStack *usb_stack, libusb_context *context, libusb_device
 		goto cleanup;
 	}
 
-	phase = 9;
+	phase = 10;
 
 cleanup:
 	switch (phase) { // no breaks, all cases fall through intentionally
-	case 8:
+	case 9:
 		array_destroy(&usb_stack->write_transfers, (ItemDestroyFunction)usb_transfer_destroy);
 		// fall through
 
+	case 8:
+		write_ring_destroy(&usb_stack->write_ring);
+		// fall through
+
 	case 7:
-		queue_destroy(&usb_stack->write_queue, NULL);
+		array_destroy(&usb_stack->read_transfers, (ItemDestroyFunction)usb_transfer_destroy);
 		// fall through
 
 	case 6:
-		array_destroy(&usb_stack->read_transfers, (ItemDestroyFunction)usb_transfer_destroy);
+		event_timing_destroy_timer(&usb_stack->reopen_timer);
 		// fall through
 
 	case 5:
-		timer_destroy(&usb_stack->pending_error_timer);
+		event_timing_destroy_timer(&usb_stack->write_transfer_idle_timer);
 		// fall through
 
 	case 4:
-		libusb_release_interface(usb_stack->device_handle, usb_stack->interface_number);
+		event_timing_destroy_timer(&usb_stack->pending_error_timer);
 		// fall through
 
 	case 3:
-		libusb_close(usb_stack->device_handle);
+		usb_stack_close(usb_stack);
 		// fall through
 
 	case 2:
@@ -613,12 +1038,10 @@ cleanup:
 		break;
 	}
 
-	return phase == 9 ? 0 : -1;
+	return phase == 10 ? 0 : -1;
 }
 
 void usb_stack_destroy(USBStack *usb_stack) {
-	int i;
-	USBTransfer *usb_transfer;
 	uint64_t now;
 	uint64_t start;
 	char name[STACK_MAX_NAME_LENGTH];
@@ -635,21 +1058,7 @@ void usb_stack_destroy(USBStack *usb_stack) {
 		log_debug("Cancelling %d pending transfer(s) before releasing %s",
 		          usb_stack->pending_transfers, usb_stack->base.name);
 
-		for (i = 0; i < usb_stack->read_transfers.count; ++i) {
-			usb_transfer = array_get(&usb_stack->read_transfers, i);
-
-			if (usb_transfer->submitted) {
-				usb_transfer_cancel(usb_transfer);
-			}
-		}
-
-		for (i = 0; i < usb_stack->write_transfers.count; ++i) {
-			usb_transfer = array_get(&usb_stack->write_transfers, i);
-
-			if (usb_transfer->submitted) {
-				usb_transfer_cancel(usb_transfer);
-			}
-		}
+		usb_stack_cancel_transfers(usb_stack);
 
 		// wait for transfer cancellations to finish
 		now = millitime();
@@ -677,13 +1086,19 @@ void usb_stack_destroy(USBStack *usb_stack) {
 	array_destroy(&usb_stack->read_transfers, (ItemDestroyFunction)usb_transfer_destroy);
 	array_destroy(&usb_stack->write_transfers, (ItemDestroyFunction)usb_transfer_destroy);
 
-	timer_destroy(&usb_stack->pending_error_timer);
+	event_timing_destroy_timer(&usb_stack->reopen_timer);
+	event_timing_destroy_timer(&usb_stack->write_transfer_idle_timer);
+	event_timing_destroy_timer(&usb_stack->pending_error_timer);
 
-	queue_destroy(&usb_stack->write_queue, NULL);
-
-	libusb_release_interface(usb_stack->device_handle, usb_stack->interface_number);
+	// abandoned write transfers might still be sent from the write ring
+	if (usb_stack->pending_write_transfers > 0) {
+		log_warn("Leaking write ring of %s, %d abandoned write transfer(s) are still using it",
+		         usb_stack->base.name, usb_stack->pending_write_transfers);
+	} else {
+		write_ring_destroy(&usb_stack->write_ring);
+	}
 
-	libusb_close(usb_stack->device_handle);
+	usb_stack_close(usb_stack);
 
 	string_copy(name, sizeof(name), usb_stack->base.name, -1);
 
@@ -695,6 +1110,57 @@ void usb_stack_destroy(USBStack *usb_stack) {
 	          usb_stack->bus_number, usb_stack->device_address, name);
 }
 
+// reopens the device in place without blocking the event loop. the transfers
+// are cancelled here and usb_stack_finish_reopen continues once they have
+// finished. meanwhile the USB stack stays registered, new requests for it are
+// kept in its write queue and sent after the device got reopened
+int usb_stack_reopen(USBStack *usb_stack) {
+	if (usb_stack->reopening) {
+		log_debug("%s is already being reopened", usb_stack->base.name);
+
+		return 0;
+	}
+
+	if (usb_stack->expecting_removal) {
+		log_warn("Cannot reopen %s that is about to be removed", usb_stack->base.name);
+
+		return -1;
+	}
+
+	log_info("Reopening %s, keeping %d request(s) in write queue",
+	         usb_stack->base.name, usb_stack->write_ring.queued);
+
+	usb_stack->reopening = true;
+	usb_stack->reopen_start = millitime();
+
+	// stops all transfer submissions
+	usb_stack->expecting_removal = true;
+
+	timer_configure(&usb_stack->pending_error_timer, 0, 0);
+	timer_configure(&usb_stack->write_transfer_idle_timer, 0, 0);
+
+	usb_stack_cancel_transfers(usb_stack);
+
+	if (timer_configure(&usb_stack->reopen_timer, PENDING_TRANSFERS_CHECK_INTERVAL * 1000,
+	                    PENDING_TRANSFERS_CHECK_INTERVAL * 1000) < 0) {
+		log_error("Could not start reopen timer for %s: %s (%d)",
+		          usb_stack->base.name, get_errno_name(errno), errno);
+
+		// without the timer the reopen would never finish, do it right away
+		usb_stack->reopen_start = 0;
+
+		usb_stack_finish_reopen(usb_stack);
+
+		return -1;
+	}
+
+	return 0;
+}
+
+void usb_stack_release_write(USBStack *usb_stack, Packet *request) {
+	write_ring_release(&usb_stack->write_ring, request);
+}
+
 void usb_stack_start_pending_error_timer(USBStack *usb_stack) {
 	if (timer_configure(&usb_stack->pending_error_timer, PENDING_ERROR_TIMER_DELAY, 0) < 0) {
 		log_error("Could not start pending error timer for %s: %s (%d)",
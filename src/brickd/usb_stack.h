@@ -27,14 +27,16 @@
 #include <stdbool.h>
 
 #include <daemonlib/array.h>
-#include <daemonlib/queue.h>
+#include <daemonlib/packet.h>
 #include <daemonlib/timer.h>
 
 #include "stack.h"
+#include "write_ring.h"
 
 typedef struct {
 	Stack base;
 
+	int index; // in the USB stack array of usb.c
 	uint8_t bus_number;
 	uint8_t device_address;
 	libusb_context *context;
@@ -44,21 +46,39 @@ typedef struct {
 	uint8_t endpoint_in;
 	uint8_t endpoint_out;
 	Timer pending_error_timer;
+	Timer write_transfer_idle_timer;
+	Timer reopen_timer;
 	Array read_transfers;
 	Array write_transfers;
+	int min_write_transfers;
+	int max_write_transfers;
+	uint64_t write_transfer_idle_timeout;
 	int pending_transfers;
-	Queue write_queue;
-	uint32_t dropped_writes;
+	int pending_write_transfers;
+	int peak_write_transfers; // since the last idle check
+	uint32_t added_write_transfers;
+	uint32_t released_write_transfers;
+	int pending_error_recoveries; // within the current window
+	uint64_t first_pending_error_recovery; // milliseconds
+	uint64_t reopen_start; // milliseconds
+	uint32_t reopens;
+	WriteRing write_ring;
 	bool connected;
 	bool red_brick;
 	bool expecting_short_Ax_response;
 	bool expecting_read_stall_before_removal;
 	bool expecting_removal;
+	bool reopening;
+	bool discarded; // could not be reopened, gets removed from the main loop
 } USBStack;
 
 int usb_stack_create(USBStack *usb_stack, libusb_context *context, libusb_device *device, bool red_brick);
 void usb_stack_destroy(USBStack *usb_stack);
 
+int usb_stack_reopen(USBStack *usb_stack);
+
+void usb_stack_release_write(USBStack *usb_stack, Packet *request);
+
 void usb_stack_start_pending_error_timer(USBStack *usb_stack);
 
 #endif // BRICKD_USB_STACK_H
@@ -86,6 +86,19 @@ void usb_transfer_finish(struct libusb_transfer *handle) {
 	usb_transfer->submitted = false;
 	--usb_transfer->usb_stack->pending_transfers;
 
+	if (usb_transfer->type == USB_TRANSFER_TYPE_WRITE) {
+		--usb_transfer->usb_stack->pending_write_transfers;
+
+		// the request of a write transfer that got cancelled for reopening
+		// the device stays in the write ring, it is sent again afterwards
+		if (handle->status != LIBUSB_TRANSFER_CANCELLED ||
+		    !usb_transfer->usb_stack->reopening) {
+			usb_stack_release_write(usb_transfer->usb_stack, usb_transfer->buffer);
+		}
+
+		usb_transfer->buffer = NULL;
+	}
+
 	if (handle->status == LIBUSB_TRANSFER_CANCELLED) {
 		log_debug("%s transfer %p (handle: %p, submission: %u) for %s was cancelled%s",
 		          usb_transfer_get_type_name(usb_transfer->type, true),
@@ -184,7 +197,9 @@ void usb_transfer_finish(struct libusb_transfer *handle) {
 	}
 }
 
-#if defined _WIN32 && !defined BRICKD_UWP_BUILD
+// usb_winapi.c and usb_posix.c handle USB events on their own thread, at least
+// optionally, and forward finished transfers to the main thread
+#if (defined _WIN32 && !defined BRICKD_UWP_BUILD) || (!defined _WIN32 && !defined __ANDROID__)
 
 extern void LIBUSB_CALL usb_transfer_callback(struct libusb_transfer *handle);
 
@@ -199,7 +214,7 @@ static void LIBUSB_CALL usb_transfer_callback(struct libusb_transfer *handle) {
 int usb_transfer_create(USBTransfer *usb_transfer, USBStack *usb_stack,
                         USBTransferType type, USBTransferFunction function) {
 	struct libusb_transfer *handle;
-	uint8_t *buffer;
+	uint8_t *buffer = NULL;
 
 	handle = libusb_alloc_transfer(0);
 
@@ -210,15 +225,19 @@ int usb_transfer_create(USBTransfer *usb_transfer, USBStack *usb_stack,
 		return -1;
 	}
 
-	buffer = malloc(MAX_BUFFER_LENGTH);
+	// write transfers don't own a buffer, they send the requests in-place from
+	// the write ring of their USB stack
+	if (type == USB_TRANSFER_TYPE_READ) {
+		buffer = malloc(MAX_BUFFER_LENGTH);
 
-	if (buffer == NULL) {
-		log_error("Could not allocate buffer for %s transfer for %s",
-		          usb_transfer_get_type_name(type, false), usb_stack->base.name);
+		if (buffer == NULL) {
+			log_error("Could not allocate buffer for %s transfer for %s",
+			          usb_transfer_get_type_name(type, false), usb_stack->base.name);
 
-		libusb_free_transfer(handle);
+			libusb_free_transfer(handle);
 
-		return -1;
+			return -1;
+		}
 	}
 
 	usb_transfer->usb_stack = usb_stack;
@@ -254,6 +273,13 @@ void usb_transfer_destroy(USBTransfer *usb_transfer) {
 		         usb_transfer->handle, usb_transfer->submission, usb_transfer->usb_stack->base.name);
 
 		usb_transfer->handle->user_data = NULL;
+
+		// the buffer of a write transfer belongs to the write ring, don't let
+		// the abandoned transfer free it
+		if (usb_transfer->type == USB_TRANSFER_TYPE_WRITE) {
+			usb_transfer->handle->buffer = NULL;
+		}
+
 		usb_transfer->handle = NULL;
 	}
 }
@@ -351,6 +377,14 @@ int usb_transfer_submit(USBTransfer *usb_transfer) {
 
 	++usb_transfer->usb_stack->pending_transfers;
 
+	if (usb_transfer->type == USB_TRANSFER_TYPE_WRITE) {
+		++usb_transfer->usb_stack->pending_write_transfers;
+
+		if (usb_transfer->usb_stack->pending_write_transfers > usb_transfer->usb_stack->peak_write_transfers) {
+			usb_transfer->usb_stack->peak_write_transfers = usb_transfer->usb_stack->pending_write_transfers;
+		}
+	}
+
 	log_packet_debug("Submitted %s transfer %p (handle: %p, submission: %u) for %u bytes to %s",
 	                 usb_transfer_get_type_name(usb_transfer->type, false),
 	                 usb_transfer, usb_transfer->handle, usb_transfer->submission,
@@ -28,6 +28,7 @@
 
 #include "usb.h"
 
+#include "event_timing.h"
 #include "usb_windows.h"
 
 // BEGIN: cfgmgr32.h
@@ -326,8 +327,8 @@ static void LIBUSB_CALL usb_add_pollfd(int fd, short events, void *opaque) {
 	log_event_debug("Got told to add libusb pollfd (handle: %d, events: %d)", fd, events);
 
 	// FIXME: handle error?
-	event_add_source(fd, EVENT_SOURCE_TYPE_USB, "usb-poll", events,
-	                 usb_handle_events_internal, context);
+	event_timing_add_source(fd, EVENT_SOURCE_TYPE_USB, "usb-poll", events,
+	                        usb_handle_events_internal, context);
 }
 
 static void LIBUSB_CALL usb_remove_pollfd(int fd, void *opaque) {
@@ -335,7 +336,7 @@ static void LIBUSB_CALL usb_remove_pollfd(int fd, void *opaque) {
 
 	log_event_debug("Got told to remove libusb pollfd (handle: %d)", fd);
 
-	event_remove_source(fd, EVENT_SOURCE_TYPE_USB);
+	event_timing_remove_source(fd, EVENT_SOURCE_TYPE_USB);
 }
 
 int usb_init_platform(libusb_context *context) {
@@ -375,8 +376,8 @@ int usb_init_platform(libusb_context *context) {
 	}
 
 	for (pollfd = pollfds; *pollfd != NULL; ++pollfd) {
-		if (event_add_source((*pollfd)->fd, EVENT_SOURCE_TYPE_USB, "usb-poll",
-		                     (*pollfd)->events, usb_handle_events_internal, context) < 0) {
+		if (event_timing_add_source((*pollfd)->fd, EVENT_SOURCE_TYPE_USB, "usb-poll",
+		                            (*pollfd)->events, usb_handle_events_internal, context) < 0) {
 			goto cleanup;
 		}
 
@@ -393,11 +394,11 @@ cleanup:
 	switch (phase) { // no breaks, all cases fall through intentionally
 	case 2:
 		for (pollfd = pollfds; pollfd != last_added_pollfd; ++pollfd) {
-			event_remove_source((*pollfd)->fd, EVENT_SOURCE_TYPE_USB);
+			event_timing_remove_source((*pollfd)->fd, EVENT_SOURCE_TYPE_USB);
 		}
 
 		if (last_added_pollfd != NULL) {
-			event_remove_source((*last_added_pollfd)->fd, EVENT_SOURCE_TYPE_USB);
+			event_timing_remove_source((*last_added_pollfd)->fd, EVENT_SOURCE_TYPE_USB);
 		}
 
 		// fall through
@@ -428,7 +429,7 @@ void usb_exit_platform(libusb_context *context) {
 		log_error("Could not get pollfds from libusb context");
 	} else {
 		for (pollfd = pollfds; *pollfd != NULL; ++pollfd) {
-			event_remove_source((*pollfd)->fd, EVENT_SOURCE_TYPE_USB);
+			event_timing_remove_source((*pollfd)->fd, EVENT_SOURCE_TYPE_USB);
 		}
 
 		libusb_free_pollfds(pollfds);
@@ -39,6 +39,8 @@
 #include <daemonlib/threads.h>
 
 #include "usb.h"
+
+#include "event_timing.h"
 #include "usb_transfer.h"
 
 #include "service.h"
@@ -350,8 +352,8 @@ int usb_init_platform(libusb_context *context) {
 
 	phase = 1;
 
-	if (event_add_source(_transfer_pipe.base.read_handle, EVENT_SOURCE_TYPE_GENERIC,
-	                     "usb-transfer", EVENT_READ, usb_forward_transfer, NULL) < 0) {
+	if (event_timing_add_source(_transfer_pipe.base.read_handle, EVENT_SOURCE_TYPE_GENERIC,
+	                            "usb-transfer", EVENT_READ, usb_forward_transfer, NULL) < 0) {
 		goto cleanup;
 	}
 
@@ -412,7 +414,7 @@ cleanup:
 		// fall through
 
 	case 2:
-		event_remove_source(_transfer_pipe.base.read_handle, EVENT_SOURCE_TYPE_GENERIC);
+		event_timing_remove_source(_transfer_pipe.base.read_handle, EVENT_SOURCE_TYPE_GENERIC);
 		// fall through
 
 	case 1:
@@ -441,7 +443,7 @@ void usb_exit_platform(libusb_context *context) {
 		usb_stop_message_pump();
 	}
 
-	event_remove_source(_transfer_pipe.base.read_handle, EVENT_SOURCE_TYPE_GENERIC);
+	event_timing_remove_source(_transfer_pipe.base.read_handle, EVENT_SOURCE_TYPE_GENERIC);
 	pipe_destroy(&_transfer_pipe);
 }
 
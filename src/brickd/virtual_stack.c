@@ -0,0 +1,392 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * virtual_stack.c: Stack of emulated devices for hardware-free benchmarking
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * the virtual stack answers requests in-process, so the whole path from the
+ * client over the network and hardware subsystems to a stack and back can be
+ * load-tested without any hardware. it is only created if the
+ * virtual_stack.device_count option is not 0.
+ *
+ * the virtual devices pretend to be Master Bricks with consecutive UIDs
+ * starting at VIRTUAL_STACK_FIRST_UID. they don't know the actual API of the
+ * Master Brick. a request without payload is treated as getter and answered
+ * with a payload that holds a per-device counter, a request with payload is
+ * treated as setter and answered with an empty response, if a response is
+ * expected at all. the get-identity and enumerate functions are implemented
+ * properly, so the API bindings can discover the virtual devices.
+ *
+ * all responses are served one after another with the configured service
+ * time, like requests on a single USB connection. additionally, each device
+ * can send a USB-voltage callback with the configured callback period.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <daemonlib/base58.h>
+#include <daemonlib/config.h>
+#include <daemonlib/log.h>
+#include <daemonlib/timer.h>
+#include <daemonlib/utils.h>
+
+#include "virtual_stack.h"
+
+#include "delayed_response.h"
+#include "event_timing.h"
+#include "hardware.h"
+#include "stack.h"
+
+static LogSource _log_source = LOG_SOURCE_INITIALIZER;
+
+#define MASTER_BRICK_DEVICE_IDENTIFIER 13
+#define MASTER_CALLBACK_USB_VOLTAGE 61
+
+#define GETTER_PAYLOAD_LENGTH 8 // enough for the return values of most getters
+
+#include <daemonlib/packed_begin.h>
+
+typedef struct {
+	PacketHeader header;
+	char uid[8];
+	char connected_uid[8];
+	char position;
+	uint8_t hardware_version[3];
+	uint8_t firmware_version[3];
+	uint16_t device_identifier;
+} ATTRIBUTE_PACKED GetIdentityResponse;
+
+typedef struct {
+	PacketHeader header;
+	uint32_t value;
+	uint8_t padding[GETTER_PAYLOAD_LENGTH - sizeof(uint32_t)];
+} ATTRIBUTE_PACKED GetterResponse;
+
+typedef struct {
+	PacketHeader header;
+	uint16_t voltage;
+} ATTRIBUTE_PACKED USBVoltageCallback;
+
+#include <daemonlib/packed_end.h>
+
+typedef struct {
+	uint32_t uid; // always little endian
+	uint32_t value; // incremented for each getter response and callback
+} VirtualDevice;
+
+typedef struct {
+	Stack base;
+
+	VirtualDevice *devices;
+	int device_count;
+	uint64_t service_time; // in microseconds
+	DelayedResponseQueue response_queue;
+	Timer callback_timer;
+} VirtualStack;
+
+static VirtualStack _virtual_stack;
+
+// sends the response after the service time of all responses before it and
+// its own service time have passed
+static void virtual_stack_respond(Packet *response) {
+	if (_virtual_stack.service_time == 0) {
+		delayed_response_send(&_virtual_stack.base, response);
+
+		return;
+	}
+
+	delayed_response_queue_push(&_virtual_stack.response_queue, response,
+	                            0, _virtual_stack.service_time);
+}
+
+static void virtual_stack_prepare_enumerate_callback(EnumerateCallback *enumerate_callback,
+                                                     VirtualDevice *device,
+                                                     EnumerationType type) {
+	memset(enumerate_callback, 0, sizeof(*enumerate_callback));
+
+	enumerate_callback->header.uid = device->uid;
+	enumerate_callback->header.length = sizeof(*enumerate_callback);
+	enumerate_callback->header.function_id = CALLBACK_ENUMERATE;
+	packet_header_set_sequence_number(&enumerate_callback->header, 0);
+	packet_header_set_response_expected(&enumerate_callback->header, true);
+
+	base58_encode(enumerate_callback->uid, uint32_from_le(device->uid));
+	enumerate_callback->connected_uid[0] = '0';
+	enumerate_callback->position = '0';
+	enumerate_callback->hardware_version[0] = 1;
+	enumerate_callback->hardware_version[1] = 0;
+	enumerate_callback->hardware_version[2] = 0;
+	enumerate_callback->firmware_version[0] = 2;
+	enumerate_callback->firmware_version[1] = 0;
+	enumerate_callback->firmware_version[2] = 0;
+	enumerate_callback->device_identifier = uint16_to_le(MASTER_BRICK_DEVICE_IDENTIFIER);
+	enumerate_callback->enumeration_type = type;
+}
+
+static void virtual_stack_enumerate(EnumerationType type) {
+	int i;
+	union {
+		EnumerateCallback enumerate_callback;
+		Packet packet;
+	} u;
+
+	for (i = 0; i < _virtual_stack.device_count; ++i) {
+		virtual_stack_prepare_enumerate_callback(&u.enumerate_callback,
+		                                         &_virtual_stack.devices[i], type);
+
+		if (type == ENUMERATION_TYPE_AVAILABLE) {
+			virtual_stack_respond(&u.packet);
+		} else {
+			delayed_response_send(&_virtual_stack.base, &u.packet);
+		}
+	}
+}
+
+static int virtual_stack_dispatch_request(Stack *stack, Packet *request,
+                                          Recipient *recipient) {
+	VirtualDevice *device;
+	union {
+		GetIdentityResponse get_identity_response;
+		GetterResponse getter_response;
+		Packet packet;
+	} u;
+
+	(void)stack;
+
+	if (request->header.function_id == FUNCTION_ENUMERATE) {
+		log_packet_debug("Received enumerate request, sending enumerate-available callback(s) for %d virtual device(s)",
+		                 _virtual_stack.device_count);
+
+		virtual_stack_enumerate(ENUMERATION_TYPE_AVAILABLE);
+
+		return 0;
+	}
+
+	if (recipient == NULL) {
+		// broadcast or request for an unknown UID
+		return 0;
+	}
+
+	if (!packet_header_get_response_expected(&request->header)) {
+		return 0;
+	}
+
+	device = &_virtual_stack.devices[recipient->opaque];
+
+	memset(&u.packet, 0, sizeof(u.packet));
+
+	u.packet.header = request->header;
+
+	if (request->header.function_id == FUNCTION_GET_IDENTITY) {
+		u.get_identity_response.header.length = sizeof(u.get_identity_response);
+
+		base58_encode(u.get_identity_response.uid, uint32_from_le(device->uid));
+		u.get_identity_response.connected_uid[0] = '0';
+		u.get_identity_response.position = '0';
+		u.get_identity_response.hardware_version[0] = 1;
+		u.get_identity_response.firmware_version[0] = 2;
+		u.get_identity_response.device_identifier = uint16_to_le(MASTER_BRICK_DEVICE_IDENTIFIER);
+	} else if (request->header.length == sizeof(PacketHeader)) {
+		u.getter_response.header.length = sizeof(u.getter_response);
+		u.getter_response.value = uint32_to_le(device->value++);
+	} else {
+		u.packet.header.length = sizeof(PacketHeader);
+	}
+
+	virtual_stack_respond(&u.packet);
+
+	return 0;
+}
+
+static void virtual_stack_handle_callback(void *opaque) {
+	int i;
+	VirtualDevice *device;
+	union {
+		USBVoltageCallback callback;
+		Packet packet;
+	} u;
+
+	(void)opaque;
+
+	memset(&u.packet, 0, sizeof(u.packet));
+
+	u.callback.header.length = sizeof(u.callback);
+	u.callback.header.function_id = MASTER_CALLBACK_USB_VOLTAGE;
+	packet_header_set_sequence_number(&u.callback.header, 0);
+	packet_header_set_response_expected(&u.callback.header, true);
+
+	for (i = 0; i < _virtual_stack.device_count; ++i) {
+		device = &_virtual_stack.devices[i];
+
+		u.callback.header.uid = device->uid;
+		u.callback.voltage = uint16_to_le((uint16_t)device->value++);
+
+		delayed_response_send(&_virtual_stack.base, &u.packet);
+	}
+}
+
+static void virtual_stack_collect_metrics(Stack *stack, Metrics *metrics) {
+	(void)stack;
+
+	delayed_response_queue_collect_metrics(&_virtual_stack.response_queue, metrics);
+}
+
+int virtual_stack_init(void) {
+	int phase = 0;
+	int device_count = config_get_option_value("virtual_stack.device_count")->integer;
+	int callback_period = config_get_option_value("virtual_stack.callback_period")->integer;
+	int i;
+	char base58[BASE58_MAX_LENGTH];
+
+	if (device_count == 0) {
+		return 0;
+	}
+
+	log_info("Initializing virtual stack with %d device(s), first UID %s",
+	         device_count, base58_encode(base58, VIRTUAL_STACK_FIRST_UID));
+
+	_virtual_stack.device_count = device_count;
+	_virtual_stack.service_time = config_get_option_value("virtual_stack.service_time")->integer;
+
+	// create base stack
+	if (stack_create(&_virtual_stack.base, "virtual", virtual_stack_dispatch_request) < 0) {
+		log_error("Could not create base stack for virtual stack: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	_virtual_stack.base.collect_metrics = virtual_stack_collect_metrics;
+
+	phase = 1;
+
+	_virtual_stack.devices = calloc(device_count, sizeof(VirtualDevice));
+
+	if (_virtual_stack.devices == NULL) {
+		log_error("Could not allocate %d virtual device(s): %s (%d)",
+		          device_count, get_errno_name(ENOMEM), ENOMEM);
+
+		goto cleanup;
+	}
+
+	phase = 2;
+
+	// create response queue
+	if (delayed_response_queue_create(&_virtual_stack.response_queue, &_virtual_stack.base,
+	                                  "virtual-stack-service") < 0) {
+		goto cleanup;
+	}
+
+	phase = 3;
+
+	// create callback timer
+	if (event_timing_create_timer(&_virtual_stack.callback_timer, "virtual-stack-callback",
+	                              virtual_stack_handle_callback, NULL) < 0) {
+		log_error("Could not create callback timer for virtual stack: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 4;
+
+	for (i = 0; i < device_count; ++i) {
+		_virtual_stack.devices[i].uid = uint32_to_le(VIRTUAL_STACK_FIRST_UID + i);
+
+		if (stack_add_recipient(&_virtual_stack.base, _virtual_stack.devices[i].uid, i) < 0) {
+			goto cleanup;
+		}
+	}
+
+	// add to stacks array
+	if (hardware_add_stack(&_virtual_stack.base) < 0) {
+		goto cleanup;
+	}
+
+	phase = 5;
+
+	if (callback_period > 0 &&
+	    timer_configure(&_virtual_stack.callback_timer, callback_period, callback_period) < 0) {
+		log_error("Could not start callback timer for virtual stack: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	// like real devices after power-on
+	virtual_stack_enumerate(ENUMERATION_TYPE_CONNECTED);
+
+	phase = 6;
+
+cleanup:
+	switch (phase) { // no breaks, all cases fall through intentionally
+	case 5:
+		hardware_remove_stack(&_virtual_stack.base);
+		// fall through
+
+	case 4:
+		event_timing_destroy_timer(&_virtual_stack.callback_timer);
+		// fall through
+
+	case 3:
+		delayed_response_queue_destroy(&_virtual_stack.response_queue);
+		// fall through
+
+	case 2:
+		free(_virtual_stack.devices);
+		// fall through
+
+	case 1:
+		stack_destroy(&_virtual_stack.base);
+		// fall through
+
+	default:
+		break;
+	}
+
+	if (phase != 6) {
+		_virtual_stack.device_count = 0;
+
+		return -1;
+	}
+
+	return 0;
+}
+
+void virtual_stack_exit(void) {
+	if (_virtual_stack.device_count == 0) {
+		return;
+	}
+
+	log_debug("Shutting down virtual stack");
+
+	hardware_remove_stack(&_virtual_stack.base);
+
+	event_timing_destroy_timer(&_virtual_stack.callback_timer);
+
+	delayed_response_queue_destroy(&_virtual_stack.response_queue);
+
+	free(_virtual_stack.devices);
+
+	stack_destroy(&_virtual_stack.base);
+
+	_virtual_stack.device_count = 0;
+}
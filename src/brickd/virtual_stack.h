@@ -0,0 +1,31 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * virtual_stack.h: Stack of emulated devices for hardware-free benchmarking
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef BRICKD_VIRTUAL_STACK_H
+#define BRICKD_VIRTUAL_STACK_H
+
+#define VIRTUAL_STACK_FIRST_UID 0x10000000 // UID of the first virtual device
+#define VIRTUAL_STACK_MAX_DEVICE_COUNT 4096
+
+int virtual_stack_init(void);
+void virtual_stack_exit(void);
+
+#endif // BRICKD_VIRTUAL_STACK_H
@@ -50,7 +50,10 @@ static void websocket_free_queued_data(void *item) {
 	free(queued_data->buffer);
 }
 
-static int websocket_send_frame(Websocket *websocket, const void *buffer, int length) {
+// sends the frame for the given payload, starting at the given offset into
+// the frame. returns the number of frame bytes that were sent
+static int websocket_send_frame_from(Websocket *websocket, const void *buffer,
+                                     int length, int offset) {
 	WebsocketFrameWithPayload frame;
 
 	if (length > WEBSOCKET_MAX_UNEXTENDED_PAYLOAD_DATA_LENGTH) {
@@ -70,7 +73,12 @@ static int websocket_send_frame(Websocket *websocket, const void *buffer, int le
 	websocket_frame_set_payload_length(&frame.header, length);
 	memcpy(frame.payload_data, buffer, length);
 
-	return socket_send_platform((Socket *)websocket, &frame, sizeof(WebsocketFrameHeader) + length);
+	return socket_send_platform((Socket *)websocket, (uint8_t *)&frame + offset,
+	                            websocket_get_frame_length(length) - offset);
+}
+
+static int websocket_send_frame(Websocket *websocket, const void *buffer, int length) {
+	return websocket_send_frame_from(websocket, buffer, length, 0);
 }
 
 static void websocket_send_queued_data(Websocket *websocket) {
@@ -85,6 +93,10 @@ static void websocket_send_queued_data(Websocket *websocket) {
 	}
 }
 
+int websocket_get_frame_length(int payload_length) {
+	return (int)sizeof(WebsocketFrameHeader) + payload_length;
+}
+
 int websocket_frame_get_opcode(WebsocketFrameHeader *header) {
 	return header->opcode_rsv_fin & 0xF;
 }
@@ -489,3 +501,23 @@ int websocket_send(Socket *socket, const void *buffer, int length) {
 
 	return length;
 }
+
+// like websocket_send, but returns the number of frame bytes that were sent
+// instead. a partially sent frame is continued by passing the number of its
+// bytes that are already sent as offset, it is complete once the offset
+// reaches websocket_get_frame_length. before the initial handshake is finished
+// the whole frame is queued. sets errno on error
+int websocket_send_partial(Socket *socket, const void *buffer, int length, int offset) {
+	Websocket *websocket = (Websocket *)socket;
+
+	if (websocket->state == WEBSOCKET_STATE_HANDSHAKE_DONE ||
+	    websocket->state == WEBSOCKET_STATE_HEADER_DONE) {
+		return websocket_send_frame_from(websocket, buffer, length, offset);
+	}
+
+	if (websocket_send(socket, buffer, length) < 0) {
+		return -1;
+	}
+
+	return websocket_get_frame_length(length);
+}
@@ -110,6 +110,8 @@ typedef struct {
 	Queue send_queue;
 } Websocket;
 
+int websocket_get_frame_length(int payload_length);
+
 int websocket_frame_get_opcode(WebsocketFrameHeader *header);
 void websocket_frame_set_opcode(WebsocketFrameHeader *header, int opcode);
 int websocket_frame_get_fin(WebsocketFrameHeader *header);
@@ -132,5 +134,6 @@ Socket *websocket_create_allocated(void);
 void websocket_destroy(Socket *socket);
 int websocket_receive(Socket *socket, void *buffer, int length);
 int websocket_send(Socket *socket, const void *buffer, int length);
+int websocket_send_partial(Socket *socket, const void *buffer, int length, int offset);
 
 #endif // BRICKD_WEBSOCKET_H
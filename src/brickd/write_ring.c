@@ -0,0 +1,533 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * write_ring.c: Ring of variable length requests that are sent in-place
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * a write ring stores requests back-to-back, each one only takes a state byte
+ * and a link plus its header.length bytes. a request is copied into the ring
+ * once and is then handed to the USB write transfer directly from there. the
+ * tail only moves over released entries, so an entry stays in place until its
+ * write transfer has finished, even if write transfers finish out of order.
+ *
+ * head and tail are free running counters. an entry is always stored
+ * contiguously. if it does not fit between the head and the end of the
+ * buffer then the rest of the buffer is marked with a skip state and the
+ * entry starts at the beginning of the buffer.
+ *
+ * the buffer is allocated with sizeof(Packet) bytes of slack at its end, so
+ * a request at the end of the buffer can be accessed as a whole Packet
+ * without reading past the allocation.
+ *
+ * the buffer starts small and its size is doubled, up to the maximum size,
+ * whenever a request does not fit anymore. the entries cannot be moved,
+ * because the flows and the write transfers point to them. instead, the old
+ * buffer is retired with its entries in place and freed as soon as all of
+ * them are released. new requests go to the new buffer right away. there is
+ * at most one retired buffer, the ring does not grow again before it is
+ * freed.
+ *
+ * queued entries are linked into one flow per UID. the flows are served with
+ * deficit round-robin scheduling: the current flow sends requests as long as
+ * their length is covered by its deficit, then the next flow gets another
+ * quantum added to its deficit. the quantum is the maximum request length,
+ * so every flow sends at least one request per round. a UID that floods the
+ * ring only delays its own requests. if its flow reaches the maximum number
+ * of queued requests then its oldest queued request is dropped to make room.
+ * the bytes of dropped requests are reclaimed as soon as the tail reaches
+ * them. only if the ring is full nonetheless the new request is dropped.
+ *
+ * flows only exist as long as they have queued requests. there are as many
+ * flows as UIDs with queued requests, typically a few, so the flows are
+ * looked up by a linear search.
+ */
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <daemonlib/utils.h>
+
+#include "write_ring.h"
+
+static uint32_t write_ring_get_entry_size(WriteRingEntry *entry) {
+	return offsetof(WriteRingEntry, packet) + entry->packet.header.length;
+}
+
+// returns the entry at the given counter, after moving the counter over a
+// skip state at the end of the buffer
+static WriteRingEntry *write_ring_get_entry(uint8_t *buffer, uint32_t size, uint32_t *counter) {
+	WriteRingEntry *entry = (WriteRingEntry *)(buffer + (*counter & (size - 1)));
+
+	if (entry->state == WRITE_RING_ENTRY_SKIP) {
+		*counter += size - (*counter & (size - 1));
+
+		entry = (WriteRingEntry *)buffer;
+	}
+
+	return entry;
+}
+
+// moves the tail over all released entries of the given buffer
+static void write_ring_advance_buffer_tail(uint8_t *buffer, uint32_t size,
+                                          uint32_t head, uint32_t *tail) {
+	WriteRingEntry *entry;
+
+	while (*tail != head) {
+		entry = write_ring_get_entry(buffer, size, tail);
+
+		if (entry->state != WRITE_RING_ENTRY_RELEASED) {
+			break;
+		}
+
+		*tail += write_ring_get_entry_size(entry);
+	}
+}
+
+// moves the tails over all released entries and frees the retired buffer
+// once all of its entries are released
+static void write_ring_advance_tail(WriteRing *ring) {
+	write_ring_advance_buffer_tail(ring->buffer, ring->size, ring->head, &ring->tail);
+
+	if (ring->retired_buffer == NULL) {
+		return;
+	}
+
+	write_ring_advance_buffer_tail(ring->retired_buffer, ring->retired_size,
+	                               ring->retired_head, &ring->retired_tail);
+
+	if (ring->retired_tail == ring->retired_head) {
+		free(ring->retired_buffer);
+
+		ring->retired_buffer = NULL;
+	}
+}
+
+// doubles the size of the buffer. the current buffer is retired if it still
+// has unreleased entries, otherwise it is freed right away
+static int write_ring_grow(WriteRing *ring) {
+	uint8_t *buffer;
+
+	if (ring->size >= ring->max_size || ring->retired_buffer != NULL) {
+		return -1;
+	}
+
+	buffer = malloc(ring->size * 2 + sizeof(Packet));
+
+	if (buffer == NULL) {
+		return -1;
+	}
+
+	if (ring->head != ring->tail) {
+		ring->retired_buffer = ring->buffer;
+		ring->retired_size = ring->size;
+		ring->retired_head = ring->head;
+		ring->retired_tail = ring->tail;
+	} else {
+		free(ring->buffer);
+	}
+
+	ring->buffer = buffer;
+	ring->size *= 2;
+	ring->head = 0;
+	ring->tail = 0;
+
+	return 0;
+}
+
+static int write_ring_find_flow(WriteRing *ring, uint32_t uid) {
+	int i;
+
+	for (i = 0; i < ring->flows.count; ++i) {
+		if (((WriteRingFlow *)array_get(&ring->flows, i))->uid == uid) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+// removes a flow without queued entries. if it was the current flow then the
+// next flow becomes the current one and gets its quantum
+static void write_ring_remove_flow(WriteRing *ring, int index) {
+	WriteRingFlow *flow;
+
+	array_remove(&ring->flows, index, NULL);
+
+	if (ring->flows.count == 0) {
+		ring->current_flow = 0;
+	} else if (index < ring->current_flow) {
+		--ring->current_flow;
+	} else if (index == ring->current_flow) {
+		if (ring->current_flow >= ring->flows.count) {
+			ring->current_flow = 0;
+		}
+
+		flow = array_get(&ring->flows, ring->current_flow);
+		flow->deficit += WRITE_RING_QUANTUM;
+	}
+}
+
+static void write_ring_count_drop(WriteRing *ring, uint32_t uid) {
+	int i;
+	WriteRingDrops *drops;
+
+	++ring->dropped;
+
+	for (i = 0; i < ring->drops.count; ++i) {
+		drops = array_get(&ring->drops, i);
+
+		if (drops->uid == uid) {
+			++drops->count;
+
+			return;
+		}
+	}
+
+	// only the total is counted for all further UIDs
+	if (ring->drops.count >= WRITE_RING_MAX_DROP_UIDS) {
+		return;
+	}
+
+	drops = array_append(&ring->drops);
+
+	if (drops == NULL) {
+		return;
+	}
+
+	drops->uid = uid;
+	drops->count = 1;
+}
+
+static void write_ring_drop_oldest(WriteRing *ring, int index) {
+	WriteRingFlow *flow = array_get(&ring->flows, index);
+	WriteRingEntry *entry = flow->first;
+
+	entry->state = WRITE_RING_ENTRY_RELEASED;
+
+	flow->first = entry->next;
+	--flow->queued;
+	--ring->queued;
+
+	write_ring_count_drop(ring, flow->uid);
+
+	if (flow->queued == 0) {
+		write_ring_remove_flow(ring, index);
+	}
+
+	write_ring_advance_tail(ring);
+}
+
+// creates a ring with a buffer of the given initial size that grows up to the
+// given maximum size. both sizes have to be powers of two
+int write_ring_create(WriteRing *ring, uint32_t size, uint32_t max_size,
+                      int max_queued_per_flow) {
+	if (size < sizeof(WriteRingEntry) || (size & (size - 1)) != 0 ||
+	    max_size < size || (max_size & (max_size - 1)) != 0 || max_queued_per_flow < 1) {
+		errno = EINVAL;
+
+		return -1;
+	}
+
+	ring->buffer = malloc(size + sizeof(Packet));
+
+	if (ring->buffer == NULL) {
+		errno = ENOMEM;
+
+		return -1;
+	}
+
+	if (array_create(&ring->flows, 16, sizeof(WriteRingFlow), true) < 0) {
+		free(ring->buffer);
+
+		return -1;
+	}
+
+	if (array_create(&ring->drops, 16, sizeof(WriteRingDrops), true) < 0) {
+		array_destroy(&ring->flows, NULL);
+		free(ring->buffer);
+
+		return -1;
+	}
+
+	ring->size = size;
+	ring->max_size = max_size;
+	ring->head = 0;
+	ring->tail = 0;
+	ring->retired_buffer = NULL;
+	ring->retired_size = 0;
+	ring->retired_head = 0;
+	ring->retired_tail = 0;
+	ring->queued = 0;
+	ring->max_queued_per_flow = max_queued_per_flow;
+	ring->current_flow = 0;
+	ring->dropped = 0;
+
+	return 0;
+}
+
+void write_ring_destroy(WriteRing *ring) {
+	array_destroy(&ring->drops, NULL);
+	array_destroy(&ring->flows, NULL);
+
+	free(ring->retired_buffer);
+	free(ring->buffer);
+}
+
+// copies the request into the flow of its UID and returns the queued copy, or
+// NULL if the request had to be dropped
+Packet *write_ring_push(WriteRing *ring, Packet *request) {
+	uint32_t entry_size = offsetof(WriteRingEntry, packet) + request->header.length;
+	uint32_t position;
+	uint32_t contiguous;
+	uint32_t required = entry_size;
+	int index = write_ring_find_flow(ring, request->header.uid);
+	WriteRingFlow *flow;
+	WriteRingEntry *entry;
+
+	if (index >= 0 &&
+	    ((WriteRingFlow *)array_get(&ring->flows, index))->queued >= ring->max_queued_per_flow) {
+		write_ring_drop_oldest(ring, index);
+
+		// the flow is gone if this was its only queued entry
+		index = write_ring_find_flow(ring, request->header.uid);
+	}
+
+	// start over at the beginning of the buffer whenever the ring is empty.
+	// this keeps the entries in the part of the buffer that is already in use
+	if (ring->head == ring->tail) {
+		ring->head = 0;
+		ring->tail = 0;
+	}
+
+	position = ring->head & (ring->size - 1);
+	contiguous = ring->size - position;
+
+	if (contiguous < entry_size) {
+		required += contiguous;
+	}
+
+	if (ring->size - (ring->head - ring->tail) < required) {
+		if (write_ring_grow(ring) < 0) {
+			write_ring_count_drop(ring, request->header.uid);
+
+			return NULL;
+		}
+
+		// the new buffer is empty, the entry always fits at its beginning
+		position = 0;
+		contiguous = ring->size;
+		required = entry_size;
+	}
+
+	if (index >= 0) {
+		flow = array_get(&ring->flows, index);
+	} else {
+		flow = array_append(&ring->flows);
+
+		if (flow == NULL) {
+			write_ring_count_drop(ring, request->header.uid);
+
+			return NULL;
+		}
+
+		flow->uid = request->header.uid;
+		flow->first = NULL;
+		flow->last = NULL;
+		flow->requeued = NULL;
+		flow->queued = 0;
+		flow->deficit = 0;
+	}
+
+	if (contiguous < entry_size) {
+		ring->buffer[position] = WRITE_RING_ENTRY_SKIP;
+
+		position = 0;
+	}
+
+	entry = (WriteRingEntry *)(ring->buffer + position);
+	entry->state = WRITE_RING_ENTRY_QUEUED;
+	entry->next = NULL;
+
+	memcpy(&entry->packet, request, request->header.length);
+
+	if (flow->last != NULL) {
+		flow->last->next = entry;
+	} else {
+		flow->first = entry;
+	}
+
+	flow->last = entry;
+	++flow->queued;
+
+	ring->head += required;
+	++ring->queued;
+
+	return &entry->packet;
+}
+
+// returns the next queued request in round-robin order or NULL if no request
+// is queued
+Packet *write_ring_peek(WriteRing *ring) {
+	WriteRingFlow *flow;
+
+	if (ring->queued == 0) {
+		return NULL;
+	}
+
+	while (true) {
+		flow = array_get(&ring->flows, ring->current_flow);
+
+		if (flow->first->packet.header.length <= flow->deficit) {
+			return &flow->first->packet;
+		}
+
+		// the current flow used up its deficit, go to the next one
+		ring->current_flow = (ring->current_flow + 1) % ring->flows.count;
+
+		flow = array_get(&ring->flows, ring->current_flow);
+		flow->deficit += WRITE_RING_QUANTUM;
+	}
+}
+
+// marks the request returned by the last call of write_ring_peek as submitted.
+// it stays in the ring until it gets released
+void write_ring_pop(WriteRing *ring) {
+	WriteRingFlow *flow = array_get(&ring->flows, ring->current_flow);
+	WriteRingEntry *entry = flow->first;
+
+	entry->state = WRITE_RING_ENTRY_SUBMITTED;
+
+	flow->first = entry->next;
+	flow->deficit -= entry->packet.header.length;
+	--flow->queued;
+	--ring->queued;
+
+	if (flow->queued == 0) {
+		write_ring_remove_flow(ring, ring->current_flow);
+	}
+}
+
+// releases a submitted request. its bytes become available again as soon as
+// all older requests are released as well
+void write_ring_release(WriteRing *ring, Packet *request) {
+	containerof(request, WriteRingEntry, packet)->state = WRITE_RING_ENTRY_RELEASED;
+
+	write_ring_advance_tail(ring);
+}
+
+// puts the submitted entries of the given buffer back in front of the queued
+// entries of their flows, in the order they were pushed
+static int write_ring_requeue_buffer(WriteRing *ring, uint8_t *buffer, uint32_t size,
+                                     uint32_t head, uint32_t tail) {
+	WriteRingEntry *entry;
+	int index;
+	WriteRingFlow *flow;
+	int requeued = 0;
+
+	while (tail != head) {
+		entry = write_ring_get_entry(buffer, size, &tail);
+		tail += write_ring_get_entry_size(entry);
+
+		if (entry->state != WRITE_RING_ENTRY_SUBMITTED) {
+			continue;
+		}
+
+		index = write_ring_find_flow(ring, entry->packet.header.uid);
+
+		if (index >= 0) {
+			flow = array_get(&ring->flows, index);
+		} else {
+			flow = array_append(&ring->flows);
+
+			if (flow == NULL) {
+				entry->state = WRITE_RING_ENTRY_RELEASED;
+
+				write_ring_count_drop(ring, entry->packet.header.uid);
+
+				continue;
+			}
+
+			flow->uid = entry->packet.header.uid;
+			flow->first = NULL;
+			flow->last = NULL;
+			flow->requeued = NULL;
+			flow->queued = 0;
+			flow->deficit = 0;
+		}
+
+		if (flow->requeued == NULL) {
+			entry->next = flow->first;
+			flow->first = entry;
+		} else {
+			entry->next = flow->requeued->next;
+			flow->requeued->next = entry;
+		}
+
+		if (flow->last == flow->requeued) {
+			flow->last = entry;
+		}
+
+		flow->requeued = entry;
+		entry->state = WRITE_RING_ENTRY_QUEUED;
+
+		++flow->queued;
+		++ring->queued;
+		++requeued;
+	}
+
+	return requeued;
+}
+
+// puts all submitted requests that were not released back into the queue, to
+// send them again after their USB write transfers got cancelled. returns the
+// number of requeued requests, requests that cannot be requeued are dropped
+int write_ring_requeue(WriteRing *ring) {
+	int requeued = 0;
+	int i;
+
+	if (ring->retired_buffer != NULL) {
+		requeued += write_ring_requeue_buffer(ring, ring->retired_buffer, ring->retired_size,
+		                                      ring->retired_head, ring->retired_tail);
+	}
+
+	requeued += write_ring_requeue_buffer(ring, ring->buffer, ring->size,
+	                                      ring->head, ring->tail);
+
+	for (i = 0; i < ring->flows.count; ++i) {
+		((WriteRingFlow *)array_get(&ring->flows, i))->requeued = NULL;
+	}
+
+	write_ring_advance_tail(ring);
+
+	return requeued;
+}
+
+// returns the number of bytes in use, including skipped bytes and the bytes
+// in use of the retired buffer
+uint32_t write_ring_get_used(WriteRing *ring) {
+	uint32_t used = ring->head - ring->tail;
+
+	if (ring->retired_buffer != NULL) {
+		used += ring->retired_head - ring->retired_tail;
+	}
+
+	return used;
+}
@@ -0,0 +1,99 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * write_ring.h: Ring of variable length requests that are sent in-place
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef BRICKD_WRITE_RING_H
+#define BRICKD_WRITE_RING_H
+
+#include <stdint.h>
+
+#include <daemonlib/array.h>
+#include <daemonlib/packet.h>
+
+#define WRITE_RING_QUANTUM 80 // bytes, the maximum TFP packet length
+#define WRITE_RING_MAX_DROP_UIDS 256
+
+typedef enum {
+	WRITE_RING_ENTRY_QUEUED = 0,
+	WRITE_RING_ENTRY_SUBMITTED,
+	WRITE_RING_ENTRY_RELEASED,
+	WRITE_RING_ENTRY_SKIP
+} WriteRingEntryState;
+
+typedef struct _WriteRingEntry WriteRingEntry;
+
+#include <daemonlib/packed_begin.h>
+
+struct _WriteRingEntry {
+	uint8_t state;
+	WriteRingEntry *next; // next queued entry of the same flow
+	Packet packet; // only header.length bytes are stored
+} ATTRIBUTE_PACKED;
+
+#include <daemonlib/packed_end.h>
+
+typedef struct {
+	uint32_t uid; // always little endian
+	WriteRingEntry *first; // oldest queued entry
+	WriteRingEntry *last; // newest queued entry
+	WriteRingEntry *requeued; // newest requeued entry, only during write_ring_requeue
+	int queued;
+	int deficit; // bytes
+} WriteRingFlow;
+
+typedef struct {
+	uint32_t uid; // always little endian
+	uint32_t count;
+} WriteRingDrops;
+
+typedef struct {
+	uint8_t *buffer;
+	uint32_t size; // always a power of two
+	uint32_t max_size; // the buffer grows up to this size
+	uint32_t head; // end of the newest entry
+	uint32_t tail; // oldest entry that is not released yet
+	uint8_t *retired_buffer; // previous buffer with unreleased entries, or NULL
+	uint32_t retired_size;
+	uint32_t retired_head;
+	uint32_t retired_tail;
+	int queued;
+	int max_queued_per_flow;
+	Array flows; // only flows with queued entries, in round-robin order
+	int current_flow;
+	Array drops; // per UID, for the first WRITE_RING_MAX_DROP_UIDS UIDs
+	uint32_t dropped;
+} WriteRing;
+
+int write_ring_create(WriteRing *ring, uint32_t size, uint32_t max_size,
+                      int max_queued_per_flow);
+void write_ring_destroy(WriteRing *ring);
+
+Packet *write_ring_push(WriteRing *ring, Packet *request);
+
+Packet *write_ring_peek(WriteRing *ring);
+void write_ring_pop(WriteRing *ring);
+
+void write_ring_release(WriteRing *ring, Packet *request);
+
+int write_ring_requeue(WriteRing *ring);
+
+uint32_t write_ring_get_used(WriteRing *ring);
+
+#endif // BRICKD_WRITE_RING_H
@@ -27,6 +27,7 @@
 #include "zombie.h"
 
 #include "client.h"
+#include "event_timing.h"
 
 static LogSource _log_source = LOG_SOURCE_INITIALIZER;
 
@@ -50,7 +51,7 @@ int zombie_create(Zombie *zombie, Client *client) {
 	          zombie->id, client_expand_signature(client), zombie->pending_request_count);
 
 	// create single shot timer with a delay of 1sec
-	if (timer_create_(&zombie->timer, zombie_handle_timeout, zombie) < 0) {
+	if (event_timing_create_timer(&zombie->timer, "zombie", zombie_handle_timeout, zombie) < 0) {
 		log_error("Could not create zombie timer: %s (%d)",
 		          get_errno_name(errno), errno);
 
@@ -61,7 +62,7 @@ int zombie_create(Zombie *zombie, Client *client) {
 		log_error("Could not start zombie timer: %s (%d)",
 		          get_errno_name(errno), errno);
 
-		timer_destroy(&zombie->timer);
+		event_timing_destroy_timer(&zombie->timer);
 
 		return -1;
 	}
@@ -101,7 +102,7 @@ void zombie_destroy(Zombie *zombie) {
 		}
 	}
 
-	timer_destroy(&zombie->timer);
+	event_timing_destroy_timer(&zombie->timer);
 }
 
 void zombie_dispatch_response(Zombie *zombie, PendingRequest *pending_request,
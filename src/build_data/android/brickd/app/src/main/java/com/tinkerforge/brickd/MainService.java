@@ -36,6 +36,7 @@ import android.os.IBinder;
 import android.support.annotation.Keep;
 import android.util.Log;
 
+import java.io.File;
 import java.util.HashMap;
 import java.util.Hashtable;
 import java.util.Iterator;
@@ -46,7 +47,7 @@ public class MainService extends Service {
         System.loadLibrary("brickd-android");
     }
 
-    public native void main(MainService service, boolean debuggerConnected);
+    public native void main(MainService service, boolean debuggerConnected, String packetTraceFilename);
     public native void interrupt();
     public native void hotplug();
 
@@ -153,7 +154,8 @@ public class MainService extends Service {
         mThread = new Thread(new Runnable() {
             @Override
             public void run() {
-                main(MainService.this, android.os.Debug.isDebuggerConnected());
+                main(MainService.this, android.os.Debug.isDebuggerConnected(),
+                     new File(getFilesDir(), "brickd-packet-trace.bin").getAbsolutePath());
             }
         });
 
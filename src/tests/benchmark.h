@@ -0,0 +1,44 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * benchmark.h: Result reporting shared by the benchmarks
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef BRICKD_TESTS_BENCHMARK_H
+#define BRICKD_TESTS_BENCHMARK_H
+
+/*
+ * every benchmark result is printed as one JSON object on its own line, so
+ * the output of "make bench" can be collected and compared between builds by
+ * picking the lines starting with '{'. all other output (errors and the final
+ * "success") is plain text. the name identifies the operation, the parameter
+ * the variant of it, e.g. the number of pending requests.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+static void benchmark_report(const char *name, const char *parameter, int value,
+                             uint64_t operations, uint64_t duration /* microseconds */) {
+	printf("{\"benchmark\": \"%s\", \"%s\": %d, \"operations\": %llu, \"duration_us\": %llu, \"ns_per_op\": %.2f}\n",
+	       name, parameter, value, (unsigned long long)operations, (unsigned long long)duration,
+	       operations > 0 ? duration * 1000.0 / operations : 0.0);
+	fflush(stdout);
+}
+
+#endif // BRICKD_TESTS_BENCHMARK_H
@@ -0,0 +1,324 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * codec_benchmark.c: Benchmark for the WebSocket framing and the SHA1 and
+ *                    HMAC-SHA1 implementations
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <daemonlib/packet.h>
+#include <daemonlib/utils.h>
+
+#include "../brickd/hmac.h"
+#include "../brickd/sha1.h"
+#include "../brickd/websocket.h"
+
+#include "benchmark.h"
+
+#define FRAMES 2000000
+#define FRAMES_PER_READ 64
+#define HANDSHAKES 200000
+#define HASHES 1000000
+
+#define HANDSHAKE "GET / HTTP/1.1\r\n" \
+                  "Host: localhost:4280\r\n" \
+                  "Upgrade: websocket\r\n" \
+                  "Connection: Upgrade\r\n" \
+                  "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n" \
+                  "Sec-WebSocket-Protocol: tfp\r\n" \
+                  "Sec-WebSocket-Version: 13\r\n" \
+                  "\r\n"
+
+static uint64_t _sent_bytes = 0;
+
+// the WebSocket is not connected to an actual socket, everything it sends is
+// only counted
+int socket_create(Socket *socket) {
+	memset(socket, 0, sizeof(*socket));
+
+	return 0;
+}
+
+void socket_destroy_platform(Socket *socket) {
+	(void)socket;
+}
+
+int socket_receive_platform(Socket *socket, void *buffer, int length) {
+	(void)socket;
+	(void)buffer;
+	(void)length;
+
+	return 0;
+}
+
+int socket_send_platform(Socket *socket, const void *buffer, int length) {
+	(void)socket;
+	(void)buffer;
+
+	_sent_bytes += length;
+
+	return length;
+}
+
+static uint8_t _stream[FRAMES_PER_READ * (sizeof(WebsocketFrame) + sizeof(Packet))];
+static int _stream_length = 0;
+static int _stream_payload_length = 0;
+
+// fills the stream with masked binary frames of random length, as a browser
+// sends them
+static void create_stream(void) {
+	int i;
+	int k;
+	int length;
+	WebsocketFrame *frame;
+	uint8_t *payload;
+
+	for (i = 0; i < FRAMES_PER_READ; ++i) {
+		frame = (WebsocketFrame *)(_stream + _stream_length);
+		payload = _stream + _stream_length + sizeof(WebsocketFrame);
+		length = sizeof(PacketHeader) + rand() % (sizeof(Packet) - sizeof(PacketHeader) + 1);
+
+		frame->header.opcode_rsv_fin = 0;
+		frame->header.payload_length_mask = 0;
+
+		websocket_frame_set_fin(&frame->header, 1);
+		websocket_frame_set_opcode(&frame->header, WEBSOCKET_OPCODE_BINARY_FRAME);
+		websocket_frame_set_mask(&frame->header, 1);
+		websocket_frame_set_payload_length(&frame->header, length);
+
+		for (k = 0; k < WEBSOCKET_MASK_LENGTH; ++k) {
+			frame->masking_key[k] = (uint8_t)rand();
+		}
+
+		for (k = 0; k < length; ++k) {
+			payload[k] = (uint8_t)(k ^ frame->masking_key[k % WEBSOCKET_MASK_LENGTH]);
+		}
+
+		_stream_length += sizeof(WebsocketFrame) + length;
+		_stream_payload_length += length;
+	}
+}
+
+static int benchmark_parse(void) {
+	Websocket websocket;
+	uint8_t buffer[sizeof(_stream)];
+	int i;
+	int result;
+	uint64_t start;
+	uint64_t duration = 0;
+
+	if (websocket_create(&websocket) < 0) {
+		printf("benchmark_parse: websocket_create failed\n");
+
+		return -1;
+	}
+
+	websocket.state = WEBSOCKET_STATE_HANDSHAKE_DONE;
+
+	for (i = 0; i < FRAMES / FRAMES_PER_READ; ++i) {
+		// the parser unmasks in-place, restore the masked stream untimed
+		memcpy(buffer, _stream, _stream_length);
+
+		start = microtime();
+		result = websocket_parse(&websocket, buffer, _stream_length);
+		duration += microtime() - start;
+
+		if (result != _stream_payload_length) {
+			printf("benchmark_parse: payload length mismatch (actual: %d != expected: %d)\n",
+			       result, _stream_payload_length);
+
+			websocket_destroy(&websocket.base);
+
+			return -1;
+		}
+	}
+
+	benchmark_report("websocket_parse", "frames_per_read", FRAMES_PER_READ,
+	                 (uint64_t)(FRAMES / FRAMES_PER_READ) * FRAMES_PER_READ, duration);
+
+	websocket_destroy(&websocket.base);
+
+	return 0;
+}
+
+static int benchmark_handshake(void) {
+	Websocket websocket;
+	char buffer[sizeof(HANDSHAKE)];
+	int i;
+	uint64_t start;
+	uint64_t duration = 0;
+
+	for (i = 0; i < HANDSHAKES; ++i) {
+		if (websocket_create(&websocket) < 0) {
+			printf("benchmark_handshake: websocket_create failed\n");
+
+			return -1;
+		}
+
+		memcpy(buffer, HANDSHAKE, sizeof(HANDSHAKE));
+
+		start = microtime();
+		websocket_parse(&websocket, buffer, sizeof(HANDSHAKE) - 1);
+		duration += microtime() - start;
+
+		if (websocket.state != WEBSOCKET_STATE_HANDSHAKE_DONE) {
+			printf("benchmark_handshake: handshake was not accepted\n");
+
+			websocket_destroy(&websocket.base);
+
+			return -1;
+		}
+
+		websocket_destroy(&websocket.base);
+	}
+
+	benchmark_report("websocket_parse_handshake", "length", sizeof(HANDSHAKE) - 1,
+	                 HANDSHAKES, duration);
+
+	return 0;
+}
+
+static int benchmark_send(int length) {
+	Websocket websocket;
+	Packet response;
+	int i;
+	uint64_t start;
+	uint64_t duration;
+
+	if (websocket_create(&websocket) < 0) {
+		printf("benchmark_send: websocket_create failed\n");
+
+		return -1;
+	}
+
+	websocket.state = WEBSOCKET_STATE_HANDSHAKE_DONE;
+	_sent_bytes = 0;
+
+	memset(&response, 0, sizeof(response));
+
+	start = microtime();
+
+	// this is what happens for every response sent to a WebSocket client
+	for (i = 0; i < FRAMES; ++i) {
+		websocket_send(&websocket.base, &response, length);
+	}
+
+	duration = microtime() - start;
+
+	benchmark_report("websocket_send_frame", "length", length, FRAMES, duration);
+
+	websocket_destroy(&websocket.base);
+
+	if (_sent_bytes != (uint64_t)FRAMES * (sizeof(WebsocketFrameHeader) + length)) {
+		printf("benchmark_send: sent byte count mismatch\n");
+
+		return -1;
+	}
+
+	return 0;
+}
+
+static void benchmark_sha1(int length) {
+	uint8_t data[4096];
+	SHA1 sha1;
+	uint8_t digest[SHA1_DIGEST_LENGTH];
+	int i;
+	int count = HASHES / (1 + length / 64);
+	uint64_t start;
+	uint64_t duration;
+
+	memset(data, 0xA5, length);
+
+	start = microtime();
+
+	for (i = 0; i < count; ++i) {
+		data[0] = (uint8_t)i;
+
+		sha1_init(&sha1);
+		sha1_update(&sha1, data, length);
+		sha1_final(&sha1, digest);
+	}
+
+	duration = microtime() - start;
+
+	benchmark_report("sha1_update", "length", length, count, duration);
+}
+
+// this is what happens for every authenticate request
+static void benchmark_hmac_sha1(void) {
+	const char *secret = "My Authentication Secret!";
+	uint32_t nonces[2];
+	uint8_t digest[SHA1_DIGEST_LENGTH];
+	int i;
+	uint64_t start;
+	uint64_t duration;
+
+	nonces[0] = 0x12345678;
+
+	start = microtime();
+
+	for (i = 0; i < HASHES; ++i) {
+		nonces[1] = (uint32_t)i;
+
+		hmac_sha1((const uint8_t *)secret, (int)strlen(secret),
+		          (const uint8_t *)nonces, sizeof(nonces), digest);
+	}
+
+	duration = microtime() - start;
+
+	benchmark_report("hmac_sha1", "length", sizeof(nonces), HASHES, duration);
+}
+
+int main(void) {
+	int length;
+
+#ifdef _WIN32
+	fixes_init();
+#endif
+
+	srand(1);
+
+	create_stream();
+
+	if (benchmark_parse() < 0) {
+		return EXIT_FAILURE;
+	}
+
+	if (benchmark_handshake() < 0) {
+		return EXIT_FAILURE;
+	}
+
+	for (length = (int)sizeof(PacketHeader); length <= (int)sizeof(Packet); length += 24) {
+		if (benchmark_send(length) < 0) {
+			return EXIT_FAILURE;
+		}
+	}
+
+	for (length = 64; length <= 4096; length *= 8) {
+		benchmark_sha1(length);
+	}
+
+	benchmark_hmac_sha1();
+
+	printf("success\n");
+
+	return EXIT_SUCCESS;
+}
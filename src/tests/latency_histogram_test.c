@@ -0,0 +1,161 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * latency_histogram_test.c: Tests for the LatencyHistogram type
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <daemonlib/utils.h>
+
+#include "../brickd/latency_histogram.h"
+
+static LatencyHistogram _histogram;
+
+// the reported value has to be within the bucket of the exact value, the
+// relative error of a bucket is at most 1/16
+static int check_percentile(int test, double quantile, uint32_t expected) {
+	uint32_t actual = latency_histogram_get_percentile(&_histogram, quantile);
+
+	if (actual < expected || actual > (uint64_t)expected + expected / 16) {
+		printf("test%d: percentile %g mismatch (actual: %u != expected: %u)\n",
+		       test, quantile, actual, expected);
+
+		return -1;
+	}
+
+	return 0;
+}
+
+// empty histogram
+static int test1(void) {
+	latency_histogram_reset(&_histogram);
+
+	if (latency_histogram_get_percentile(&_histogram, 0.5) != 0) {
+		printf("test1: empty histogram has non-zero percentile\n");
+
+		return -1;
+	}
+
+	return 0;
+}
+
+// uniform distribution
+static int test2(void) {
+	uint32_t i;
+
+	latency_histogram_reset(&_histogram);
+
+	for (i = 1; i <= 100000; ++i) {
+		latency_histogram_record(&_histogram, i);
+	}
+
+	if (_histogram.count != 100000 || _histogram.max != 100000 ||
+	    _histogram.sum != (uint64_t)100000 * 100001 / 2) {
+		printf("test2: count, max or sum mismatch\n");
+
+		return -1;
+	}
+
+	if (check_percentile(2, 0.0, 1) < 0 ||
+	    check_percentile(2, 0.5, 50000) < 0 ||
+	    check_percentile(2, 0.9, 90000) < 0 ||
+	    check_percentile(2, 0.99, 99000) < 0 ||
+	    check_percentile(2, 0.999, 99900) < 0 ||
+	    check_percentile(2, 1.0, 100000) < 0) {
+		return -1;
+	}
+
+	return 0;
+}
+
+// single values are reported exactly over the whole range, because the
+// reported value is capped to the maximum
+static int test3(void) {
+	uint64_t value;
+
+	for (value = 0; value <= UINT32_MAX; value = value * 3 + 1) {
+		latency_histogram_reset(&_histogram);
+		latency_histogram_record(&_histogram, value);
+
+		if (check_percentile(3, 0.5, (uint32_t)value) < 0) {
+			return -1;
+		}
+	}
+
+	// values beyond the range are clamped
+	latency_histogram_reset(&_histogram);
+	latency_histogram_record(&_histogram, (uint64_t)1 << 40);
+
+	if (check_percentile(3, 0.5, UINT32_MAX) < 0) {
+		return -1;
+	}
+
+	return 0;
+}
+
+// outliers have to show up in the tail only
+static int test4(void) {
+	int i;
+
+	latency_histogram_reset(&_histogram);
+
+	for (i = 0; i < 9990; ++i) {
+		latency_histogram_record(&_histogram, 250);
+	}
+
+	for (i = 0; i < 10; ++i) {
+		latency_histogram_record(&_histogram, 80000);
+	}
+
+	if (check_percentile(4, 0.5, 250) < 0 ||
+	    check_percentile(4, 0.99, 250) < 0 ||
+	    check_percentile(4, 0.999, 250) < 0 ||
+	    check_percentile(4, 0.9995, 80000) < 0) {
+		return -1;
+	}
+
+	return 0;
+}
+
+int main(void) {
+#ifdef _WIN32
+	fixes_init();
+#endif
+
+	if (test1() < 0) {
+		return EXIT_FAILURE;
+	}
+
+	if (test2() < 0) {
+		return EXIT_FAILURE;
+	}
+
+	if (test3() < 0) {
+		return EXIT_FAILURE;
+	}
+
+	if (test4() < 0) {
+		return EXIT_FAILURE;
+	}
+
+	printf("success\n");
+
+	return EXIT_SUCCESS;
+}
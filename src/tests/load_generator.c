@@ -0,0 +1,854 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * load_generator.c: Multi-client, pipelined load generator for brickd
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * the load generator opens many connections to a Brick Daemon and keeps a
+ * configurable number of requests in flight on each of them. it speaks the
+ * TCP/IP protocol directly instead of using the C bindings, because the
+ * bindings only allow one request in flight per device.
+ *
+ * the requests are a weighted mix of getters and setters sent to the
+ * discovered devices and callback subscription changes sent to the Brick
+ * Daemon UID. by default it targets Master Bricks, so it works with real
+ * Master Bricks and with the virtual stack of the Brick Daemon. all requests
+ * have the response-expected flag set and are matched to their responses by
+ * sequence number and function ID, which limits the depth to 15 requests per
+ * connection. the sequence number of a request that timed out is not reused
+ * until its late response arrives or all other sequence numbers have been
+ * used once, so a late response is not mistaken for the response to a newer
+ * request.
+ *
+ * the result is printed as JSON to stdout, progress messages go to stderr.
+ * authentication is not supported.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+	#include <winsock2.h>
+	#include <ws2tcpip.h>
+#else
+	#include <fcntl.h>
+	#include <netdb.h>
+	#include <netinet/in.h>
+	#include <netinet/tcp.h>
+	#include <poll.h>
+	#include <sys/socket.h>
+	#include <unistd.h>
+#endif
+
+#include <daemonlib/base58.h>
+#include <daemonlib/packet.h>
+#include <daemonlib/utils.h>
+
+#include "../brickd/latency_histogram.h"
+
+#ifdef _WIN32
+	#define poll WSAPoll
+	#define close_socket closesocket
+	typedef SOCKET SocketHandle;
+	#define INVALID_SOCKET_HANDLE INVALID_SOCKET
+#else
+	#define close_socket close
+	typedef int SocketHandle;
+	#define INVALID_SOCKET_HANDLE -1
+#endif
+
+#define UID_BRICK_DAEMON 1
+#define FUNCTION_SUBSCRIBE_CALLBACK 3
+#define FUNCTION_UNSUBSCRIBE_CALLBACK 4
+
+#define MAX_DEPTH 15 // limited by the 4 bit sequence number, 0 is used for callbacks
+#define MAX_DEVICES 4096
+#define DISCOVERY_TIME 1000000 // 1 second in microseconds
+
+typedef enum {
+	OPERATION_GETTER = 0,
+	OPERATION_SETTER,
+	OPERATION_SUBSCRIPTION,
+	OPERATION_COUNT
+} Operation;
+
+static const char *_operation_names[OPERATION_COUNT] = {
+	"getter",
+	"setter",
+	"subscription"
+};
+
+#include <daemonlib/packed_begin.h>
+
+typedef struct {
+	PacketHeader header;
+	uint32_t period; // always little endian
+} ATTRIBUTE_PACKED SetterRequest;
+
+typedef struct {
+	PacketHeader header;
+	uint32_t uid; // always little endian
+	uint8_t function_id;
+} ATTRIBUTE_PACKED CallbackSubscriptionRequest;
+
+#include <daemonlib/packed_end.h>
+
+typedef struct {
+	uint64_t timestamp; // 0 marks a sequence number that is not in flight
+	Operation operation;
+	uint8_t function_id;
+	bool quarantined; // expired, a late response might still arrive
+} InFlightRequest;
+
+typedef struct {
+	SocketHandle handle;
+	uint8_t sequence_number;
+	InFlightRequest in_flight[MAX_DEPTH + 1]; // indexed by sequence number
+	int in_flight_count;
+	bool subscribed;
+	int next_device;
+	uint8_t receive_buffer[4096];
+	int receive_buffer_used;
+	uint8_t send_buffer[MAX_DEPTH * sizeof(Packet)];
+	int send_buffer_used;
+} Connection;
+
+typedef struct {
+	uint64_t completed;
+	uint64_t errors;
+	LatencyHistogram latency;
+} OperationStatistics;
+
+static const char *_host = "localhost";
+static const char *_port = "4223";
+static int _connection_count = 100;
+static int _depth = 4;
+static int _duration = 10; // seconds
+static int _weights[OPERATION_COUNT] = { 8, 1, 1 };
+static int _getter_function_id = 40; // Master Brick get-usb-voltage
+static int _setter_function_id = 49; // Master Brick set-usb-voltage-callback-period
+static int _callback_function_id = 61; // Master Brick usb-voltage callback
+static int _device_identifier = 13; // Master Brick
+static int _timeout = 2500; // milliseconds
+
+static Connection *_connections;
+static struct pollfd *_pollfds;
+static uint32_t _devices[MAX_DEVICES]; // always little endian
+static int _device_count;
+static OperationStatistics _statistics[OPERATION_COUNT];
+static LatencyHistogram _latency;
+static uint64_t _timeouts;
+static uint64_t _callbacks;
+static bool _measuring;
+
+static void print_usage(const char *binary) {
+	fprintf(stderr,
+	        "Usage: %s [options]\n"
+	        "\n"
+	        "Options:\n"
+	        "  --host <host>                Brick Daemon host (default: localhost)\n"
+	        "  --port <port>                Brick Daemon port (default: 4223)\n"
+	        "  --connections <count>        number of connections (default: 100)\n"
+	        "  --depth <count>              requests in flight per connection, 1 to 15 (default: 4)\n"
+	        "  --duration <seconds>         measurement duration (default: 10)\n"
+	        "  --mix <get>:<set>:<sub>      weights of getters, setters and callback\n"
+	        "                               subscription changes (default: 8:1:1)\n"
+	        "  --uid <uid>                  use this device instead of discovering devices\n"
+	        "  --device-identifier <id>     device identifier to discover (default: 13)\n"
+	        "  --getter-function <id>       function ID of the getter (default: 40)\n"
+	        "  --setter-function <id>       function ID of the setter, its only parameter\n"
+	        "                               is an uint32 set to 0 (default: 49)\n"
+	        "  --callback-function <id>     function ID of the subscribed callback (default: 61)\n"
+	        "  --timeout <milliseconds>     response timeout (default: 2500)\n",
+	        binary);
+}
+
+static int parse_integer(const char *string, int min, int max, int *value) {
+	char *end = NULL;
+	long result;
+
+	errno = 0;
+	result = strtol(string, &end, 10);
+
+	if (errno != 0 || end == string || *end != '\0' || result < min || result > max) {
+		return -1;
+	}
+
+	*value = (int)result;
+
+	return 0;
+}
+
+static int parse_arguments(int argc, char **argv) {
+	int i;
+	const char *name;
+	const char *value;
+	int result = 0;
+	uint32_t uid;
+
+	for (i = 1; i < argc; i += 2) {
+		name = argv[i];
+
+		if (i + 1 >= argc) {
+			fprintf(stderr, "Missing value for option '%s'\n", name);
+
+			return -1;
+		}
+
+		value = argv[i + 1];
+
+		if (strcmp(name, "--host") == 0) {
+			_host = value;
+		} else if (strcmp(name, "--port") == 0) {
+			_port = value;
+		} else if (strcmp(name, "--connections") == 0) {
+			result = parse_integer(value, 1, 100000, &_connection_count);
+		} else if (strcmp(name, "--depth") == 0) {
+			result = parse_integer(value, 1, MAX_DEPTH, &_depth);
+		} else if (strcmp(name, "--duration") == 0) {
+			result = parse_integer(value, 1, 86400, &_duration);
+		} else if (strcmp(name, "--mix") == 0) {
+			if (sscanf(value, "%d:%d:%d", &_weights[OPERATION_GETTER],
+			           &_weights[OPERATION_SETTER], &_weights[OPERATION_SUBSCRIPTION]) != 3 ||
+			    _weights[OPERATION_GETTER] < 0 || _weights[OPERATION_SETTER] < 0 ||
+			    _weights[OPERATION_SUBSCRIPTION] < 0 ||
+			    _weights[OPERATION_GETTER] + _weights[OPERATION_SETTER] +
+			    _weights[OPERATION_SUBSCRIPTION] == 0) {
+				result = -1;
+			}
+		} else if (strcmp(name, "--uid") == 0) {
+			if (base58_decode(&uid, value) < 0 || _device_count >= MAX_DEVICES) {
+				result = -1;
+			} else {
+				_devices[_device_count++] = uint32_to_le(uid);
+			}
+		} else if (strcmp(name, "--device-identifier") == 0) {
+			result = parse_integer(value, 0, UINT16_MAX, &_device_identifier);
+		} else if (strcmp(name, "--getter-function") == 0) {
+			result = parse_integer(value, 1, 255, &_getter_function_id);
+		} else if (strcmp(name, "--setter-function") == 0) {
+			result = parse_integer(value, 1, 255, &_setter_function_id);
+		} else if (strcmp(name, "--callback-function") == 0) {
+			result = parse_integer(value, 1, 255, &_callback_function_id);
+		} else if (strcmp(name, "--timeout") == 0) {
+			result = parse_integer(value, 1, 3600000, &_timeout);
+		} else {
+			fprintf(stderr, "Unknown option '%s'\n", name);
+
+			return -1;
+		}
+
+		if (result < 0) {
+			fprintf(stderr, "Invalid value '%s' for option '%s'\n", value, name);
+
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int connection_open(Connection *connection, struct addrinfo *address) {
+	int option = 1;
+#ifdef _WIN32
+	u_long non_blocking = 1;
+#endif
+
+	memset(connection, 0, sizeof(*connection));
+
+	connection->handle = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+
+	if (connection->handle == INVALID_SOCKET_HANDLE) {
+		return -1;
+	}
+
+	if (connect(connection->handle, address->ai_addr, (int)address->ai_addrlen) < 0) {
+		close_socket(connection->handle);
+
+		return -1;
+	}
+
+	setsockopt(connection->handle, IPPROTO_TCP, TCP_NODELAY, (const char *)&option, sizeof(option));
+
+#ifdef _WIN32
+	ioctlsocket(connection->handle, FIONBIO, &non_blocking);
+#else
+	fcntl(connection->handle, F_SETFL, fcntl(connection->handle, F_GETFL, 0) | O_NONBLOCK);
+#endif
+
+	return 0;
+}
+
+// returns NULL if the request does not fit into the send buffer, because
+// the bytes of expired requests have not been sent yet
+static PacketHeader *connection_append_request(Connection *connection, uint32_t uid,
+                                               uint8_t function_id, int length) {
+	PacketHeader *header;
+
+	if (connection->send_buffer_used + length > (int)sizeof(connection->send_buffer)) {
+		return NULL;
+	}
+
+	header = (PacketHeader *)(connection->send_buffer + connection->send_buffer_used);
+
+	memset(header, 0, length);
+
+	header->uid = uid;
+	header->length = (uint8_t)length;
+	header->function_id = function_id;
+
+	connection->send_buffer_used += length;
+
+	return header;
+}
+
+static Operation choose_operation(void) {
+	int total = _weights[OPERATION_GETTER] + _weights[OPERATION_SETTER] +
+	            _weights[OPERATION_SUBSCRIPTION];
+	int value = rand() % total;
+
+	if (value < _weights[OPERATION_GETTER]) {
+		return OPERATION_GETTER;
+	}
+
+	if (value < _weights[OPERATION_GETTER] + _weights[OPERATION_SETTER]) {
+		return OPERATION_SETTER;
+	}
+
+	return OPERATION_SUBSCRIPTION;
+}
+
+// advances to the next sequence number that is neither in flight nor in
+// quarantine. the sequence number of an expired request stays in quarantine
+// until its late response arrives or until the search has skipped it once,
+// which means the sequence numbers have wrapped around completely since it
+// expired. returns false if no sequence number is usable at the moment
+static bool connection_next_sequence_number(Connection *connection) {
+	int i;
+	InFlightRequest *request;
+
+	for (i = 0; i < MAX_DEPTH; ++i) {
+		connection->sequence_number = connection->sequence_number % MAX_DEPTH + 1;
+		request = &connection->in_flight[connection->sequence_number];
+
+		if (request->timestamp != 0) {
+			continue;
+		}
+
+		if (request->quarantined) {
+			request->quarantined = false;
+
+			continue;
+		}
+
+		return true;
+	}
+
+	return false;
+}
+
+// fills the connection up to the configured depth. stops early if no
+// sequence number is usable or the send buffer is full, the remaining
+// requests are sent on a later call
+static void connection_send_requests(Connection *connection) {
+	Operation operation;
+	uint32_t uid;
+	uint8_t function_id;
+	PacketHeader *header;
+	CallbackSubscriptionRequest *subscription;
+	uint64_t now = microtime();
+
+	while (connection->in_flight_count < _depth) {
+		if (!connection_next_sequence_number(connection)) {
+			return;
+		}
+
+		operation = choose_operation();
+		uid = _devices[connection->next_device];
+		connection->next_device = (connection->next_device + 1) % _device_count;
+
+		switch (operation) {
+		case OPERATION_GETTER:
+			function_id = (uint8_t)_getter_function_id;
+			header = connection_append_request(connection, uid, function_id,
+			                                   sizeof(PacketHeader));
+
+			break;
+
+		case OPERATION_SETTER:
+			function_id = (uint8_t)_setter_function_id;
+			header = connection_append_request(connection, uid, function_id,
+			                                   sizeof(SetterRequest));
+
+			break;
+
+		default:
+			function_id = connection->subscribed ? FUNCTION_UNSUBSCRIBE_CALLBACK
+			                                     : FUNCTION_SUBSCRIBE_CALLBACK;
+			header = connection_append_request(connection, uint32_to_le(UID_BRICK_DAEMON),
+			                                   function_id, sizeof(CallbackSubscriptionRequest));
+
+			if (header != NULL) {
+				subscription = (CallbackSubscriptionRequest *)header;
+				subscription->uid = uid;
+				subscription->function_id = (uint8_t)_callback_function_id;
+				connection->subscribed = !connection->subscribed;
+			}
+
+			break;
+		}
+
+		if (header == NULL) {
+			return;
+		}
+
+		packet_header_set_sequence_number(header, connection->sequence_number);
+		packet_header_set_response_expected(header, true);
+
+		connection->in_flight[connection->sequence_number].timestamp = now;
+		connection->in_flight[connection->sequence_number].operation = operation;
+		connection->in_flight[connection->sequence_number].function_id = function_id;
+		++connection->in_flight_count;
+	}
+}
+
+static int connection_flush(Connection *connection) {
+	int length;
+
+	if (connection->send_buffer_used == 0) {
+		return 0;
+	}
+
+	length = send(connection->handle, (const char *)connection->send_buffer,
+	              connection->send_buffer_used, 0);
+
+	if (length < 0) {
+#ifdef _WIN32
+		if (WSAGetLastError() == WSAEWOULDBLOCK) {
+#else
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+#endif
+			return 0;
+		}
+
+		return -1;
+	}
+
+	memmove(connection->send_buffer, connection->send_buffer + length,
+	        connection->send_buffer_used - length);
+
+	connection->send_buffer_used -= length;
+
+	return 0;
+}
+
+static void handle_enumerate_callback(EnumerateCallback *enumerate_callback) {
+	int i;
+
+	if (enumerate_callback->header.length != sizeof(EnumerateCallback) ||
+	    uint16_from_le(enumerate_callback->device_identifier) != _device_identifier ||
+	    enumerate_callback->enumeration_type == ENUMERATION_TYPE_DISCONNECTED) {
+		return;
+	}
+
+	for (i = 0; i < _device_count; ++i) {
+		if (_devices[i] == enumerate_callback->header.uid) {
+			return;
+		}
+	}
+
+	if (_device_count < MAX_DEVICES) {
+		_devices[_device_count++] = enumerate_callback->header.uid;
+	}
+}
+
+static void handle_packet(Connection *connection, Packet *packet) {
+	uint8_t sequence_number = packet_header_get_sequence_number(&packet->header);
+	InFlightRequest *request;
+	uint64_t latency;
+
+	if (sequence_number == 0) {
+		if (packet->header.function_id == CALLBACK_ENUMERATE) {
+			if (!_measuring) {
+				handle_enumerate_callback((EnumerateCallback *)packet);
+			}
+		} else if (_measuring) {
+			++_callbacks;
+		}
+
+		return;
+	}
+
+	request = &connection->in_flight[sequence_number];
+
+	if (request->timestamp == 0) {
+		// late response after its timeout or of a discovery request. the
+		// late response has arrived now, so the sequence number can be
+		// reused without its quarantine
+		request->quarantined = false;
+
+		return;
+	}
+
+	if (packet->header.function_id != request->function_id) {
+		// late response to an earlier request with the same sequence number
+		return;
+	}
+
+	if (_measuring) {
+		latency = microtime() - request->timestamp;
+
+		++_statistics[request->operation].completed;
+
+		if (packet_header_get_error_code(&packet->header) != PACKET_E_SUCCESS) {
+			++_statistics[request->operation].errors;
+		}
+
+		latency_histogram_record(&_statistics[request->operation].latency, latency);
+		latency_histogram_record(&_latency, latency);
+	}
+
+	request->timestamp = 0;
+	--connection->in_flight_count;
+}
+
+static int connection_receive(Connection *connection) {
+	int length;
+	int offset = 0;
+	PacketHeader *header;
+	union {
+		Packet packet;
+		uint8_t buffer[sizeof(Packet)];
+	} u;
+
+	length = recv(connection->handle, (char *)connection->receive_buffer + connection->receive_buffer_used,
+	              sizeof(connection->receive_buffer) - connection->receive_buffer_used, 0);
+
+	if (length == 0) {
+		fprintf(stderr, "Connection closed by Brick Daemon\n");
+
+		return -1;
+	}
+
+	if (length < 0) {
+#ifdef _WIN32
+		if (WSAGetLastError() == WSAEWOULDBLOCK) {
+#else
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+#endif
+			return 0;
+		}
+
+		return -1;
+	}
+
+	connection->receive_buffer_used += length;
+
+	while (connection->receive_buffer_used - offset >= (int)sizeof(PacketHeader)) {
+		header = (PacketHeader *)(connection->receive_buffer + offset);
+
+		if (header->length < sizeof(PacketHeader) || header->length > sizeof(u.buffer)) {
+			fprintf(stderr, "Received response with invalid length %u\n", header->length);
+
+			return -1;
+		}
+
+		if (connection->receive_buffer_used - offset < header->length) {
+			break;
+		}
+
+		// copy the response to get an aligned and complete Packet
+		memcpy(u.buffer, header, header->length);
+
+		handle_packet(connection, &u.packet);
+
+		offset += header->length;
+	}
+
+	memmove(connection->receive_buffer, connection->receive_buffer + offset,
+	        connection->receive_buffer_used - offset);
+
+	connection->receive_buffer_used -= offset;
+
+	return 0;
+}
+
+// frees sequence numbers of requests that did not get a response in time
+static void connection_expire_requests(Connection *connection, uint64_t now) {
+	int i;
+	InFlightRequest *request;
+
+	for (i = 1; i <= MAX_DEPTH; ++i) {
+		request = &connection->in_flight[i];
+
+		if (request->timestamp != 0 && now - request->timestamp > (uint64_t)_timeout * 1000) {
+			request->timestamp = 0;
+			request->quarantined = true;
+			--connection->in_flight_count;
+
+			if (_measuring) {
+				++_timeouts;
+			}
+		}
+	}
+}
+
+// runs the event loop over the first count connections until the deadline
+static int run(int count, uint64_t deadline, bool send_requests) {
+	int i;
+	int ready;
+	uint64_t now = microtime();
+	uint64_t next_expiry = now;
+
+	while (now < deadline) {
+		if (now >= next_expiry) {
+			for (i = 0; i < count; ++i) {
+				connection_expire_requests(&_connections[i], now);
+			}
+
+			next_expiry = now + 100000;
+		}
+
+		for (i = 0; i < count; ++i) {
+			if (send_requests) {
+				connection_send_requests(&_connections[i]);
+			}
+
+			if (connection_flush(&_connections[i]) < 0) {
+				fprintf(stderr, "Could not send to Brick Daemon\n");
+
+				return -1;
+			}
+
+			_pollfds[i].fd = _connections[i].handle;
+			_pollfds[i].events = POLLIN | (_connections[i].send_buffer_used > 0 ? POLLOUT : 0);
+			_pollfds[i].revents = 0;
+		}
+
+		ready = poll(_pollfds, count, 100);
+
+		if (ready < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			fprintf(stderr, "Could not poll connections\n");
+
+			return -1;
+		}
+
+		for (i = 0; i < count && ready > 0; ++i) {
+			if (_pollfds[i].revents == 0) {
+				continue;
+			}
+
+			--ready;
+
+			if ((_pollfds[i].revents & (POLLIN | POLLERR | POLLHUP)) != 0 &&
+			    connection_receive(&_connections[i]) < 0) {
+				return -1;
+			}
+		}
+
+		now = microtime();
+	}
+
+	return 0;
+}
+
+static int discover_devices(void) {
+	PacketHeader *header;
+
+	// the send buffer is still empty, the request always fits
+	header = connection_append_request(&_connections[0], 0, FUNCTION_ENUMERATE,
+	                                   sizeof(PacketHeader));
+
+	packet_header_set_sequence_number(header, 1);
+
+	if (run(1, microtime() + DISCOVERY_TIME, false) < 0) {
+		return -1;
+	}
+
+	if (_device_count == 0) {
+		fprintf(stderr, "No device with device identifier %d found\n", _device_identifier);
+
+		return -1;
+	}
+
+	return 0;
+}
+
+static void print_latency(const char *indent, LatencyHistogram *histogram) {
+	printf("%s\"latency_us\": {\"p50\": %u, \"p90\": %u, \"p99\": %u, \"p999\": %u, \"max\": %u, \"mean\": %.1f}",
+	       indent,
+	       latency_histogram_get_percentile(histogram, 0.5),
+	       latency_histogram_get_percentile(histogram, 0.9),
+	       latency_histogram_get_percentile(histogram, 0.99),
+	       latency_histogram_get_percentile(histogram, 0.999),
+	       histogram->max,
+	       histogram->count > 0 ? (double)histogram->sum / histogram->count : 0.0);
+}
+
+static void print_result(double elapsed) {
+	int i;
+	uint64_t completed = 0;
+	uint64_t errors = 0;
+
+	for (i = 0; i < OPERATION_COUNT; ++i) {
+		completed += _statistics[i].completed;
+		errors += _statistics[i].errors;
+	}
+
+	printf("{\n");
+	printf("  \"connections\": %d,\n", _connection_count);
+	printf("  \"depth\": %d,\n", _depth);
+	printf("  \"devices\": %d,\n", _device_count);
+	printf("  \"duration_s\": %.3f,\n", elapsed);
+	printf("  \"requests\": %.0f,\n", (double)completed);
+	printf("  \"errors\": %.0f,\n", (double)errors);
+	printf("  \"timeouts\": %.0f,\n", (double)_timeouts);
+	printf("  \"throughput_rps\": %.1f,\n", completed / elapsed);
+	printf("  \"callbacks\": %.0f,\n", (double)_callbacks);
+	printf("  \"callback_rate\": %.1f,\n", _callbacks / elapsed);
+	print_latency("  ", &_latency);
+	printf(",\n  \"operations\": {\n");
+
+	for (i = 0; i < OPERATION_COUNT; ++i) {
+		printf("    \"%s\": {\n", _operation_names[i]);
+		printf("      \"requests\": %.0f,\n", (double)_statistics[i].completed);
+		printf("      \"errors\": %.0f,\n", (double)_statistics[i].errors);
+		print_latency("      ", &_statistics[i].latency);
+		printf("\n    }%s\n", i < OPERATION_COUNT - 1 ? "," : "");
+	}
+
+	printf("  }\n");
+	printf("}\n");
+}
+
+int main(int argc, char **argv) {
+	struct addrinfo hints;
+	struct addrinfo *address = NULL;
+	int i;
+	int exit_code = EXIT_FAILURE;
+	int opened = 0;
+	uint64_t start;
+	uint64_t stop;
+#ifdef _WIN32
+	WSADATA wsa_data;
+
+	fixes_init();
+
+	if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0) {
+		fprintf(stderr, "Could not initialize Windows Sockets\n");
+
+		return EXIT_FAILURE;
+	}
+#endif
+
+	if (parse_arguments(argc, argv) < 0) {
+		print_usage(argv[0]);
+
+		return EXIT_FAILURE;
+	}
+
+	srand(1);
+
+	_connections = calloc(_connection_count, sizeof(Connection));
+	_pollfds = calloc(_connection_count, sizeof(struct pollfd));
+
+	if (_connections == NULL || _pollfds == NULL) {
+		fprintf(stderr, "Could not allocate %d connection(s)\n", _connection_count);
+
+		goto cleanup;
+	}
+
+	memset(&hints, 0, sizeof(hints));
+
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	if (getaddrinfo(_host, _port, &hints, &address) != 0) {
+		fprintf(stderr, "Could not resolve %s:%s\n", _host, _port);
+
+		goto cleanup;
+	}
+
+	if (connection_open(&_connections[0], address) < 0) {
+		fprintf(stderr, "Could not connect to %s:%s\n", _host, _port);
+
+		goto cleanup;
+	}
+
+	opened = 1;
+
+	if (_device_count == 0) {
+		if (discover_devices() < 0) {
+			goto cleanup;
+		}
+
+		fprintf(stderr, "Discovered %d device(s)\n", _device_count);
+	}
+
+	for (; opened < _connection_count; ++opened) {
+		if (connection_open(&_connections[opened], address) < 0) {
+			fprintf(stderr, "Could not open connection %d to %s:%s\n",
+			        opened + 1, _host, _port);
+
+			goto cleanup;
+		}
+	}
+
+	fprintf(stderr, "Running %d connection(s) with %d request(s) in flight each for %d second(s)\n",
+	        _connection_count, _depth, _duration);
+
+	for (i = 0; i < OPERATION_COUNT; ++i) {
+		latency_histogram_reset(&_statistics[i].latency);
+	}
+
+	latency_histogram_reset(&_latency);
+
+	_measuring = true;
+	start = microtime();
+
+	if (run(_connection_count, start + (uint64_t)_duration * 1000000, true) < 0) {
+		goto cleanup;
+	}
+
+	stop = microtime();
+	_measuring = false;
+
+	print_result((stop - start) / 1000000.0);
+
+	exit_code = EXIT_SUCCESS;
+
+cleanup:
+	for (i = 0; i < opened; ++i) {
+		close_socket(_connections[i].handle);
+	}
+
+	if (address != NULL) {
+		freeaddrinfo(address);
+	}
+
+	free(_pollfds);
+	free(_connections);
+
+	return exit_code;
+}
@@ -0,0 +1,280 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * packet_reader_benchmark.c: Tests and benchmark for the PacketReader type
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <daemonlib/packet.h>
+#include <daemonlib/utils.h>
+
+#include "../brickd/packet_reader.h"
+
+#include "benchmark.h"
+
+#define STREAM_REQUESTS 1000000
+
+static uint8_t *_stream;
+static int _stream_length;
+static uint32_t _stream_checksum; // sum of all UIDs
+
+// fills the stream with pipelined requests of random length
+static int create_stream(void) {
+	int i;
+	int offset = 0;
+	PacketHeader *header;
+
+	_stream = malloc(STREAM_REQUESTS * sizeof(Packet));
+
+	if (_stream == NULL) {
+		printf("create_stream: malloc failed\n");
+
+		return -1;
+	}
+
+	for (i = 0; i < STREAM_REQUESTS; ++i) {
+		header = (PacketHeader *)(_stream + offset);
+
+		header->uid = (uint32_t)rand() | 2; // 0 and 1 are special UIDs
+		header->length = sizeof(PacketHeader) + rand() % (sizeof(Packet) - sizeof(PacketHeader) + 1);
+		header->function_id = 1 + rand() % 255;
+		header->sequence_number_and_options = (1 + rand() % 15) << 4;
+		header->error_code_and_future_use = 0;
+
+		_stream_checksum += header->uid;
+
+		memset(_stream + offset + sizeof(PacketHeader), i & 0xFF, header->length - sizeof(PacketHeader));
+
+		offset += header->length;
+	}
+
+	_stream_length = offset;
+
+	return 0;
+}
+
+// simulates the socket, every read returns as much data as fits
+static int read_stream(int *offset, uint8_t *buffer, int length) {
+	if (length > _stream_length - *offset) {
+		length = _stream_length - *offset;
+	}
+
+	memcpy(buffer, _stream + *offset, length);
+
+	*offset += length;
+
+	return length;
+}
+
+// the framing as done before the PacketReader: a fixed buffer, a copy of each
+// request and a memmove of the remaining data after each request
+static int benchmark_legacy(void) {
+	union {
+		uint8_t buffer[512];
+		Packet packet;
+	} u;
+	int used = 0;
+	int offset = 0;
+	int length;
+	int requests = 0;
+	uint32_t checksum = 0;
+	uint64_t start = microtime();
+	uint64_t duration;
+	Packet request;
+
+	while ((length = read_stream(&offset, u.buffer + used, sizeof(u.buffer) - used)) > 0) {
+		used += length;
+
+		while (used >= (int)sizeof(PacketHeader) && used >= u.packet.header.length) {
+			length = u.packet.header.length;
+
+			memcpy(&request, &u.packet, length);
+
+			checksum += request.header.uid;
+			++requests;
+
+			memmove(u.buffer, u.buffer + length, used - length);
+
+			used -= length;
+		}
+	}
+
+	duration = microtime() - start;
+
+	benchmark_report("client_framing_legacy", "buffer_size", sizeof(u.buffer), requests, duration);
+
+	if (requests != STREAM_REQUESTS || checksum != _stream_checksum) {
+		printf("benchmark_legacy: request count mismatch (actual: %d != expected: %d)\n",
+		       requests, STREAM_REQUESTS);
+
+		return -1;
+	}
+
+	return 0;
+}
+
+static int benchmark_reader(int size) {
+	PacketReader reader;
+	uint8_t *buffer;
+	int offset = 0;
+	int length;
+	int result;
+	int requests = 0;
+	uint32_t checksum = 0;
+	uint64_t start;
+	uint64_t duration;
+	Packet *request;
+	const char *message;
+
+	if (packet_reader_create(&reader, size) < 0) {
+		printf("benchmark_reader: packet_reader_create failed\n");
+
+		return -1;
+	}
+
+	start = microtime();
+
+	for (;;) {
+		buffer = packet_reader_get_free(&reader, &length);
+		length = read_stream(&offset, buffer, length);
+
+		if (length == 0) {
+			break;
+		}
+
+		packet_reader_commit(&reader, length);
+
+		while ((result = packet_reader_next(&reader, &request, &message)) > 0) {
+			checksum += request->header.uid;
+			++requests;
+		}
+
+		if (result < 0) {
+			printf("benchmark_reader: invalid request after %d request(s): %s\n", requests, message);
+
+			packet_reader_destroy(&reader);
+
+			return -1;
+		}
+	}
+
+	duration = microtime() - start;
+
+	benchmark_report("client_framing", "buffer_size", size, requests, duration);
+
+	if (requests != STREAM_REQUESTS || checksum != _stream_checksum ||
+	    packet_reader_get_pending(&reader) != 0) {
+		printf("benchmark_reader: request count mismatch (actual: %d != expected: %d)\n",
+		       requests, STREAM_REQUESTS);
+
+		packet_reader_destroy(&reader);
+
+		return -1;
+	}
+
+	packet_reader_destroy(&reader);
+
+	return 0;
+}
+
+// an invalid header has to be detected, even if it arrives byte by byte
+static int test1(void) {
+	PacketReader reader;
+	PacketHeader header;
+	uint8_t *buffer;
+	int length;
+	int i;
+	int result = 0;
+	Packet *request;
+	const char *message = NULL;
+
+	if (packet_reader_create(&reader, 0) < 0) {
+		printf("test1: packet_reader_create failed\n");
+
+		return -1;
+	}
+
+	memset(&header, 0, sizeof(header));
+
+	header.uid = 2;
+	header.length = 4; // too short
+
+	for (i = 0; i < (int)sizeof(header) && result == 0; ++i) {
+		buffer = packet_reader_get_free(&reader, &length);
+		buffer[0] = ((uint8_t *)&header)[i];
+
+		packet_reader_commit(&reader, 1);
+
+		result = packet_reader_next(&reader, &request, &message);
+
+		if (result != 0 && i < (int)sizeof(header) - 1) {
+			printf("test1: unexpected result %d after %d byte(s)\n", result, i + 1);
+
+			packet_reader_destroy(&reader);
+
+			return -1;
+		}
+	}
+
+	packet_reader_destroy(&reader);
+
+	if (result >= 0 || message == NULL) {
+		printf("test1: invalid header was not detected\n");
+
+		return -1;
+	}
+
+	return 0;
+}
+
+int main(void) {
+	int size;
+
+#ifdef _WIN32
+	fixes_init();
+#endif
+
+	srand(1);
+
+	if (test1() < 0) {
+		return EXIT_FAILURE;
+	}
+
+	if (create_stream() < 0) {
+		return EXIT_FAILURE;
+	}
+
+	if (benchmark_legacy() < 0) {
+		return EXIT_FAILURE;
+	}
+
+	for (size = 512; size <= 65536; size *= 4) {
+		if (benchmark_reader(size) < 0) {
+			return EXIT_FAILURE;
+		}
+	}
+
+	free(_stream);
+
+	printf("success\n");
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,498 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * pending_request_benchmark.c: Benchmark for the response dispatch of the
+ *                              network subsystem
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <daemonlib/config.h>
+#include <daemonlib/node.h>
+#include <daemonlib/packet.h>
+#include <daemonlib/utils.h>
+
+#include "../brickd/client.h"
+#include "../brickd/event_timing.h"
+#include "../brickd/hardware.h"
+#include "../brickd/hmac.h"
+#include "../brickd/metrics_server.h"
+#include "../brickd/network.h"
+#ifndef _WIN32
+	#include "../brickd/network_shard.h"
+#endif
+#include "../brickd/packet_buffer.h"
+#include "../brickd/packet_trace.h"
+#include "../brickd/traffic_capture.h"
+#include "../brickd/websocket.h"
+#include "../brickd/zombie.h"
+
+#include "benchmark.h"
+
+#define BATCH 1000 // requests in flight per round
+#define ROUNDS 2000
+#define CALLBACKS 2000000
+#define BACKGROUND_UID_BASE 0x10000000
+#define ACTIVE_UID_COUNT 64
+
+static IO _io;
+static uint32_t _dispatched_responses = 0;
+
+// the network subsystem is linked as is, everything around it is replaced by
+// stubs. all options have their zero value: no authentication, no pending
+// request expiry and no response coalescing
+const ConfigOptionValue *config_get_option_value(const char *name) {
+	static const ConfigOptionValue value;
+
+	(void)name;
+
+	return &value;
+}
+
+uint32_t get_random_uint32(void) {
+	return 0;
+}
+
+// a server socket has to exist for the network subsystem to start
+void socket_open_server(Array *sockets, const char *address, uint16_t port,
+                        bool dual_stack, SocketCreateAllocatedFunction create_allocated) {
+	Socket *socket = array_append(sockets);
+
+	(void)address;
+	(void)port;
+	(void)dual_stack;
+	(void)create_allocated;
+
+	memset(socket, 0, sizeof(*socket));
+}
+
+Socket *socket_create_allocated(void) {
+	return NULL;
+}
+
+void socket_destroy(Socket *socket) {
+	(void)socket;
+}
+
+Socket *socket_accept(Socket *socket, struct sockaddr *address, socklen_t *length) {
+	(void)socket;
+	(void)address;
+	(void)length;
+
+	return NULL;
+}
+
+int socket_address_to_hostname(struct sockaddr *address, socklen_t address_length,
+                               char *hostname, int hostname_length,
+                               char *port, int port_length) {
+	(void)address;
+	(void)address_length;
+	(void)hostname;
+	(void)hostname_length;
+	(void)port;
+	(void)port_length;
+
+	return -1;
+}
+
+Socket *websocket_create_allocated(void) {
+	return NULL;
+}
+
+int event_timing_add_source(IOHandle handle, EventSourceType type, const char *name,
+                            uint32_t events, EventFunction function, void *opaque) {
+	(void)handle;
+	(void)type;
+	(void)name;
+	(void)events;
+	(void)function;
+	(void)opaque;
+
+	return 0;
+}
+
+void event_timing_remove_source(IOHandle handle, EventSourceType type) {
+	(void)handle;
+	(void)type;
+}
+
+int event_timing_create_timer(Timer *timer, const char *name, TimerFunction function, void *opaque) {
+	(void)timer;
+	(void)name;
+	(void)function;
+	(void)opaque;
+
+	return 0;
+}
+
+void event_timing_destroy_timer(Timer *timer) {
+	(void)timer;
+}
+
+int timer_configure(Timer *timer, uint64_t delay, uint64_t interval) {
+	(void)timer;
+	(void)delay;
+	(void)interval;
+
+	return 0;
+}
+
+int metrics_server_init(void) {
+	return 0;
+}
+
+void metrics_server_exit(void) {
+}
+
+#ifndef _WIN32
+
+int network_shard_init(int count) {
+	(void)count;
+
+	return 0;
+}
+
+void network_shard_exit(void) {
+}
+
+int network_shard_get_count(void) {
+	return 0;
+}
+
+Client *network_shard_create_client(const char *name, Socket *socket, bool packet_writes) {
+	(void)name;
+	(void)socket;
+	(void)packet_writes;
+
+	return NULL;
+}
+
+#endif
+
+Stack *hardware_get_route(uint32_t uid) {
+	(void)uid;
+
+	return NULL;
+}
+
+void hardware_record_response_latency(uint32_t uid, uint64_t latency) {
+	(void)uid;
+	(void)latency;
+}
+
+uint32_t packet_trace_get_current_id(void) {
+	return 0;
+}
+
+bool traffic_capture_is_enabled(void) {
+	return false;
+}
+
+void traffic_capture_record(TrafficCaptureRecordType type, uint32_t client,
+                            uint32_t stack, Packet *packet) {
+	(void)type;
+	(void)client;
+	(void)stack;
+	(void)packet;
+}
+
+void packet_buffer_unref(PacketBuffer *buffer) {
+	(void)buffer;
+}
+
+void packet_buffer_free_pool(void) {
+}
+
+void packet_buffer_get_usage(int *live, int *pooled) {
+	*live = 0;
+	*pooled = 0;
+}
+
+int zombie_create(Zombie *zombie, Client *client) {
+	(void)zombie;
+	(void)client;
+
+	return -1;
+}
+
+void zombie_destroy(Zombie *zombie) {
+	(void)zombie;
+}
+
+void zombie_dispatch_response(Zombie *zombie, PendingRequest *pending_request,
+                              Packet *response) {
+	(void)zombie;
+	(void)pending_request;
+	(void)response;
+}
+
+// the client only keeps the parts the network subsystem looks at
+int client_create(Client *client, const char *name, IO *io,
+                  uint32_t authentication_nonce,
+                  ClientDestroyDoneFunction destroy_done) {
+	(void)authentication_nonce;
+	(void)destroy_done;
+
+	memset(client, 0, sizeof(*client));
+
+	string_copy(client->name, sizeof(client->name), name, -1);
+
+	client->io = io;
+
+	node_reset(&client->pending_request_sentinel);
+
+	return 0;
+}
+
+const char *client_get_authentication_state_name(ClientAuthenticationState state) {
+	(void)state;
+
+	return "disabled";
+}
+
+bool client_is_subscribed_to_callback(Client *client, Packet *callback) {
+	(void)client;
+	(void)callback;
+
+	return true;
+}
+
+// same as in client.c
+void pending_request_remove_and_free(PendingRequest *pending_request) {
+	network_remove_pending_request(pending_request);
+	node_remove(&pending_request->client_node);
+
+	if (pending_request->client != NULL) {
+		--pending_request->client->pending_request_count;
+	}
+
+	network_free_pending_request(pending_request);
+}
+
+void client_destroy(Client *client) {
+	PendingRequest *pending_request;
+
+	while (client->pending_request_sentinel.next != &client->pending_request_sentinel) {
+		pending_request = containerof(client->pending_request_sentinel.next, PendingRequest, client_node);
+
+		pending_request_remove_and_free(pending_request);
+	}
+}
+
+void client_dispatch_response(Client *client, PendingRequest *pending_request,
+                              Packet *response, PacketBuffer **response_buffer,
+                              bool force, bool ignore_authentication) {
+	(void)client;
+	(void)response;
+	(void)response_buffer;
+	(void)force;
+	(void)ignore_authentication;
+
+	if (pending_request != NULL) {
+		pending_request_remove_and_free(pending_request);
+	}
+
+	++_dispatched_responses;
+}
+
+void client_flush_responses(Client *client) {
+	(void)client;
+}
+
+void client_get_write_statistics(uint32_t *write_count, uint32_t *response_count) {
+	*write_count = 0;
+	*response_count = 0;
+}
+
+void client_collect_metrics(Client *client, Metrics *metrics) {
+	(void)client;
+	(void)metrics;
+}
+
+static void create_request(Packet *request, uint32_t uid, uint8_t function_id,
+                           uint8_t sequence_number) {
+	memset(&request->header, 0, sizeof(request->header));
+
+	request->header.uid = uint32_to_le(uid);
+	request->header.length = sizeof(PacketHeader);
+	request->header.function_id = function_id;
+
+	packet_header_set_sequence_number(&request->header, sequence_number);
+	packet_header_set_response_expected(&request->header, true);
+}
+
+// matched responses while other pending requests wait in the background,
+// e.g. for devices that are slow to respond
+static int benchmark_response(int background) {
+	Client *background_client;
+	Client *client;
+	Packet requests[BATCH];
+	Packet request;
+	int round;
+	int i;
+	uint64_t start;
+	uint64_t duration = 0;
+	int result = -1;
+
+	if (network_init() < 0) {
+		printf("benchmark_response: network_init failed\n");
+
+		return -1;
+	}
+
+	background_client = network_create_client("background", &_io);
+	client = network_create_client("benchmark", &_io);
+
+	if (background_client == NULL || client == NULL) {
+		printf("benchmark_response: network_create_client failed\n");
+
+		goto cleanup;
+	}
+
+	for (i = 0; i < background; ++i) {
+		create_request(&request, BACKGROUND_UID_BASE + i, 1, 1 + i % 15);
+
+		if (network_client_expects_response(background_client, &request) == NULL) {
+			printf("benchmark_response: network_client_expects_response failed\n");
+
+			goto cleanup;
+		}
+	}
+
+	for (i = 0; i < BATCH; ++i) {
+		create_request(&requests[i], 1 + i % ACTIVE_UID_COUNT, 1 + i % 4, 1 + i % 15);
+	}
+
+	_dispatched_responses = 0;
+
+	for (round = 0; round < ROUNDS; ++round) {
+		for (i = 0; i < BATCH; ++i) {
+			if (network_client_expects_response(client, &requests[i]) == NULL) {
+				printf("benchmark_response: network_client_expects_response failed\n");
+
+				goto cleanup;
+			}
+		}
+
+		start = microtime();
+
+		// this is what happens for every response received from a stack
+		for (i = 0; i < BATCH; ++i) {
+			network_dispatch_response(&requests[i]);
+		}
+
+		duration += microtime() - start;
+	}
+
+	benchmark_report("network_dispatch_response", "pending_requests", background,
+	                 (uint64_t)ROUNDS * BATCH, duration);
+
+	if (_dispatched_responses != (uint32_t)ROUNDS * BATCH ||
+	    client->pending_request_count != 0 ||
+	    background_client->pending_request_count != background) {
+		printf("benchmark_response: response count mismatch (actual: %u != expected: %d)\n",
+		       _dispatched_responses, ROUNDS * BATCH);
+
+		goto cleanup;
+	}
+
+	result = 0;
+
+cleanup:
+	network_exit();
+
+	return result;
+}
+
+// callbacks are broadcast, they don't match a pending request
+static int benchmark_callback(void) {
+	Packet callback;
+	int i;
+	uint64_t start;
+	uint64_t duration;
+	int result = -1;
+
+	if (network_init() < 0) {
+		printf("benchmark_callback: network_init failed\n");
+
+		return -1;
+	}
+
+	if (network_create_client("benchmark", &_io) == NULL) {
+		printf("benchmark_callback: network_create_client failed\n");
+
+		goto cleanup;
+	}
+
+	create_request(&callback, 1, 100, 0);
+
+	_dispatched_responses = 0;
+
+	start = microtime();
+
+	for (i = 0; i < CALLBACKS; ++i) {
+		network_dispatch_response(&callback);
+	}
+
+	duration = microtime() - start;
+
+	benchmark_report("network_dispatch_callback", "clients", 1, CALLBACKS, duration);
+
+	if (_dispatched_responses != CALLBACKS) {
+		printf("benchmark_callback: callback count mismatch (actual: %u != expected: %d)\n",
+		       _dispatched_responses, CALLBACKS);
+
+		goto cleanup;
+	}
+
+	result = 0;
+
+cleanup:
+	network_exit();
+
+	return result;
+}
+
+int main(void) {
+	static const int backgrounds[] = {0, 1000, 32000};
+	int i;
+
+#ifdef _WIN32
+	fixes_init();
+#endif
+
+	memset(&_io, 0, sizeof(_io));
+
+	_io.type = "benchmark";
+
+	for (i = 0; i < (int)(sizeof(backgrounds) / sizeof(backgrounds[0])); ++i) {
+		if (benchmark_response(backgrounds[i]) < 0) {
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (benchmark_callback() < 0) {
+		return EXIT_FAILURE;
+	}
+
+	printf("success\n");
+
+	return EXIT_SUCCESS;
+}
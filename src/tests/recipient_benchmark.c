@@ -0,0 +1,272 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * recipient_benchmark.c: Tests and benchmark for the recipient index of the
+ *                        Stack type
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <daemonlib/utils.h>
+
+#include "../brickd/hardware.h"
+#include "../brickd/network.h"
+#include "../brickd/stack.h"
+
+#include "benchmark.h"
+
+#define MAX_UIDS 32768
+#define LOOKUPS 10000000
+
+// stack.c reports routes to the hardware subsystem and disconnects to the
+// network subsystem, neither is needed here
+int hardware_add_route(Stack *stack, uint32_t uid) {
+	(void)stack;
+	(void)uid;
+
+	return 0;
+}
+
+void hardware_remove_routes(Stack *stack) {
+	(void)stack;
+}
+
+void network_dispatch_response(Packet *response) {
+	(void)response;
+}
+
+// packet trace and traffic capture are disabled
+uint32_t packet_trace_add_source(PacketTraceSourceType type, const char *name) {
+	(void)type;
+	(void)name;
+
+	return 0;
+}
+
+void packet_trace_remove_source(uint32_t source) {
+	(void)source;
+}
+
+uint32_t packet_trace_get_current_id(void) {
+	return 0;
+}
+
+void packet_trace_record(PacketTraceHop hop, uint32_t trace_id, uint32_t source, Packet *packet) {
+	(void)hop;
+	(void)trace_id;
+	(void)source;
+	(void)packet;
+}
+
+uint32_t traffic_capture_add_source(TrafficCaptureRecordType type, const char *name) {
+	(void)type;
+	(void)name;
+
+	return 0;
+}
+
+static int dispatch_request(Stack *stack, Packet *request, Recipient *recipient) {
+	(void)stack;
+	(void)request;
+	(void)recipient;
+
+	return 0;
+}
+
+static uint32_t _uids[MAX_UIDS];
+static int _present[MAX_UIDS];
+
+static int validate_recipients(int test, Stack *stack) {
+	int i;
+	int count = 0;
+	Recipient *recipient;
+
+	for (i = 0; i < MAX_UIDS; ++i) {
+		recipient = stack_get_recipient(stack, _uids[i]);
+
+		if (_present[i]) {
+			++count;
+
+			if (recipient == NULL) {
+				printf("test%d: recipient %u is missing\n", test, _uids[i]);
+
+				return -1;
+			}
+
+			if (recipient->opaque != (uint64_t)_present[i]) {
+				printf("test%d: recipient %u opaque mismatch (actual: %u != expected: %d)\n",
+				       test, _uids[i], (uint32_t)recipient->opaque, _present[i]);
+
+				return -1;
+			}
+		} else if (recipient != NULL) {
+			printf("test%d: recipient %u should be missing\n", test, _uids[i]);
+
+			return -1;
+		}
+	}
+
+	if (stack->recipients.count != count) {
+		printf("test%d: count mismatch (actual: %d != expected: %d)\n",
+		       test, stack->recipients.count, count);
+
+		return -1;
+	}
+
+	return 0;
+}
+
+// random add, update and remove operations against a reference array
+static int test1(void) {
+	Stack stack;
+	int result = -1;
+	int round;
+	int i;
+
+	if (stack_create(&stack, "test1", dispatch_request) < 0) {
+		printf("test1: stack_create failed\n");
+
+		return -1;
+	}
+
+	for (i = 0; i < MAX_UIDS; ++i) {
+		_uids[i] = (uint32_t)(i + 1) * 2654435761u; // unique and never 0
+		_present[i] = 0;
+	}
+
+	for (round = 0; round < 200000; ++round) {
+		i = rand() % MAX_UIDS;
+
+		if (rand() % 3 == 0) {
+			stack_remove_recipient(&stack, _uids[i]);
+
+			_present[i] = 0;
+		} else {
+			if (stack_add_recipient(&stack, _uids[i], round + 1) < 0) {
+				printf("test1: stack_add_recipient failed\n");
+
+				goto cleanup;
+			}
+
+			_present[i] = round + 1;
+		}
+
+		if (round % 10000 == 0 && validate_recipients(1, &stack) < 0) {
+			goto cleanup;
+		}
+	}
+
+	if (validate_recipients(1, &stack) < 0) {
+		goto cleanup;
+	}
+
+	stack_clear_recipients(&stack);
+
+	for (i = 0; i < MAX_UIDS; ++i) {
+		_present[i] = 0;
+	}
+
+	if (validate_recipients(1, &stack) < 0) {
+		goto cleanup;
+	}
+
+	result = 0;
+
+cleanup:
+	stack_destroy(&stack);
+
+	return result;
+}
+
+// lookup throughput for different stack sizes
+static int benchmark(int count) {
+	Stack stack;
+	int i;
+	uint64_t start;
+	uint64_t get_duration;
+	uint64_t add_duration;
+	int found = 0;
+
+	if (stack_create(&stack, "benchmark", dispatch_request) < 0) {
+		printf("benchmark: stack_create failed\n");
+
+		return -1;
+	}
+
+	for (i = 0; i < count; ++i) {
+		_uids[i] = (uint32_t)rand() | 1;
+
+		if (stack_add_recipient(&stack, _uids[i], i) < 0) {
+			printf("benchmark: stack_add_recipient failed\n");
+
+			stack_destroy(&stack);
+
+			return -1;
+		}
+	}
+
+	start = microtime();
+
+	for (i = 0; i < LOOKUPS; ++i) {
+		if (stack_get_recipient(&stack, _uids[i % count]) != NULL) {
+			++found;
+		}
+	}
+
+	get_duration = microtime() - start;
+	start = microtime();
+
+	// this is what happens for every response received from a stack
+	for (i = 0; i < LOOKUPS; ++i) {
+		stack_add_recipient(&stack, _uids[i % count], i);
+	}
+
+	add_duration = microtime() - start;
+
+	benchmark_report("stack_get_recipient", "recipients", count, LOOKUPS, get_duration);
+	benchmark_report("stack_add_recipient", "recipients", count, LOOKUPS, add_duration);
+
+	stack_destroy(&stack);
+
+	return found == LOOKUPS ? 0 : -1;
+}
+
+int main(void) {
+	int count;
+
+#ifdef _WIN32
+	fixes_init();
+#endif
+
+	srand(1);
+
+	if (test1() < 0) {
+		return EXIT_FAILURE;
+	}
+
+	for (count = 1; count <= MAX_UIDS; count *= 8) {
+		if (benchmark(count) < 0) {
+			return EXIT_FAILURE;
+		}
+	}
+
+	printf("success\n");
+
+	return EXIT_SUCCESS;
+}
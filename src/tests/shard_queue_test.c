@@ -0,0 +1,209 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * shard_queue_test.c: Tests for the ShardQueue type
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+	#include <windows.h>
+#else
+	#include <sched.h>
+#endif
+
+#include <daemonlib/threads.h>
+#include <daemonlib/utils.h>
+
+#include "../brickd/shard_queue.h"
+
+#define TEST1_RECORDS 1000000
+#define TEST1_QUEUE_SIZE 4096
+
+// the other side might run on the same CPU, let it make progress
+static void test1_yield(void) {
+#ifdef _WIN32
+	SwitchToThread();
+#else
+	sched_yield();
+#endif
+}
+
+static int test1_get_length(uint32_t i) {
+	return (int)((i * 2654435761u) >> 24) % 300;
+}
+
+static uint8_t test1_get_byte(uint32_t i, int k) {
+	return (uint8_t)(i * 31 + k);
+}
+
+// the producer pushes records of varying length as fast as possible, so the
+// queue is full most of the time and records wrap around the buffer end
+static void test1_producer(void *opaque) {
+	ShardQueue *queue = opaque;
+	ShardQueueRecord *record;
+	uint32_t i;
+	int length;
+	int k;
+
+	for (i = 0; i < TEST1_RECORDS; ++i) {
+		length = test1_get_length(i);
+
+		while ((record = shard_queue_reserve(queue, length)) == NULL) {
+			test1_yield();
+		}
+
+		record->id = i;
+		record->type = 1;
+
+		for (k = 0; k < length; ++k) {
+			record->data[k] = test1_get_byte(i, k);
+		}
+
+		shard_queue_commit(queue);
+	}
+}
+
+static int test1(void) {
+	ShardQueue queue;
+	ShardQueueRecord *record;
+	Thread thread;
+	uint32_t i;
+	int k;
+	uint64_t start;
+	uint64_t duration;
+
+	if (shard_queue_create(&queue, TEST1_QUEUE_SIZE) < 0) {
+		printf("test1: shard_queue_create failed\n");
+
+		return -1;
+	}
+
+	start = microtime();
+
+	thread_create(&thread, test1_producer, &queue);
+
+	for (i = 0; i < TEST1_RECORDS; ++i) {
+		while ((record = shard_queue_peek(&queue)) == NULL) {
+			test1_yield();
+		}
+
+		if (record->id != i || record->type != 1 || record->length != test1_get_length(i)) {
+			printf("test1: record %u mismatch (id: %u, type: %u, length: %u)\n",
+			       i, record->id, record->type, record->length);
+
+			return -1;
+		}
+
+		for (k = 0; k < record->length; ++k) {
+			if (record->data[k] != test1_get_byte(i, k)) {
+				printf("test1: record %u content mismatch at byte %d\n", i, k);
+
+				return -1;
+			}
+		}
+
+		shard_queue_pop(&queue);
+	}
+
+	thread_join(&thread);
+	thread_destroy(&thread);
+
+	duration = microtime() - start;
+
+	if (shard_queue_peek(&queue) != NULL) {
+		printf("test1: queue not empty\n");
+
+		return -1;
+	}
+
+	printf("test1: %d records, %.2f ns/record\n", TEST1_RECORDS, duration * 1000.0 / TEST1_RECORDS);
+
+	shard_queue_destroy(&queue);
+
+	return 0;
+}
+
+// commit has to report the transition from empty to non-empty exactly
+static int test2(void) {
+	ShardQueue queue;
+
+	if (shard_queue_create(&queue, 256) < 0) {
+		printf("test2: shard_queue_create failed\n");
+
+		return -1;
+	}
+
+	if (shard_queue_reserve(&queue, 200) != NULL) {
+		printf("test2: oversized record was accepted\n");
+
+		return -1;
+	}
+
+	shard_queue_reserve(&queue, 8);
+
+	if (!shard_queue_commit(&queue)) {
+		printf("test2: first commit did not report an empty queue\n");
+
+		return -1;
+	}
+
+	shard_queue_reserve(&queue, 8);
+
+	if (shard_queue_commit(&queue)) {
+		printf("test2: second commit reported an empty queue\n");
+
+		return -1;
+	}
+
+	shard_queue_peek(&queue);
+	shard_queue_pop(&queue);
+	shard_queue_peek(&queue);
+	shard_queue_pop(&queue);
+
+	shard_queue_reserve(&queue, 8);
+
+	if (!shard_queue_commit(&queue)) {
+		printf("test2: commit after draining did not report an empty queue\n");
+
+		return -1;
+	}
+
+	shard_queue_destroy(&queue);
+
+	return 0;
+}
+
+int main(void) {
+#ifdef _WIN32
+	fixes_init();
+#endif
+
+	if (test1() < 0) {
+		return EXIT_FAILURE;
+	}
+
+	if (test2() < 0) {
+		return EXIT_FAILURE;
+	}
+
+	printf("success\n");
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,273 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * spitfp_benchmark.c: Benchmark for the SPITFP receive path of the
+ *                     BrickletStack type
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <daemonlib/utils.h>
+
+// the SPITFP parser is static, include it to benchmark it without SPI hardware
+#include "../brickd/bricklet_stack.c"
+
+#include "benchmark.h"
+
+#define MESSAGES 2000000
+#define FRAME_COUNT 14 // one frame per sequence number from 2 to 15
+
+// the SPI transfer and the notification of the main thread are done by the
+// platform code, none of it is used by the parser
+int bricklet_stack_create_platform(BrickletStack *bricklet_stack) {
+	(void)bricklet_stack;
+
+	return 0;
+}
+
+void bricklet_stack_destroy_platform(BrickletStack *bricklet_stack) {
+	(void)bricklet_stack;
+}
+
+int bricklet_stack_chip_select_gpio(BrickletStack *bricklet_stack, bool enable) {
+	(void)bricklet_stack;
+	(void)enable;
+
+	return 0;
+}
+
+int bricklet_stack_notify(BrickletStack *bricklet_stack) {
+	(void)bricklet_stack;
+
+	return 0;
+}
+
+int bricklet_stack_wait(BrickletStack *bricklet_stack) {
+	(void)bricklet_stack;
+
+	return 0;
+}
+
+int bricklet_stack_spi_transceive(BrickletStack *bricklet_stack, uint8_t *write_buffer,
+                                  uint8_t *read_buffer, int length) {
+	(void)bricklet_stack;
+	(void)write_buffer;
+	(void)read_buffer;
+	(void)length;
+
+	return 0;
+}
+
+int event_timing_add_source(IOHandle handle, EventSourceType type, const char *name,
+                            uint32_t events, EventFunction function, void *opaque) {
+	(void)handle;
+	(void)type;
+	(void)name;
+	(void)events;
+	(void)function;
+	(void)opaque;
+
+	return 0;
+}
+
+void event_timing_remove_source(IOHandle handle, EventSourceType type) {
+	(void)handle;
+	(void)type;
+}
+
+int hardware_add_stack(Stack *stack) {
+	(void)stack;
+
+	return 0;
+}
+
+int hardware_remove_stack(Stack *stack) {
+	(void)stack;
+
+	return 0;
+}
+
+int hardware_add_route(Stack *stack, uint32_t uid) {
+	(void)stack;
+	(void)uid;
+
+	return 0;
+}
+
+void hardware_remove_routes(Stack *stack) {
+	(void)stack;
+}
+
+void network_dispatch_response(Packet *response) {
+	(void)response;
+}
+
+// packet trace and traffic capture are disabled
+uint32_t packet_trace_add_source(PacketTraceSourceType type, const char *name) {
+	(void)type;
+	(void)name;
+
+	return 0;
+}
+
+void packet_trace_remove_source(uint32_t source) {
+	(void)source;
+}
+
+uint32_t packet_trace_get_current_id(void) {
+	return 0;
+}
+
+void packet_trace_record(PacketTraceHop hop, uint32_t trace_id, uint32_t source, Packet *packet) {
+	(void)hop;
+	(void)trace_id;
+	(void)source;
+	(void)packet;
+}
+
+uint32_t traffic_capture_add_source(TrafficCaptureRecordType type, const char *name) {
+	(void)type;
+	(void)name;
+
+	return 0;
+}
+
+static BrickletStack _bricklet_stack;
+static uint8_t _frames[FRAME_COUNT][SPITFP_MAX_TFP_MESSAGE_LENGTH];
+
+// creates a SPITFP frame carrying a valid response, as a Bricklet sends it
+static void create_frame(uint8_t *frame, int payload_length, uint8_t sequence_number) {
+	Packet response;
+	uint8_t checksum = 0;
+	int length = sizeof(PacketHeader) + payload_length;
+	int i;
+
+	memset(&response, 0, sizeof(response));
+
+	response.header.uid = uint32_to_le(0x12345678);
+	response.header.length = (uint8_t)length;
+	response.header.function_id = 1;
+
+	packet_header_set_sequence_number(&response.header, 1 + sequence_number % 15);
+	packet_header_set_response_expected(&response.header, true);
+
+	memset(response.payload, sequence_number, payload_length);
+
+	frame[0] = (uint8_t)(length + SPITFP_PROTOCOL_OVERHEAD);
+	frame[1] = sequence_number; // the Bricklet has not seen any message yet
+	memcpy(frame + 2, &response, length);
+
+	for (i = 0; i < length + 2; ++i) {
+		PEARSON(checksum, frame[i]);
+	}
+
+	frame[length + 2] = checksum;
+}
+
+static int benchmark(int payload_length) {
+	int i;
+	int k;
+	int handled = 0;
+	uint8_t *frame;
+	uint64_t start;
+	uint64_t duration;
+
+	for (i = 0; i < FRAME_COUNT; ++i) {
+		create_frame(_frames[i], payload_length, (uint8_t)(2 + i));
+	}
+
+	start = microtime();
+
+	for (i = 0; i < MESSAGES; ++i) {
+		frame = _frames[i % FRAME_COUNT];
+
+		// this is what the SPI thread does for every received frame
+		for (k = 0; k < frame[0]; ++k) {
+			ringbuffer_add(&_bricklet_stack.ringbuffer_recv, frame[k]);
+		}
+
+		bricklet_stack_check_message(&_bricklet_stack);
+
+		if (_bricklet_stack.response_queue.count > 0) {
+			queue_pop(&_bricklet_stack.response_queue, NULL);
+
+			++handled;
+		}
+
+		// the ACK was transferred with the next SPI transceive
+		_bricklet_stack.buffer_send_length = 0;
+	}
+
+	duration = microtime() - start;
+
+	benchmark_report("bricklet_stack_check_message", "payload_length", payload_length,
+	                 MESSAGES, duration);
+
+	if (handled != MESSAGES || ringbuffer_get_used(&_bricklet_stack.ringbuffer_recv) != 0) {
+		printf("benchmark: message count mismatch (actual: %d != expected: %d)\n",
+		       handled, MESSAGES);
+
+		return -1;
+	}
+
+	return 0;
+}
+
+int main(void) {
+	int payload_length;
+	int result = EXIT_SUCCESS;
+
+	memset(&_bricklet_stack, 0, sizeof(_bricklet_stack));
+
+	_bricklet_stack.config.position = 'a';
+
+	ringbuffer_init(&_bricklet_stack.ringbuffer_recv, BRICKLET_STACK_SPI_RECEIVE_BUFFER_LENGTH,
+	                _bricklet_stack.buffer_recv);
+
+	if (queue_create(&_bricklet_stack.request_queue, sizeof(Packet)) < 0 ||
+	    queue_create(&_bricklet_stack.response_queue, sizeof(Packet)) < 0) {
+		printf("main: queue_create failed\n");
+
+		return EXIT_FAILURE;
+	}
+
+	mutex_create(&_bricklet_stack.request_queue_mutex);
+	mutex_create(&_bricklet_stack.response_queue_mutex);
+
+	for (payload_length = 0; payload_length <= TFP_MESSAGE_MAX_LENGTH - (int)sizeof(PacketHeader);
+	     payload_length += 24) {
+		if (benchmark(payload_length) < 0) {
+			result = EXIT_FAILURE;
+
+			break;
+		}
+	}
+
+	mutex_destroy(&_bricklet_stack.response_queue_mutex);
+	mutex_destroy(&_bricklet_stack.request_queue_mutex);
+
+	queue_destroy(&_bricklet_stack.response_queue, NULL);
+	queue_destroy(&_bricklet_stack.request_queue, NULL);
+
+	if (result == EXIT_SUCCESS) {
+		printf("success\n");
+	}
+
+	return result;
+}
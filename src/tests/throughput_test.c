@@ -38,7 +38,8 @@ USB 2.0: 1.999 msec per getter
 
 */
 
-int main(void) {
+int main(int argc, char **argv) {
+	const char *uid = "6wwv71";
 	IPConnection ipcon;
 	Master master;
 	int i;
@@ -46,12 +47,18 @@ int main(void) {
 	uint16_t voltage;
 	uint64_t start, stop;
 
+	// a virtual stack can be used instead of a real Master Brick, its first
+	// device has the UID pHNvw
+	if (argc > 1) {
+		uid = argv[1];
+	}
+
 #ifdef _WIN32
 	fixes_init();
 #endif
 
 	ipcon_create(&ipcon);
-	master_create(&master, "6wwv71", &ipcon);
+	master_create(&master, uid, &ipcon);
 
 	if (ipcon_connect(&ipcon, "localhost", 4223) < 0) {
 		printf("error 1\n");
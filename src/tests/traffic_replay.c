@@ -0,0 +1,726 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * traffic_replay.c: Replays the requests of a traffic capture against brickd
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * the traffic replay plays the client side of a traffic capture written by
+ * the traffic_capture.filename option of the Brick Daemon, the replay stack
+ * of the Brick Daemon can play the device side. each recorded client gets
+ * its own connection. the recorded requests are sent unmodified at their
+ * recorded time, scaled by the speed, and are matched to their responses by
+ * sequence number.
+ *
+ * a request is held back while an earlier request of the same connection
+ * with the same sequence number is still waiting for its response. with a
+ * speed of 0 this limits each connection to 15 requests in flight.
+ *
+ * the result is printed as JSON to stdout, progress messages go to stderr.
+ * recorded authentication requests are sent as is and fail, because the
+ * nonces differ, so captures of authenticated clients cannot be replayed.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+	#include <winsock2.h>
+	#include <ws2tcpip.h>
+#else
+	#include <fcntl.h>
+	#include <netdb.h>
+	#include <netinet/in.h>
+	#include <netinet/tcp.h>
+	#include <poll.h>
+	#include <sys/socket.h>
+	#include <unistd.h>
+#endif
+
+#include <daemonlib/packet.h>
+#include <daemonlib/utils.h>
+
+#include "../brickd/byte_order.h"
+#include "../brickd/latency_histogram.h"
+#include "../brickd/traffic_capture.h"
+
+#ifdef _WIN32
+	#define poll WSAPoll
+	#define close_socket closesocket
+	typedef SOCKET SocketHandle;
+	#define INVALID_SOCKET_HANDLE INVALID_SOCKET
+#else
+	#define close_socket close
+	typedef int SocketHandle;
+	#define INVALID_SOCKET_HANDLE -1
+#endif
+
+#define MAX_SEQUENCE_NUMBER 15
+#define SEND_BUFFER_SIZE 16384 // bytes
+
+typedef struct {
+	uint64_t offset; // recorded time since the first request in microseconds
+	Packet request;
+} ReplayRequest;
+
+typedef struct {
+	uint32_t client; // recorded client ID
+	SocketHandle handle;
+	ReplayRequest *requests;
+	int request_count;
+	int request_allocated;
+	int next_request;
+	uint64_t in_flight[MAX_SEQUENCE_NUMBER + 1]; // send time by sequence number, 0 marks a free one
+	int in_flight_count;
+	uint8_t receive_buffer[4096];
+	int receive_buffer_used;
+	uint8_t send_buffer[SEND_BUFFER_SIZE];
+	int send_buffer_used;
+} Connection;
+
+static const char *_host = "localhost";
+static const char *_port = "4223";
+static const char *_capture = NULL;
+static int _speed = 100; // percent, 0 sends as fast as possible
+static int _timeout = 2500; // milliseconds
+
+static Connection *_connections;
+static int _connection_count;
+static struct pollfd *_pollfds;
+static uint64_t _recorded_duration; // microseconds
+static uint64_t _sent;
+static uint64_t _responses;
+static uint64_t _errors;
+static uint64_t _timeouts;
+static uint64_t _callbacks;
+static uint64_t _max_send_lag; // microseconds
+static LatencyHistogram _latency;
+
+static void print_usage(const char *binary) {
+	fprintf(stderr,
+	        "Usage: %s --capture <file> [options]\n"
+	        "\n"
+	        "Options:\n"
+	        "  --capture <file>             traffic capture written by brickd\n"
+	        "  --host <host>                Brick Daemon host (default: localhost)\n"
+	        "  --port <port>                Brick Daemon port (default: 4223)\n"
+	        "  --speed <percent>            replay speed in percent of the recorded\n"
+	        "                               speed, 0 sends as fast as possible (default: 100)\n"
+	        "  --timeout <milliseconds>     response timeout (default: 2500)\n",
+	        binary);
+}
+
+static int parse_integer(const char *string, int min, int max, int *value) {
+	char *end = NULL;
+	long result;
+
+	errno = 0;
+	result = strtol(string, &end, 10);
+
+	if (errno != 0 || end == string || *end != '\0' || result < min || result > max) {
+		return -1;
+	}
+
+	*value = (int)result;
+
+	return 0;
+}
+
+static int parse_arguments(int argc, char **argv) {
+	int i;
+	const char *name;
+	const char *value;
+	int result = 0;
+
+	for (i = 1; i < argc; i += 2) {
+		name = argv[i];
+
+		if (i + 1 >= argc) {
+			fprintf(stderr, "Missing value for option '%s'\n", name);
+
+			return -1;
+		}
+
+		value = argv[i + 1];
+
+		if (strcmp(name, "--capture") == 0) {
+			_capture = value;
+		} else if (strcmp(name, "--host") == 0) {
+			_host = value;
+		} else if (strcmp(name, "--port") == 0) {
+			_port = value;
+		} else if (strcmp(name, "--speed") == 0) {
+			result = parse_integer(value, 0, 100000, &_speed);
+		} else if (strcmp(name, "--timeout") == 0) {
+			result = parse_integer(value, 1, 3600000, &_timeout);
+		} else {
+			fprintf(stderr, "Unknown option '%s'\n", name);
+
+			return -1;
+		}
+
+		if (result < 0) {
+			fprintf(stderr, "Invalid value '%s' for option '%s'\n", value, name);
+
+			return -1;
+		}
+	}
+
+	if (_capture == NULL) {
+		fprintf(stderr, "Missing option '--capture'\n");
+
+		return -1;
+	}
+
+	return 0;
+}
+
+static Connection *get_connection(uint32_t client) {
+	int i;
+	Connection *connections;
+
+	for (i = 0; i < _connection_count; ++i) {
+		if (_connections[i].client == client) {
+			return &_connections[i];
+		}
+	}
+
+	connections = realloc(_connections, (_connection_count + 1) * sizeof(Connection));
+
+	if (connections == NULL) {
+		return NULL;
+	}
+
+	_connections = connections;
+
+	memset(&_connections[_connection_count], 0, sizeof(Connection));
+
+	_connections[_connection_count].client = client;
+	_connections[_connection_count].handle = INVALID_SOCKET_HANDLE;
+
+	return &_connections[_connection_count++];
+}
+
+static int add_request(Connection *connection, uint64_t offset, Packet *request) {
+	ReplayRequest *requests;
+	int allocated;
+
+	if (connection->request_count == connection->request_allocated) {
+		allocated = connection->request_allocated > 0 ? connection->request_allocated * 2 : 256;
+		requests = realloc(connection->requests, allocated * sizeof(ReplayRequest));
+
+		if (requests == NULL) {
+			return -1;
+		}
+
+		connection->requests = requests;
+		connection->request_allocated = allocated;
+	}
+
+	connection->requests[connection->request_count].offset = offset;
+
+	memcpy(&connection->requests[connection->request_count].request, request, request->header.length);
+
+	++connection->request_count;
+
+	return 0;
+}
+
+static int load_capture(void) {
+	FILE *fp;
+	TrafficCaptureHeader header;
+	TrafficCaptureRecordHeader record_header;
+	uint64_t timestamp;
+	uint64_t first_timestamp = 0;
+	bool first = true;
+	Connection *connection;
+	union {
+		Packet packet;
+		uint8_t data[256];
+	} u;
+	int result = -1;
+
+	fp = fopen(_capture, "rb");
+
+	if (fp == NULL) {
+		fprintf(stderr, "Could not open capture '%s': %s\n", _capture, strerror(errno));
+
+		return -1;
+	}
+
+	if (fread(&header, 1, sizeof(header), fp) != sizeof(header) ||
+	    memcmp(header.magic, TRAFFIC_CAPTURE_MAGIC, sizeof(header.magic)) != 0 ||
+	    uint32_from_le(header.version) != TRAFFIC_CAPTURE_VERSION ||
+	    uint32_from_le(header.record_header_size) != sizeof(record_header)) {
+		fprintf(stderr, "Capture '%s' has an invalid or unsupported header\n", _capture);
+
+		goto cleanup;
+	}
+
+	while (fread(&record_header, 1, sizeof(record_header), fp) == sizeof(record_header)) {
+		if (fread(u.data, 1, record_header.length, fp) != record_header.length) {
+			fprintf(stderr, "Capture '%s' is truncated\n", _capture);
+
+			goto cleanup;
+		}
+
+		if (record_header.type != TRAFFIC_CAPTURE_RECORD_REQUEST) {
+			continue;
+		}
+
+		if (record_header.length < sizeof(PacketHeader) ||
+		    record_header.length > sizeof(Packet) ||
+		    record_header.length != u.packet.header.length) {
+			fprintf(stderr, "Capture '%s' contains a malformed request\n", _capture);
+
+			goto cleanup;
+		}
+
+		timestamp = uint64_from_le(record_header.timestamp);
+
+		if (first) {
+			first_timestamp = timestamp;
+			first = false;
+		}
+
+		_recorded_duration = timestamp - first_timestamp;
+		connection = get_connection(uint32_from_le(record_header.client));
+
+		if (connection == NULL || add_request(connection, _recorded_duration, &u.packet) < 0) {
+			fprintf(stderr, "Could not allocate memory for capture '%s'\n", _capture);
+
+			goto cleanup;
+		}
+	}
+
+	if (_connection_count == 0) {
+		fprintf(stderr, "Capture '%s' contains no requests\n", _capture);
+
+		goto cleanup;
+	}
+
+	result = 0;
+
+cleanup:
+	fclose(fp);
+
+	return result;
+}
+
+static int connection_open(Connection *connection, struct addrinfo *address) {
+	int option = 1;
+#ifdef _WIN32
+	u_long non_blocking = 1;
+#endif
+
+	connection->handle = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+
+	if (connection->handle == INVALID_SOCKET_HANDLE) {
+		return -1;
+	}
+
+	if (connect(connection->handle, address->ai_addr, (int)address->ai_addrlen) < 0) {
+		close_socket(connection->handle);
+
+		connection->handle = INVALID_SOCKET_HANDLE;
+
+		return -1;
+	}
+
+	setsockopt(connection->handle, IPPROTO_TCP, TCP_NODELAY, (const char *)&option, sizeof(option));
+
+#ifdef _WIN32
+	ioctlsocket(connection->handle, FIONBIO, &non_blocking);
+#else
+	fcntl(connection->handle, F_SETFL, fcntl(connection->handle, F_GETFL, 0) | O_NONBLOCK);
+#endif
+
+	return 0;
+}
+
+// appends all requests that are due, returns the time in microseconds until
+// the next request is due or UINT64_MAX if nothing is left to send
+static uint64_t connection_send_requests(Connection *connection, uint64_t start, uint64_t now) {
+	ReplayRequest *replay_request;
+	uint64_t due;
+	uint8_t sequence_number;
+	bool response_expected;
+
+	while (connection->next_request < connection->request_count) {
+		replay_request = &connection->requests[connection->next_request];
+		due = start + (_speed > 0 ? replay_request->offset * 100 / _speed : 0);
+
+		if (due > now) {
+			return due - now;
+		}
+
+		sequence_number = packet_header_get_sequence_number(&replay_request->request.header);
+		response_expected = sequence_number != 0 &&
+		                    packet_header_get_response_expected(&replay_request->request.header);
+
+		if ((response_expected && connection->in_flight[sequence_number] != 0) ||
+		    connection->send_buffer_used + replay_request->request.header.length > SEND_BUFFER_SIZE) {
+			// wait for a response or for the send buffer to drain
+			return 1000;
+		}
+
+		memcpy(connection->send_buffer + connection->send_buffer_used,
+		       &replay_request->request, replay_request->request.header.length);
+
+		connection->send_buffer_used += replay_request->request.header.length;
+
+		if (response_expected) {
+			connection->in_flight[sequence_number] = now;
+			++connection->in_flight_count;
+		}
+
+		if (now - due > _max_send_lag) {
+			_max_send_lag = now - due;
+		}
+
+		++_sent;
+		++connection->next_request;
+	}
+
+	return UINT64_MAX;
+}
+
+static int connection_flush(Connection *connection) {
+	int length;
+
+	if (connection->send_buffer_used == 0) {
+		return 0;
+	}
+
+	length = send(connection->handle, (const char *)connection->send_buffer,
+	              connection->send_buffer_used, 0);
+
+	if (length < 0) {
+#ifdef _WIN32
+		if (WSAGetLastError() == WSAEWOULDBLOCK) {
+#else
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+#endif
+			return 0;
+		}
+
+		return -1;
+	}
+
+	memmove(connection->send_buffer, connection->send_buffer + length,
+	        connection->send_buffer_used - length);
+
+	connection->send_buffer_used -= length;
+
+	return 0;
+}
+
+static void handle_packet(Connection *connection, Packet *packet) {
+	uint8_t sequence_number = packet_header_get_sequence_number(&packet->header);
+
+	if (sequence_number == 0) {
+		++_callbacks;
+
+		return;
+	}
+
+	if (connection->in_flight[sequence_number] == 0) {
+		// response after its timeout
+		return;
+	}
+
+	latency_histogram_record(&_latency, microtime() - connection->in_flight[sequence_number]);
+
+	++_responses;
+
+	if (packet_header_get_error_code(&packet->header) != PACKET_E_SUCCESS) {
+		++_errors;
+	}
+
+	connection->in_flight[sequence_number] = 0;
+	--connection->in_flight_count;
+}
+
+static int connection_receive(Connection *connection) {
+	int length;
+	int offset = 0;
+	PacketHeader *header;
+	union {
+		Packet packet;
+		uint8_t buffer[sizeof(Packet)];
+	} u;
+
+	length = recv(connection->handle, (char *)connection->receive_buffer + connection->receive_buffer_used,
+	              sizeof(connection->receive_buffer) - connection->receive_buffer_used, 0);
+
+	if (length == 0) {
+		fprintf(stderr, "Connection closed by Brick Daemon\n");
+
+		return -1;
+	}
+
+	if (length < 0) {
+#ifdef _WIN32
+		if (WSAGetLastError() == WSAEWOULDBLOCK) {
+#else
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+#endif
+			return 0;
+		}
+
+		return -1;
+	}
+
+	connection->receive_buffer_used += length;
+
+	while (connection->receive_buffer_used - offset >= (int)sizeof(PacketHeader)) {
+		header = (PacketHeader *)(connection->receive_buffer + offset);
+
+		if (header->length < sizeof(PacketHeader) || header->length > sizeof(u.buffer)) {
+			fprintf(stderr, "Received response with invalid length %u\n", header->length);
+
+			return -1;
+		}
+
+		if (connection->receive_buffer_used - offset < header->length) {
+			break;
+		}
+
+		// copy the response to get an aligned and complete Packet
+		memcpy(u.buffer, header, header->length);
+
+		handle_packet(connection, &u.packet);
+
+		offset += header->length;
+	}
+
+	memmove(connection->receive_buffer, connection->receive_buffer + offset,
+	        connection->receive_buffer_used - offset);
+
+	connection->receive_buffer_used -= offset;
+
+	return 0;
+}
+
+// frees sequence numbers of requests that did not get a response in time
+static void connection_expire_requests(Connection *connection, uint64_t now) {
+	int i;
+
+	for (i = 1; i <= MAX_SEQUENCE_NUMBER; ++i) {
+		if (connection->in_flight[i] != 0 && now - connection->in_flight[i] > (uint64_t)_timeout * 1000) {
+			connection->in_flight[i] = 0;
+			--connection->in_flight_count;
+
+			++_timeouts;
+		}
+	}
+}
+
+// runs until all requests are sent and all responses are received or expired
+static int run(uint64_t start) {
+	int i;
+	int ready;
+	uint64_t now = start;
+	uint64_t next_expiry = now;
+	uint64_t wait;
+	uint64_t next_due;
+	bool done = false;
+
+	while (!done) {
+		if (now >= next_expiry) {
+			for (i = 0; i < _connection_count; ++i) {
+				connection_expire_requests(&_connections[i], now);
+			}
+
+			next_expiry = now + 100000;
+		}
+
+		wait = 100000;
+		done = true;
+
+		for (i = 0; i < _connection_count; ++i) {
+			next_due = connection_send_requests(&_connections[i], start, now);
+
+			if (next_due < wait) {
+				wait = next_due;
+			}
+
+			if (connection_flush(&_connections[i]) < 0) {
+				fprintf(stderr, "Could not send to Brick Daemon\n");
+
+				return -1;
+			}
+
+			if (_connections[i].next_request < _connections[i].request_count ||
+			    _connections[i].in_flight_count > 0 || _connections[i].send_buffer_used > 0) {
+				done = false;
+			}
+
+			_pollfds[i].fd = _connections[i].handle;
+			_pollfds[i].events = POLLIN | (_connections[i].send_buffer_used > 0 ? POLLOUT : 0);
+			_pollfds[i].revents = 0;
+		}
+
+		if (done) {
+			break;
+		}
+
+		ready = poll(_pollfds, _connection_count, (int)((wait + 999) / 1000));
+
+		if (ready < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			fprintf(stderr, "Could not poll connections\n");
+
+			return -1;
+		}
+
+		for (i = 0; i < _connection_count && ready > 0; ++i) {
+			if (_pollfds[i].revents == 0) {
+				continue;
+			}
+
+			--ready;
+
+			if ((_pollfds[i].revents & (POLLIN | POLLERR | POLLHUP)) != 0 &&
+			    connection_receive(&_connections[i]) < 0) {
+				return -1;
+			}
+		}
+
+		now = microtime();
+	}
+
+	return 0;
+}
+
+static void print_result(double elapsed) {
+	printf("{\n");
+	printf("  \"capture\": \"%s\",\n", _capture);
+	printf("  \"speed_percent\": %d,\n", _speed);
+	printf("  \"connections\": %d,\n", _connection_count);
+	printf("  \"recorded_duration_s\": %.3f,\n", _recorded_duration / 1000000.0);
+	printf("  \"duration_s\": %.3f,\n", elapsed);
+	printf("  \"requests\": %.0f,\n", (double)_sent);
+	printf("  \"responses\": %.0f,\n", (double)_responses);
+	printf("  \"errors\": %.0f,\n", (double)_errors);
+	printf("  \"timeouts\": %.0f,\n", (double)_timeouts);
+	printf("  \"callbacks\": %.0f,\n", (double)_callbacks);
+	printf("  \"max_send_lag_us\": %.0f,\n", (double)_max_send_lag);
+	printf("  \"latency_us\": {\"p50\": %u, \"p90\": %u, \"p99\": %u, \"p999\": %u, \"max\": %u, \"mean\": %.1f}\n",
+	       latency_histogram_get_percentile(&_latency, 0.5),
+	       latency_histogram_get_percentile(&_latency, 0.9),
+	       latency_histogram_get_percentile(&_latency, 0.99),
+	       latency_histogram_get_percentile(&_latency, 0.999),
+	       _latency.max,
+	       _latency.count > 0 ? (double)_latency.sum / _latency.count : 0.0);
+	printf("}\n");
+}
+
+int main(int argc, char **argv) {
+	struct addrinfo hints;
+	struct addrinfo *address = NULL;
+	int i;
+	int exit_code = EXIT_FAILURE;
+	uint64_t start;
+#ifdef _WIN32
+	WSADATA wsa_data;
+
+	fixes_init();
+
+	if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0) {
+		fprintf(stderr, "Could not initialize Windows Sockets\n");
+
+		return EXIT_FAILURE;
+	}
+#endif
+
+	if (parse_arguments(argc, argv) < 0) {
+		print_usage(argv[0]);
+
+		return EXIT_FAILURE;
+	}
+
+	if (load_capture() < 0) {
+		goto cleanup;
+	}
+
+	_pollfds = calloc(_connection_count, sizeof(struct pollfd));
+
+	if (_pollfds == NULL) {
+		fprintf(stderr, "Could not allocate %d connection(s)\n", _connection_count);
+
+		goto cleanup;
+	}
+
+	memset(&hints, 0, sizeof(hints));
+
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	if (getaddrinfo(_host, _port, &hints, &address) != 0) {
+		fprintf(stderr, "Could not resolve %s:%s\n", _host, _port);
+
+		goto cleanup;
+	}
+
+	for (i = 0; i < _connection_count; ++i) {
+		if (connection_open(&_connections[i], address) < 0) {
+			fprintf(stderr, "Could not open connection %d to %s:%s\n",
+			        i + 1, _host, _port);
+
+			goto cleanup;
+		}
+	}
+
+	fprintf(stderr, "Replaying %.3f second(s) of traffic over %d connection(s) at %d%% speed\n",
+	        _recorded_duration / 1000000.0, _connection_count, _speed);
+
+	latency_histogram_reset(&_latency);
+
+	start = microtime();
+
+	if (run(start) < 0) {
+		goto cleanup;
+	}
+
+	print_result((microtime() - start) / 1000000.0);
+
+	exit_code = EXIT_SUCCESS;
+
+cleanup:
+	for (i = 0; i < _connection_count; ++i) {
+		if (_connections[i].handle != INVALID_SOCKET_HANDLE) {
+			close_socket(_connections[i].handle);
+		}
+
+		free(_connections[i].requests);
+	}
+
+	if (address != NULL) {
+		freeaddrinfo(address);
+	}
+
+	free(_pollfds);
+	free(_connections);
+
+	return exit_code;
+}
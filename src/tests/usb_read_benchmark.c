@@ -0,0 +1,369 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * usb_read_benchmark.c: Test and benchmark for the parsing of USB read
+ *                       transfers carrying multiple responses
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <daemonlib/utils.h>
+
+// the read callback is static, include it to test it without USB hardware
+#include "../brickd/usb_stack.c"
+
+#include "benchmark.h"
+
+#define TRANSFERS 1000000
+#define TRANSFER_LENGTH 1024 // same as MAX_BUFFER_LENGTH in usb_transfer.c
+#define RESPONSE_LENGTH 16
+#define MAX_RESPONSE_LENGTH 80 // header, payload and optional data
+#define TEST_TRANSFERS 1000
+#define TEST_TRUNCATION_INTERVAL 100
+#define MAX_RESPONSES (TRANSFER_LENGTH / (int)sizeof(PacketHeader))
+
+// the USB device is never opened, none of the libusb functions is called
+libusb_ref_device_t libusb_ref_device = NULL;
+libusb_unref_device_t libusb_unref_device = NULL;
+libusb_get_bus_number_t libusb_get_bus_number = NULL;
+libusb_get_device_address_t libusb_get_device_address = NULL;
+libusb_open_t libusb_open = NULL;
+libusb_close_t libusb_close = NULL;
+libusb_claim_interface_t libusb_claim_interface = NULL;
+libusb_release_interface_t libusb_release_interface = NULL;
+libusb_clear_halt_t libusb_clear_halt = NULL;
+
+const ConfigOptionValue *config_get_option_value(const char *name) {
+	static const ConfigOptionValue value;
+
+	(void)name;
+
+	return &value;
+}
+
+int event_timing_create_timer(Timer *timer, const char *name, TimerFunction function, void *opaque) {
+	(void)timer;
+	(void)name;
+	(void)function;
+	(void)opaque;
+
+	return 0;
+}
+
+void event_timing_destroy_timer(Timer *timer) {
+	(void)timer;
+}
+
+int timer_configure(Timer *timer, uint64_t delay, uint64_t interval) {
+	(void)timer;
+	(void)delay;
+	(void)interval;
+
+	return 0;
+}
+
+int hardware_add_stack(Stack *stack) {
+	(void)stack;
+
+	return 0;
+}
+
+int hardware_remove_stack(Stack *stack) {
+	(void)stack;
+
+	return 0;
+}
+
+int hardware_add_route(Stack *stack, uint32_t uid) {
+	(void)stack;
+	(void)uid;
+
+	return 0;
+}
+
+void hardware_remove_routes(Stack *stack) {
+	(void)stack;
+}
+
+void usb_handle_events(void) {
+}
+
+void usb_discard_stack(USBStack *usb_stack) {
+	(void)usb_stack;
+}
+
+int usb_get_interface_endpoints(libusb_device_handle *device_handle, int interface_number,
+                                uint8_t *endpoint_in, uint8_t *endpoint_out) {
+	(void)device_handle;
+	(void)interface_number;
+	(void)endpoint_in;
+	(void)endpoint_out;
+
+	return -1;
+}
+
+int usb_get_device_name(libusb_device_handle *device_handle, char *name, int length) {
+	(void)device_handle;
+	(void)name;
+	(void)length;
+
+	return -1;
+}
+
+const char *usb_get_error_name(int error_code) {
+	(void)error_code;
+
+	return "<unknown>";
+}
+
+int usb_transfer_create(USBTransfer *usb_transfer, USBStack *usb_stack,
+                        USBTransferType type, USBTransferFunction function) {
+	(void)usb_transfer;
+	(void)usb_stack;
+	(void)type;
+	(void)function;
+
+	return -1;
+}
+
+void usb_transfer_destroy(USBTransfer *usb_transfer) {
+	(void)usb_transfer;
+}
+
+bool usb_transfer_is_submittable(USBTransfer *usb_transfer) {
+	(void)usb_transfer;
+
+	return false;
+}
+
+int usb_transfer_submit(USBTransfer *usb_transfer) {
+	(void)usb_transfer;
+
+	return -1;
+}
+
+void usb_transfer_cancel(USBTransfer *usb_transfer) {
+	(void)usb_transfer;
+}
+
+void usb_transfer_clear_pending_error(USBTransfer *usb_transfer) {
+	(void)usb_transfer;
+}
+
+// packet trace and traffic capture are disabled
+uint32_t packet_trace_add_source(PacketTraceSourceType type, const char *name) {
+	(void)type;
+	(void)name;
+
+	return 0;
+}
+
+void packet_trace_remove_source(uint32_t source) {
+	(void)source;
+}
+
+uint32_t packet_trace_get_current_id(void) {
+	return 0;
+}
+
+void packet_trace_record(PacketTraceHop hop, uint32_t trace_id, uint32_t source, Packet *packet) {
+	(void)hop;
+	(void)trace_id;
+	(void)source;
+	(void)packet;
+}
+
+uint32_t traffic_capture_add_source(TrafficCaptureRecordType type, const char *name) {
+	(void)type;
+	(void)name;
+
+	return 0;
+}
+
+static USBStack _usb_stack;
+static USBTransfer _usb_transfer;
+static struct libusb_transfer _handle;
+static uint8_t _buffer[TRANSFER_LENGTH];
+static Packet _expected[MAX_RESPONSES];
+static int _expected_count = 0;
+static int _dispatched_responses = 0;
+static bool _mismatch = false;
+
+// this is where the responses leave the USB stack
+void network_dispatch_response(Packet *response) {
+	if (_dispatched_responses < _expected_count &&
+	    memcmp(response, &_expected[_dispatched_responses], _expected[_dispatched_responses].header.length) != 0) {
+		_mismatch = true;
+	}
+
+	++_dispatched_responses;
+}
+
+static int create_response(uint8_t *buffer, uint32_t uid, int length, uint8_t sequence_number) {
+	Packet *response = (Packet *)buffer;
+	int i;
+
+	memset(&response->header, 0, sizeof(response->header));
+
+	response->header.uid = uint32_to_le(uid);
+	response->header.length = (uint8_t)length;
+	response->header.function_id = 1;
+
+	packet_header_set_sequence_number(&response->header, 1 + sequence_number % 15);
+	packet_header_set_response_expected(&response->header, true);
+
+	for (i = (int)sizeof(PacketHeader); i < length; ++i) {
+		buffer[i] = (uint8_t)(uid + i);
+	}
+
+	return length;
+}
+
+// fills the transfer buffer with responses of random length, optionally
+// followed by a truncated response. returns the number of complete responses
+static int create_transfer(uint32_t seed, bool truncate) {
+	int length = 0;
+	int response_length;
+	int count = 0;
+
+	while (true) {
+		response_length = sizeof(PacketHeader) + rand() % (MAX_RESPONSE_LENGTH - sizeof(PacketHeader) + 1);
+
+		if (length + response_length > TRANSFER_LENGTH || (count > 0 && rand() % 8 == 0)) {
+			break;
+		}
+
+		create_response(_buffer + length, seed + count, response_length, (uint8_t)count);
+		memcpy(&_expected[count], _buffer + length, response_length);
+
+		length += response_length;
+		++count;
+	}
+
+	// the truncated response has to be dropped, this logs an error
+	if (truncate && length + MAX_RESPONSE_LENGTH <= TRANSFER_LENGTH) {
+		create_response(_buffer + length, seed + count, MAX_RESPONSE_LENGTH, (uint8_t)count);
+
+		length += 1 + rand() % (MAX_RESPONSE_LENGTH - 1);
+	}
+
+	_handle.actual_length = length;
+
+	return count;
+}
+
+static int test(void) {
+	int i;
+
+	for (i = 0; i < TEST_TRANSFERS; ++i) {
+		_expected_count = create_transfer(1 + (uint32_t)i * 100, i % TEST_TRUNCATION_INTERVAL == 0);
+		_dispatched_responses = 0;
+
+		usb_stack_read_callback(&_usb_transfer);
+
+		if (_mismatch || _dispatched_responses != _expected_count) {
+			printf("test: transfer %d dispatched wrong responses (actual: %d, expected: %d)\n",
+			       i, _dispatched_responses, _expected_count);
+
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+// every transfer carries the given number of responses back-to-back, as a
+// Brick does under load
+static int benchmark(int responses_per_transfer) {
+	int length = 0;
+	int i;
+	uint64_t start;
+	uint64_t duration;
+
+	for (i = 0; i < responses_per_transfer; ++i) {
+		length += create_response(_buffer + length, 1 + i % 16, RESPONSE_LENGTH, (uint8_t)i);
+	}
+
+	_handle.actual_length = length;
+	_expected_count = 0;
+	_dispatched_responses = 0;
+
+	start = microtime();
+
+	// this is what happens for every completed read transfer
+	for (i = 0; i < TRANSFERS; ++i) {
+		usb_stack_read_callback(&_usb_transfer);
+	}
+
+	duration = microtime() - start;
+
+	benchmark_report("usb_stack_read_callback", "responses_per_transfer",
+	                 responses_per_transfer, TRANSFERS, duration);
+
+	if (_dispatched_responses != TRANSFERS * responses_per_transfer) {
+		printf("benchmark: response count mismatch (actual: %d != expected: %d)\n",
+		       _dispatched_responses, TRANSFERS * responses_per_transfer);
+
+		return -1;
+	}
+
+	return 0;
+}
+
+int main(void) {
+	int responses_per_transfer;
+	int result = EXIT_SUCCESS;
+
+	srand(1);
+
+	memset(&_usb_stack, 0, sizeof(_usb_stack));
+	memset(&_usb_transfer, 0, sizeof(_usb_transfer));
+	memset(&_handle, 0, sizeof(_handle));
+
+	if (stack_create(&_usb_stack.base, "USB benchmark", usb_stack_dispatch_request) < 0) {
+		printf("main: stack_create failed\n");
+
+		return EXIT_FAILURE;
+	}
+
+	_usb_transfer.usb_stack = &_usb_stack;
+	_usb_transfer.type = USB_TRANSFER_TYPE_READ;
+	_usb_transfer.handle = &_handle;
+	_usb_transfer.buffer = _buffer;
+
+	if (test() < 0) {
+		result = EXIT_FAILURE;
+	}
+
+	for (responses_per_transfer = 1;
+	     result == EXIT_SUCCESS && responses_per_transfer <= TRANSFER_LENGTH / RESPONSE_LENGTH;
+	     responses_per_transfer *= 2) {
+		if (benchmark(responses_per_transfer) < 0) {
+			result = EXIT_FAILURE;
+		}
+	}
+
+	stack_destroy(&_usb_stack.base);
+
+	if (result == EXIT_SUCCESS) {
+		printf("success\n");
+	}
+
+	return result;
+}
@@ -0,0 +1,556 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * write_ring_test.c: Tests for the WriteRing type
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../brickd/write_ring.h"
+
+#define TEST1_REQUESTS 1000000
+#define TEST1_RING_SIZE 4096
+#define TEST1_MAX_SUBMITTED 16
+#define TEST1_UIDS 7
+
+static int test1_get_length(uint32_t i) {
+	return (int)sizeof(PacketHeader) + (int)((i * 2654435761u) >> 24) % (int)(sizeof(Packet) - sizeof(PacketHeader) + 1);
+}
+
+static void test1_create_request(Packet *request, uint32_t i) {
+	int length = test1_get_length(i);
+	int k;
+
+	memset(request, 0, sizeof(*request));
+
+	request->header.uid = i % TEST1_UIDS;
+	request->header.length = (uint8_t)length;
+
+	for (k = 0; k < length - (int)sizeof(PacketHeader); ++k) {
+		((uint8_t *)request)[sizeof(PacketHeader) + k] = (uint8_t)(i * 31 + k);
+	}
+}
+
+// requests of varying length for a few UIDs wrap around the buffer end many
+// times. the requests of each UID are submitted in order. up to
+// TEST1_MAX_SUBMITTED requests are submitted at once and they are released in
+// pseudo random order, as finished USB write transfers would release them
+static int test1(void) {
+	WriteRing ring;
+	Packet request;
+	Packet *queued;
+	Packet *submitted[TEST1_MAX_SUBMITTED];
+	int submitted_count = 0;
+	uint32_t pushed = 0;
+	uint32_t popped = 0;
+	uint32_t expected[TEST1_UIDS];
+	uint32_t round = 0;
+	int k;
+	int index;
+	uint32_t uid;
+
+	for (k = 0; k < TEST1_UIDS; ++k) {
+		expected[k] = k;
+	}
+
+	if (write_ring_create(&ring, TEST1_RING_SIZE, TEST1_RING_SIZE, TEST1_REQUESTS) < 0) {
+		printf("test1: write_ring_create failed\n");
+
+		return -1;
+	}
+
+	while (popped < TEST1_REQUESTS) {
+		// fill the ring
+		while (pushed < TEST1_REQUESTS) {
+			test1_create_request(&request, pushed);
+
+			if (write_ring_push(&ring, &request) == NULL) {
+				break;
+			}
+
+			++pushed;
+		}
+
+		if (ring.queued != (int)(pushed - popped)) {
+			printf("test1: queued count mismatch (actual: %d != expected: %u)\n",
+			       ring.queued, pushed - popped);
+
+			return -1;
+		}
+
+		// submit as many as possible
+		while (submitted_count < TEST1_MAX_SUBMITTED && (queued = write_ring_peek(&ring)) != NULL) {
+			uid = queued->header.uid;
+
+			if (uid >= TEST1_UIDS) {
+				printf("test1: request %u has invalid UID %u\n", popped, uid);
+
+				return -1;
+			}
+
+			test1_create_request(&request, expected[uid]);
+
+			if (memcmp(queued, &request, request.header.length) != 0) {
+				printf("test1: request %u mismatch\n", expected[uid]);
+
+				return -1;
+			}
+
+			expected[uid] += TEST1_UIDS;
+
+			write_ring_pop(&ring);
+
+			submitted[submitted_count++] = queued;
+			++popped;
+		}
+
+		// release some of them, not in submission order
+		k = 1 + (int)((++round * 2654435761u) >> 16) % TEST1_MAX_SUBMITTED;
+
+		while (k > 0 && submitted_count > 0) {
+			index = k % submitted_count;
+
+			write_ring_release(&ring, submitted[index]);
+
+			submitted[index] = submitted[--submitted_count];
+			--k;
+		}
+	}
+
+	while (submitted_count > 0) {
+		write_ring_release(&ring, submitted[--submitted_count]);
+	}
+
+	if (write_ring_get_used(&ring) != 0 || write_ring_peek(&ring) != NULL) {
+		printf("test1: ring not empty (used: %u)\n", write_ring_get_used(&ring));
+
+		return -1;
+	}
+
+	write_ring_destroy(&ring);
+
+	return 0;
+}
+
+// the bytes of a released request are only reused after all older requests
+// are released as well
+static int test2(void) {
+	WriteRing ring;
+	Packet request;
+	Packet *first;
+	Packet *second;
+	uint32_t used;
+
+	if (write_ring_create(&ring, 256, 256, 16) < 0) {
+		printf("test2: write_ring_create failed\n");
+
+		return -1;
+	}
+
+	memset(&request, 0, sizeof(request));
+
+	request.header.length = 72;
+
+	write_ring_push(&ring, &request);
+	write_ring_push(&ring, &request);
+	write_ring_push(&ring, &request);
+
+	if (write_ring_push(&ring, &request) != NULL) {
+		printf("test2: push into full ring succeeded\n");
+
+		return -1;
+	}
+
+	first = write_ring_peek(&ring);
+	write_ring_pop(&ring);
+
+	second = write_ring_peek(&ring);
+	write_ring_pop(&ring);
+
+	used = write_ring_get_used(&ring);
+
+	write_ring_release(&ring, second);
+
+	if (write_ring_get_used(&ring) != used || write_ring_push(&ring, &request) != NULL) {
+		printf("test2: release of the second request freed bytes before the first was released\n");
+
+		return -1;
+	}
+
+	write_ring_release(&ring, first);
+
+	if (write_ring_get_used(&ring) != used / 3) {
+		printf("test2: release of the first request did not free both requests\n");
+
+		return -1;
+	}
+
+	// the next request doesn't fit at the end of the buffer and wraps around
+	if (write_ring_push(&ring, &request) != (Packet *)(ring.buffer + offsetof(WriteRingEntry, packet))) {
+		printf("test2: request did not wrap around the buffer end\n");
+
+		return -1;
+	}
+
+	if (ring.queued != 2) {
+		printf("test2: queued count mismatch (actual: %d != expected: 2)\n", ring.queued);
+
+		return -1;
+	}
+
+	write_ring_destroy(&ring);
+
+	return 0;
+}
+
+// a UID that floods the ring does not delay the requests of another UID and
+// only its own requests get dropped
+static int test3(void) {
+	WriteRing ring;
+	Packet request;
+	Packet *queued;
+	WriteRingDrops *drops;
+	int i;
+	int flood_count = 0;
+	int other_count = 0;
+
+	if (write_ring_create(&ring, 65536, 65536, 100) < 0) {
+		printf("test3: write_ring_create failed\n");
+
+		return -1;
+	}
+
+	memset(&request, 0, sizeof(request));
+
+	request.header.length = 80;
+	request.header.uid = 1;
+
+	for (i = 0; i < 1000; ++i) {
+		request.header.function_id = (uint8_t)i;
+
+		write_ring_push(&ring, &request);
+	}
+
+	if (ring.queued != 100 || ring.dropped != 900) {
+		printf("test3: flooding UID was not limited (queued: %d, dropped: %u)\n",
+		       ring.queued, ring.dropped);
+
+		return -1;
+	}
+
+	// the oldest requests were dropped
+	queued = write_ring_peek(&ring);
+
+	if (queued->header.function_id != (uint8_t)900) {
+		printf("test3: oldest request was not dropped\n");
+
+		return -1;
+	}
+
+	request.header.uid = 2;
+
+	for (i = 0; i < 10; ++i) {
+		write_ring_push(&ring, &request);
+	}
+
+	// both UIDs take turns
+	for (i = 0; i < 20; ++i) {
+		queued = write_ring_peek(&ring);
+
+		if (queued->header.uid == 1) {
+			++flood_count;
+		} else {
+			++other_count;
+		}
+
+		write_ring_pop(&ring);
+		write_ring_release(&ring, queued);
+	}
+
+	if (flood_count != 10 || other_count != 10) {
+		printf("test3: UIDs did not take turns (flooding: %d, other: %d)\n",
+		       flood_count, other_count);
+
+		return -1;
+	}
+
+	if (ring.drops.count != 1) {
+		printf("test3: drops counted for %d UIDs instead of 1\n", ring.drops.count);
+
+		return -1;
+	}
+
+	drops = array_get(&ring.drops, 0);
+
+	if (drops->uid != 1 || drops->count != 900) {
+		printf("test3: drops not counted for the flooding UID\n");
+
+		return -1;
+	}
+
+	while ((queued = write_ring_peek(&ring)) != NULL) {
+		write_ring_pop(&ring);
+		write_ring_release(&ring, queued);
+	}
+
+	if (write_ring_get_used(&ring) != 0 || ring.flows.count != 0) {
+		printf("test3: ring not empty (used: %u, flows: %d)\n",
+		       write_ring_get_used(&ring), ring.flows.count);
+
+		return -1;
+	}
+
+	write_ring_destroy(&ring);
+
+	return 0;
+}
+
+// the UIDs share the bandwidth by bytes, not by requests
+static int test4(void) {
+	WriteRing ring;
+	Packet request;
+	Packet *queued;
+	int i;
+	int bytes[2] = {0, 0};
+
+	if (write_ring_create(&ring, 65536, 65536, 1000) < 0) {
+		printf("test4: write_ring_create failed\n");
+
+		return -1;
+	}
+
+	memset(&request, 0, sizeof(request));
+
+	for (i = 0; i < 500; ++i) {
+		request.header.uid = 0;
+		request.header.length = 8;
+
+		write_ring_push(&ring, &request);
+
+		request.header.uid = 1;
+		request.header.length = 80;
+
+		write_ring_push(&ring, &request);
+	}
+
+	for (i = 0; i < 100; ++i) {
+		queued = write_ring_peek(&ring);
+		bytes[queued->header.uid] += queued->header.length;
+
+		write_ring_pop(&ring);
+		write_ring_release(&ring, queued);
+	}
+
+	if (bytes[0] < bytes[1] - 80 || bytes[0] > bytes[1] + 80) {
+		printf("test4: bytes are not shared equally (%d != %d)\n", bytes[0], bytes[1]);
+
+		return -1;
+	}
+
+	write_ring_destroy(&ring);
+
+	return 0;
+}
+
+// the buffer grows when a request does not fit anymore. the old buffer keeps
+// its entries in place until they are released
+static int test5(void) {
+	WriteRing ring;
+	Packet request;
+	Packet *queued[10];
+	uint8_t *first_buffer;
+	int i;
+
+	if (write_ring_create(&ring, 256, 512, 16) < 0) {
+		printf("test5: write_ring_create failed\n");
+
+		return -1;
+	}
+
+	memset(&request, 0, sizeof(request));
+
+	request.header.length = 72;
+	first_buffer = ring.buffer;
+
+	for (i = 0; i < 3; ++i) {
+		queued[i] = write_ring_push(&ring, &request);
+	}
+
+	// the fourth request does not fit, the buffer grows
+	queued[3] = write_ring_push(&ring, &request);
+
+	if (ring.size != 512 || ring.retired_buffer != first_buffer ||
+	    queued[3] != (Packet *)(ring.buffer + offsetof(WriteRingEntry, packet))) {
+		printf("test5: buffer did not grow (size: %u)\n", ring.size);
+
+		return -1;
+	}
+
+	for (i = 0; i < 3; ++i) {
+		if (memcmp(queued[i], &request, request.header.length) != 0) {
+			printf("test5: request %d in the retired buffer was modified\n", i);
+
+			return -1;
+		}
+	}
+
+	// the buffer is at its maximum size now, 6 requests fit into it
+	for (i = 4; i < 10; ++i) {
+		queued[i] = write_ring_push(&ring, &request);
+	}
+
+	if (queued[8] == NULL || queued[9] != NULL || ring.size != 512) {
+		printf("test5: buffer grew past its maximum size\n");
+
+		return -1;
+	}
+
+	for (i = 0; i < 9; ++i) {
+		if (write_ring_peek(&ring) != queued[i]) {
+			printf("test5: request %d is out of order\n", i);
+
+			return -1;
+		}
+
+		write_ring_pop(&ring);
+		write_ring_release(&ring, queued[i]);
+
+		if (i == 2 && ring.retired_buffer != NULL) {
+			printf("test5: retired buffer was not freed after its last release\n");
+
+			return -1;
+		}
+	}
+
+	if (write_ring_get_used(&ring) != 0) {
+		printf("test5: ring not empty (used: %u)\n", write_ring_get_used(&ring));
+
+		return -1;
+	}
+
+	write_ring_destroy(&ring);
+
+	return 0;
+}
+
+// submitted requests that were not released are requeued in front of the
+// queued requests of their UID, in their original order
+static int test6(void) {
+	WriteRing ring;
+	Packet request;
+	Packet *queued;
+	int i;
+	int expected[7] = {0, 2, 4, 6, 1, 3, 7};
+
+	if (write_ring_create(&ring, 4096, 4096, 16) < 0) {
+		printf("test6: write_ring_create failed\n");
+
+		return -1;
+	}
+
+	memset(&request, 0, sizeof(request));
+
+	request.header.length = 8;
+
+	// UID 1 gets the even and UID 2 the odd function IDs
+	for (i = 0; i < 8; ++i) {
+		request.header.uid = 1 + i % 2;
+		request.header.function_id = (uint8_t)i;
+
+		write_ring_push(&ring, &request);
+	}
+
+	// submit 6 requests, release one of them
+	for (i = 0; i < 6; ++i) {
+		queued = write_ring_peek(&ring);
+
+		write_ring_pop(&ring);
+
+		if (queued->header.function_id == 5) {
+			write_ring_release(&ring, queued);
+		}
+	}
+
+	if (write_ring_requeue(&ring) != 5 || ring.queued != 7) {
+		printf("test6: submitted requests were not requeued (queued: %d)\n", ring.queued);
+
+		return -1;
+	}
+
+	// the requests of UID 1 come first, because UID 1 still has its deficit
+	for (i = 0; i < 7; ++i) {
+		queued = write_ring_peek(&ring);
+
+		if (queued == NULL || queued->header.function_id != expected[i]) {
+			printf("test6: request %d is out of order\n", i);
+
+			return -1;
+		}
+
+		write_ring_pop(&ring);
+		write_ring_release(&ring, queued);
+	}
+
+	if (write_ring_get_used(&ring) != 0 || ring.flows.count != 0) {
+		printf("test6: ring not empty (used: %u, flows: %d)\n",
+		       write_ring_get_used(&ring), ring.flows.count);
+
+		return -1;
+	}
+
+	write_ring_destroy(&ring);
+
+	return 0;
+}
+
+int main(void) {
+#ifdef _WIN32
+	fixes_init();
+#endif
+
+	if (test1() < 0) {
+		return EXIT_FAILURE;
+	}
+
+	if (test2() < 0) {
+		return EXIT_FAILURE;
+	}
+
+	if (test3() < 0) {
+		return EXIT_FAILURE;
+	}
+
+	if (test4() < 0) {
+		return EXIT_FAILURE;
+	}
+
+	if (test5() < 0) {
+		return EXIT_FAILURE;
+	}
+
+	if (test6() < 0) {
+		return EXIT_FAILURE;
+	}
+
+	printf("success\n");
+
+	return EXIT_SUCCESS;
+}